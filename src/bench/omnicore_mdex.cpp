@@ -0,0 +1,91 @@
+// Copyright (c) 2020 The Omni Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <omnicore/mdex.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+//! Number of price levels in the benchmarked order books
+static const int NUM_PRICE_LEVELS = 1000;
+
+/** Amounts of an order in the book. */
+struct BenchOrder
+{
+    int64_t amountForSale;
+    int64_t amountDesired;
+};
+
+static std::vector<BenchOrder> CreateOrders()
+{
+    std::vector<BenchOrder> orders;
+    orders.reserve(NUM_PRICE_LEVELS);
+    for (int i = 0; i < NUM_PRICE_LEVELS; ++i) {
+        orders.push_back(BenchOrder{100000000 + i * 7919, 50000000 + i * 104729});
+    }
+    return orders;
+}
+
+/**
+ * Walks the price levels like the matching loop: levels are visited, until the
+ * price of the new order is no longer sufficient, and each level is checked with
+ * the price comparisons of a fill.
+ */
+static void OmniMetaDExMatchRational(benchmark::State& state)
+{
+    std::map<rational_t, BenchOrder> levels;
+    for (const BenchOrder& order : CreateOrders()) {
+        levels[rational_t(order.amountDesired, order.amountForSale)] = order;
+    }
+    const BenchOrder& median = CreateOrders()[NUM_PRICE_LEVELS / 2];
+    const rational_t buyersPrice(median.amountDesired, median.amountForSale);
+
+    int64_t nMatched = 0;
+    while (state.KeepRunning()) {
+        for (std::map<rational_t, BenchOrder>::const_iterator it = levels.begin(); it != levels.end(); ++it) {
+            if (buyersPrice < it->first) break;
+            const BenchOrder& order = it->second;
+            const rational_t unitPrice(order.amountDesired, order.amountForSale);
+            assert(unitPrice == it->first);
+            assert(unitPrice <= buyersPrice);
+            const rational_t effectivePrice(order.amountDesired + 1, order.amountForSale);
+            if (effectivePrice > buyersPrice) continue;
+            assert(effectivePrice >= unitPrice);
+            ++nMatched;
+        }
+    }
+    assert(nMatched > 0);
+}
+
+static void OmniMetaDExMatchFixedPoint(benchmark::State& state)
+{
+    std::map<CMPMetaDExPrice, BenchOrder> levels;
+    for (const BenchOrder& order : CreateOrders()) {
+        levels[CMPMetaDExPrice(order.amountDesired, order.amountForSale)] = order;
+    }
+    const BenchOrder& median = CreateOrders()[NUM_PRICE_LEVELS / 2];
+    const CMPMetaDExPrice buyersPrice(median.amountDesired, median.amountForSale);
+
+    int64_t nMatched = 0;
+    while (state.KeepRunning()) {
+        for (std::map<CMPMetaDExPrice, BenchOrder>::const_iterator it = levels.begin(); it != levels.end(); ++it) {
+            if (buyersPrice < it->first) break;
+            const BenchOrder& order = it->second;
+            const CMPMetaDExPrice unitPrice(order.amountDesired, order.amountForSale);
+            assert(unitPrice == it->first);
+            assert(unitPrice <= buyersPrice);
+            const CMPMetaDExPrice effectivePrice(order.amountDesired + 1, order.amountForSale);
+            if (effectivePrice > buyersPrice) continue;
+            assert(effectivePrice >= unitPrice);
+            ++nMatched;
+        }
+    }
+    assert(nMatched > 0);
+}
+
+BENCHMARK(OmniMetaDExMatchRational, 200);
+BENCHMARK(OmniMetaDExMatchFixedPoint, 200);
@@ -0,0 +1,70 @@
+// Copyright (c) 2020 The Omni Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <omnicore/nftdb.h>
+
+#include <fs.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string>
+
+//! Number of token ranges of each benchmarked property
+static const int NUM_RANGES = 5000;
+//! Number of properties with non-fungible tokens
+static const int NUM_PROPERTIES = 4;
+
+/**
+ * Creates a database, where the owners of the tokens alternate with each grant, so that
+ * every grant results in a separate range.
+ */
+static void CreateRanges(CMPNonFungibleTokensDB& db)
+{
+    for (uint32_t propertyId = 1; propertyId <= NUM_PROPERTIES; ++propertyId) {
+        for (int i = 0; i < NUM_RANGES; ++i) {
+            db.CreateNonFungibleTokens(propertyId, 10, (i % 2) ? "bob" : "alice", "data");
+        }
+    }
+}
+
+static void OmniNonFungibleTokenOwner(benchmark::State& state)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path("omni_nftdb_bench_%%%%%%%%");
+    {
+        CMPNonFungibleTokensDB db(path, true);
+        CreateRanges(db);
+
+        int64_t tokenId = 0;
+        while (state.KeepRunning()) {
+            tokenId = (tokenId + 7919) % (NUM_RANGES * 10);
+            const std::string owner = db.GetNonFungibleTokenOwner(NUM_PROPERTIES / 2, tokenId + 1);
+            assert(owner == (((tokenId / 10) % 2) ? "bob" : "alice"));
+        }
+    }
+    fs::remove_all(path);
+}
+
+static void OmniNonFungibleTokenMove(benchmark::State& state)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path("omni_nftdb_bench_%%%%%%%%");
+    {
+        CMPNonFungibleTokensDB db(path, true);
+        CreateRanges(db);
+
+        // a range of alice, which is surrounded by ranges of bob, is moved to carol and back
+        const uint32_t propertyId = NUM_PROPERTIES / 2;
+        const int64_t start = (NUM_RANGES / 2) * 10 + 1;
+        const int64_t end = start + 9;
+        while (state.KeepRunning()) {
+            bool success = db.MoveNonFungibleTokens(propertyId, start, end, "alice", "carol");
+            success &= db.MoveNonFungibleTokens(propertyId, start, end, "carol", "alice");
+            assert(success);
+        }
+    }
+    fs::remove_all(path);
+}
+
+BENCHMARK(OmniNonFungibleTokenOwner, 2000);
+BENCHMARK(OmniNonFungibleTokenMove, 200);
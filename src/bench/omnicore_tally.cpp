@@ -0,0 +1,163 @@
+// Copyright (c) 2020 The Omni Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <omnicore/tally.h>
+#include <tinyformat.h>
+
+#include <assert.h>
+#include <stdint.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//! Number of addresses in the benchmarked tally maps
+static const int NUM_ADDRESSES = 100000;
+//! Number of properties held by each address
+static const int NUM_PROPERTIES = 3;
+
+/** The former layout of the tally map: node based maps of balance records. */
+struct LegacyBalanceRecord
+{
+    int64_t balance[TALLY_TYPE_COUNT];
+};
+typedef std::unordered_map<std::string, std::map<uint32_t, LegacyBalanceRecord> > LegacyTallyMap;
+
+static std::vector<std::string> CreateAddresses()
+{
+    std::vector<std::string> addresses;
+    addresses.reserve(NUM_ADDRESSES);
+    for (int i = 0; i < NUM_ADDRESSES; ++i) {
+        addresses.push_back(strprintf("1Address%026d", i));
+    }
+    return addresses;
+}
+
+static void PopulateLegacy(LegacyTallyMap& tallyMap, const std::vector<std::string>& addresses)
+{
+    for (const std::string& address : addresses) {
+        std::map<uint32_t, LegacyBalanceRecord>& tally = tallyMap[address];
+        for (uint32_t propertyId = 1; propertyId <= NUM_PROPERTIES; ++propertyId) {
+            tally[propertyId * 7].balance[BALANCE] += 1;
+        }
+    }
+}
+
+static void PopulateFlat(CMPTallyMap& tallyMap, const std::vector<std::string>& addresses)
+{
+    for (const std::string& address : addresses) {
+        CMPTally& tally = tallyMap.insert(std::make_pair(address, CMPTally())).first->second;
+        for (uint32_t propertyId = 1; propertyId <= NUM_PROPERTIES; ++propertyId) {
+            tally.updateMoney(propertyId * 7, 1, BALANCE);
+        }
+    }
+}
+
+/** Returns the number of bytes allocated on the heap, or 0, if not supported. */
+static size_t GetHeapUsage()
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+    return static_cast<unsigned int>(mallinfo().uordblks);
+#else
+    return 0;
+#endif
+}
+
+/** Prints the heap usage of a populated tally map once, as comment of the benchmark results. */
+static void PrintHeapUsage(const std::string& name, size_t nBefore, size_t nAfter, bool& fPrinted)
+{
+    if (fPrinted || nAfter < nBefore) return;
+    fPrinted = true;
+    std::cout << strprintf("# %s: %u bytes, %.1f bytes per address", name, nAfter - nBefore, double(nAfter - nBefore) / NUM_ADDRESSES) << std::endl;
+}
+
+static void OmniTallyPopulateLegacy(benchmark::State& state)
+{
+    const std::vector<std::string> addresses = CreateAddresses();
+    while (state.KeepRunning()) {
+        LegacyTallyMap tallyMap;
+        PopulateLegacy(tallyMap, addresses);
+    }
+}
+
+static void OmniTallyPopulateFlat(benchmark::State& state)
+{
+    const std::vector<std::string> addresses = CreateAddresses();
+    while (state.KeepRunning()) {
+        CMPTallyMap tallyMap;
+        PopulateFlat(tallyMap, addresses);
+    }
+}
+
+static void OmniTallyMemoryLegacy(benchmark::State& state)
+{
+    const std::vector<std::string> addresses = CreateAddresses();
+    bool fPrinted = false;
+    while (state.KeepRunning()) {
+        size_t nBefore = GetHeapUsage();
+        LegacyTallyMap tallyMap;
+        PopulateLegacy(tallyMap, addresses);
+        PrintHeapUsage("OmniTallyMemoryLegacy", nBefore, GetHeapUsage(), fPrinted);
+    }
+}
+
+static void OmniTallyMemoryFlat(benchmark::State& state)
+{
+    const std::vector<std::string> addresses = CreateAddresses();
+    bool fPrinted = false;
+    while (state.KeepRunning()) {
+        size_t nBefore = GetHeapUsage();
+        CMPTallyMap tallyMap;
+        PopulateFlat(tallyMap, addresses);
+        PrintHeapUsage("OmniTallyMemoryFlat", nBefore, GetHeapUsage(), fPrinted);
+    }
+}
+
+static void OmniTallyLookupLegacy(benchmark::State& state)
+{
+    const std::vector<std::string> addresses = CreateAddresses();
+    LegacyTallyMap tallyMap;
+    PopulateLegacy(tallyMap, addresses);
+
+    int64_t total = 0;
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        const std::string& address = addresses[n++ % addresses.size()];
+        LegacyTallyMap::const_iterator it = tallyMap.find(address);
+        std::map<uint32_t, LegacyBalanceRecord>::const_iterator record = it->second.find(14);
+        total += record->second.balance[BALANCE];
+    }
+    assert(total > 0);
+}
+
+static void OmniTallyLookupFlat(benchmark::State& state)
+{
+    const std::vector<std::string> addresses = CreateAddresses();
+    CMPTallyMap tallyMap;
+    PopulateFlat(tallyMap, addresses);
+
+    int64_t total = 0;
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        const std::string& address = addresses[n++ % addresses.size()];
+        CMPTallyMap::const_iterator it = tallyMap.find(address);
+        total += it->second.getMoney(14, BALANCE);
+    }
+    assert(total > 0);
+}
+
+BENCHMARK(OmniTallyPopulateLegacy, 5);
+BENCHMARK(OmniTallyPopulateFlat, 5);
+BENCHMARK(OmniTallyMemoryLegacy, 1);
+BENCHMARK(OmniTallyMemoryFlat, 1);
+BENCHMARK(OmniTallyLookupLegacy, 2000 * 1000);
+BENCHMARK(OmniTallyLookupFlat, 2000 * 1000);
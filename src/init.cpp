@@ -103,6 +103,7 @@ static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 static const char* DEFAULT_ASMAP_FILENAME="ip_asn.map";
 
 // Omni Core initialization and shutdown handlers
+extern int64_t mastercore_reserve_dbcache(int64_t nTotalCache);
 extern int mastercore_init();
 extern int mastercore_shutdown();
 extern int CheckWalletUpdate(bool forceUpdate = false);
@@ -586,6 +587,12 @@ void SetupServerArgs()
     gArgs.AddArg("-omnitxcache", "The maximum number of transactions in the input transaction cache (default: 500000)", false, OptionsCategory::OMNI);
     gArgs.AddArg("-omniprogressfrequency", "Time in seconds after which the initial scanning progress is reported (default: 30)", false, OptionsCategory::OMNI);
     gArgs.AddArg("-omniseedblockfilter", "Set skipping of blocks without Omni transactions during initial scan (default: 1)", false, OptionsCategory::OMNI);
+    gArgs.AddArg("-omninftauditinterval", "The number of blocks between full audits of the non-fungible token database, 0 to disable (default: 0)", false, OptionsCategory::OMNI);
+    gArgs.AddArg("-omnidbcache=<n>", "Size of the block cache shared by the Omni databases in MiB, 0 to disable (default: 1/16 of -dbcache)", false, OptionsCategory::OMNI);
+    gArgs.AddArg("-omnidbbloom=<n>", "Bits per key of the bloom filters of the Omni databases, 0 to disable (default: 10)", false, OptionsCategory::OMNI);
+    gArgs.AddArg("-omnidbnocache=<name>", "Don't fill the block cache with reads of the named Omni database, e.g. MP_txlist (can be used multiple times)", false, OptionsCategory::OMNI);
+    gArgs.AddArg("-omnidbnobloom=<name>", "Don't use bloom filters for the named Omni database, e.g. MP_txlist (can be used multiple times)", false, OptionsCategory::OMNI);
+    gArgs.AddArg("-omniscanthreads", "The number of threads, which read blocks ahead of the initial scan, 0 to disable (default: 2)", false, OptionsCategory::OMNI);
     gArgs.AddArg("-omnilogfile", "The path of the log file (default: omnicore.log)", false, OptionsCategory::OMNI);
     gArgs.AddArg("-omnidebug=<category>", "Enable or disable log categories, can be \"all\" or \"none\"", false, OptionsCategory::OMNI);
     gArgs.AddArg("-autocommit", "Enable or disable broadcasting of transactions, when creating transactions (default: 1)", false, OptionsCategory::OMNI);
@@ -1531,6 +1538,8 @@ bool AppInitMain(NodeContext& node)
     int64_t nTotalCache = (gArgs.GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
+    int64_t nOmniDBCache = mastercore_reserve_dbcache(nTotalCache); // the Omni databases share a part of the cache
+    nTotalCache -= nOmniDBCache;
     int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
     if (gArgs.GetBoolArg("-experimental-btc-balances", DEFAULT_ADDRINDEX)) {
         // enable 3/4 of the cache if addressindex is enabled
@@ -1561,6 +1570,7 @@ bool AppInitMain(NodeContext& node)
                   filter_index_cache * (1.0 / 1024 / 1024), BlockFilterTypeName(filter_type));
     }
     LogPrintf("* Using %.1f MiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1f MiB for Omni databases\n", nOmniDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1f MiB for in-memory UTXO set (plus up to %.1f MiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
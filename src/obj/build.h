@@ -0,0 +1 @@
+#define BUILD_SUFFIX d10cf06-dirty
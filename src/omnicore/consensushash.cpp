@@ -13,15 +13,44 @@
 #include <omnicore/sp.h>
 
 #include <arith_uint256.h>
+#include <crypto/sha256.h>
 #include <uint256.h>
 
 #include <stdint.h>
 #include <algorithm>
+#include <map>
 #include <string>
 #include <vector>
 
+void CConsensusAccumulator::Add(const std::string& dataStr)
+{
+    uint256 hash;
+    CSHA256().Write((const unsigned char*)dataStr.c_str(), dataStr.length()).Finalize(hash.begin());
+    sum += UintToArith256(hash);
+}
+
+void CConsensusAccumulator::Remove(const std::string& dataStr)
+{
+    uint256 hash;
+    CSHA256().Write((const unsigned char*)dataStr.c_str(), dataStr.length()).Finalize(hash.begin());
+    sum -= UintToArith256(hash);
+}
+
 namespace mastercore
 {
+//! Whether balances and MetaDEx trades are tracked by the incremental consensus hash
+static bool fIncrementalHashEnabled = false;
+//! Incrementally maintained commitment to the balances
+static CConsensusAccumulator accBalances;
+//! Incrementally maintained commitment to the MetaDEx trades
+static CConsensusAccumulator accMetaDEx;
+//! Whether property issuers are tracked by the incremental consensus hash
+static bool fPropertiesTracked = false;
+//! Incrementally maintained commitment to the property issuers
+static CConsensusAccumulator accProperties;
+//! Consensus strings of the property issuers in the commitment, by property identifier
+static std::map<uint32_t, std::string> mapPropertyStrings;
+
 bool ShouldConsensusHashBlock(int block) {
     if (msc_debug_consensus_hash_every_block) {
         return true;
@@ -157,7 +186,7 @@ uint256 GetConsensusHash()
     // Placeholders:  "address|propertyid|balance|selloffer_reserve|accept_reserve|metadex_reserve"
     // Sort alphabetically first
     std::map<std::string, CMPTally> tallyMapSorted;
-    for (std::unordered_map<std::string, CMPTally>::iterator uoit = mp_tally_map.begin(); uoit != mp_tally_map.end(); ++uoit) {
+    for (CMPTallyMap::iterator uoit = mp_tally_map.begin(); uoit != mp_tally_map.end(); ++uoit) {
         tallyMapSorted.insert(std::make_pair(uoit->first,uoit->second));
     }
     for (std::map<std::string, CMPTally>::iterator my_it = tallyMapSorted.begin(); my_it != tallyMapSorted.end(); ++my_it) {
@@ -273,6 +302,216 @@ uint256 GetConsensusHash()
     return consensusHash;
 }
 
+/** Accumulates all non-empty balance records. */
+static void AccumulateBalances(CConsensusAccumulator& acc)
+{
+    for (CMPTallyMap::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
+        const std::string& address = my_it->first;
+        CMPTally& tally = my_it->second;
+        tally.init();
+        uint32_t propertyId = 0;
+        while (0 != (propertyId = (tally.next()))) {
+            std::string dataStr = GenerateConsensusString(tally, address, propertyId);
+            if (!dataStr.empty()) acc.Add(dataStr);
+        }
+    }
+}
+
+/** Accumulates all open MetaDEx trades. */
+static void AccumulateMetaDEx(CConsensusAccumulator& acc)
+{
+    for (md_PropertiesMap::const_iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
+        const md_PricesMap& prices = my_it->second;
+        for (md_PricesMap::const_iterator it = prices.begin(); it != prices.end(); ++it) {
+            const md_Set& indexes = it->second;
+            for (md_Set::const_iterator it = indexes.begin(); it != indexes.end(); ++it) {
+                acc.Add(GenerateConsensusString(*it));
+            }
+        }
+    }
+}
+
+/** Accumulates the issuers of all properties, and collects their consensus strings. */
+static void AccumulateProperties(CConsensusAccumulator& acc, std::map<uint32_t, std::string>& strings)
+{
+    for (uint8_t ecosystem = 1; ecosystem <= 2; ecosystem++) {
+        uint32_t startPropertyId = (ecosystem == 1) ? 1 : TEST_ECO_PROPERTY_1;
+        for (uint32_t propertyId = startPropertyId; propertyId < pDbSpInfo->peekNextSPID(ecosystem); propertyId++) {
+            CMPSPInfo::Entry sp;
+            if (!pDbSpInfo->getSP(propertyId, sp)) {
+                PrintToLog("Error loading property ID %d for consensus hashing, hash should not be trusted!\n", propertyId);
+                continue;
+            }
+            std::string dataStr = GenerateConsensusString(propertyId, sp.issuer);
+            acc.Add(dataStr);
+            strings[propertyId] = dataStr;
+        }
+    }
+}
+
+/**
+ * Obtains an incrementally maintained hash of the active state.
+ *
+ * This is an alternative to the consensus hash, which covers the same state and uses the
+ * same consensus strings, but doesn't require sorting or rehashing the whole state.
+ *
+ * Balances, MetaDEx trades and property issuers are maintained as they change, after the
+ * hash was first requested. DEx offers, accepts and crowdsales are accumulated on each
+ * call, as they are few. Each section is an order independent sum of hashes, and the result
+ * is the SHA256 hash of the section sums.
+ *
+ * The result is not compatible with the consensus hash and not used for checkpoints.
+ */
+uint256 GetIncrementalConsensusHash()
+{
+    LOCK(cs_tally);
+
+    if (!fIncrementalHashEnabled) {
+        accBalances.Clear();
+        AccumulateBalances(accBalances);
+        accMetaDEx.Clear();
+        AccumulateMetaDEx(accMetaDEx);
+        fIncrementalHashEnabled = true;
+    }
+
+    if (!fPropertiesTracked) {
+        accProperties.Clear();
+        mapPropertyStrings.clear();
+        AccumulateProperties(accProperties, mapPropertyStrings);
+        fPropertiesTracked = true;
+    }
+
+    CConsensusAccumulator accOffers;
+    for (OfferMap::const_iterator it = my_offers.begin(); it != my_offers.end(); ++it) {
+        const std::string& sellCombo = it->first;
+        accOffers.Add(GenerateConsensusString(it->second, sellCombo.substr(0, sellCombo.size() - 2)));
+    }
+
+    CConsensusAccumulator accAccepts;
+    for (AcceptMap::const_iterator it = my_accepts.begin(); it != my_accepts.end(); ++it) {
+        const std::string& acceptCombo = it->first;
+        accAccepts.Add(GenerateConsensusString(it->second, acceptCombo.substr(acceptCombo.find("+") + 1)));
+    }
+
+    CConsensusAccumulator accCrowds;
+    for (CrowdMap::const_iterator it = my_crowds.begin(); it != my_crowds.end(); ++it) {
+        accCrowds.Add(GenerateConsensusString(it->second));
+    }
+
+    const uint256 sections[] = {
+        accBalances.GetHash(), accOffers.GetHash(), accAccepts.GetHash(),
+        accMetaDEx.GetHash(), accCrowds.GetHash(), accProperties.GetHash()
+    };
+    CSHA256 hasher;
+    for (const uint256& section : sections) {
+        hasher.Write(section.begin(), section.size());
+    }
+
+    uint256 incrementalHash;
+    hasher.Finalize(incrementalHash.begin());
+
+    return incrementalHash;
+}
+
+/**
+ * Checks the maintained sections of the incremental consensus hash against sections,
+ * which are accumulated from the whole state.
+ *
+ * @return True, if the maintained sections match the state
+ */
+bool VerifyIncrementalConsensusHash()
+{
+    LOCK(cs_tally);
+
+    bool fValid = true;
+
+    if (fIncrementalHashEnabled) {
+        CConsensusAccumulator balances;
+        AccumulateBalances(balances);
+        if (balances.GetHash() != accBalances.GetHash()) {
+            PrintToLog("%s(): ERROR: maintained balances diverged from the state\n", __func__);
+            fValid = false;
+        }
+
+        CConsensusAccumulator trades;
+        AccumulateMetaDEx(trades);
+        if (trades.GetHash() != accMetaDEx.GetHash()) {
+            PrintToLog("%s(): ERROR: maintained MetaDEx trades diverged from the state\n", __func__);
+            fValid = false;
+        }
+    }
+
+    if (fPropertiesTracked) {
+        CConsensusAccumulator properties;
+        std::map<uint32_t, std::string> strings;
+        AccumulateProperties(properties, strings);
+        if (properties.GetHash() != accProperties.GetHash()) {
+            PrintToLog("%s(): ERROR: maintained property issuers diverged from the state\n", __func__);
+            fValid = false;
+        }
+    }
+
+    return fValid;
+}
+
+void ResetIncrementalConsensusHash()
+{
+    LOCK(cs_tally);
+
+    fIncrementalHashEnabled = false;
+    accBalances.Clear();
+    accMetaDEx.Clear();
+
+    ConsensusHashResetProperties();
+}
+
+void ConsensusHashRemoveBalance(const CMPTally& tally, const std::string& address, uint32_t propertyId)
+{
+    if (!fIncrementalHashEnabled) return;
+
+    std::string dataStr = GenerateConsensusString(tally, address, propertyId);
+    if (!dataStr.empty()) accBalances.Remove(dataStr);
+}
+
+void ConsensusHashAddBalance(const CMPTally& tally, const std::string& address, uint32_t propertyId)
+{
+    if (!fIncrementalHashEnabled) return;
+
+    std::string dataStr = GenerateConsensusString(tally, address, propertyId);
+    if (!dataStr.empty()) accBalances.Add(dataStr);
+}
+
+void ConsensusHashRemoveMetaDEx(const CMPMetaDEx& obj)
+{
+    if (fIncrementalHashEnabled) accMetaDEx.Remove(GenerateConsensusString(obj));
+}
+
+void ConsensusHashAddMetaDEx(const CMPMetaDEx& obj)
+{
+    if (fIncrementalHashEnabled) accMetaDEx.Add(GenerateConsensusString(obj));
+}
+
+void ConsensusHashUpdateProperty(uint32_t propertyId, const std::string& issuer)
+{
+    LOCK(cs_tally);
+
+    if (!fPropertiesTracked) return;
+
+    std::string& dataStr = mapPropertyStrings[propertyId];
+    if (!dataStr.empty()) accProperties.Remove(dataStr);
+    dataStr = GenerateConsensusString(propertyId, issuer);
+    accProperties.Add(dataStr);
+}
+
+void ConsensusHashResetProperties()
+{
+    LOCK(cs_tally);
+
+    fPropertiesTracked = false;
+    accProperties.Clear();
+    mapPropertyStrings.clear();
+}
+
 uint256 GetMetaDExHash(const uint32_t propertyId)
 {
     CSHA256 hasher;
@@ -281,7 +520,7 @@ uint256 GetMetaDExHash(const uint32_t propertyId)
 
     std::vector<std::pair<arith_uint256, std::string> > vecMetaDExTrades;
     for (md_PropertiesMap::const_iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        if (propertyId == 0 || propertyId == my_it->first) {
+        if (propertyId == 0 || propertyId == my_it->first.first) {
             const md_PricesMap& prices = my_it->second;
             for (md_PricesMap::const_iterator it = prices.begin(); it != prices.end(); ++it) {
                 const md_Set& indexes = it->second;
@@ -313,7 +552,7 @@ uint256 GetBalancesHash(const uint32_t hashPropertyId)
     LOCK(cs_tally);
 
     std::map<std::string, CMPTally> tallyMapSorted;
-    for (std::unordered_map<std::string, CMPTally>::iterator uoit = mp_tally_map.begin(); uoit != mp_tally_map.end(); ++uoit) {
+    for (CMPTallyMap::iterator uoit = mp_tally_map.begin(); uoit != mp_tally_map.end(); ++uoit) {
         tallyMapSorted.insert(std::make_pair(uoit->first,uoit->second));
     }
     for (std::map<std::string, CMPTally>::iterator my_it = tallyMapSorted.begin(); my_it != tallyMapSorted.end(); ++my_it) {
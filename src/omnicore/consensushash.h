@@ -1,8 +1,40 @@
 #ifndef BITCOIN_OMNICORE_CONSENSUSHASH_H
 #define BITCOIN_OMNICORE_CONSENSUSHASH_H
 
+#include <arith_uint256.h>
 #include <uint256.h>
 
+#include <stdint.h>
+#include <string>
+
+class CMPMetaDEx;
+class CMPTally;
+
+/** Order independent commitment to a set of consensus strings.
+ *
+ * The commitment is the sum of the SHA256 hashes of the strings, modulo 2^256,
+ * so strings can be added and removed in any order. It is meant to detect
+ * diverging state between nodes, not to withstand crafted collisions.
+ */
+class CConsensusAccumulator
+{
+private:
+    arith_uint256 sum;
+
+public:
+    /** Adds a string to the commitment. */
+    void Add(const std::string& dataStr);
+
+    /** Removes a previously added string from the commitment. */
+    void Remove(const std::string& dataStr);
+
+    /** Resets the commitment to the empty set. */
+    void Clear() { sum = 0; }
+
+    /** Returns the commitment. */
+    uint256 GetHash() const { return ArithToUint256(sum); }
+};
+
 namespace mastercore
 {
 /** Checks if a given block should be consensus hashed. */
@@ -17,6 +49,33 @@ uint256 GetMetaDExHash(const uint32_t propertyId = 0);
 /** Obtains a hash of the balances for a specific property. */
 uint256 GetBalancesHash(const uint32_t hashPropertyId);
 
+/** Obtains an incrementally maintained hash of the active state, as alternative to the consensus hash. */
+uint256 GetIncrementalConsensusHash();
+
+/** Checks the maintained parts of the incremental consensus hash against the whole state. */
+bool VerifyIncrementalConsensusHash();
+
+/** Stops maintaining the incremental consensus hash, until it is requested again. */
+void ResetIncrementalConsensusHash();
+
+/** Removes a balance record from the incremental consensus hash, before it is changed. */
+void ConsensusHashRemoveBalance(const CMPTally& tally, const std::string& address, uint32_t propertyId);
+
+/** Adds a balance record to the incremental consensus hash, after it was changed. */
+void ConsensusHashAddBalance(const CMPTally& tally, const std::string& address, uint32_t propertyId);
+
+/** Removes a MetaDEx order from the incremental consensus hash. */
+void ConsensusHashRemoveMetaDEx(const CMPMetaDEx& obj);
+
+/** Adds a MetaDEx order to the incremental consensus hash. */
+void ConsensusHashAddMetaDEx(const CMPMetaDEx& obj);
+
+/** Updates the issuer of a property in the incremental consensus hash, after it was stored. */
+void ConsensusHashUpdateProperty(uint32_t propertyId, const std::string& issuer);
+
+/** Stops tracking the property issuers, e.g. after properties were rolled back, until the hash is requested again. */
+void ConsensusHashResetProperties();
+
 }
 
 #endif // BITCOIN_OMNICORE_CONSENSUSHASH_H
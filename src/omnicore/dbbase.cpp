@@ -3,13 +3,91 @@
 #include <omnicore/log.h>
 
 #include <fs.h>
+#include <tinyformat.h>
+#include <util/strencodings.h>
 #include <util/system.h>
 
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
 #include <leveldb/write_batch.h>
 
 #include <stdint.h>
 
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+//! Block cache shared by the databases
+static leveldb::Cache* pSharedCache = nullptr;
+
+//! Size of the shared block cache in bytes
+static size_t nSharedCacheSize = 0;
+
+//! Bloom filter policy shared by the databases
+static const leveldb::FilterPolicy* pBloomFilterPolicy = nullptr;
+
+//! Number of bits per key of the shared bloom filters
+static int nBloomFilterBits = 0;
+
+//! Whether a block write session is active
+static std::atomic<bool> fBlockWriteSession{false};
+
+//! Guards the databases with block writes
+static Mutex cs_block_writes;
+
+//! Databases, which buffer their writes during block write sessions
+static std::set<CDBBase*> setBlockWriteDBs;
+
+//! Database, which keeps the journal of block write sessions
+static CDBBase* pJournalDB = nullptr;
+
+//! Key of the journal entry, which exists while the writes of a block are not committed
+static const std::string JOURNAL_KEY = "J";
+
+//! Block of the journal entry, or -1 without entry, guarded by cs_block_writes
+static int nJournalBlock = -1;
+
+//! Whether writes, which can't be rolled back, were made during the session, guarded by cs_block_writes
+static bool fJournalUnbuffered = false;
+
+//! Whether committing buffered writes failed, which keeps the journal entry, guarded by cs_block_writes
+static bool fJournalCommitFailed = false;
+
+/** Collects the writes of a batch as buffered writes. */
+class CPendingWritesHandler : public leveldb::WriteBatch::Handler
+{
+private:
+    std::map<std::string, std::pair<bool, std::string> >& writes;
+
+public:
+    explicit CPendingWritesHandler(std::map<std::string, std::pair<bool, std::string> >& pendingWrites) : writes(pendingWrites) {}
+
+    void Put(const leveldb::Slice& key, const leveldb::Slice& value) override
+    {
+        writes[key.ToString()] = std::make_pair(false, value.ToString());
+    }
+
+    void Delete(const leveldb::Slice& key) override
+    {
+        writes[key.ToString()] = std::make_pair(true, std::string());
+    }
+};
+
+/**
+ * Checks, if a database is named by an option, which can be used multiple times.
+ */
+static bool IsDatabaseNamed(const std::string& strArg, const fs::path& path)
+{
+    const std::string strName = path.filename().string();
+    for (const std::string& name : gArgs.GetArgs(strArg)) {
+        if (name == strName) return true;
+    }
+    return false;
+}
+
 /**
  * Opens or creates a LevelDB based database.
  */
@@ -22,6 +100,12 @@ leveldb::Status CDBBase::Open(const fs::path& path, bool fWipe)
     TryCreateDirectories(path);
     if (msc_debug_persistence) PrintToLog("Opening LevelDB in %s\n", path.string());
 
+    // a database excluded from caching still uses the shared cache, as LevelDB would
+    // otherwise create a private one, but its reads don't fill it
+    options.block_cache = pSharedCache;
+    readoptions.fill_cache = !IsDatabaseNamed("-omnidbnocache", path);
+    options.filter_policy = (fBloomFilter && !IsDatabaseNamed("-omnidbnobloom", path)) ? pBloomFilterPolicy : nullptr;
+
     return leveldb::DB::Open(options, path.string(), &pdb);
 }
 
@@ -46,6 +130,11 @@ void CDBBase::Clear()
     nRead = 0;
     nWritten = 0;
 
+    {
+        LOCK(cs_pending);
+        pendingWrites.clear();
+    }
+
     int64_t nTime = GetTimeMicros() - nTimeStart;
     if (msc_debug_persistence)
         PrintToLog("Removed %d entries: %s [%.3f ms/entry, %.3f ms total]\n",
@@ -57,12 +146,263 @@ void CDBBase::Clear()
  */
 void CDBBase::Close()
 {
+    {
+        LOCK(cs_block_writes);
+        if (fBlockWrites) setBlockWriteDBs.erase(this);
+        if (pJournalDB == this) pJournalDB = nullptr;
+    }
     if (pdb) {
+        CommitWrites();
         delete pdb;
         pdb = NULL;
     }
 }
 
+/**
+ * Buffers the writes of this database during block write sessions.
+ */
+void CDBBase::EnableBlockWrites()
+{
+    LOCK(cs_block_writes);
+    fBlockWrites = true;
+    setBlockWriteDBs.insert(this);
+}
+
+/**
+ * Uses the shared bloom filter policy, if configured, for point lookups.
+ */
+void CDBBase::EnableBloomFilter()
+{
+    assert(!pdb);
+    fBloomFilter = true;
+}
+
+/**
+ * Keeps the journal of block write sessions in this database.
+ */
+void CDBBase::EnableJournal()
+{
+    LOCK(cs_block_writes);
+    pJournalDB = this;
+}
+
+bool CDBBase::IsBuffering() const
+{
+    return fBlockWrites && fBlockWriteSession;
+}
+
+void CDBBase::MarkUnbufferedWrite()
+{
+    if (!fBlockWriteSession) return;
+
+    LOCK(cs_block_writes);
+    if (nJournalBlock < 0 || fJournalUnbuffered) return;
+
+    fJournalUnbuffered = true;
+    leveldb::Status status = WriteJournal(false);
+    if (!status.ok()) {
+        PrintToLog("%s(): ERROR: failed to write journal: %s\n", __func__, status.ToString());
+    }
+}
+
+leveldb::Status CDBBase::WriteJournal(bool fErase)
+{
+    AssertLockHeld(cs_block_writes);
+    if (pJournalDB == nullptr || pJournalDB->pdb == nullptr) {
+        return leveldb::Status::OK();
+    }
+
+    if (fErase) {
+        return pJournalDB->pdb->Delete(pJournalDB->syncoptions, JOURNAL_KEY);
+    }
+    std::string strValue = strprintf("%d:%d", nJournalBlock, fJournalUnbuffered ? 1 : 0);
+    return pJournalDB->pdb->Put(pJournalDB->syncoptions, JOURNAL_KEY, strValue);
+}
+
+/**
+ * Reads a value, including buffered writes.
+ */
+leveldb::Status CDBBase::Read(const leveldb::Slice& key, std::string* value) const
+{
+    assert(pdb);
+    {
+        LOCK(cs_pending);
+        std::map<std::string, std::pair<bool, std::string> >::const_iterator it = pendingWrites.find(key.ToString());
+        if (it != pendingWrites.end()) {
+            if (it->second.first) {
+                return leveldb::Status::NotFound(key);
+            }
+            *value = it->second.second;
+            return leveldb::Status::OK();
+        }
+    }
+
+    return pdb->Get(readoptions, key, value);
+}
+
+/**
+ * Stores a value, or buffers it during a block write session.
+ */
+leveldb::Status CDBBase::Put(const leveldb::Slice& key, const leveldb::Slice& value)
+{
+    assert(pdb);
+    if (!IsBuffering()) {
+        MarkUnbufferedWrite();
+        return pdb->Put(writeoptions, key, value);
+    }
+
+    LOCK(cs_pending);
+    pendingWrites[key.ToString()] = std::make_pair(false, value.ToString());
+    return leveldb::Status::OK();
+}
+
+/**
+ * Deletes a value, or buffers the deletion during a block write session.
+ */
+leveldb::Status CDBBase::Delete(const leveldb::Slice& key)
+{
+    assert(pdb);
+    if (!IsBuffering()) {
+        MarkUnbufferedWrite();
+        return pdb->Delete(writeoptions, key);
+    }
+
+    LOCK(cs_pending);
+    pendingWrites[key.ToString()] = std::make_pair(true, std::string());
+    return leveldb::Status::OK();
+}
+
+/**
+ * Applies a batch of writes, or buffers them during a block write session.
+ */
+leveldb::Status CDBBase::Write(leveldb::WriteBatch& batch)
+{
+    assert(pdb);
+    if (!IsBuffering()) {
+        MarkUnbufferedWrite();
+        return pdb->Write(writeoptions, &batch);
+    }
+
+    LOCK(cs_pending);
+    CPendingWritesHandler handler(pendingWrites);
+    return batch.Iterate(&handler);
+}
+
+/**
+ * Commits the buffered writes of this database in one batch.
+ */
+leveldb::Status CDBBase::CommitWrites()
+{
+    assert(pdb);
+    LOCK(cs_pending);
+    if (pendingWrites.empty()) {
+        return leveldb::Status::OK();
+    }
+
+    leveldb::WriteBatch batch;
+    for (std::map<std::string, std::pair<bool, std::string> >::const_iterator it = pendingWrites.begin(); it != pendingWrites.end(); ++it) {
+        if (it->second.first) {
+            batch.Delete(it->first);
+        } else {
+            batch.Put(it->first, it->second.second);
+        }
+    }
+
+    leveldb::Status status = pdb->Write(writeoptions, &batch);
+    if (msc_debug_persistence) PrintToLog("Committed %d buffered writes: %s\n", pendingWrites.size(), status.ToString());
+    pendingWrites.clear();
+
+    return status;
+}
+
+/**
+ * Starts buffering the writes of all databases with block writes.
+ *
+ * Writes left over from an unfinished session are committed first. If committing
+ * failed before, the journal keeps the entry of that block.
+ */
+void CDBBase::BeginBlockWrites(int nBlock)
+{
+    CommitBlockWrites();
+
+    LOCK(cs_block_writes);
+    if (nJournalBlock < 0) {
+        nJournalBlock = nBlock;
+        fJournalUnbuffered = false;
+        leveldb::Status status = WriteJournal(false);
+        if (!status.ok()) {
+            PrintToLog("%s(): ERROR: failed to write journal: %s\n", __func__, status.ToString());
+        }
+    }
+    fBlockWriteSession = true;
+}
+
+/**
+ * Commits the buffered writes of all databases, and ends the block write session.
+ */
+bool CDBBase::CommitBlockWrites()
+{
+    fBlockWriteSession = false;
+
+    bool fSuccess = true;
+    LOCK(cs_block_writes);
+    for (std::set<CDBBase*>::const_iterator it = setBlockWriteDBs.begin(); it != setBlockWriteDBs.end(); ++it) {
+        leveldb::Status status = (*it)->CommitWrites();
+        if (!status.ok()) {
+            PrintToLog("%s(): ERROR: failed to commit block writes: %s\n", __func__, status.ToString());
+            fSuccess = false;
+        }
+    }
+
+    if (!fSuccess) fJournalCommitFailed = true;
+    if (nJournalBlock >= 0 && !fJournalCommitFailed) {
+        leveldb::Status status = WriteJournal(true);
+        if (!status.ok()) {
+            PrintToLog("%s(): ERROR: failed to erase journal: %s\n", __func__, status.ToString());
+        }
+        nJournalBlock = -1;
+    }
+
+    return fSuccess;
+}
+
+/**
+ * Checks the journal for a block, whose writes were not committed completely.
+ */
+bool CDBBase::GetInterruptedBlock(int& nBlock, bool& fUnbufferedWrites)
+{
+    LOCK(cs_block_writes);
+    if (pJournalDB == nullptr || pJournalDB->pdb == nullptr) {
+        return false;
+    }
+
+    std::string strValue;
+    if (!pJournalDB->pdb->Get(pJournalDB->readoptions, JOURNAL_KEY, &strValue).ok()) {
+        return false;
+    }
+
+    size_t nPos = strValue.find(':');
+    nBlock = atoi(strValue.substr(0, nPos));
+    fUnbufferedWrites = (nPos == std::string::npos || strValue.substr(nPos + 1) != "0");
+
+    return true;
+}
+
+/**
+ * Erases the journal entry of an interrupted block, after the databases were recovered.
+ */
+void CDBBase::ClearInterruptedBlock()
+{
+    LOCK(cs_block_writes);
+    nJournalBlock = -1;
+    fJournalUnbuffered = false;
+    fJournalCommitFailed = false;
+    leveldb::Status status = WriteJournal(true);
+    if (!status.ok()) {
+        PrintToLog("%s(): ERROR: failed to erase journal: %s\n", __func__, status.ToString());
+    }
+}
+
 
 /**
 @todo  Move initialization and deinitialization of databases into this file (?)
@@ -84,3 +424,55 @@ t_tradelistdb->recordTrade();
 TradeDB().recordTrade();
 
 */
+
+/**
+ * Configures the block cache and bloom filters shared by the databases.
+ */
+void CDBBase::SetSharedOptions(size_t nCacheSize, int nBloomBits)
+{
+    ReleaseSharedOptions();
+
+    if (nCacheSize > 0) {
+        pSharedCache = leveldb::NewLRUCache(nCacheSize);
+        nSharedCacheSize = nCacheSize;
+    }
+    if (nBloomBits > 0) {
+        pBloomFilterPolicy = leveldb::NewBloomFilterPolicy(nBloomBits);
+        nBloomFilterBits = nBloomBits;
+    }
+
+    PrintToLog("Using %.1f MiB shared block cache and %d bits per key bloom filters for the databases\n",
+            nSharedCacheSize * (1.0 / 1024 / 1024), nBloomFilterBits);
+}
+
+/**
+ * Releases the shared block cache and bloom filters, after the databases were closed.
+ */
+void CDBBase::ReleaseSharedOptions()
+{
+    delete pSharedCache;
+    pSharedCache = nullptr;
+    nSharedCacheSize = 0;
+
+    delete pBloomFilterPolicy;
+    pBloomFilterPolicy = nullptr;
+    nBloomFilterBits = 0;
+}
+
+/** Returns the size of the shared block cache in bytes. */
+size_t CDBBase::GetSharedCacheSize()
+{
+    return nSharedCacheSize;
+}
+
+/** Returns the number of bytes used in the shared block cache. */
+size_t CDBBase::GetSharedCacheUsage()
+{
+    return pSharedCache ? pSharedCache->TotalCharge() : 0;
+}
+
+/** Returns the number of bits per key of the shared bloom filters. */
+int CDBBase::GetBloomFilterBits()
+{
+    return nBloomFilterBits;
+}
@@ -2,13 +2,30 @@
 #define BITCOIN_OMNICORE_DBBASE_H
 
 #include <leveldb/db.h>
+#include <leveldb/status.h>
+#include <leveldb/write_batch.h>
 
 #include <fs.h>
+#include <sync.h>
 
 #include <assert.h>
 #include <stddef.h>
 
+#include <map>
+#include <string>
+#include <utility>
+
 /** Base class for LevelDB based storage.
+ *
+ * Databases, which enable block writes, buffer their writes while a block write
+ * session is active, and all of them are committed together at the end of the block.
+ * Buffered writes are visible to Read(), but not to iterators.
+ *
+ * The databases are committed one after another, so a journal entry records the
+ * block of the session, until all of them were committed. Writes through Put(),
+ * Delete() and Write() of databases without block writes, which can't be rolled
+ * back, are recorded as well. The journal entry is synced, before any write of
+ * the block is made.
  */
 class CDBBase
 {
@@ -16,6 +33,27 @@ private:
     //! Options used when iterating over values of the database
     leveldb::ReadOptions iteroptions;
 
+    //! Whether writes are buffered during block write sessions
+    bool fBlockWrites;
+
+    //! Whether the shared bloom filter policy is used
+    bool fBloomFilter;
+
+    //! Guards the buffered writes
+    mutable Mutex cs_pending;
+
+    //! Buffered writes of the current block, with key -> (erased, value)
+    std::map<std::string, std::pair<bool, std::string> > pendingWrites;
+
+    /** Returns true, if writes are currently buffered. */
+    bool IsBuffering() const;
+
+    /** Records in the journal, that a database without block writes was written during the session. */
+    static void MarkUnbufferedWrite();
+
+    /** Writes or erases the journal entry of the block write session. */
+    static leveldb::Status WriteJournal(bool fErase);
+
 protected:
     //! Database options used
     leveldb::Options options;
@@ -38,7 +76,7 @@ protected:
     //! Number of entries written
     unsigned int nWritten;
 
-    CDBBase() : pdb(NULL), nRead(0), nWritten(0)
+    CDBBase() : fBlockWrites(false), fBloomFilter(false), pdb(NULL), nRead(0), nWritten(0)
     {
         options.paranoid_checks = true;
         options.create_if_missing = true;
@@ -61,6 +99,10 @@ protected:
      * It is expected that the database is not closed. The iterator is owned by the
      * caller, and the object has to be deleted explicitly.
      *
+     * Writes buffered during a block write session are not visible to iterators,
+     * so databases with block writes must not be iterated during a session, or
+     * only for data, which is not written in the session.
+     *
      * @return A new LevelDB iterator
      */
     leveldb::Iterator* NewIterator() const
@@ -73,7 +115,9 @@ protected:
      * Opens or creates a LevelDB based database.
      *
      * If the database is wiped before opening, it's content is destroyed, including
-     * all log files and meta data.
+     * all log files and meta data. The shared block cache is used, if configured.
+ * Reads of a database named by -omnidbnocache don't fill the cache, and one
+ * named by -omnidbnobloom has no bloom filters.
      *
      * @param path   The path of the database to open
      * @param fWipe  Whether to wipe the database before opening
@@ -83,14 +127,119 @@ protected:
 
     /**
      * Deinitializes and closes the database.
+     *
+     * Buffered writes are committed before the database is closed.
      */
     void Close();
 
+    /**
+     * Buffers the writes of this database during block write sessions.
+     */
+    void EnableBlockWrites();
+
+    /**
+     * Uses the shared bloom filter policy, if configured, for point lookups.
+     *
+     * Must be called before the database is opened.
+     */
+    void EnableBloomFilter();
+
+    /**
+     * Keeps the journal of block write sessions in this database.
+     *
+     * The key "J" is reserved for the journal entry.
+     */
+    void EnableJournal();
+
+    /**
+     * Reads a value, including buffered writes.
+     */
+    leveldb::Status Read(const leveldb::Slice& key, std::string* value) const;
+
+    /**
+     * Stores a value, or buffers it during a block write session.
+     */
+    leveldb::Status Put(const leveldb::Slice& key, const leveldb::Slice& value);
+
+    /**
+     * Deletes a value, or buffers the deletion during a block write session.
+     */
+    leveldb::Status Delete(const leveldb::Slice& key);
+
+    /**
+     * Applies a batch of writes, or buffers them during a block write session.
+     */
+    leveldb::Status Write(leveldb::WriteBatch& batch);
+
 public:
     /**
      * Deletes all entries of the database, and resets the counters.
      */
     void Clear();
+
+    /**
+     * Commits the buffered writes of this database in one batch.
+     */
+    leveldb::Status CommitWrites();
+
+    /**
+     * Starts buffering the writes of all databases with block writes.
+     *
+     * Until the writes are committed, they are visible to Read(), but not to
+     * iterators of NewIterator(). Rewinds and loading on startup iterate outside
+     * of sessions. RPC calls, which iterate while a block is processed, see the
+     * entries of the previous block.
+     *
+     * @param nBlock  The block, which is recorded in the journal
+     */
+    static void BeginBlockWrites(int nBlock);
+
+    /**
+     * Commits the buffered writes of all databases, and ends the block write session.
+     *
+     * The journal entry is erased, if all writes were committed successfully.
+     *
+     * @return True, if all writes were committed successfully
+     */
+    static bool CommitBlockWrites();
+
+    /**
+     * Checks the journal for a block, whose writes were not committed completely.
+     *
+     * @param nBlock[out]             The block of the interrupted session
+     * @param fUnbufferedWrites[out]  Whether writes, which can't be rolled back, were made
+     * @return True, if the writes of a block were interrupted
+     */
+    static bool GetInterruptedBlock(int& nBlock, bool& fUnbufferedWrites);
+
+    /**
+     * Erases the journal entry of an interrupted block, after the databases were recovered.
+     */
+    static void ClearInterruptedBlock();
+
+    /**
+     * Configures the block cache and bloom filters shared by the databases.
+     *
+     * Must be called before the databases are opened.
+     *
+     * @param nCacheSize  The size of the shared block cache in bytes, 0 to disable
+     * @param nBloomBits  The number of bits per key of bloom filters, 0 to disable
+     */
+    static void SetSharedOptions(size_t nCacheSize, int nBloomBits);
+
+    /**
+     * Releases the shared block cache and bloom filters, after the databases were closed.
+     */
+    static void ReleaseSharedOptions();
+
+    /** Returns the size of the shared block cache in bytes. */
+    static size_t GetSharedCacheSize();
+
+    /** Returns the number of bytes used in the shared block cache. */
+    static size_t GetSharedCacheUsage();
+
+    /** Returns the number of bits per key of the shared bloom filters. */
+    static int GetBloomFilterBits();
 };
 
 
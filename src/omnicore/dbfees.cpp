@@ -7,6 +7,7 @@
 #include <omnicore/dbfees.h>
 
 #include <omnicore/log.h>
+#include <omnicore/omnicore.h>
 #include <omnicore/rules.h>
 #include <omnicore/sp.h>
 #include <omnicore/sto.h>
@@ -14,6 +15,7 @@
 #include <validation.h>
 
 #include <leveldb/db.h>
+#include <leveldb/write_batch.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -27,28 +29,136 @@
 
 using namespace mastercore;
 
-std::map<uint32_t, int64_t> distributionThresholds;
+/** Parses fee cache history items in the format "block:amount,block:amount,...". */
+static std::set<feeCacheItem> ParseCacheHistory(const std::string& strValue)
+{
+    std::set<feeCacheItem> sCacheHistoryItems;
+    std::vector<std::string> vCacheHistoryItems;
+    boost::split(vCacheHistoryItems, strValue, boost::is_any_of(","), boost::token_compress_on);
+    for (std::vector<std::string>::iterator it = vCacheHistoryItems.begin(); it != vCacheHistoryItems.end(); ++it) {
+        std::vector<std::string> vCacheHistoryItem;
+        boost::split(vCacheHistoryItem, *it, boost::is_any_of(":"), boost::token_compress_on);
+        if (2 != vCacheHistoryItem.size()) {
+            PrintToConsole("ERROR: vCacheHistoryItem has unexpected number of elements: %d (raw %s)!\n", vCacheHistoryItem.size(), *it);
+            continue;
+        }
+        int64_t cacheItemBlock = boost::lexical_cast<int64_t>(vCacheHistoryItem[0]);
+        int64_t cacheItemAmount = boost::lexical_cast<int64_t>(vCacheHistoryItem[1]);
+        sCacheHistoryItems.insert(std::make_pair(cacheItemBlock, cacheItemAmount));
+    }
+    return sCacheHistoryItems;
+}
+
+/** Formats fee cache history items in the format "block:amount,block:amount,...". */
+static std::string FormatCacheHistory(const std::set<feeCacheItem>& sCacheHistoryItems)
+{
+    std::string strValue;
+    for (std::set<feeCacheItem>::const_iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); ++it) {
+        if (!strValue.empty()) strValue += ",";
+        strValue += strprintf("%d:%d", it->first, it->second);
+    }
+    return strValue;
+}
 
 COmniFeeCache::COmniFeeCache(const fs::path& path, bool fWipe)
 {
     leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
     PrintToConsole("Loading fee cache database: %s\n", status.ToString());
+
+    Load();
 }
 
 COmniFeeCache::~COmniFeeCache()
 {
+    Flush();
     if (msc_debug_fees) PrintToLog("COmniFeeCache closed\n");
 }
 
+// Loads the fee cache history items from the database
+void COmniFeeCache::Load()
+{
+    assert(pdb);
+    LOCK(cs_tally);
+
+    cacheHistory.clear();
+    dirtyProperties.clear();
+
+    leveldb::Iterator* it = NewIterator();
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        ++nRead;
+        uint32_t propertyId = boost::lexical_cast<uint32_t>(it->key().ToString());
+        std::set<feeCacheItem> sCacheHistoryItems = ParseCacheHistory(it->value().ToString());
+        if (!sCacheHistoryItems.empty()) {
+            cacheHistory[propertyId] = sCacheHistoryItems;
+        }
+    }
+    delete it;
+}
+
+// Deletes all entries of the fee cache
+void COmniFeeCache::Clear()
+{
+    LOCK(cs_tally);
+
+    CDBBase::Clear();
+    cacheHistory.clear();
+    dirtyProperties.clear();
+}
+
+// Writes modified entries to the database in one batch
+void COmniFeeCache::Flush()
+{
+    assert(pdb);
+    LOCK(cs_tally);
+
+    if (dirtyProperties.empty()) {
+        return;
+    }
+
+    leveldb::WriteBatch batch;
+    for (std::set<uint32_t>::const_iterator it = dirtyProperties.begin(); it != dirtyProperties.end(); ++it) {
+        const std::string key = strprintf("%010d", *it);
+        std::map<uint32_t, std::set<feeCacheItem> >::const_iterator itHistory = cacheHistory.find(*it);
+        if (itHistory != cacheHistory.end()) {
+            batch.Put(key, FormatCacheHistory(itHistory->second));
+        } else {
+            batch.Delete(key);
+        }
+    }
+
+    leveldb::Status status = Write(batch);
+    assert(status.ok());
+    nWritten += dirtyProperties.size();
+    if (msc_debug_fees) PrintToLog("Flushed fee cache for %d properties [%s]\n", dirtyProperties.size(), status.ToString());
+
+    dirtyProperties.clear();
+}
+
+// Replaces the fee cache history items of a property
+void COmniFeeCache::SetCacheHistory(const uint32_t &propertyId, const std::set<feeCacheItem>& sCacheHistoryItems)
+{
+    if (sCacheHistoryItems.empty()) {
+        cacheHistory.erase(propertyId);
+    } else {
+        cacheHistory[propertyId] = sCacheHistoryItems;
+    }
+    dirtyProperties.insert(propertyId);
+}
+
 // Returns the distribution threshold for a property
 int64_t COmniFeeCache::GetDistributionThreshold(const uint32_t &propertyId)
 {
+    LOCK(cs_tally);
+
     return distributionThresholds[propertyId];
 }
 
 // Sets the distribution thresholds to total tokens for a property / OMNI_FEE_THRESHOLD
 void COmniFeeCache::UpdateDistributionThresholds(uint32_t propertyId)
 {
+    LOCK(cs_tally);
+
     int64_t distributionThreshold = getTotalTokens(propertyId) / OMNI_FEE_THRESHOLD;
     if (distributionThreshold <= 0) {
         // protect against zero valued thresholds for low token count properties
@@ -60,14 +170,12 @@ void COmniFeeCache::UpdateDistributionThresholds(uint32_t propertyId)
 // Gets the current amount of the fee cache for a property
 int64_t COmniFeeCache::GetCachedAmount(const uint32_t &propertyId)
 {
-    assert(pdb);
+    LOCK(cs_tally);
+
     // Get the fee history, set is sorted by block so last entry is most recent
-    std::set<feeCacheItem> sCacheHistoryItems = GetCacheHistory(propertyId);
-    if (!sCacheHistoryItems.empty()) {
-        std::set<feeCacheItem>::iterator endIt = sCacheHistoryItems.end();
-        --endIt;
-        feeCacheItem mostRecentItem = *endIt;
-        return mostRecentItem.second;
+    std::map<uint32_t, std::set<feeCacheItem> >::const_iterator it = cacheHistory.find(propertyId);
+    if (it != cacheHistory.end() && !it->second.empty()) {
+        return it->second.rbegin()->second;
     } else {
         return 0; // property has never generated a fee
     }
@@ -76,35 +184,32 @@ int64_t COmniFeeCache::GetCachedAmount(const uint32_t &propertyId)
 // Zeros a property in the fee cache
 void COmniFeeCache::ClearCache(const uint32_t &propertyId, int block)
 {
+    LOCK(cs_tally);
+
     if (msc_debug_fees) PrintToLog("ClearCache starting (block %d, property ID %d)...\n", block, propertyId);
-    const std::string key = strprintf("%010d", propertyId);
     std::set<feeCacheItem> sCacheHistoryItems = GetCacheHistory(propertyId);
     if (msc_debug_fees) PrintToLog("   Iterating cache history (%d items)...\n",sCacheHistoryItems.size());
-    std::string newValue;
-    if (!sCacheHistoryItems.empty()) {
-        for (std::set<feeCacheItem>::iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); it++) {
-            feeCacheItem tempItem = *it;
-            if (tempItem.first == block) continue;
-            if (!newValue.empty()) newValue += ",";
-            newValue += strprintf("%d:%d", tempItem.first, tempItem.second);
-            if (msc_debug_fees) PrintToLog("      Readding entry: block %d amount %d\n", tempItem.first, tempItem.second);
-        }
-        if (!newValue.empty()) newValue += ",";
+    std::set<feeCacheItem> sNewItems;
+    for (std::set<feeCacheItem>::iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); it++) {
+        feeCacheItem tempItem = *it;
+        if (tempItem.first == block) continue;
+        sNewItems.insert(tempItem);
+        if (msc_debug_fees) PrintToLog("      Readding entry: block %d amount %d\n", tempItem.first, tempItem.second);
     }
     if (msc_debug_fees) PrintToLog("   Adding zero valued entry: block %d\n", block);
-    newValue += strprintf("%d:%d", block, 0);
-    leveldb::Status status = pdb->Put(writeoptions, key, newValue);
-    assert(status.ok());
-    ++nWritten;
+    sNewItems.insert(std::make_pair(block, 0));
+    SetCacheHistory(propertyId, sNewItems);
 
     PruneCache(propertyId, block);
 
-    if (msc_debug_fees) PrintToLog("Cleared cache for property %d block %d [%s]\n", propertyId, block, status.ToString());
+    if (msc_debug_fees) PrintToLog("Cleared cache for property %d block %d\n", propertyId, block);
 }
 
 // Adds a fee to the cache (eg on a completed trade)
 void COmniFeeCache::AddFee(const uint32_t &propertyId, int block, const int64_t &amount)
 {
+    LOCK(cs_tally);
+
     if (msc_debug_fees) PrintToLog("Starting AddFee for prop %d (block %d amount %d)...\n", propertyId, block, amount);
 
     // Get current cached fee
@@ -119,32 +224,26 @@ void COmniFeeCache::AddFee(const uint32_t &propertyId, int block, const int64_t
         if (!gArgs.GetBoolArg("-overrideforcedshutdown", false)) {
             fs::path persistPath = GetDataDir() / "MP_persist";
             if (fs::exists(persistPath)) fs::remove_all(persistPath); // prevent the node being restarted without a reparse after forced shutdown
+            FlushLog();
             AbortNode(msg, msg);
         }
     }
     int64_t newCachedAmount = currentCachedAmount + amount;
 
     if (msc_debug_fees) PrintToLog("   New cached amount %d\n", newCachedAmount);
-    const std::string key = strprintf("%010d", propertyId);
     std::set<feeCacheItem> sCacheHistoryItems = GetCacheHistory(propertyId);
     if (msc_debug_fees) PrintToLog("   Iterating cache history (%d items)...\n",sCacheHistoryItems.size());
-    std::string newValue;
-    if (!sCacheHistoryItems.empty()) {
-        for (std::set<feeCacheItem>::iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); it++) {
-            feeCacheItem tempItem = *it;
-            if (tempItem.first == block) continue; // this is an older entry for the same block, discard it
-            if (!newValue.empty()) newValue += ",";
-            newValue += strprintf("%d:%d", tempItem.first, tempItem.second);
-            if (msc_debug_fees) PrintToLog("      Readding entry: block %d amount %d\n", tempItem.first, tempItem.second);
-        }
-        if (!newValue.empty()) newValue += ",";
+    std::set<feeCacheItem> sNewItems;
+    for (std::set<feeCacheItem>::iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); it++) {
+        feeCacheItem tempItem = *it;
+        if (tempItem.first == block) continue; // this is an older entry for the same block, discard it
+        sNewItems.insert(tempItem);
+        if (msc_debug_fees) PrintToLog("      Readding entry: block %d amount %d\n", tempItem.first, tempItem.second);
     }
     if (msc_debug_fees) PrintToLog("   Adding requested entry: block %d new amount %d\n", block, newCachedAmount);
-    newValue += strprintf("%d:%d", block, newCachedAmount);
-    leveldb::Status status = pdb->Put(writeoptions, key, newValue);
-    assert(status.ok());
-    ++nWritten;
-    if (msc_debug_fees) PrintToLog("AddFee completed for property %d (new=%s [%s])\n", propertyId, newValue, status.ToString());
+    sNewItems.insert(std::make_pair(block, newCachedAmount));
+    SetCacheHistory(propertyId, sNewItems);
+    if (msc_debug_fees) PrintToLog("AddFee completed for property %d (new=%s)\n", propertyId, FormatCacheHistory(sNewItems));
 
     // Call for pruning (we only prune when we update a record)
     PruneCache(propertyId, block);
@@ -159,29 +258,28 @@ void COmniFeeCache::AddFee(const uint32_t &propertyId, int block, const int64_t
 void COmniFeeCache::RollBackCache(int block)
 {
     assert(pdb);
-    for (uint8_t ecosystem = 1; ecosystem <= 2; ecosystem++) {
-        uint32_t startPropertyId = (ecosystem == 1) ? 1 : TEST_ECO_PROPERTY_1;
-        for (uint32_t propertyId = startPropertyId; propertyId < mastercore::pDbSpInfo->peekNextSPID(ecosystem); propertyId++) {
-            const std::string key = strprintf("%010d", propertyId);
-            std::set<feeCacheItem> sCacheHistoryItems = GetCacheHistory(propertyId);
-            if (!sCacheHistoryItems.empty()) {
-                std::set<feeCacheItem>::iterator mostRecentIt = sCacheHistoryItems.end();
-                std::string newValue;
-                --mostRecentIt;
-                feeCacheItem mostRecentItem = *mostRecentIt;
-                if (mostRecentItem.first < block) continue; // all entries are unaffected by this rollback, nothing to do
-                for (std::set<feeCacheItem>::iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); it++) {
-                    feeCacheItem tempItem = *it;
-                    if (tempItem.first >= block) continue; // discard this entry
-                    if (!newValue.empty()) newValue += ",";
-                    newValue += strprintf("%d:%d", tempItem.first, tempItem.second);
-                }
-                leveldb::Status status = pdb->Put(writeoptions, key, newValue);
-                assert(status.ok());
-                PrintToLog("Rolling back fee cache for property %d, new=%s [%s])\n", propertyId, newValue, status.ToString());
-            }
+    LOCK(cs_tally);
+
+    // only properties with cached fees are affected
+    std::map<uint32_t, std::set<feeCacheItem> >::iterator itHistory = cacheHistory.begin();
+    while (itHistory != cacheHistory.end()) {
+        const uint32_t propertyId = itHistory->first;
+        std::set<feeCacheItem>& sCacheHistoryItems = itHistory->second;
+        if (sCacheHistoryItems.empty() || sCacheHistoryItems.rbegin()->first < block) {
+            ++itHistory;
+            continue; // all entries are unaffected by this rollback, nothing to do
+        }
+        sCacheHistoryItems.erase(sCacheHistoryItems.lower_bound(std::make_pair(block, std::numeric_limits<int64_t>::min())), sCacheHistoryItems.end());
+        PrintToLog("Rolling back fee cache for property %d, new=%s)\n", propertyId, FormatCacheHistory(sCacheHistoryItems));
+        dirtyProperties.insert(propertyId);
+        if (sCacheHistoryItems.empty()) {
+            itHistory = cacheHistory.erase(itHistory);
+        } else {
+            ++itHistory;
         }
     }
+
+    Flush();
 }
 
 // Evaluates fee caches for the property against threshold and executes distribution if threshold met
@@ -238,12 +336,12 @@ void COmniFeeCache::DistributeCache(const uint32_t &propertyId, int block)
 // Prunes entries over MAX_STATE_HISTORY blocks old from the entry for a property
 void COmniFeeCache::PruneCache(const uint32_t &propertyId, int block)
 {
+    LOCK(cs_tally);
+
     if (msc_debug_fees) PrintToLog("Starting PruneCache for prop %d block %d...\n", propertyId, block);
-    assert(pdb);
 
     int pruneBlock = block - MAX_STATE_HISTORY;
     if (msc_debug_fees) PrintToLog("Removing entries prior to block %d...\n", pruneBlock);
-    const std::string key = strprintf("%010d", propertyId);
     std::set<feeCacheItem> sCacheHistoryItems = GetCacheHistory(propertyId);
     if (msc_debug_fees) PrintToLog("   Iterating cache history (%d items)...\n",sCacheHistoryItems.size());
     if (!sCacheHistoryItems.empty()) {
@@ -253,7 +351,7 @@ void COmniFeeCache::PruneCache(const uint32_t &propertyId, int block)
             if (msc_debug_fees) PrintToLog("Ending PruneCache - no matured entries found.\n");
             return; // all entries are above supplied block value, nothing to do
         }
-        std::string newValue;
+        std::set<feeCacheItem> sNewItems;
         for (std::set<feeCacheItem>::iterator it = sCacheHistoryItems.begin(); it != sCacheHistoryItems.end(); it++) {
             feeCacheItem tempItem = *it;
             if (tempItem.first < pruneBlock) {
@@ -262,21 +360,17 @@ void COmniFeeCache::PruneCache(const uint32_t &propertyId, int block)
                     continue; // discard this entry
                 }
             }
-            if (!newValue.empty()) newValue += ",";
-            newValue += strprintf("%d:%d", tempItem.first, tempItem.second);
+            sNewItems.insert(tempItem);
             if (msc_debug_fees) PrintToLog("      Readding immature entry: block %d amount %d\n", tempItem.first, tempItem.second);
         }
         // make sure the pruned cache isn't completely empty, if it is, prune down to just the most recent entry
-        if (newValue.empty()) {
-            std::set<feeCacheItem>::iterator mostRecentIt = sCacheHistoryItems.end();
-            --mostRecentIt;
-            feeCacheItem mostRecentItem = *mostRecentIt;
-            newValue = strprintf("%d:%d", mostRecentItem.first, mostRecentItem.second);
+        if (sNewItems.empty()) {
+            feeCacheItem mostRecentItem = *sCacheHistoryItems.rbegin();
+            sNewItems.insert(mostRecentItem);
             if (msc_debug_fees) PrintToLog("   All entries matured and pruned - readding most recent entry: block %d amount %d\n", mostRecentItem.first, mostRecentItem.second);
         }
-        leveldb::Status status = pdb->Put(writeoptions, key, newValue);
-        assert(status.ok());
-        if (msc_debug_fees) PrintToLog("PruneCache completed for property %d (new=%s [%s])\n", propertyId, newValue, status.ToString());
+        SetCacheHistory(propertyId, sNewItems);
+        if (msc_debug_fees) PrintToLog("PruneCache completed for property %d (new=%s)\n", propertyId, FormatCacheHistory(sNewItems));
     } else {
         return; // nothing to do
     }
@@ -291,6 +385,8 @@ void COmniFeeCache::printStats()
 // Show Fee Cache DB records
 void COmniFeeCache::printAll()
 {
+    Flush();
+
     int count = 0;
     leveldb::Iterator* it = NewIterator();
     for(it->SeekToFirst(); it->Valid(); it->Next()) {
@@ -303,37 +399,19 @@ void COmniFeeCache::printAll()
 // Return a set containing fee cache history items
 std::set<feeCacheItem> COmniFeeCache::GetCacheHistory(const uint32_t &propertyId)
 {
-    assert(pdb);
-
-    const std::string key = strprintf("%010d", propertyId);
+    LOCK(cs_tally);
 
-    std::set<feeCacheItem> sCacheHistoryItems;
-    std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, key, &strValue);
-    if (status.IsNotFound()) {
-        return sCacheHistoryItems; // no cache, return empty set
-    }
-    assert(status.ok());
-    std::vector<std::string> vCacheHistoryItems;
-    boost::split(vCacheHistoryItems, strValue, boost::is_any_of(","), boost::token_compress_on);
-    for (std::vector<std::string>::iterator it = vCacheHistoryItems.begin(); it != vCacheHistoryItems.end(); ++it) {
-        std::vector<std::string> vCacheHistoryItem;
-        boost::split(vCacheHistoryItem, *it, boost::is_any_of(":"), boost::token_compress_on);
-        if (2 != vCacheHistoryItem.size()) {
-            PrintToConsole("ERROR: vCacheHistoryItem has unexpected number of elements: %d (raw %s)!\n", vCacheHistoryItem.size(), *it);
-            printAll();
-            continue;
-        }
-        int64_t cacheItemBlock = boost::lexical_cast<int64_t>(vCacheHistoryItem[0]);
-        int64_t cacheItemAmount = boost::lexical_cast<int64_t>(vCacheHistoryItem[1]);
-        sCacheHistoryItems.insert(std::make_pair(cacheItemBlock, cacheItemAmount));
+    std::map<uint32_t, std::set<feeCacheItem> >::const_iterator it = cacheHistory.find(propertyId);
+    if (it == cacheHistory.end()) {
+        return std::set<feeCacheItem>(); // no cache, return empty set
     }
 
-    return sCacheHistoryItems;
+    return it->second;
 }
 
 COmniFeeHistory::COmniFeeHistory(const fs::path& path, bool fWipe)
 {
+    EnableBloomFilter();
     leveldb::Status status = Open(path, fWipe);
     PrintToConsole("Loading fee history database: %s\n", status.ToString());
 }
@@ -6,6 +6,7 @@
 
 #include <fs.h>
 #include <stdint.h>
+#include <map>
 #include <set>
 #include <string>
 #include <utility>
@@ -14,13 +15,35 @@ typedef std::pair<int, int64_t> feeCacheItem;
 typedef std::pair<std::string, int64_t> feeHistoryItem;
 
 /** LevelDB based storage for the MetaDEx fee cache.
+ *
+ * The fee cache and the distribution thresholds are kept in memory. Modified
+ * entries are written to the database with Flush(), which is called once per
+ * block.
  */
 class COmniFeeCache : public CDBBase
 {
+private:
+    //! Fee cache history items of properties with cached fees
+    std::map<uint32_t, std::set<feeCacheItem> > cacheHistory;
+    //! Properties with entries, which were not yet written to the database
+    std::set<uint32_t> dirtyProperties;
+    //! Distribution thresholds of properties
+    std::map<uint32_t, int64_t> distributionThresholds;
+
+    /** Loads the fee cache history items from the database */
+    void Load();
+    /** Replaces the fee cache history items of a property */
+    void SetCacheHistory(const uint32_t &propertyId, const std::set<feeCacheItem>& sCacheHistoryItems);
+
 public:
     COmniFeeCache(const fs::path& path, bool fWipe);
     virtual ~COmniFeeCache();
 
+    /** Deletes all entries of the fee cache */
+    void Clear();
+    /** Writes modified entries to the database in one batch */
+    void Flush();
+
     /** Show Fee Cache DB statistics */
     void printStats();
     /** Show Fee Cache DB records */
@@ -0,0 +1,89 @@
+#include <omnicore/dbmarkerindex.h>
+
+#include <omnicore/log.h>
+
+#include <clientversion.h>
+#include <fs.h>
+#include <serialize.h>
+#include <streams.h>
+#include <uint256.h>
+
+#include <leveldb/db.h>
+#include <leveldb/status.h>
+
+#include <assert.h>
+
+#include <string>
+#include <utility>
+
+//! Version of the marker check, the index is rebuilt when it changes
+static const char MARKER_INDEX_VERSION = 1;
+
+COmniMarkerIndex::COmniMarkerIndex(const fs::path& path, bool fWipe)
+{
+    EnableBloomFilter();
+    leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
+    PrintToConsole("Loading marker index database: %s\n", status.ToString());
+
+    CheckVersion();
+}
+
+COmniMarkerIndex::~COmniMarkerIndex()
+{
+    if (msc_debug_persistence) PrintToLog("COmniMarkerIndex closed\n");
+}
+
+/**
+ * Wipes the index, if it was built with a different marker check.
+ */
+void COmniMarkerIndex::CheckVersion()
+{
+    assert(pdb);
+
+    std::string strValue;
+    leveldb::Status status = Read("version", &strValue);
+    if (status.ok() && strValue == std::string(1, MARKER_INDEX_VERSION)) {
+        return;
+    }
+
+    Clear();
+    Put("version", std::string(1, MARKER_INDEX_VERSION));
+}
+
+/**
+ * Records whether a block contains transactions with an Omni marker.
+ */
+void COmniMarkerIndex::RecordBlock(const uint256& blockHash, bool fHasMarker)
+{
+    assert(pdb);
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << std::make_pair('b', blockHash);
+    leveldb::Slice slKey(&ssKey[0], ssKey.size());
+
+    leveldb::Status status = Put(slKey, fHasMarker ? "1" : "0");
+    if (!status.ok()) {
+        PrintToLog("%s(): ERROR for block %s: %s\n", __func__, blockHash.GetHex(), status.ToString());
+    }
+    ++nWritten;
+}
+
+/**
+ * Returns true, if the block is known not to contain transactions with an Omni marker.
+ *
+ * Blocks, which were not recorded yet, are not known to be without marker.
+ */
+bool COmniMarkerIndex::IsBlockWithoutMarker(const uint256& blockHash) const
+{
+    assert(pdb);
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << std::make_pair('b', blockHash);
+    leveldb::Slice slKey(&ssKey[0], ssKey.size());
+
+    std::string strValue;
+    leveldb::Status status = Read(slKey, &strValue);
+
+    return status.ok() && strValue == "0";
+}
@@ -0,0 +1,38 @@
+#ifndef BITCOIN_OMNICORE_DBMARKERINDEX_H
+#define BITCOIN_OMNICORE_DBMARKERINDEX_H
+
+#include <omnicore/dbbase.h>
+
+#include <fs.h>
+#include <uint256.h>
+
+/** LevelDB based storage for whether blocks contain transactions with an Omni marker.
+ *
+ * Entries are keyed by block hash, so they remain valid when blocks are disconnected
+ * and connected again. The index is derived from the blockchain only, and is kept when
+ * the Omni state is cleared, so a reparse can skip blocks without Omni transactions.
+ */
+class COmniMarkerIndex : public CDBBase
+{
+public:
+    COmniMarkerIndex(const fs::path& path, bool fWipe);
+    virtual ~COmniMarkerIndex();
+
+    /** Records whether a block contains transactions with an Omni marker. */
+    void RecordBlock(const uint256& blockHash, bool fHasMarker);
+
+    /** Returns true, if the block is known not to contain transactions with an Omni marker. */
+    bool IsBlockWithoutMarker(const uint256& blockHash) const;
+
+private:
+    /** Wipes the index, if it was built with a different marker check. */
+    void CheckVersion();
+};
+
+namespace mastercore
+{
+    //! LevelDB based storage for whether blocks contain transactions with an Omni marker
+    extern COmniMarkerIndex* pDbMarkerIndex;
+}
+
+#endif // BITCOIN_OMNICORE_DBMARKERINDEX_H
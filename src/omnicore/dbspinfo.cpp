@@ -1,5 +1,6 @@
 #include <omnicore/dbspinfo.h>
 
+#include <omnicore/consensushash.h>
 #include <omnicore/dbbase.h>
 #include <omnicore/log.h>
 
@@ -19,7 +20,9 @@
 
 #include <stdint.h>
 
+#include <list>
 #include <string>
+#include <utility>
 
 
 CMPSPInfo::Entry::Entry()
@@ -137,9 +140,15 @@ std::string CMPSPInfo::Entry::getDelegate(int block) const
 }
 
 
-CMPSPInfo::CMPSPInfo(const fs::path& path, bool fWipe)
+//! Maximum number of decoded entries in the cache
+static const size_t MAX_CACHED_SP_ENTRIES = 1000;
+
+CMPSPInfo::CMPSPInfo(const fs::path& path, bool fWipe) : nCacheHits(0), nCacheMisses(0)
 {
+    EnableBloomFilter();
     leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
+    EnableJournal();
     PrintToConsole("Loading smart property database: %s\n", status.ToString());
 
     // special cases for constant SPs OMN and TOMN
@@ -173,10 +182,17 @@ CMPSPInfo::~CMPSPInfo()
 
 void CMPSPInfo::Clear()
 {
-    // wipe database via parent class
-    CDBBase::Clear();
-    // reset "next property identifiers"
-    init();
+    {
+        LOCK(cs_cache);
+        cacheEntries.clear();
+        cacheOrder.clear();
+
+        // wipe database via parent class
+        CDBBase::Clear();
+        // reset "next property identifiers"
+        init();
+    }
+    mastercore::ConsensusHashResetProperties();
 }
 
 void CMPSPInfo::init(uint32_t nextSPID, uint32_t nextTestSPID)
@@ -228,32 +244,40 @@ bool CMPSPInfo::updateSP(uint32_t propertyId, const Entry& info)
     ssSpPrevKey << propertyId;
     leveldb::Slice slSpPrevKey(&ssSpPrevKey[0], ssSpPrevKey.size());
 
-    leveldb::WriteBatch batch;
-    std::string strSpPrevValue;
+    leveldb::Status status;
+    {
+        LOCK(cs_cache);
+        leveldb::WriteBatch batch;
+        std::string strSpPrevValue;
 
-    // if a value exists move it to the old key
-    if (!pdb->Get(readoptions, slSpKey, &strSpPrevValue).IsNotFound()) {
-        batch.Put(slSpPrevKey, strSpPrevValue);
-    }
-    batch.Put(slSpKey, slSpValue);
+        // if a value exists move it to the old key
+        if (!Read(slSpKey, &strSpPrevValue).IsNotFound()) {
+            batch.Put(slSpPrevKey, strSpPrevValue);
+        }
+        batch.Put(slSpKey, slSpValue);
+
+        // Update delegate info if set
+        if (!info.historicalDelegates.empty()) {
+            std::string delegateKey = strprintf("DE-%d", propertyId);
+            CDataStream ssDelegateValue(SER_DISK, CLIENT_VERSION);
+            ssDelegateValue << info.delegate;
+            ssDelegateValue << info.historicalDelegates;
+            leveldb::Slice slDelegateValue(&ssDelegateValue[0], ssDelegateValue.size());
+            batch.Put(delegateKey, slDelegateValue);
+        }
 
-    // Update delegate info if set
-    if (!info.historicalDelegates.empty()) {
-        std::string delegateKey = strprintf("DE-%d", propertyId);
-        CDataStream ssDelegateValue(SER_DISK, CLIENT_VERSION);
-        ssDelegateValue << info.delegate;
-        ssDelegateValue << info.historicalDelegates;
-        leveldb::Slice slDelegateValue(&ssDelegateValue[0], ssDelegateValue.size());
-        batch.Put(delegateKey, slDelegateValue);
+        status = Write(batch);
+        uncacheSP(propertyId);
     }
 
-    leveldb::Status status = pdb->Write(syncoptions, &batch);
-
     if (!status.ok()) {
         PrintToLog("%s(): ERROR for SP %d: %s\n", __func__, propertyId, status.ToString());
         return false;
     }
 
+    // not under cs_cache, as the consensus hash locks cs_tally
+    mastercore::ConsensusHashUpdateProperty(propertyId, info.issuer);
+
     PrintToLog("%s(): updated entry for SP %d successfully\n", __func__, propertyId);
     return true;
 }
@@ -297,10 +321,10 @@ uint32_t CMPSPInfo::putSP(uint8_t ecosystem, const Entry& info)
 
     // sanity checking
     std::string existingEntry;
-    if (!pdb->Get(readoptions, slSpKey, &existingEntry).IsNotFound() && slSpValue.compare(existingEntry) != 0) {
+    if (!Read(slSpKey, &existingEntry).IsNotFound() && slSpValue.compare(existingEntry) != 0) {
         std::string strError = strprintf("writing SP %d to DB, when a different SP already exists for that identifier", propertyId);
         PrintToLog("%s() ERROR: %s\n", __func__, strError);
-    } else if (!pdb->Get(readoptions, slTxIndexKey, &existingEntry).IsNotFound() && slTxValue.compare(existingEntry) != 0) {
+    } else if (!Read(slTxIndexKey, &existingEntry).IsNotFound() && slTxValue.compare(existingEntry) != 0) {
         std::string strError = strprintf("writing index txid %s : SP %d is overwriting a different value", info.txid.ToString(), propertyId);
         PrintToLog("%s() ERROR: %s\n", __func__, strError);
     }
@@ -309,7 +333,7 @@ uint32_t CMPSPInfo::putSP(uint8_t ecosystem, const Entry& info)
     std::string uniqueKey = strprintf("UE-%d", propertyId);
     if (info.unique) {
         // sanity checking
-        if (!pdb->Get(readoptions, uniqueKey, &existingEntry).IsNotFound() && existingEntry != strprintf("%d", info.unique)) {
+        if (!Read(uniqueKey, &existingEntry).IsNotFound() && existingEntry != strprintf("%d", info.unique)) {
             std::string strError = strprintf("writing SP %d unique field to DB, when a different SP already exists for that identifier", propertyId);
             PrintToLog("%s() ERROR: %s\n", __func__, strError);
         }
@@ -324,10 +348,17 @@ uint32_t CMPSPInfo::putSP(uint8_t ecosystem, const Entry& info)
         batch.Put(uniqueKey, strprintf("%d", info.unique));
     }
 
-    leveldb::Status status = pdb->Write(syncoptions, &batch);
+    leveldb::Status status;
+    {
+        LOCK(cs_cache);
+        status = Write(batch);
+        uncacheSP(propertyId);
+    }
 
     if (!status.ok()) {
         PrintToLog("%s(): ERROR for SP %d: %s\n", __func__, propertyId, status.ToString());
+    } else if (propertyId) {
+        mastercore::ConsensusHashUpdateProperty(propertyId, info.issuer);
     }
 
     return propertyId;
@@ -344,6 +375,34 @@ bool CMPSPInfo::getSP(uint32_t propertyId, Entry& info) const
         return true;
     }
 
+    LOCK(cs_cache);
+
+    auto it = cacheEntries.find(propertyId);
+    if (it != cacheEntries.end()) {
+        // move the entry to the front of the usage order
+        cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second.second);
+        info = it->second.first;
+        ++nCacheHits;
+        return true;
+    }
+    ++nCacheMisses;
+
+    if (!readSP(propertyId, info)) {
+        return false;
+    }
+
+    cacheOrder.push_front(propertyId);
+    cacheEntries.emplace(propertyId, std::make_pair(info, cacheOrder.begin()));
+    if (cacheEntries.size() > MAX_CACHED_SP_ENTRIES) {
+        cacheEntries.erase(cacheOrder.back());
+        cacheOrder.pop_back();
+    }
+
+    return true;
+}
+
+bool CMPSPInfo::readSP(uint32_t propertyId, Entry& info) const
+{
     // DB key for property entry
     CDataStream ssSpKey(SER_DISK, CLIENT_VERSION);
     ssSpKey << std::make_pair('s', propertyId);
@@ -351,7 +410,7 @@ bool CMPSPInfo::getSP(uint32_t propertyId, Entry& info) const
 
     // DB value for property entry
     std::string strSpValue;
-    leveldb::Status status = pdb->Get(readoptions, slSpKey, &strSpValue);
+    leveldb::Status status = Read(slSpKey, &strSpValue);
     if (!status.ok()) {
         if (!status.IsNotFound()) {
             PrintToLog("%s(): ERROR for SP %d: %s\n", __func__, propertyId, status.ToString());
@@ -370,7 +429,7 @@ bool CMPSPInfo::getSP(uint32_t propertyId, Entry& info) const
     // Check for unique entry
     std::string uniqueKey = strprintf("UE-%d", propertyId);
     std::string uniqueValue;
-    leveldb::Status statusUnique = pdb->Get(readoptions, uniqueKey, &uniqueValue);
+    leveldb::Status statusUnique = Read(uniqueKey, &uniqueValue);
     if (statusUnique.ok() && !statusUnique.IsNotFound()) {
         try {
             info.unique = boost::lexical_cast<bool>(uniqueValue);
@@ -383,7 +442,7 @@ bool CMPSPInfo::getSP(uint32_t propertyId, Entry& info) const
     // Check for delegate entry
     std::string delegateKey = strprintf("DE-%d", propertyId);
     std::string delegateValue;
-    leveldb::Status statusDelegate = pdb->Get(readoptions, delegateKey, &delegateValue);
+    leveldb::Status statusDelegate = Read(delegateKey, &delegateValue);
     if (statusDelegate.ok() && !statusDelegate.IsNotFound()) {
         try {
             CDataStream ssDelegateValue(delegateValue.data(), delegateValue.data() + delegateValue.size(), SER_DISK, CLIENT_VERSION);
@@ -398,6 +457,17 @@ bool CMPSPInfo::getSP(uint32_t propertyId, Entry& info) const
     return true;
 }
 
+void CMPSPInfo::uncacheSP(uint32_t propertyId)
+{
+    AssertLockHeld(cs_cache);
+
+    auto it = cacheEntries.find(propertyId);
+    if (it != cacheEntries.end()) {
+        cacheOrder.erase(it->second.second);
+        cacheEntries.erase(it);
+    }
+}
+
 bool CMPSPInfo::hasSP(uint32_t propertyId) const
 {
     // Special cases for constant SPs MSC and TMSC
@@ -412,7 +482,7 @@ bool CMPSPInfo::hasSP(uint32_t propertyId) const
 
     // DB value for property entry
     std::string strSpValue;
-    leveldb::Status status = pdb->Get(readoptions, slSpKey, &strSpValue);
+    leveldb::Status status = Read(slSpKey, &strSpValue);
 
     return status.ok();
 }
@@ -428,7 +498,7 @@ uint32_t CMPSPInfo::findSPByTX(const uint256& txid) const
 
     // DB value for identifier
     std::string strTxIndexValue;
-    if (!pdb->Get(readoptions, slTxIndexKey, &strTxIndexValue).ok()) {
+    if (!Read(slTxIndexKey, &strTxIndexValue).ok()) {
         std::string strError = strprintf("failed to find property created with %s", txid.GetHex());
         PrintToLog("%s(): ERROR: %s", __func__, strError);
         return 0;
@@ -514,7 +584,15 @@ int64_t CMPSPInfo::popBlock(const uint256& block_hash)
     // clean up the iterator
     delete iter;
 
-    leveldb::Status status = pdb->Write(syncoptions, &commitBatch);
+    // entries of any property may be rolled back
+    leveldb::Status status;
+    {
+        LOCK(cs_cache);
+        status = pdb->Write(syncoptions, &commitBatch);
+        cacheEntries.clear();
+        cacheOrder.clear();
+    }
+    mastercore::ConsensusHashResetProperties();
 
     if (!status.ok()) {
         PrintToLog("%s(): ERROR: %s\n", __func__, status.ToString());
@@ -621,3 +699,21 @@ void CMPSPInfo::printAll() const
     // clean up the iterator
     delete iter;
 }
+
+void CMPSPInfo::printStats() const
+{
+    LOCK(cs_cache);
+    PrintToConsole("CMPSPInfo stats: cached= %d , hits= %d , misses= %d\n", cacheEntries.size(), nCacheHits, nCacheMisses);
+}
+
+uint64_t CMPSPInfo::getCacheHits() const
+{
+    LOCK(cs_cache);
+    return nCacheHits;
+}
+
+uint64_t CMPSPInfo::getCacheMisses() const
+{
+    LOCK(cs_cache);
+    return nCacheMisses;
+}
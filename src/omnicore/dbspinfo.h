@@ -7,12 +7,16 @@
 
 #include <fs.h>
 #include <serialize.h>
+#include <sync.h>
 #include <uint256.h>
 
 #include <stdint.h>
 
+#include <list>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 /** LevelDB based storage for currencies, smart properties and tokens.
  *
@@ -41,6 +45,9 @@
  *      uint32_t propertyId
  *  Value:
  *      CMPSPInfo::Entry info
+ *
+ * Decoded entries are kept in a bounded cache of recently used properties,
+ * which is updated, whenever entries are written or rolled back.
  */
 class CMPSPInfo : public CDBBase
 {
@@ -153,6 +160,22 @@ private:
     uint32_t next_spid;
     uint32_t next_test_spid;
 
+    //! Guards the cache of decoded entries
+    mutable Mutex cs_cache;
+    //! Property identifiers of cached entries, the most recently used first
+    mutable std::list<uint32_t> cacheOrder;
+    //! Cached entries and their position in the usage order
+    mutable std::unordered_map<uint32_t, std::pair<Entry, std::list<uint32_t>::iterator> > cacheEntries;
+    //! Number of entries served from the cache
+    mutable uint64_t nCacheHits;
+    //! Number of entries, which were not cached
+    mutable uint64_t nCacheMisses;
+
+    /** Loads an entry from the database, bypassing the cache. */
+    bool readSP(uint32_t propertyId, Entry& info) const;
+    /** Removes an entry from the cache. */
+    void uncacheSP(uint32_t propertyId);
+
 public:
     CMPSPInfo(const fs::path& path, bool fWipe);
     virtual ~CMPSPInfo();
@@ -175,6 +198,12 @@ public:
     bool getWatermark(uint256& watermark) const;
 
     void printAll() const;
+    void printStats() const;
+
+    /** Returns the number of entries served from the cache. */
+    uint64_t getCacheHits() const;
+    /** Returns the number of entries, which were not cached. */
+    uint64_t getCacheMisses() const;
 };
 
 
@@ -15,6 +15,7 @@
 #include <leveldb/iterator.h>
 #include <leveldb/slice.h>
 #include <leveldb/status.h>
+#include <leveldb/write_batch.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -22,15 +23,64 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 using mastercore::IsMyAddress;
 using mastercore::isPropertyDivisible;
 
+//! Prefix of the entries keyed by transaction and address
+static const char KEY_TXID = 't';
+//! Prefix of the entries keyed by address, block and transaction
+static const char KEY_ADDRESS = 'a';
+
+/** Returns the common prefix of the entries of all recipients of a transaction. */
+static std::string TxidKeyPrefix(const uint256& txid)
+{
+    return strprintf("%c%s:", KEY_TXID, txid.ToString());
+}
+
+/** Returns the key of a receipt, which is ordered by transaction and address. */
+static std::string TxidKey(const uint256& txid, const std::string& address)
+{
+    return TxidKeyPrefix(txid) + address;
+}
+
+/** Returns the common prefix of the entries of all receipts of an address. */
+static std::string AddressKeyPrefix(const std::string& address)
+{
+    return strprintf("%c%s:", KEY_ADDRESS, address);
+}
+
+/** Returns the key of a receipt, which is ordered by address, block and transaction. */
+static std::string AddressKey(const std::string& address, int block, const uint256& txid)
+{
+    return AddressKeyPrefix(address) + strprintf("%010d:%s", block, txid.ToString());
+}
+
+/** Parses the key of a receipt, which is ordered by address, block and transaction. */
+static bool ParseAddressKey(const leveldb::Slice& key, std::string& address, int& block, uint256& txid)
+{
+    // prefix, address, ':', block with 10 digits, ':', txid with 64 digits
+    const size_t nSuffix = 1 + 10 + 1 + 64;
+    if (key.size() < 1 + nSuffix || key[0] != KEY_ADDRESS) return false;
+
+    const std::string strKey = key.ToString();
+    const size_t nAddressEnd = strKey.size() - nSuffix;
+    if (strKey[nAddressEnd] != ':' || strKey[nAddressEnd + 11] != ':') return false;
+
+    address = strKey.substr(1, nAddressEnd - 1);
+    block = atoi(strKey.substr(nAddressEnd + 1, 10));
+    txid.SetHex(strKey.substr(nAddressEnd + 12));
+    return true;
+}
+
 CMPSTOList::CMPSTOList(const fs::path& path, bool fWipe)
 {
     leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
     PrintToConsole("Loading send-to-owners database: %s\n", status.ToString());
 }
 
@@ -53,62 +103,49 @@ void CMPSTOList::getRecipients(const uint256 txid, std::string filterAddress, Un
         filterByAddress = true;
     }
 
-    // iterate through SDB, dropping all records where key is not filterAddress (if filtering)
-    int count = 0;
-
     // the fee is variable based on version of STO - provide number of recipients and allow calling function to work out fee
     *numRecipients = 0;
 
-    leveldb::Slice skey, svalue;
+    // all recipients of the STO are stored under the transaction, ordered by address
+    const std::string prefix = TxidKeyPrefix(txid);
+
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        skey = it->key();
-        std::string recipientAddress = skey.ToString();
-        svalue = it->value();
-        std::string strValue = svalue.ToString();
-        // see if txid is in the data
-        size_t txidMatch = strValue.find(txid.ToString());
-        if (txidMatch != std::string::npos) {
-            ++*numRecipients;
-            // the txid exists inside the data, this address was a recipient of this STO, check filter and add the details
-            if (filter) {
-                if (((filterByAddress) && (filterAddress == recipientAddress)) || ((filterByWallet) && (IsMyAddress(recipientAddress, iWallet)))) {
-                } else {
-                    continue;
-                } // move on if no filter match (but counter still increased for fee)
-            }
-            std::vector<std::string> vstr;
-            boost::split(vstr, strValue, boost::is_any_of(","), boost::token_compress_on);
-            for (uint32_t i = 0; i < vstr.size(); i++) {
-                std::vector<std::string> svstr;
-                boost::split(svstr, vstr[i], boost::is_any_of(":"), boost::token_compress_on);
-                if (4 == svstr.size()) {
-                    if (svstr[0] == txid.ToString()) {
-                        //add data to array
-                        uint64_t amount = 0;
-                        uint64_t propertyId = 0;
-                        try {
-                            amount = boost::lexical_cast<uint64_t>(svstr[3]);
-                            propertyId = boost::lexical_cast<uint64_t>(svstr[2]);
-                        } catch (const boost::bad_lexical_cast &e) {
-                            PrintToLog("DEBUG STO - error in converting values from leveldb\n");
-                            delete it;
-                            return; //(something went wrong)
-                        }
-                        UniValue recipient(UniValue::VOBJ);
-                        recipient.pushKV("address", recipientAddress);
-                        if (isPropertyDivisible(propertyId)) {
-                            recipient.pushKV("amount", FormatDivisibleMP(amount));
-                        } else {
-                            recipient.pushKV("amount", FormatIndivisibleMP(amount));
-                        }
-                        *total += amount;
-                        recipientArray->push_back(recipient);
-                        ++count;
-                    }
-                }
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        ++*numRecipients;
+        const std::string recipientAddress = it->key().ToString().substr(prefix.size());
+
+        // check filter (but counter still increased for fee)
+        if (filter) {
+            if (((filterByAddress) && (filterAddress == recipientAddress)) || ((filterByWallet) && (IsMyAddress(recipientAddress, iWallet)))) {
+            } else {
+                continue;
             }
         }
+
+        std::vector<std::string> vstr;
+        const std::string strValue = it->value().ToString();
+        boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
+        if (3 != vstr.size()) continue;
+
+        uint64_t amount = 0;
+        uint64_t propertyId = 0;
+        try {
+            amount = boost::lexical_cast<uint64_t>(vstr[2]);
+            propertyId = boost::lexical_cast<uint64_t>(vstr[1]);
+        } catch (const boost::bad_lexical_cast &e) {
+            PrintToLog("DEBUG STO - error in converting values from leveldb\n");
+            delete it;
+            return; //(something went wrong)
+        }
+        UniValue recipient(UniValue::VOBJ);
+        recipient.pushKV("address", recipientAddress);
+        if (isPropertyDivisible(propertyId)) {
+            recipient.pushKV("amount", FormatDivisibleMP(amount));
+        } else {
+            recipient.pushKV("amount", FormatIndivisibleMP(amount));
+        }
+        *total += amount;
+        recipientArray->push_back(recipient);
     }
 
     delete it;
@@ -119,28 +156,36 @@ std::string CMPSTOList::getMySTOReceipts(std::string filterAddress, interfaces::
 {
     if (!pdb) return "";
     std::string mySTOReceipts = "";
-    leveldb::Slice skey, svalue;
+    std::set<std::string> seenTxids;
+
+    // receipts are ordered by address, block and transaction
+    const std::string prefix = filterAddress.empty() ? std::string(1, KEY_ADDRESS) : AddressKeyPrefix(filterAddress);
+
+    std::string lastAddress;
+    bool fMine = false;
+
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        skey = it->key();
-        std::string recipientAddress = skey.ToString();
-        if (!IsMyAddress(recipientAddress, &iWallet)) continue; // not ours, not interested
-        if ((!filterAddress.empty()) && (filterAddress != recipientAddress)) continue; // not the filtered address
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        std::string recipientAddress;
+        int block;
+        uint256 txid;
+        if (!ParseAddressKey(it->key(), recipientAddress, block, txid)) continue;
+
+        if (recipientAddress != lastAddress) {
+            lastAddress = recipientAddress;
+            fMine = IsMyAddress(recipientAddress, &iWallet);
+        }
+        if (!fMine) continue; // not ours, not interested
+
         // ours, get info
-        svalue = it->value();
-        std::string strValue = svalue.ToString();
-        // break into individual receipts
         std::vector<std::string> vstr;
-        boost::split(vstr, strValue, boost::is_any_of(","), boost::token_compress_on);
-        for (uint32_t i = 0; i < vstr.size(); i++) {
-            // add to array
-            std::vector<std::string> svstr;
-            boost::split(svstr, vstr[i], boost::is_any_of(":"), boost::token_compress_on);
-            if (4 == svstr.size()) {
-                size_t txidMatch = mySTOReceipts.find(svstr[0]);
-                if (txidMatch == std::string::npos) mySTOReceipts += svstr[0] + ":" + svstr[1] + ":" + recipientAddress + ":" + svstr[2] + ",";
-            }
-        }
+        const std::string strValue = it->value().ToString();
+        boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
+        if (2 != vstr.size()) continue;
+
+        const std::string strTxid = txid.ToString();
+        if (!seenTxids.insert(strTxid).second) continue;
+        mySTOReceipts += strprintf("%s:%d:%s:%s,", strTxid, block, recipientAddress, vstr[0]);
     }
     delete it;
     // above code will leave a trailing comma - strip it
@@ -148,6 +193,31 @@ std::string CMPSTOList::getMySTOReceipts(std::string filterAddress, interfaces::
     return mySTOReceipts;
 }
 
+/**
+ * Checks, whether an address of the wallet is a recipient of a send to owners transaction.
+ *
+ * Only the recipients of the transaction are visited.
+ */
+bool CMPSTOList::hasMySTOReceipt(const uint256& txid, interfaces::Wallet& iWallet)
+{
+    if (!pdb) return false;
+
+    const std::string prefix = TxidKeyPrefix(txid);
+    bool fMine = false;
+
+    leveldb::Iterator* it = NewIterator();
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        const std::string recipientAddress = it->key().ToString().substr(prefix.size());
+        if (IsMyAddress(recipientAddress, &iWallet)) {
+            fMine = true;
+            break;
+        }
+    }
+    delete it;
+
+    return fMine;
+}
+
 /**
  * This function deletes records of STO receivers above/equal to a specific block from the STO database.
  *
@@ -155,35 +225,34 @@ std::string CMPSTOList::getMySTOReceipts(std::string filterAddress, interfaces::
  */
 int CMPSTOList::deleteAboveBlock(int blockNum)
 {
+    if (!pdb) return 0;
+
     unsigned int n_found = 0;
-    std::vector<std::string> vecSTORecords;
+    leveldb::WriteBatch batch;
+
+    const std::string prefix(1, KEY_ADDRESS);
+
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        std::string newValue;
-        std::string oldValue = it->value().ToString();
-        bool needsUpdate = false;
-        boost::split(vecSTORecords, oldValue, boost::is_any_of(","), boost::token_compress_on);
-        for (uint32_t i = 0; i < vecSTORecords.size(); i++) {
-            std::vector<std::string> vecSTORecordFields;
-            boost::split(vecSTORecordFields, vecSTORecords[i], boost::is_any_of(":"), boost::token_compress_on);
-            if (4 != vecSTORecordFields.size()) continue;
-            if (atoi(vecSTORecordFields[1]) < blockNum) {
-                newValue += vecSTORecords[i].append(","); // STO before the reorg, add data back to new value string
-            } else {
-                needsUpdate = true;
-            }
-        }
-        if (needsUpdate) { // rewrite record with existing key and new value
-            ++n_found;
-            leveldb::Status status = pdb->Put(writeoptions, it->key().ToString(), newValue);
-            PrintToLog("DEBUG STO - rewriting STO data after reorg\n");
-            PrintToLog("STODBDEBUG : %s(): %s, line %d, file: %s\n", __FUNCTION__, status.ToString(), __LINE__, __FILE__);
-        }
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        std::string address;
+        int block;
+        uint256 txid;
+        if (!ParseAddressKey(it->key(), address, block, txid)) continue;
+        if (block < blockNum) continue;
+
+        // remove both entries of the receipt
+        batch.Delete(it->key());
+        batch.Delete(TxidKey(txid, address));
+        ++n_found;
     }
+    delete it;
 
-    PrintToLog("%s(%d); stodb updated records= %d\n", __FUNCTION__, blockNum, n_found);
+    leveldb::Status status = Write(batch);
+    if (!status.ok()) {
+        PrintToLog("%s(): ERROR: %s\n", __func__, status.ToString());
+    }
 
-    delete it;
+    PrintToLog("%s(%d); stodb updated records= %d\n", __FUNCTION__, blockNum, n_found);
 
     return (n_found);
 }
@@ -213,49 +282,38 @@ bool CMPSTOList::exists(std::string address)
 {
     if (!pdb) return false;
 
-    std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, address, &strValue);
+    const std::string prefix = AddressKeyPrefix(address);
 
-    if (!status.ok()) {
-        if (status.IsNotFound()) return false;
-    }
+    leveldb::Iterator* it = NewIterator();
+    it->Seek(prefix);
+    bool fFound = it->Valid() && it->key().starts_with(prefix);
+    delete it;
 
-    return true;
+    return fFound;
 }
 
-void CMPSTOList::recordSTOReceive(std::string address, const uint256 &txid, int nBlock, unsigned int propertyId, uint64_t amount)
+/**
+ * Records the recipients of a send to owners transaction.
+ *
+ * All receipts are written in one batch, each with an entry keyed by transaction
+ * and address, and one keyed by address, block and transaction.
+ */
+void CMPSTOList::recordSTOReceives(const uint256& txid, int nBlock, uint32_t propertyId, const std::vector<std::pair<std::string, uint64_t> >& receipts)
 {
     if (!pdb) return;
 
-    bool addressExists = exists(address);
-    if (addressExists) {
-        // retrieve existing record
-        std::vector<std::string> vstr;
-        std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, address, &strValue);
-        if (status.ok()) {
-            // add details to record
-            // see if we are overwriting (check)
-            size_t txidMatch = strValue.find(txid.ToString());
-            if (txidMatch != std::string::npos) PrintToLog("STODEBUG : Duplicating entry for %s : %s\n", address, txid.ToString());
-
-            const std::string key = address;
-            const std::string newValue = strprintf("%s:%d:%u:%lu,", txid.ToString(), nBlock, propertyId, amount);
-            strValue += newValue;
-            // write updated record
-            leveldb::Status status;
-            if (pdb) {
-                status = pdb->Put(writeoptions, key, strValue);
-                PrintToLog("STODBDEBUG : %s(): %s, line %d, file: %s\n", __FUNCTION__, status.ToString(), __LINE__, __FILE__);
-            }
-        }
-    } else {
-        const std::string key = address;
-        const std::string value = strprintf("%s:%d:%u:%lu,", txid.ToString(), nBlock, propertyId, amount);
-        leveldb::Status status;
-        if (pdb) {
-            status = pdb->Put(writeoptions, key, value);
-            PrintToLog("STODBDEBUG : %s(): %s, line %d, file: %s\n", __FUNCTION__, status.ToString(), __LINE__, __FILE__);
-        }
+    leveldb::WriteBatch batch;
+    for (std::vector<std::pair<std::string, uint64_t> >::const_iterator it = receipts.begin(); it != receipts.end(); ++it) {
+        const std::string& address = it->first;
+        const uint64_t amount = it->second;
+
+        batch.Put(TxidKey(txid, address), strprintf("%d:%u:%lu", nBlock, propertyId, amount));
+        batch.Put(AddressKey(address, nBlock, txid), strprintf("%u:%lu", propertyId, amount));
+    }
+
+    leveldb::Status status = Write(batch);
+    nWritten += receipts.size();
+    if (msc_debug_persistence || !status.ok()) {
+        PrintToLog("STODBDEBUG : %s(): %s, %d receipts of %s\n", __func__, status.ToString(), receipts.size(), txid.ToString());
     }
 }
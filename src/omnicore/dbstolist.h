@@ -11,12 +11,18 @@
 #include <stdint.h>
 
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace interfaces {
 class Wallet;
 } // namespace interfaces
 
 /** LevelDB based storage for STO recipients.
+ *
+ * Each receipt is stored twice: keyed by transaction and address, to list the
+ * recipients of a transaction, and keyed by address, block and transaction, to
+ * list the receipts of an address. Both are answered by prefix scans.
  */
 class CMPSTOList : public CDBBase
 {
@@ -26,6 +32,8 @@ public:
 
     void getRecipients(const uint256 txid, std::string filterAddress, UniValue* recipientArray, uint64_t* total, uint64_t* numRecipients, interfaces::Wallet* iWallet = nullptr);
     std::string getMySTOReceipts(std::string filterAddress, interfaces::Wallet& iWallet);
+    /** Checks, whether an address of the wallet is a recipient of a send to owners transaction. */
+    bool hasMySTOReceipt(const uint256& txid, interfaces::Wallet& iWallet);
     
     /**
      * This function deletes records of STO receivers above/equal to a specific block from the STO database.
@@ -36,7 +44,8 @@ public:
     void printStats();
     void printAll();
     bool exists(std::string address);
-    void recordSTOReceive(std::string, const uint256&, int, unsigned int, uint64_t);
+    /** Records the recipients of a send to owners transaction in one batch. */
+    void recordSTOReceives(const uint256& txid, int nBlock, uint32_t propertyId, const std::vector<std::pair<std::string, uint64_t> >& receipts);
 };
 
 namespace mastercore
@@ -15,6 +15,7 @@
 #include <leveldb/iterator.h>
 #include <leveldb/slice.h>
 #include <leveldb/status.h>
+#include <leveldb/write_batch.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -22,6 +23,7 @@
 #include <stddef.h>
 
 #include <algorithm>
+#include <limits>
 #include <map>
 #include <string>
 #include <utility>
@@ -29,9 +31,60 @@
 
 using mastercore::isPropertyDivisible;
 
+/**
+ * Returns the key prefix of the address index entries of an address.
+ */
+static std::string AddressIndexPrefix(const std::string& address)
+{
+    return strprintf("A:%s:", address);
+}
+
+/**
+ * Returns the key of the address index entry for a new trade.
+ *
+ * Entries of the index have the form "A:<address>:<block>:<index>" with the
+ * block and position zero padded, such that the trades of an address are
+ * ordered by block and position in block.
+ */
+static std::string AddressIndexKey(const std::string& address, int blockNum, int blockIndex)
+{
+    return strprintf("%s%010d:%010d", AddressIndexPrefix(address), blockNum, blockIndex);
+}
+
+/**
+ * Returns the key prefix of the pair index entries of a property pair.
+ *
+ * Both orientations of a pair share the same prefix.
+ */
+static std::string PairIndexPrefix(uint32_t propertyIdA, uint32_t propertyIdB)
+{
+    return strprintf("P:%010u:%010u:", std::min(propertyIdA, propertyIdB), std::max(propertyIdA, propertyIdB));
+}
+
+/**
+ * Returns the key of the pair index entry for a matched trade.
+ *
+ * Entries of the index have the form "P:<property>:<property>:<inverted block>:<txid1+txid2>",
+ * with the lower property identifier first, such that the most recent trades
+ * of a pair come first.
+ */
+static std::string PairIndexKey(uint32_t prop1, uint32_t prop2, int blockNum, const std::string& tradeKey)
+{
+    return strprintf("%s%010d:%s", PairIndexPrefix(prop1, prop2), std::numeric_limits<int32_t>::max() - blockNum, tradeKey);
+}
+
+/**
+ * Whether the key belongs to an index entry, rather than a trade.
+ */
+static bool IsIndexKey(const leveldb::Slice& key)
+{
+    return key.starts_with("A:") || key.starts_with("P:");
+}
+
 CMPTradeList::CMPTradeList(const fs::path& path, bool fWipe)
 {
     leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
     PrintToConsole("Loading trades database: %s\n", status.ToString());
 }
 
@@ -45,7 +98,12 @@ void CMPTradeList::recordMatchedTrade(const uint256& txid1, const uint256& txid2
     if (!pdb) return;
     const std::string key = txid1.ToString() + "+" + txid2.ToString();
     const std::string value = strprintf("%s:%s:%u:%u:%lu:%lu:%d:%d", address1, address2, prop1, prop2, amount1, amount2, blockNum, fee);
-    leveldb::Status status = pdb->Put(writeoptions, key, value);
+
+    // atomically write the trade and the pair index entry, which holds a copy of the trade
+    leveldb::WriteBatch batch;
+    batch.Put(key, value);
+    batch.Put(PairIndexKey(prop1, prop2, blockNum, key), value);
+    leveldb::Status status = Write(batch);
     ++nWritten;
     if (msc_debug_tradedb) PrintToLog("%s: %s\n", __func__, status.ToString());
 }
@@ -54,7 +112,13 @@ void CMPTradeList::recordNewTrade(const uint256& txid, const std::string& addres
 {
     if (!pdb) return;
     std::string strValue = strprintf("%s:%d:%d:%d:%d", address, propertyIdForSale, propertyIdDesired, blockNum, blockIndex);
-    leveldb::Status status = pdb->Put(writeoptions, txid.ToString(), strValue);
+    std::string strIndexValue = strprintf("%s:%d:%d", txid.ToString(), propertyIdForSale, propertyIdDesired);
+
+    // atomically write the trade and the address index entry
+    leveldb::WriteBatch batch;
+    batch.Put(txid.ToString(), strValue);
+    batch.Put(AddressIndexKey(address, blockNum, blockIndex), strIndexValue);
+    leveldb::Status status = Write(batch);
     ++nWritten;
     if (msc_debug_tradedb) PrintToLog("%s: %s\n", __func__, status.ToString());
 }
@@ -71,24 +135,31 @@ int CMPTradeList::deleteAboveBlock(int blockNum)
     std::vector<std::string> vstr;
     int block = 0;
     unsigned int n_found = 0;
+    leveldb::WriteBatch batch;
     leveldb::Iterator* it = NewIterator();
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
         skey = it->key();
         svalue = it->value();
+        if (IsIndexKey(skey)) continue; // index entries are removed together with their trade
         ++count;
         std::string strvalue = it->value().ToString();
         boost::split(vstr, strvalue, boost::is_any_of(":"), boost::token_compress_on);
-        if (7 == vstr.size()) block = atoi(vstr[6]); // trade matches have 7 tokens, key is txid+txid, only care about block
+        if (8 == vstr.size()) block = atoi(vstr[6]); // trade matches have 8 tokens, key is txid+txid, only care about block
         if (5 == vstr.size()) block = atoi(vstr[3]); // trades have 5 tokens, key is txid, only care about block
         if (block >= blockNum) {
             ++n_found;
             PrintToLog("%s() DELETING FROM TRADEDB: %s=%s\n", __func__, skey.ToString(), svalue.ToString());
-            pdb->Delete(writeoptions, skey);
+            batch.Delete(skey);
+            if (5 == vstr.size()) batch.Delete(AddressIndexKey(vstr[0], block, atoi(vstr[4])));
+            if (8 == vstr.size()) batch.Delete(PairIndexKey(boost::lexical_cast<uint32_t>(vstr[2]), boost::lexical_cast<uint32_t>(vstr[3]), block, skey.ToString()));
         }
     }
     
     delete it;
 
+    leveldb::Status status = Write(batch);
+    if (!status.ok()) PrintToLog("%s(): ERROR: %s\n", __func__, status.ToString());
+
     PrintToLog("%s(%d); tradedb n_found= %d\n", __func__, blockNum, n_found);
 
     return n_found;
@@ -201,63 +272,54 @@ bool CMPTradeList::getMatchingTrades(const uint256& txid, uint32_t propertyId, U
 
 // obtains a vector of txids where the supplied address participated in a trade (needed for gettradehistory_MP)
 // optional property ID parameter will filter on propertyId transacted if supplied
-// sorted by block then index
+// sorted by block then index, as given by the order of the address index
 void CMPTradeList::getTradesForAddress(const std::string& address, std::vector<uint256>& vecTransactions, uint32_t propertyIdFilter)
 {
     if (!pdb) return;
 
-    std::map<std::string, uint256> mapTrades;
+    const std::string strPrefix = AddressIndexPrefix(address);
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        std::string strKey = it->key().ToString();
+    for (it->Seek(strPrefix); it->Valid() && it->key().starts_with(strPrefix); it->Next()) {
         std::string strValue = it->value().ToString();
         std::vector<std::string> vecValues;
-        if (strKey.size() != 64) continue; // only interested in trades
-        uint256 txid = uint256S(strKey);
-        size_t addressMatch = strValue.find(address);
-        if (addressMatch == std::string::npos) continue;
         boost::split(vecValues, strValue, boost::is_any_of(":"), boost::token_compress_on);
-        if (vecValues.size() != 5) {
-            PrintToLog("TRADEDB error - unexpected number of tokens in value (%s)\n", strValue);
+        if (vecValues.size() != 3) {
+            PrintToLog("TRADEDB error - unexpected number of tokens in index value (%s)\n", strValue);
             continue;
         }
-        uint32_t propertyIdForSale = boost::lexical_cast<uint32_t>(vecValues[1]);
-        uint32_t propertyIdDesired = boost::lexical_cast<uint32_t>(vecValues[2]);
-        int64_t blockNum = boost::lexical_cast<uint32_t>(vecValues[3]);
-        int64_t txIndex = boost::lexical_cast<uint32_t>(vecValues[4]);
-        if (propertyIdFilter != 0 && propertyIdFilter != propertyIdForSale && propertyIdFilter != propertyIdDesired) continue;
-        std::string sortKey = strprintf("%06d%010d", blockNum, txIndex);
-        mapTrades.insert(std::make_pair(sortKey, txid));
+        if (propertyIdFilter != 0) {
+            uint32_t propertyIdForSale = boost::lexical_cast<uint32_t>(vecValues[1]);
+            uint32_t propertyIdDesired = boost::lexical_cast<uint32_t>(vecValues[2]);
+            if (propertyIdFilter != propertyIdForSale && propertyIdFilter != propertyIdDesired) continue;
+        }
+        vecTransactions.push_back(uint256S(vecValues[0]));
     }
     delete it;
-
-    for (std::map<std::string, uint256>::iterator it = mapTrades.begin(); it != mapTrades.end(); it++) {
-        vecTransactions.push_back(it->second);
-    }
-}
-
-static bool CompareTradePair(const std::pair<int64_t, UniValue>& firstJSONObj, const std::pair<int64_t, UniValue>& secondJSONObj)
-{
-    return firstJSONObj.first > secondJSONObj.first;
 }
 
 // obtains an array of matching trades with pricing and volume details for a pair sorted by blocknumber
-void CMPTradeList::getTradesForPair(uint32_t propertyIdSideA, uint32_t propertyIdSideB, UniValue& responseArray, uint64_t count)
+// the most recent trades are read from the pair index, skipping the given number of most recent trades first
+void CMPTradeList::getTradesForPair(uint32_t propertyIdSideA, uint32_t propertyIdSideB, UniValue& responseArray, uint64_t count, uint64_t skip)
 {
     if (!pdb) return;
-    leveldb::Iterator* it = NewIterator();
-    std::vector<std::pair<int64_t, UniValue> > vecResponse;
+    std::vector<UniValue> vecResponse;
     bool propertyIdSideAIsDivisible = isPropertyDivisible(propertyIdSideA);
     bool propertyIdSideBIsDivisible = isPropertyDivisible(propertyIdSideB);
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        std::string strKey = it->key().ToString();
+    const std::string strPrefix = PairIndexPrefix(propertyIdSideA, propertyIdSideB);
+    uint64_t skipped = 0;
+    leveldb::Iterator* it = NewIterator();
+    for (it->Seek(strPrefix); it->Valid() && it->key().starts_with(strPrefix) && vecResponse.size() < count; it->Next()) {
+        if (skipped < skip) {
+            ++skipped;
+            continue;
+        }
+        std::string strKey = it->key().ToString().substr(strPrefix.size() + 11);
         std::string strValue = it->value().ToString();
         std::vector<std::string> vecKeys;
         std::vector<std::string> vecValues;
         uint256 sellerTxid, matchingTxid;
         std::string sellerAddress, matchingAddress;
         int64_t amountReceived = 0, amountSold = 0;
-        if (strKey.size() != 129) continue; // only interested in matches
         boost::split(vecKeys, strKey, boost::is_any_of("+"), boost::token_compress_on);
         boost::split(vecValues, strValue, boost::is_any_of(":"), boost::token_compress_on);
         if (vecKeys.size() != 2 || vecValues.size() != 8) {
@@ -311,26 +373,15 @@ void CMPTradeList::getTradesForPair(uint32_t propertyIdSideA, uint32_t propertyI
         }
         trade.pushKV("matchingtxid", matchingTxid.GetHex());
         trade.pushKV("matchingaddress", matchingAddress);
-        vecResponse.push_back(std::make_pair(blockNum, trade));
+        vecResponse.push_back(trade);
     }
 
-    // sort the response most recent first before adding to the array
-    std::sort(vecResponse.begin(), vecResponse.end(), CompareTradePair);
-    uint64_t processed = 0;
-    for (std::vector<std::pair<int64_t, UniValue> >::iterator it = vecResponse.begin(); it != vecResponse.end(); ++it) {
-        responseArray.push_back(it->second);
-        processed++;
-        if (processed >= count) break;
-    }
+    delete it;
 
-    std::vector<UniValue> responseArrayValues = responseArray.getValues();
-    std::reverse(responseArrayValues.begin(), responseArrayValues.end());
-    responseArray.clear();
-    for (std::vector<UniValue>::iterator it = responseArrayValues.begin(); it != responseArrayValues.end(); ++it) {
-        responseArray.push_back(*it);
+    // the index is ordered most recent first, but the response lists the oldest trade first
+    for (std::vector<UniValue>::reverse_iterator rit = vecResponse.rbegin(); rit != vecResponse.rend(); ++rit) {
+        responseArray.push_back(*rit);
     }
-
-    delete it;
 }
 
 int CMPTradeList::getMPTradeCountTotal()
@@ -338,6 +389,7 @@ int CMPTradeList::getMPTradeCountTotal()
     int count = 0;
     leveldb::Iterator* it = NewIterator();
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (IsIndexKey(it->key())) continue;
         ++count;
     }
     delete it;
@@ -14,6 +14,13 @@
 #include <vector>
 
 /** LevelDB based storage for the MetaDEx trade history. Trades are listed with key "txid1+txid2".
+ *
+ * New trades are additionally indexed by address with keys of the form
+ * "A:<address>:<block>:<index>" and "txid:propertyForSale:propertyDesired" as value.
+ *
+ * Matched trades are additionally indexed by property pair with keys of the form
+ * "P:<property>:<property>:<inverted block>:<txid1+txid2>" and a copy of the
+ * trade as value, so the most recent trades of a pair come first.
  */
 class CMPTradeList : public CDBBase
 {
@@ -29,7 +36,7 @@ public:
     void printAll();
     bool getMatchingTrades(const uint256& txid, uint32_t propertyId, UniValue& tradeArray, int64_t& totalSold, int64_t& totalBought);
     void getTradesForAddress(const std::string& address, std::vector<uint256>& vecTransactions, uint32_t propertyIdFilter = 0);
-    void getTradesForPair(uint32_t propertyIdSideA, uint32_t propertyIdSideB, UniValue& response, uint64_t count);
+    void getTradesForPair(uint32_t propertyIdSideA, uint32_t propertyIdSideB, UniValue& response, uint64_t count, uint64_t skip = 0);
     int getMPTradeCountTotal();
 };
 
@@ -20,7 +20,9 @@
 
 COmniTransactionDB::COmniTransactionDB(const fs::path& path, bool fWipe)
 {
+    EnableBloomFilter();
     leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
     PrintToConsole("Loading master transactions database: %s\n", status.ToString());
 }
 
@@ -38,7 +40,7 @@ std::vector<std::string> COmniTransactionDB::FetchTransactionDetails(const uint2
     std::string strValue;
     std::vector<std::string> vTransactionDetails;
 
-    leveldb::Status status = pdb->Get(readoptions, txid.ToString(), &strValue);
+    leveldb::Status status = Read(txid.ToString(), &strValue);
     if (status.ok()) {
         std::vector<std::string> vStr;
         boost::split(vStr, strValue, boost::is_any_of(":"), boost::token_compress_on);
@@ -65,7 +67,7 @@ void COmniTransactionDB::RecordTransaction(const uint256& txid, uint32_t posInBl
     const std::string key = txid.ToString();
     const std::string value = strprintf("%d:%d", posInBlock, processingResult);
 
-    leveldb::Status status = pdb->Put(writeoptions, key, value);
+    leveldb::Status status = Put(key, value);
     ++nWritten;
 }
 
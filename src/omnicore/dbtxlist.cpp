@@ -22,6 +22,7 @@
 #include <leveldb/iterator.h>
 #include <leveldb/slice.h>
 #include <leveldb/status.h>
+#include <leveldb/write_batch.h>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -43,9 +44,49 @@ using mastercore::GetBlockIndex;
 using mastercore::isNonMainNet;
 using mastercore::pDbTransaction;
 
+/**
+ * Returns the key of the block height index entry for a record.
+ *
+ * Entries of the index have the form "h<block>:<record key>", with the block
+ * height zero padded, such that entries are ordered by block and all records
+ * of a block range can be found by seeking to the start of the range.
+ */
+static std::string HeightIndexKey(int block, const std::string& recordKey)
+{
+    return strprintf("h%010d:%s", block, recordKey);
+}
+
+/**
+ * Parses a block height index entry into the block and the key of the record.
+ */
+static bool ParseHeightIndexKey(const leveldb::Slice& indexKey, int& block, std::string& recordKey)
+{
+    if (indexKey.size() < 12 || indexKey[0] != 'h' || indexKey[11] != ':') {
+        return false;
+    }
+    const std::string strKey = indexKey.ToString();
+    block = atoi(strKey.substr(1, 10));
+    recordKey = strKey.substr(12);
+    return true;
+}
+
+/**
+ * Returns the block stored in a "valid:block:type:value" record, or -1, if the value can't be parsed.
+ */
+static int ParseRecordBlock(const std::string& strValue)
+{
+    std::vector<std::string> vstr;
+    boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
+    if (4 != vstr.size()) return -1;
+    int block = atoi(vstr[1]);
+    return (block < 0) ? -1 : block;
+}
+
 CMPTxList::CMPTxList(const fs::path& path, bool fWipe)
 {
+    EnableBloomFilter();
     leveldb::Status status = Open(path, fWipe);
+    EnableBlockWrites();
     PrintToConsole("Loading tx meta-info database: %s\n", status.ToString());
 }
 
@@ -58,18 +99,27 @@ void CMPTxList::recordTX(const uint256 &txid, bool fValid, int nBlock, unsigned
 {
     if (!pdb) return;
 
-    // overwrite detection, we should never be overwriting a tx, as that means we have redone something a second time
-    // reorgs delete all txs from levelDB above reorg_chain_height
-    if (exists(txid)) PrintToLog("LEVELDB TX OVERWRITE DETECTION - %s\n", txid.ToString());
-
     const std::string key = txid.ToString();
     const std::string value = strprintf("%u:%d:%u:%lu", fValid ? 1 : 0, nBlock, type, nValue);
-    leveldb::Status status;
+    leveldb::WriteBatch batch;
+
+    // overwrite detection, we should never be overwriting a tx, as that means we have redone something a second time
+    // reorgs delete all txs from levelDB above reorg_chain_height
+    std::string strOldValue;
+    if (Read(key, &strOldValue).ok()) {
+        PrintToLog("LEVELDB TX OVERWRITE DETECTION - %s\n", txid.ToString());
+        int oldBlock = ParseRecordBlock(strOldValue);
+        if (oldBlock >= 0 && oldBlock != nBlock) batch.Delete(HeightIndexKey(oldBlock, key));
+    }
 
     PrintToLog("%s(%s, valid=%s, block= %d, type= %d, value= %lu)\n",
             __func__, txid.ToString(), fValid ? "YES" : "NO", nBlock, type, nValue);
 
-    status = pdb->Put(writeoptions, key, value);
+    // atomically write the record and the block height index entry
+    batch.Put(key, value);
+    batch.Put(HeightIndexKey(nBlock, key), "");
+
+    leveldb::Status status = Write(batch);
     ++nWritten;
 }
 
@@ -82,44 +132,43 @@ void CMPTxList::recordPaymentTX(const uint256& txid, bool fValid, int nBlock, un
     uint64_t numberOfPayments = 1;
     unsigned int paymentNumber = 1;
     uint64_t existingNumberOfPayments = 0;
+    leveldb::WriteBatch batch;
 
     // Step 1 - Check TXList to see if this payment TXID exists
-    bool paymentEntryExists = exists(txid);
-
     // Step 2a - If doesn't exist leave number of payments & paymentNumber set to 1
     // Step 2b - If does exist add +1 to existing number of payments and set this paymentNumber as new numberOfPayments
-    if (paymentEntryExists) {
-        //retrieve old numberOfPayments
-        std::vector<std::string> vstr;
-        std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, txid.ToString(), &strValue);
-        if (status.ok()) {
-            // parse the string returned
-            boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
-
-            // obtain the existing number of payments
-            if (4 <= vstr.size()) {
-                existingNumberOfPayments = atoi(vstr[3]);
-                paymentNumber = existingNumberOfPayments + 1;
-                numberOfPayments = existingNumberOfPayments + 1;
-            }
+    std::vector<std::string> vstr;
+    std::string strValue;
+    leveldb::Status status = Read(txid.ToString(), &strValue);
+    if (status.ok()) {
+        // parse the string returned
+        boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
+
+        // obtain the existing number of payments
+        if (4 <= vstr.size()) {
+            existingNumberOfPayments = atoi(vstr[3]);
+            paymentNumber = existingNumberOfPayments + 1;
+            numberOfPayments = existingNumberOfPayments + 1;
+            int oldBlock = ParseRecordBlock(strValue);
+            if (oldBlock >= 0 && oldBlock != nBlock) batch.Delete(HeightIndexKey(oldBlock, txid.ToString()));
         }
     }
 
     // Step 3 - Create new/update master record for payment tx in TXList
     const std::string key = txid.ToString();
     const std::string value = strprintf("%u:%d:%u:%lu", fValid ? 1 : 0, nBlock, type, numberOfPayments);
-    leveldb::Status status;
     PrintToLog("DEXPAYDEBUG : Writing master record %s(%s, valid=%s, block= %d, type= %d, number of payments= %lu)\n", __func__, txid.ToString(), fValid ? "YES" : "NO", nBlock, type, numberOfPayments);
-    status = pdb->Put(writeoptions, key, value);
+    batch.Put(key, value);
+    batch.Put(HeightIndexKey(nBlock, key), "");
 
     // Step 4 - Write sub-record with payment details
     const std::string txidStr = txid.ToString();
     const std::string subKey = STR_PAYMENT_SUBKEY_TXID_PAYMENT_COMBO(txidStr, paymentNumber);
     const std::string subValue = strprintf("%d:%s:%s:%d:%lu", vout, buyer, seller, propertyId, nValue);
-    leveldb::Status subStatus;
     PrintToLog("DEXPAYDEBUG : Writing sub-record %s with value %s\n", subKey, subValue);
-    subStatus = pdb->Put(writeoptions, subKey, subValue);
+    batch.Put(subKey, subValue);
+
+    status = Write(batch);
 }
 
 void CMPTxList::recordMetaDExCancelTX(const uint256& txidMaster, const uint256& txidSub, bool fValid, int nBlock, unsigned int propertyId, uint64_t nValue)
@@ -131,13 +180,14 @@ void CMPTxList::recordMetaDExCancelTX(const uint256& txidMaster, const uint256&
     unsigned int refNumber = 1;
     uint64_t existingAffectedTXCount = 0;
     std::string txidMasterStr = txidMaster.ToString() + "-C";
+    leveldb::WriteBatch batch;
 
     // Step 1 - Check TXList to see if this cancel TXID exists
     // Step 2a - If doesn't exist leave number of affected txs & ref set to 1
     // Step 2b - If does exist add +1 to existing ref and set this ref as new number of affected
     std::vector<std::string> vstr;
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, txidMasterStr, &strValue);
+    leveldb::Status status = Read(txidMasterStr, &strValue);
     if (status.ok()) {
         // parse the string returned
         boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
@@ -146,6 +196,8 @@ void CMPTxList::recordMetaDExCancelTX(const uint256& txidMaster, const uint256&
         if (4 <= vstr.size()) {
             existingAffectedTXCount = atoi(vstr[3]);
             refNumber = existingAffectedTXCount + 1;
+            int oldBlock = ParseRecordBlock(strValue);
+            if (oldBlock >= 0 && oldBlock != nBlock) batch.Delete(HeightIndexKey(oldBlock, txidMasterStr));
         }
     }
 
@@ -153,14 +205,16 @@ void CMPTxList::recordMetaDExCancelTX(const uint256& txidMaster, const uint256&
     const std::string key = txidMasterStr;
     const std::string value = strprintf("%u:%d:%u:%lu", fValid ? 1 : 0, nBlock, type, refNumber);
     PrintToLog("METADEXCANCELDEBUG : Writing master record %s(%s, valid=%s, block= %d, type= %d, number of affected transactions= %d)\n", __func__, txidMaster.ToString(), fValid ? "YES" : "NO", nBlock, type, refNumber);
-    status = pdb->Put(writeoptions, key, value);
+    batch.Put(key, value);
+    batch.Put(HeightIndexKey(nBlock, key), "");
 
     // Step 4 - Write sub-record with cancel details
     const std::string txidStr = txidMaster.ToString() + "-C";
     const std::string subKey = STR_REF_SUBKEY_TXID_REF_COMBO(txidStr, refNumber);
     const std::string subValue = strprintf("%s:%d:%lu", txidSub.ToString(), propertyId, nValue);
     PrintToLog("METADEXCANCELDEBUG : Writing sub-record %s with value %s\n", subKey, subValue);
-    status = pdb->Put(writeoptions, subKey, subValue);
+    batch.Put(subKey, subValue);
+    status = Write(batch);
     if (msc_debug_txdb) PrintToLog("%s(): store: %s=%s, status: %s\n", __func__, subKey, subValue, status.ToString());
 }
 
@@ -173,7 +227,7 @@ void CMPTxList::recordSendAllSubRecord(const uint256& txid, int subRecordNumber,
     std::string strKey = strprintf("%s-%d", txid.ToString(), subRecordNumber);
     std::string strValue = strprintf("%d:%d", propertyId, nValue);
 
-    leveldb::Status status = pdb->Put(writeoptions, strKey, strValue);
+    leveldb::Status status = Put(strKey, strValue);
     ++nWritten;
     if (msc_debug_txdb) PrintToLog("%s(): store: %s=%s, status: %s\n", __func__, strKey, strValue, status.ToString());
 }
@@ -183,7 +237,7 @@ std::string CMPTxList::getKeyValue(std::string key)
 {
     if (!pdb) return "";
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, key, &strValue);
+    leveldb::Status status = Read(key, &strValue);
     if (status.ok()) {
         return strValue;
     } else {
@@ -225,7 +279,7 @@ int CMPTxList::getNumberOfSubRecords(const uint256& txid)
     int numberOfSubRecords = 0;
 
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, txid.ToString(), &strValue);
+    leveldb::Status status = Read(txid.ToString(), &strValue);
     if (status.ok()) {
         std::vector<std::string> vstr;
         boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
@@ -243,7 +297,7 @@ int CMPTxList::getNumberOfMetaDExCancels(const uint256 txid)
     int numberOfCancels = 0;
     std::vector<std::string> vstr;
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, txid.ToString() + "-C", &strValue);
+    leveldb::Status status = Read(txid.ToString() + "-C", &strValue);
     if (status.ok()) {
         // parse the string returned
         boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
@@ -260,7 +314,7 @@ bool CMPTxList::getPurchaseDetails(const uint256 txid, int purchaseNumber, std::
     if (!pdb) return 0;
     std::vector<std::string> vstr;
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, txid.ToString() + "-" + std::to_string(purchaseNumber), &strValue);
+    leveldb::Status status = Read(txid.ToString() + "-" + std::to_string(purchaseNumber), &strValue);
     if (status.ok()) {
         // parse the string returned
         boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
@@ -284,7 +338,7 @@ bool CMPTxList::getSendAllDetails(const uint256& txid, int subSend, uint32_t& pr
 {
     std::string strKey = strprintf("%s-%d", txid.ToString(), subSend);
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, strKey, &strValue);
+    leveldb::Status status = Read(strKey, &strValue);
     if (status.ok()) {
         std::vector<std::string> vstr;
         boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
@@ -315,23 +369,12 @@ int CMPTxList::getMPTransactionCountTotal()
 int CMPTxList::getMPTransactionCountBlock(int block)
 {
     int count = 0;
-    leveldb::Slice skey, svalue;
-    leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        skey = it->key();
-        svalue = it->value();
-        if (skey.ToString().length() == 64) {
-            std::string strValue = svalue.ToString();
-            std::vector<std::string> vstr;
-            boost::split(vstr, strValue, boost::is_any_of(":"), boost::token_compress_on);
-            if (4 == vstr.size()) {
-                if (atoi(vstr[1]) == block) {
-                    ++count;
-                }
-            }
-        }
+    std::vector<std::pair<int, std::string> > vRecords = GetRecordsInBlockRange(block, block);
+    for (const auto& record : vRecords) {
+        if (record.second.length() == 64) {
+            ++count;
+        } //extra entries for cancels are more than 64 chars long
     }
-    delete it;
     return count;
 }
 
@@ -339,28 +382,41 @@ int CMPTxList::getMPTransactionCountBlock(int block)
 int CMPTxList::GetOmniTxsInBlockRange(int blockFirst, int blockLast, std::set<uint256>& retTxs)
 {
     int count = 0;
+    std::vector<std::pair<int, std::string> > vRecords = GetRecordsInBlockRange(blockFirst, blockLast);
+    for (const auto& record : vRecords) {
+        if (record.second.length() == 64) {
+            retTxs.insert(uint256S(record.second));
+            ++count;
+        }
+    }
+    return count;
+}
+
+/**
+ * Returns the block and key of all records in the given block range.
+ *
+ * The records are looked up in the block height index, so only entries of the
+ * range are visited.
+ */
+std::vector<std::pair<int, std::string> > CMPTxList::GetRecordsInBlockRange(int blockFirst, int blockLast)
+{
+    std::vector<std::pair<int, std::string> > vRecords;
+
+    if (!pdb) return vRecords;
+
     leveldb::Iterator* it = NewIterator();
-    
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        const leveldb::Slice& sKey = it->key();
-        const leveldb::Slice& sValue = it->value();
-
-        if (sKey.ToString().length() == 64) {
-            const std::string& strValue = sValue.ToString();
-            std::vector<std::string> vStr;
-            boost::split(vStr, strValue, boost::is_any_of(":"), boost::token_compress_on);
-            if (4 == vStr.size()) {
-                int blockCurrent = atoi(vStr[1]);
-                if (blockCurrent >= blockFirst && blockCurrent <= blockLast) {
-                    retTxs.insert(uint256S(sKey.ToString()));                    
-                    ++count;
-                }
-            }
+
+    for (it->Seek(strprintf("h%010d", std::max(blockFirst, 0))); it->Valid(); it->Next()) {
+        int block;
+        std::string recordKey;
+        if (!ParseHeightIndexKey(it->key(), block, recordKey) || block > blockLast) {
+            break;
         }
+        vRecords.push_back(std::make_pair(block, recordKey));
     }
 
     delete it;
-    return count;
+    return vRecords;
 }
 
 /*
@@ -373,7 +429,7 @@ int CMPTxList::getDBVersion()
     std::string strValue;
     int verDB = 0;
 
-    leveldb::Status status = pdb->Get(readoptions, "dbversion", &strValue);
+    leveldb::Status status = Read("dbversion", &strValue);
     if (status.ok()) {
         verDB = boost::lexical_cast<uint64_t>(strValue);
     }
@@ -391,7 +447,7 @@ int CMPTxList::getDBVersion()
 int CMPTxList::setDBVersion()
 {
     std::string verStr = boost::lexical_cast<std::string>(DB_VERSION);
-    leveldb::Status status = pdb->Put(writeoptions, "dbversion", verStr);
+    leveldb::Status status = Put("dbversion", verStr);
 
     if (msc_debug_txdb) PrintToLog("%s(): dbversion %s status %s, line %d, file: %s\n", __func__, verStr, status.ToString(), __LINE__, __FILE__);
 
@@ -402,7 +458,7 @@ std::pair<int64_t,int64_t> CMPTxList::GetNonFungibleGrant(const uint256& txid)
 {
     std::string strKey = strprintf("%s-UG", txid.ToString());
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, strKey, &strValue);
+    leveldb::Status status = Read(strKey, &strValue);
     if (status.ok()) {
         std::vector<std::string> vstr;
         boost::split(vstr, strValue, boost::is_any_of("-"), boost::token_compress_on);
@@ -420,7 +476,7 @@ void CMPTxList::RecordNonFungibleGrant(const uint256& txid, int64_t start, int64
     const std::string key = txid.ToString() + "-UG";
     const std::string value = strprintf("%d-%d", start, end);
 
-    leveldb::Status status = pdb->Put(writeoptions, key, value);
+    leveldb::Status status = Put(key, value);
     PrintToLog("%s(): Writing Non-Fungible Grant range %s:%d-%d (%s), line %d, file: %s\n", __FUNCTION__, key, start, end, status.ToString(), __LINE__, __FILE__);
 }
 
@@ -429,7 +485,7 @@ bool CMPTxList::exists(const uint256 &txid)
     if (!pdb) return false;
 
     std::string strValue;
-    leveldb::Status status = pdb->Get(readoptions, txid.ToString(), &strValue);
+    leveldb::Status status = Read(txid.ToString(), &strValue);
 
     if (!status.ok()) {
         if (status.IsNotFound()) return false;
@@ -440,7 +496,7 @@ bool CMPTxList::exists(const uint256 &txid)
 
 bool CMPTxList::getTX(const uint256 &txid, std::string& value)
 {
-    leveldb::Status status = pdb->Get(readoptions, txid.ToString(), &value);
+    leveldb::Status status = Read(txid.ToString(), &value);
     ++nRead;
 
     if (status.ok()) {
@@ -502,23 +558,11 @@ std::set<int> CMPTxList::GetSeedBlocks(int startHeight, int endHeight)
 {
     std::set<int> setSeedBlocks;
 
-    if (!pdb) return setSeedBlocks;
-
-    leveldb::Iterator* it = NewIterator();
-
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        std::string itData = it->value().ToString();
-        std::vector<std::string> vstr;
-        boost::split(vstr, itData, boost::is_any_of(":"), boost::token_compress_on);
-        if (4 != vstr.size()) continue; // unexpected number of tokens
-        int block = atoi(vstr[1]);
-        if (block >= startHeight && block <= endHeight) {
-            setSeedBlocks.insert(block);
-        }
+    std::vector<std::pair<int, std::string> > vRecords = GetRecordsInBlockRange(startHeight, endHeight);
+    for (const auto& record : vRecords) {
+        setSeedBlocks.insert(record.first);
     }
 
-    delete it;
-
     return setSeedBlocks;
 }
 
@@ -797,43 +841,38 @@ void CMPTxList::printAll()
 
 // figure out if there was at least 1 Master Protocol transaction within the block range, or a block if starting equals ending
 // block numbers are inclusive
-// pass in bDeleteFound = true to erase each entry found within the block range
+// pass in bDeleteFound = true to erase each entry found within the block range, including its sub records and index entry
 bool CMPTxList::isMPinBlockRange(int starting_block, int ending_block, bool bDeleteFound)
 {
-    leveldb::Slice skey, svalue;
-    unsigned int count = 0;
-    std::vector<std::string> vstr;
-    int block;
     unsigned int n_found = 0;
+    leveldb::WriteBatch batch;
 
-    leveldb::Iterator* it = NewIterator();
-
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        skey = it->key();
-        svalue = it->value();
-
-        ++count;
-
-        std::string strvalue = it->value().ToString();
+    std::vector<std::pair<int, std::string> > vRecords = GetRecordsInBlockRange(starting_block, ending_block);
 
-        // parse the string returned, find the validity flag/bit & other parameters
-        boost::split(vstr, strvalue, boost::is_any_of(":"), boost::token_compress_on);
+    for (const auto& record : vRecords) {
+        ++n_found;
+        if (!bDeleteFound) continue;
 
-        // only care about the block number/height here
-        if (2 <= vstr.size()) {
-            block = atoi(vstr[1]);
+        const std::string& recordKey = record.second;
+        PrintToLog("%s() DELETING: %s\n", __func__, recordKey);
+        batch.Delete(recordKey);
+        batch.Delete(HeightIndexKey(record.first, recordKey));
 
-            if ((starting_block <= block) && (block <= ending_block)) {
-                ++n_found;
-                PrintToLog("%s() DELETING: %s=%s\n", __func__, skey.ToString(), svalue.ToString());
-                if (bDeleteFound) pdb->Delete(writeoptions, skey);
-            }
+        // sub records, such as payments, cancels, "send all" and grant records, are keyed by "<txid>-<suffix>"
+        const std::string subKeyPrefix = recordKey + "-";
+        leveldb::Iterator* it = NewIterator();
+        for (it->Seek(subKeyPrefix); it->Valid() && it->key().starts_with(subKeyPrefix); it->Next()) {
+            batch.Delete(it->key());
         }
+        delete it;
     }
 
-    PrintToLog("%s(%d, %d); n_found= %d\n", __func__, starting_block, ending_block, n_found);
+    if (bDeleteFound && n_found > 0) {
+        leveldb::Status status = Write(batch);
+        if (!status.ok()) PrintToLog("%s(): ERROR: %s\n", __func__, status.ToString());
+    }
 
-    delete it;
+    PrintToLog("%s(%d, %d); n_found= %d\n", __func__, starting_block, ending_block, n_found);
 
     return (n_found);
 }
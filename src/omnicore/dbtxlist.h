@@ -11,8 +11,14 @@
 
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 /** LevelDB based storage for transactions, with txid as key and validity bit, and other data as value.
+ *
+ * Master records of transactions, payments and MetaDEx cancels are additionally
+ * indexed by block height with keys of the form "h<block>:<record key>", so
+ * block range queries only visit the entries of the range.
  */
 class CMPTxList : public CDBBase
 {
@@ -61,6 +67,10 @@ public:
     void printAll();
 
     bool isMPinBlockRange(int, int, bool);
+
+private:
+    /** Returns the block and key of all records in the given block range. */
+    std::vector<std::pair<int, std::string> > GetRecordsInBlockRange(int blockFirst, int blockLast);
 };
 
 namespace mastercore
@@ -31,6 +31,45 @@
 
 namespace mastercore
 {
+/** Seller, buyer and property of an accept. */
+struct CAcceptRef
+{
+    std::string addressSeller;
+    std::string addressBuyer;
+    uint32_t propertyId;
+};
+
+//! Accepts ordered by the block, in which their payment window ends
+static std::multimap<int, CAcceptRef> acceptsByExpiry;
+
+/**
+ * Returns the block, in which the payment window of the accept ends.
+ */
+static int GetAcceptExpiry(const CMPAccept& acceptOrder)
+{
+    return acceptOrder.getAcceptBlock() + static_cast<int>(acceptOrder.getBlockTimeLimit());
+}
+
+/**
+ * Rebuilds the expiry index of the accepts, e.g. after they were loaded or cleared.
+ */
+void RebuildAcceptExpiryIndex()
+{
+    acceptsByExpiry.clear();
+
+    for (AcceptMap::const_iterator it = my_accepts.begin(); it != my_accepts.end(); ++it) {
+        // extract the seller, buyer and property from the key
+        std::vector<std::string> vstr;
+        boost::split(vstr, it->first, boost::is_any_of("-+"), boost::token_compress_on);
+        if (vstr.size() != 3) {
+            PrintToLog("%s: ERROR: invalid accept key: %s\n", __func__, it->first);
+            continue;
+        }
+        CAcceptRef ref{vstr[0], vstr[2], static_cast<uint32_t>(atoi(vstr[1]))};
+        acceptsByExpiry.insert(std::make_pair(GetAcceptExpiry(it->second), ref));
+    }
+}
+
 /**
  * Checks, if such a sell offer exists.
  */
@@ -369,6 +408,9 @@ int DEx_acceptCreate(const std::string& addressBuyer, const std::string& address
         CMPAccept acceptOffer(amountReserved, block, offer.getBlockTimeLimit(), offer.getProperty(), offer.getOfferAmountOriginal(), offer.getBTCDesiredOriginal(), offer.getHash());
         my_accepts.insert(std::make_pair(keyAcceptOrder, acceptOffer));
 
+        CAcceptRef ref{addressSeller, addressBuyer, propertyId};
+        acceptsByExpiry.insert(std::make_pair(GetAcceptExpiry(acceptOffer), ref));
+
         rc = 0;
     }
 
@@ -610,39 +652,50 @@ int DEx_payment(const uint256& txid, unsigned int vout, const std::string& addre
     return rc;
 }
 
+/**
+ * Erases the accepts, whose payment window ended.
+ *
+ * Only the accepts, which are due according to the expiry index, are visited.
+ * Entries of accepts, which were destroyed in the meantime, are skipped.
+ */
 unsigned int eraseExpiredAccepts(int blockNow)
 {
     unsigned int how_many_erased = 0;
-    AcceptMap::iterator it = my_accepts.begin();
 
-    while (my_accepts.end() != it) {
-        const CMPAccept& acceptOrder = it->second;
+    // collect the expired accepts, which are processed in the order of their keys
+    std::map<std::string, CAcceptRef> expiredAccepts;
+    std::multimap<int, CAcceptRef>::iterator it = acceptsByExpiry.begin();
 
-        int blocksSinceAccept = blockNow - acceptOrder.getAcceptBlock();
-        int blocksPaymentWindow = static_cast<int>(acceptOrder.getBlockTimeLimit());
+    while (acceptsByExpiry.end() != it && it->first <= blockNow) {
+        const CAcceptRef& ref = it->second;
+        std::string key = STR_ACCEPT_ADDR_PROP_ADDR_COMBO(ref.addressSeller, ref.addressBuyer, ref.propertyId);
+        AcceptMap::const_iterator my_it = my_accepts.find(key);
 
-        if (blocksSinceAccept >= blocksPaymentWindow) {
-            PrintToLog("%s: sell offer: %s\n", __func__, acceptOrder.getHash().GetHex());
-            PrintToLog("%s: erasing at block: %d, order confirmed at block: %d, payment window: %d\n",
-                    __func__, blockNow, acceptOrder.getAcceptBlock(), acceptOrder.getBlockTimeLimit());
+        if (my_accepts.end() != my_it && GetAcceptExpiry(my_it->second) == it->first) {
+            expiredAccepts.insert(std::make_pair(key, ref));
+        }
+        acceptsByExpiry.erase(it++);
+    }
 
-            // extract the seller, buyer and property from the key
-            std::vector<std::string> vstr;
-            boost::split(vstr, it->first, boost::is_any_of("-+"), boost::token_compress_on);
-            std::string addressSeller = vstr[0];
-            uint32_t propertyId = atoi(vstr[1]);
-            std::string addressBuyer = vstr[2];
+    for (std::map<std::string, CAcceptRef>::const_iterator exp_it = expiredAccepts.begin(); exp_it != expiredAccepts.end(); ++exp_it) {
+        AcceptMap::iterator my_it = my_accepts.find(exp_it->first);
+        if (my_accepts.end() == my_it) continue;
 
-            DEx_acceptDestroy(addressBuyer, addressSeller, propertyId);
+        const CMPAccept& acceptOrder = my_it->second;
+        const CAcceptRef& ref = exp_it->second;
 
-            my_accepts.erase(it++);
+        PrintToLog("%s: sell offer: %s\n", __func__, acceptOrder.getHash().GetHex());
+        PrintToLog("%s: erasing at block: %d, order confirmed at block: %d, payment window: %d\n",
+                __func__, blockNow, acceptOrder.getAcceptBlock(), acceptOrder.getBlockTimeLimit());
 
-            ++how_many_erased;
-        } else it++;
+        DEx_acceptDestroy(ref.addressBuyer, ref.addressSeller, ref.propertyId);
+
+        my_accepts.erase(my_it);
+
+        ++how_many_erased;
     }
 
     return how_many_erased;
 }
 
-
 } // namespace mastercore
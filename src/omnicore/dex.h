@@ -6,12 +6,11 @@
 #include <omnicore/tx.h>
 
 #include <amount.h>
-#include <hash.h>
+#include <serialize.h>
 #include <tinyformat.h>
 #include <uint256.h>
 
 #include <stdint.h>
-#include <fstream>
 #include <map>
 #include <string>
 
@@ -86,25 +85,18 @@ public:
     {
     }
 
-    void saveOffer(std::ofstream& file, const std::string& address, CHash256& hasher) const
-    {
-        std::string lineOut = strprintf("%s,%d,%d,%d,%d,%d,%d,%d,%s",
-                address,
-                offerBlock,
-                offer_amount_original,
-                property,
-                BTC_desired_original,
-                (OMNI_PROPERTY_BTC),
-                min_fee,
-                blocktimelimit,
-                txid.ToString()
-        );
-
-        // add the line to the hash
-        hasher.Write((unsigned char*)lineOut.c_str(), lineOut.length());
-
-        // write the line
-        file << lineOut << std::endl;
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(offerBlock);
+        READWRITE(offer_amount_original);
+        READWRITE(property);
+        READWRITE(BTC_desired_original);
+        READWRITE(min_fee);
+        READWRITE(blocktimelimit);
+        READWRITE(txid);
+        READWRITE(subaction);
     }
 };
 
@@ -142,6 +134,12 @@ public:
 
     int getAcceptBlock() const { return block; }
 
+    CMPAccept()
+      : accept_amount_original(0), accept_amount_remaining(0), blocktimelimit(0), property(0),
+        offer_amount_original(0), BTC_desired_original(0), block(0)
+    {
+    }
+
     CMPAccept(int64_t amountAccepted, int blockIn, uint8_t paymentWindow, uint32_t propertyId,
               int64_t offerAmountOriginal, int64_t amountDesired, const uint256& txid)
       : accept_amount_remaining(amountAccepted), blocktimelimit(paymentWindow),
@@ -194,25 +192,18 @@ public:
         return bRet;
     }
 
-    void saveAccept(std::ofstream& file, const std::string& address, const std::string& buyer, CHash256& hasher) const
-    {
-        std::string lineOut = strprintf("%s,%d,%s,%d,%d,%d,%d,%d,%d,%s",
-                address,
-                property,
-                buyer,
-                block,
-                accept_amount_remaining,
-                accept_amount_original,
-                blocktimelimit,
-                offer_amount_original,
-                BTC_desired_original,
-                offer_txid.ToString());
-
-        // add the line to the hash
-        hasher.Write((unsigned char*)lineOut.c_str(), lineOut.length());
-
-        // write the line
-        file << lineOut << std::endl;
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(accept_amount_original);
+        READWRITE(accept_amount_remaining);
+        READWRITE(blocktimelimit);
+        READWRITE(property);
+        READWRITE(offer_amount_original);
+        READWRITE(BTC_desired_original);
+        READWRITE(offer_txid);
+        READWRITE(block);
     }
 };
 
@@ -243,6 +234,9 @@ int DEx_acceptDestroy(const std::string& addressBuyer, const std::string& addres
 int DEx_payment(const uint256& txid, unsigned int vout, const std::string& addressSeller, const std::string& addressBuyer, int64_t amountPaid, int block, uint64_t* nAmended = nullptr);
 int64_t calculateDExPurchase(const int64_t amountOffered, const int64_t amountDesired, const int64_t amountPaid);
 
+/** Rebuilds the expiry index of the accepts, e.g. after they were loaded or cleared. */
+void RebuildAcceptExpiryIndex();
+
 unsigned int eraseExpiredAccepts(int block);
 }
 
@@ -9,8 +9,11 @@
 #include <assert.h>
 #include <stdio.h>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 // Default log files
@@ -19,6 +22,9 @@ const std::string LOG_FILENAME    = "omnicore.log";
 // Options
 static const long LOG_BUFFERSIZE  =  8000000; //  8 MB
 static const long LOG_SHRINKSIZE  = 50000000; // 50 MB
+static const size_t LOG_WRITER_FLUSHSIZE =   65536; // 64 KB
+static const size_t LOG_WRITER_MAXSIZE   = 4000000; //  4 MB
+static const std::chrono::milliseconds LOG_WRITER_INTERVAL{500};
 
 // Debug flags
 bool msc_debug_parser_data        = 0;
@@ -62,6 +68,8 @@ bool msc_debug_consensus_hash_every_block = 0;
 bool msc_debug_alerts             = 1;
 //! Print consensus hashes for each transaction when parsing
 bool msc_debug_consensus_hash_every_transaction = 0;
+//! Print the incremental consensus hash along with the consensus hash, and cross-check it
+bool msc_debug_consensus_hash_incremental = 0;
 //! Debug fees
 bool msc_debug_fees               = 1;
 //! Debug the non-fungible tokens database
@@ -84,6 +92,17 @@ static std::once_flag debugLogInitFlag;
  */
 static FILE* fileout = nullptr;
 static std::mutex* mutexDebugLog = nullptr;
+/** Guards the log file, acquired while holding mutexDebugLog to keep the order of writes. */
+static std::mutex* mutexLogFile = nullptr;
+/** Messages buffered for the background writer, guarded by mutexDebugLog. */
+static std::string* strLogBuffer = nullptr;
+/** Signals buffered messages to the background writer. */
+static std::condition_variable* condLogWriter = nullptr;
+/** Whether the background writer is running, guarded by mutexDebugLog. */
+static bool fLogWriterRunning = false;
+/** Whether the background writer should stop, guarded by mutexDebugLog. */
+static bool fLogWriterStop = false;
+static std::thread threadLogWriter;
 /** Flag to indicate, whether the Omni Core log file should be reopened. */
 extern std::atomic<bool> fReopenOmniCoreLog;
 /**
@@ -125,6 +144,59 @@ static void DebugLogInit()
     }
 
     mutexDebugLog = new std::mutex();
+    mutexLogFile = new std::mutex();
+    strLogBuffer = new std::string();
+    condLogWriter = new std::condition_variable();
+}
+
+/**
+ * Writes the buffered messages to the log file.
+ *
+ * The log file is locked, before the lock of the buffer is released, so
+ * messages are written in the order they were logged.
+ *
+ * @param lock[in]  The held lock of mutexDebugLog, which is released
+ */
+static void WriteLogBuffer(std::unique_lock<std::mutex>& lock)
+{
+    std::string strBuffer;
+    strBuffer.swap(*strLogBuffer);
+
+    std::lock_guard<std::mutex> lockFile(*mutexLogFile);
+    lock.unlock();
+
+    // Reopen the log file, if requested
+    if (fReopenOmniCoreLog) {
+        fReopenOmniCoreLog = false;
+        fs::path pathDebug = GetLogPath();
+        if (freopen(pathDebug.string().c_str(), "a", fileout) != nullptr) {
+            setbuf(fileout, nullptr); // Unbuffered
+        }
+    }
+
+    if (!strBuffer.empty()) {
+        fwrite(strBuffer.data(), 1, strBuffer.size(), fileout);
+    }
+}
+
+/**
+ * Writes buffered messages in the background, when enough messages were
+ * buffered, or after a short interval.
+ */
+static void ThreadLogWriter()
+{
+    std::unique_lock<std::mutex> lock(*mutexDebugLog);
+    while (true) {
+        condLogWriter->wait_for(lock, LOG_WRITER_INTERVAL, [] {
+            return fLogWriterStop || strLogBuffer->size() >= LOG_WRITER_FLUSHSIZE;
+        });
+        bool fStop = fLogWriterStop;
+
+        WriteLogBuffer(lock);
+        if (fStop) return;
+
+        lock.lock();
+    }
 }
 
 /**
@@ -144,10 +216,16 @@ static std::string GetTimestamp()
  * If "-printtoconsole" is enabled, then the message is written to the standard
  * output, usually the console, instead of a log file.
  *
- * @param str[in]  The message to log
+ * While the background writer is running, the message is buffered and written
+ * later, otherwise it's written immediately. Messages, which must not be lost,
+ * if the process ends right after, e.g. before AbortNode, are written with
+ * fFlush set, or FlushLog() is called.
+ *
+ * @param str[in]     The message to log
+ * @param fFlush[in]  Whether to write the message and all buffered messages immediately
  * @return The total number of characters written
  */
-int LogFilePrint(const std::string& str)
+int LogFilePrint(const std::string& str, bool fFlush)
 {
     int ret = 0; // Number of characters written
     if (LogInstance().m_print_to_console || fOmniCoreConsoleLog) {
@@ -161,32 +239,90 @@ int LogFilePrint(const std::string& str)
         if (fileout == nullptr) {
             return ret;
         }
-        std::lock_guard<std::mutex> lock(*mutexDebugLog);
-
-        // Reopen the log file, if requested
-        if (fReopenOmniCoreLog) {
-            fReopenOmniCoreLog = false;
-            fs::path pathDebug = GetLogPath();
-            if (freopen(pathDebug.string().c_str(), "a", fileout) != nullptr) {
-                setbuf(fileout, nullptr); // Unbuffered
-            }
-        }
+        std::unique_lock<std::mutex> lock(*mutexDebugLog);
+        size_t nBuffered = strLogBuffer->size();
 
         // Printing log timestamps can be useful for profiling
         if (LogInstance().m_log_timestamps && fStartedNewLine) {
-            ret += fprintf(fileout, "%s ", GetTimestamp().c_str());
+            strLogBuffer->append(GetTimestamp());
+            strLogBuffer->append(" ");
         }
         if (!str.empty() && str[str.size()-1] == '\n') {
             fStartedNewLine = true;
         } else {
             fStartedNewLine = false;
         }
-        ret += fwrite(str.data(), 1, str.size(), fileout);
+        strLogBuffer->append(str);
+        ret = strLogBuffer->size() - nBuffered;
+
+        if (!fLogWriterRunning || strLogBuffer->size() >= LOG_WRITER_MAXSIZE || fFlush) {
+            // Write immediately without background writer, when the buffer is full, or if requested
+            WriteLogBuffer(lock);
+        } else if (strLogBuffer->size() >= LOG_WRITER_FLUSHSIZE) {
+            condLogWriter->notify_one();
+        }
     }
 
     return ret;
 }
 
+/**
+ * Starts the background writer of the log file.
+ *
+ * Messages are buffered and written by the writer, so logging doesn't wait for
+ * the file. If the buffer is full, messages are written by the caller instead.
+ *
+ * Buffered messages are not written, when the process terminates unexpectedly,
+ * so FlushLog() is called before the node is aborted, and the writer is stopped
+ * at shutdown.
+ */
+void StartLogWriter()
+{
+    if (!LogInstance().m_print_to_file) return;
+    std::call_once(debugLogInitFlag, &DebugLogInit);
+    if (fileout == nullptr) return;
+
+    std::lock_guard<std::mutex> lock(*mutexDebugLog);
+    if (fLogWriterRunning) return;
+
+    fLogWriterRunning = true;
+    fLogWriterStop = false;
+    threadLogWriter = std::thread(&TraceThread<void (*)()>, "omnilog", &ThreadLogWriter);
+}
+
+/**
+ * Writes all buffered messages and stops the background writer.
+ */
+void StopLogWriter()
+{
+    if (mutexDebugLog == nullptr) return;
+    {
+        std::lock_guard<std::mutex> lock(*mutexDebugLog);
+        if (!fLogWriterRunning) return;
+
+        fLogWriterStop = true;
+        condLogWriter->notify_one();
+    }
+
+    threadLogWriter.join();
+
+    // Write messages, which were logged while the writer was stopping
+    std::unique_lock<std::mutex> lock(*mutexDebugLog);
+    fLogWriterRunning = false;
+    WriteLogBuffer(lock);
+}
+
+/**
+ * Writes all buffered messages to the log file.
+ */
+void FlushLog()
+{
+    if (mutexDebugLog == nullptr || fileout == nullptr) return;
+
+    std::unique_lock<std::mutex> lock(*mutexDebugLog);
+    WriteLogBuffer(lock);
+}
+
 /**
  * Prints to the standard output, usually the console.
  *
@@ -265,6 +401,7 @@ void InitDebugLogLevels()
         if (*it == "consensus_hash_every_block") msc_debug_consensus_hash_every_block = true;
         if (*it == "alerts") msc_debug_alerts = true;
         if (*it == "consensus_hash_every_transaction") msc_debug_consensus_hash_every_transaction = true;
+        if (*it == "consensus_hash_incremental") msc_debug_consensus_hash_incremental = true;
         if (*it == "fees") msc_debug_fees = true;
         if (*it == "nftdb") msc_debug_nftdb = true;
         if (*it == "none" || *it == "all") {
@@ -302,6 +439,7 @@ void InitDebugLogLevels()
             msc_debug_consensus_hash_every_block = allDebugState;
             msc_debug_alerts = allDebugState;
             msc_debug_consensus_hash_every_transaction = allDebugState;
+            msc_debug_consensus_hash_incremental = allDebugState;
             msc_debug_fees = allDebugState;
             msc_debug_nftdb = allDebugState;
         }
@@ -6,8 +6,17 @@
 
 #include <string>
 
-/** Prints to the log file. */
-int LogFilePrint(const std::string& str);
+/** Prints to the log file, and writes buffered messages immediately, if fFlush is set. */
+int LogFilePrint(const std::string& str, bool fFlush = false);
+
+/** Starts the background writer of the log file. */
+void StartLogWriter();
+
+/** Writes all buffered messages and stops the background writer. */
+void StopLogWriter();
+
+/** Writes all buffered messages to the log file. */
+void FlushLog();
 
 /** Prints to the console. */
 int ConsolePrint(const std::string& str);
@@ -51,6 +60,7 @@ extern bool msc_debug_consensus_hash;
 extern bool msc_debug_consensus_hash_every_block;
 extern bool msc_debug_alerts;
 extern bool msc_debug_consensus_hash_every_transaction;
+extern bool msc_debug_consensus_hash_incremental;
 extern bool msc_debug_fees;
 extern bool msc_debug_nftdb;
 
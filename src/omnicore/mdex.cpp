@@ -1,5 +1,6 @@
 #include <omnicore/mdex.h>
 
+#include <omnicore/consensushash.h>
 #include <omnicore/dbfees.h>
 #include <omnicore/dbtradelist.h>
 #include <omnicore/dbtxlist.h>
@@ -13,6 +14,7 @@
 #include <hash.h>
 #include <validation.h>
 #include <tinyformat.h>
+#include <txmempool.h>
 #include <uint256.h>
 
 #include <univalue.h>
@@ -23,11 +25,15 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <fstream>
 #include <limits>
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 typedef boost::multiprecision::cpp_dec_float_100 dec_float;
 typedef boost::multiprecision::checked_int128_t int128_t;
@@ -40,16 +46,52 @@ using namespace mastercore;
 //! Global map for price and order data
 md_PropertiesMap mastercore::metadex;
 
-md_PricesMap* mastercore::get_Prices(uint32_t prop)
+//! Index of the orders in the order books by transaction hash
+static std::unordered_map<uint256, const CMPMetaDEx*, SaltedTxidHasher> metadexOrders;
+
+/**
+ * Inserts an order into a set of the order books, and adds it to the index and consensus hash.
+ */
+static bool InsertOrder(md_Set& indexes, const CMPMetaDEx& obj)
+{
+    std::pair<md_Set::iterator, bool> ret = indexes.insert(obj);
+    if (!ret.second) return false;
+
+    metadexOrders[obj.getHash()] = &(*ret.first);
+    ConsensusHashAddMetaDEx(obj);
+
+    return true;
+}
+
+/**
+ * Removes an order from a set of the order books, and from the index and consensus hash.
+ *
+ * @return The iterator following the removed order
+ */
+static md_Set::iterator EraseOrder(md_Set& indexes, md_Set::iterator it)
 {
-    md_PropertiesMap::iterator it = metadex.find(prop);
+    ConsensusHashRemoveMetaDEx(*it);
+    metadexOrders.erase(it->getHash());
+
+    return indexes.erase(it);
+}
+
+void mastercore::MetaDEx_Clear()
+{
+    metadex.clear();
+    metadexOrders.clear();
+}
+
+md_PricesMap* mastercore::get_Prices(uint32_t propertyForSale, uint32_t propertyDesired)
+{
+    md_PropertiesMap::iterator it = metadex.find(std::make_pair(propertyForSale, propertyDesired));
 
     if (it != metadex.end()) return &(it->second);
 
     return static_cast<md_PricesMap*>(nullptr);
 }
 
-md_Set* mastercore::get_Indexes(md_PricesMap* p, rational_t price)
+md_Set* mastercore::get_Indexes(md_PricesMap* p, const CMPMetaDExPrice& price)
 {
     md_PricesMap::iterator it = p->find(price);
 
@@ -126,6 +168,11 @@ std::string xToString(const rational_t& value)
     }
 }
 
+std::string xToString(const CMPMetaDExPrice& value)
+{
+    return xToString(value.toRational());
+}
+
 // find the best match on the market
 // NOTE: sometimes I refer to the older order as seller & the newer order as buyer, in this trade
 // INPUT: property, desprop, desprice = of the new order being inserted; the new object being processed
@@ -134,13 +181,15 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
 {
     const uint32_t propertyForSale = pnew->getProperty();
     const uint32_t propertyDesired = pnew->getDesProperty();
+    const CMPMetaDExPrice buyersPrice = pnew->getInversePrice();
     MatchReturnType NewReturn = NOTHING;
     bool bBuyerSatisfied = false;
 
     if (msc_debug_metadex1) PrintToLog("%s(%s: prop=%d, desprop=%d, desprice= %s);newo: %s\n",
         __FUNCTION__, pnew->getAddr(), propertyForSale, propertyDesired, xToString(pnew->inversePrice()), pnew->ToString());
 
-    md_PricesMap* const ppriceMap = get_Prices(propertyDesired);
+    // the opposite side of the book: orders selling the desired property for the property offered
+    md_PricesMap* const ppriceMap = get_Prices(propertyDesired, propertyForSale);
 
     // nothing for the desired property exists in the market, sorry!
     if (!ppriceMap) {
@@ -148,16 +197,18 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
         return NewReturn;
     }
 
-    // within the desired property map (given one property) iterate over the items looking at prices
-    for (md_PricesMap::iterator priceIt = ppriceMap->begin(); priceIt != ppriceMap->end(); ++priceIt) { // check all prices
-        const rational_t sellersPrice = priceIt->first;
+    // iterate over the price levels of the pair, starting with the best (lowest) price
+    md_PricesMap::iterator priceIt = ppriceMap->begin();
+    while (priceIt != ppriceMap->end()) { // check all prices
+        const CMPMetaDExPrice& sellersPrice = priceIt->first;
 
         if (msc_debug_metadex2) PrintToLog("comparing prices: desprice %s needs to be GREATER THAN OR EQUAL TO %s\n",
-            xToString(pnew->inversePrice()), xToString(sellersPrice));
+            xToString(buyersPrice), xToString(sellersPrice));
 
         // Is the desired price check satisfied? The buyer's inverse price must be larger than that of the seller.
-        if (pnew->inversePrice() < sellersPrice) {
-            continue;
+        // Price levels are ordered, so none of the following ones can satisfy it either.
+        if (buyersPrice < sellersPrice) {
+            break;
         }
 
         md_Set* const pofferSet = &(priceIt->second);
@@ -166,17 +217,11 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
         md_Set::iterator offerIt = pofferSet->begin();
         while (offerIt != pofferSet->end()) { // specific price, check all properties
             const CMPMetaDEx* const pold = &(*offerIt);
-            assert(pold->unitPrice() == sellersPrice);
+            assert(pold->getUnitPrice() == sellersPrice);
 
             if (msc_debug_metadex1) PrintToLog("Looking at existing: %s (its prop= %d, its des prop= %d) = %s\n",
                 xToString(sellersPrice), pold->getProperty(), pold->getDesProperty(), pold->ToString());
 
-            // does the desired property match?
-            if (pold->getDesProperty() != propertyForSale) {
-                ++offerIt;
-                continue;
-            }
-
             if (msc_debug_metadex1) PrintToLog("MATCH FOUND, Trade: %s = %s\n", xToString(sellersPrice), pold->ToString());
 
             // match found, execute trade now!
@@ -196,8 +241,8 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
             assert(pnew->getProperty() != pnew->getDesProperty());
             assert(pnew->getProperty() == pold->getDesProperty());
             assert(pold->getProperty() == pnew->getDesProperty());
-            assert(pold->unitPrice() <= pnew->inversePrice());
-            assert(pnew->unitPrice() <= pold->inversePrice());
+            assert(sellersPrice <= buyersPrice);
+            assert(pnew->getUnitPrice() <= pold->getInversePrice());
 
             ///////////////////////////
 
@@ -230,9 +275,9 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
 
             // If the resulting adjusted unit price is higher than Alice' price, the
             // orders shall not execute, and no representable fill is made
-            const rational_t xEffectivePrice(nWouldPay, nCouldBuy);
+            const CMPMetaDExPrice xEffectivePrice(nWouldPay, nCouldBuy);
 
-            if (xEffectivePrice > pnew->inversePrice()) {
+            if (xEffectivePrice > buyersPrice) {
                 if (msc_debug_metadex1) PrintToLog(
                         "-- effective price is too expensive: %s\n", xToString(xEffectivePrice));
                 ++offerIt;
@@ -250,8 +295,8 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
             ///////////////////////////
 
             // postconditions
-            assert(xEffectivePrice >= pold->unitPrice());
-            assert(xEffectivePrice <= pnew->inversePrice());
+            assert(xEffectivePrice >= sellersPrice);
+            assert(xEffectivePrice <= buyersPrice);
             assert(0 <= seller_amountLeft);
             assert(0 <= buyer_amountLeft);
             assert(seller_amountForSale == seller_amountLeft + buyer_amountGot);
@@ -313,12 +358,12 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
 
             if (msc_debug_metadex1) PrintToLog("++ erased old: %s\n", offerIt->ToString());
             // erase the old seller element
-            pofferSet->erase(offerIt++);
+            offerIt = EraseOrder(*pofferSet, offerIt);
 
             // insert the updated one in place of the old
             if (0 < seller_replacement.getAmountRemaining()) {
                 PrintToLog("++ inserting seller_replacement: %s\n", seller_replacement.ToString());
-                pofferSet->insert(seller_replacement);
+                InsertOrder(*pofferSet, seller_replacement);
             }
 
             if (bBuyerSatisfied) {
@@ -327,6 +372,13 @@ static MatchReturnType x_Trade(CMPMetaDEx* const pnew)
             }
         } // specific price, check all properties
 
+        // drop exhausted price levels, so later matching starts at a live one
+        if (pofferSet->empty()) {
+            ppriceMap->erase(priceIt++);
+        } else {
+            ++priceIt;
+        }
+
         if (bBuyerSatisfied) break;
     } // check all prices
 
@@ -420,32 +472,10 @@ void CMPMetaDEx::setAmountRemaining(int64_t amount, const std::string& label)
 std::string CMPMetaDEx::ToString() const
 {
     return strprintf("%s:%34s in %d/%03u, txid: %s , trade #%u %s for #%u %s",
-        xToString(unitPrice()), addr, block, idx, txid.ToString().substr(0, 10),
+        xToString(getUnitPrice()), addr, block, idx, txid.ToString().substr(0, 10),
         property, FormatMP(property, amount_forsale), desired_property, FormatMP(desired_property, amount_desired));
 }
 
-void CMPMetaDEx::saveOffer(std::ofstream& file, CHash256 &hasher) const
-{
-    std::string lineOut = strprintf("%s,%d,%d,%d,%d,%d,%d,%d,%s,%d",
-        addr,
-        block,
-        amount_forsale,
-        property,
-        amount_desired,
-        desired_property,
-        subaction,
-        idx,
-        txid.ToString(),
-        amount_remaining
-    );
-
-    // add the line to the hash
-    hasher.Write((unsigned char*)lineOut.c_str(), lineOut.length());
-
-    // write the line
-    file << lineOut << std::endl;
-}
-
 bool MetaDEx_compare::operator()(const CMPMetaDEx &lhs, const CMPMetaDEx &rhs) const
 {
     if (lhs.getBlock() == rhs.getBlock()) return lhs.getIdx() < rhs.getIdx();
@@ -454,37 +484,12 @@ bool MetaDEx_compare::operator()(const CMPMetaDEx &lhs, const CMPMetaDEx &rhs) c
 
 bool mastercore::MetaDEx_INSERT(const CMPMetaDEx& objMetaDEx)
 {
-    // Create an empty price map (to use in case price map for this property does not already exist)
-    md_PricesMap temp_prices;
-    // Attempt to obtain the price map for the property
-    md_PricesMap *p_prices = get_Prices(objMetaDEx.getProperty());
-
-    // Create an empty set of metadex objects (to use in case no set currently exists at this price)
-    md_Set temp_indexes;
-    md_Set *p_indexes = nullptr;
-
-    // Prepare for return code
-    std::pair <md_Set::iterator, bool> ret;
-
-    // Attempt to obtain a set of metadex objects for this price from the price map
-    if (p_prices) p_indexes = get_Indexes(p_prices, objMetaDEx.unitPrice());
-    // See if the set was populated, if not no set exists at this price level, use the empty set that we created earlier
-    if (!p_indexes) p_indexes = &temp_indexes;
+    // Obtain the set of metadex objects for this pair and price, which is created, if it doesn't exist yet
+    md_PricesMap& prices = metadex[std::make_pair(objMetaDEx.getProperty(), objMetaDEx.getDesProperty())];
+    md_Set& indexes = prices[objMetaDEx.getUnitPrice()];
 
     // Attempt to insert the metadex object into the set
-    ret = p_indexes->insert(objMetaDEx);
-    if (false == ret.second) return false;
-
-    // If a prices map did not exist for this property, set p_prices to the temp empty price map
-    if (!p_prices) p_prices = &temp_prices;
-
-    // Update the prices map with the new set at this price
-    (*p_prices)[objMetaDEx.unitPrice()] = *p_indexes;
-
-    // Set the metadex map for the property to the updated (or new if it didn't exist) price map
-    metadex[objMetaDEx.getProperty()] = *p_prices;
-
-    return true;
+    return InsertOrder(indexes, objMetaDEx);
 }
 
 // pretty much directly linked to the ADD TX21 command off the wire
@@ -497,7 +502,7 @@ int mastercore::MetaDEx_ADD(const std::string& sender_addr, uint32_t prop, int64
     if (msc_debug_metadex1) PrintToLog("%s(); buyer obj: %s\n", __FUNCTION__, new_mdex.ToString());
 
     // Ensure this is not a badly priced trade (for example due to zero amounts)
-    if (0 >= new_mdex.unitPrice()) return METADEX_ERROR -66;
+    if (new_mdex.getUnitPrice() <= CMPMetaDExPrice()) return METADEX_ERROR -66;
 
     // Match against existing trades, remainder of the order will be put into the order book
     if (msc_debug_metadex3) MetaDEx_debug_print();
@@ -514,7 +519,7 @@ int mastercore::MetaDEx_ADD(const std::string& sender_addr, uint32_t prop, int64
             assert(update_tally_map(sender_addr, prop, -new_mdex.getAmountRemaining(), BALANCE));
             assert(update_tally_map(sender_addr, prop, new_mdex.getAmountRemaining(), METADEX_RESERVE));
 
-            if (msc_debug_metadex1) PrintToLog("==== INSERTED: %s= %s\n", xToString(new_mdex.unitPrice()), new_mdex.ToString());
+            if (msc_debug_metadex1) PrintToLog("==== INSERTED: %s= %s\n", xToString(new_mdex.getUnitPrice()), new_mdex.ToString());
             if (msc_debug_metadex3) MetaDEx_debug_print();
         }
     }
@@ -527,7 +532,7 @@ int mastercore::MetaDEx_CANCEL_AT_PRICE(const uint256& txid, unsigned int block,
 {
     int rc = METADEX_ERROR -20;
     CMPMetaDEx mdex(sender_addr, 0, prop, amount, property_desired, amount_desired, uint256(), 0, CMPTransaction::CANCEL_AT_PRICE);
-    md_PricesMap* prices = get_Prices(prop);
+    md_PricesMap* prices = get_Prices(prop, property_desired);
     const CMPMetaDEx* p_mdex = nullptr;
 
     if (msc_debug_metadex1) PrintToLog("%s():%s\n", __FUNCTION__, mdex.ToString());
@@ -539,12 +544,9 @@ int mastercore::MetaDEx_CANCEL_AT_PRICE(const uint256& txid, unsigned int block,
         return rc -1;
     }
 
-    // within the desired property map (given one property) iterate over the items
-    for (md_PricesMap::iterator my_it = prices->begin(); my_it != prices->end(); ++my_it) {
-        rational_t sellers_price = my_it->first;
-
-        if (mdex.unitPrice() != sellers_price) continue;
-
+    // within the book of the pair only the given price level is relevant
+    md_PricesMap::iterator my_it = prices->find(mdex.getUnitPrice());
+    if (my_it != prices->end()) {
         md_Set* indexes = &(my_it->second);
 
         for (md_Set::iterator iitt = indexes->begin(); iitt != indexes->end();) {
@@ -552,7 +554,7 @@ int mastercore::MetaDEx_CANCEL_AT_PRICE(const uint256& txid, unsigned int block,
 
             if (msc_debug_metadex3) PrintToLog("%s(): %s\n", __FUNCTION__, p_mdex->ToString());
 
-            if ((p_mdex->getDesProperty() != property_desired) || (p_mdex->getAddr() != sender_addr)) {
+            if (p_mdex->getAddr() != sender_addr) {
                 ++iitt;
                 continue;
             }
@@ -568,7 +570,7 @@ int mastercore::MetaDEx_CANCEL_AT_PRICE(const uint256& txid, unsigned int block,
             bool bValid = true;
             pDbTransactionList->recordMetaDExCancelTX(txid, p_mdex->getHash(), bValid, block, p_mdex->getProperty(), p_mdex->getAmountRemaining());
 
-            indexes->erase(iitt++);
+            iitt = EraseOrder(*indexes, iitt);
         }
     }
 
@@ -580,7 +582,7 @@ int mastercore::MetaDEx_CANCEL_AT_PRICE(const uint256& txid, unsigned int block,
 int mastercore::MetaDEx_CANCEL_ALL_FOR_PAIR(const uint256& txid, unsigned int block, const std::string& sender_addr, uint32_t prop, uint32_t property_desired)
 {
     int rc = METADEX_ERROR -30;
-    md_PricesMap* prices = get_Prices(prop);
+    md_PricesMap* prices = get_Prices(prop, property_desired);
     const CMPMetaDEx* p_mdex = nullptr;
 
     PrintToLog("%s(%d,%d)\n", __FUNCTION__, prop, property_desired);
@@ -592,7 +594,7 @@ int mastercore::MetaDEx_CANCEL_ALL_FOR_PAIR(const uint256& txid, unsigned int bl
         return rc -1;
     }
 
-    // within the desired property map (given one property) iterate over the items
+    // within the book of the pair iterate over the items
     for (md_PricesMap::iterator my_it = prices->begin(); my_it != prices->end(); ++my_it) {
         md_Set* indexes = &(my_it->second);
 
@@ -601,7 +603,7 @@ int mastercore::MetaDEx_CANCEL_ALL_FOR_PAIR(const uint256& txid, unsigned int bl
 
             if (msc_debug_metadex3) PrintToLog("%s(): %s\n", __FUNCTION__, p_mdex->ToString());
 
-            if ((p_mdex->getDesProperty() != property_desired) || (p_mdex->getAddr() != sender_addr)) {
+            if (p_mdex->getAddr() != sender_addr) {
                 ++iitt;
                 continue;
             }
@@ -617,7 +619,7 @@ int mastercore::MetaDEx_CANCEL_ALL_FOR_PAIR(const uint256& txid, unsigned int bl
             bool bValid = true;
             pDbTransactionList->recordMetaDExCancelTX(txid, p_mdex->getHash(), bValid, block, p_mdex->getProperty(), p_mdex->getAmountRemaining());
 
-            indexes->erase(iitt++);
+            iitt = EraseOrder(*indexes, iitt);
         }
     }
 
@@ -626,6 +628,25 @@ int mastercore::MetaDEx_CANCEL_ALL_FOR_PAIR(const uint256& txid, unsigned int bl
     return rc;
 }
 
+namespace {
+/** Reference to an order in the books, ordered by unit price and position. */
+struct BookOrder
+{
+    CMPMetaDExPrice price;
+    md_Set* indexes;
+    md_Set::iterator it;
+
+    BookOrder(const CMPMetaDExPrice& priceIn, md_Set* indexesIn, md_Set::iterator itIn)
+      : price(priceIn), indexes(indexesIn), it(itIn) {}
+
+    bool operator<(const BookOrder& other) const
+    {
+        if (price != other.price) return price < other.price;
+        return MetaDEx_compare()(*it, *other.it);
+    }
+};
+} // namespace
+
 /**
  * Scans the orderbook and remove everything for an address.
  */
@@ -639,43 +660,51 @@ int mastercore::MetaDEx_CANCEL_EVERYTHING(const uint256& txid, unsigned int bloc
 
     PrintToLog("<<<<<<\n");
 
-    for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        unsigned int prop = my_it->first;
+    md_PropertiesMap::iterator my_it = metadex.begin();
+    while (my_it != metadex.end()) {
+        const uint32_t prop = my_it->first.first;
+        // the books of all pairs, which offer this property for sale
+        const md_PropertiesMap::iterator end_it = metadex.upper_bound(std::make_pair(prop, std::numeric_limits<uint32_t>::max()));
 
         // skip property, if it is not in the expected ecosystem
-        if (isMainEcosystemProperty(ecosystem) && !isMainEcosystemProperty(prop)) continue;
-        if (isTestEcosystemProperty(ecosystem) && !isTestEcosystemProperty(prop)) continue;
+        if ((isMainEcosystemProperty(ecosystem) && !isMainEcosystemProperty(prop)) ||
+                (isTestEcosystemProperty(ecosystem) && !isTestEcosystemProperty(prop))) {
+            my_it = end_it;
+            continue;
+        }
 
         PrintToLog(" ## property: %u\n", prop);
-        md_PricesMap& prices = my_it->second;
 
-        for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
-            rational_t price = it->first;
-            md_Set& indexes = it->second;
-
-            PrintToLog("  # Price Level: %s\n", xToString(price));
-
-            for (md_Set::iterator it = indexes.begin(); it != indexes.end();) {
-                PrintToLog("%s= %s\n", xToString(price), it->ToString());
-
-                if (it->getAddr() != sender_addr) {
-                    ++it;
-                    continue;
+        // collect the orders of the sender, and cancel them in the order of price and
+        // position over all pairs, so cancellation records keep their sequence
+        std::vector<BookOrder> orders;
+        for (; my_it != end_it; ++my_it) {
+            md_PricesMap& prices = my_it->second;
+            for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
+                md_Set& indexes = it->second;
+                for (md_Set::iterator iitt = indexes.begin(); iitt != indexes.end(); ++iitt) {
+                    if (iitt->getAddr() != sender_addr) continue;
+                    orders.push_back(BookOrder(it->first, &indexes, iitt));
                 }
+            }
+        }
+        std::sort(orders.begin(), orders.end());
 
-                rc = 0;
-                PrintToLog("%s(): REMOVING %s\n", __FUNCTION__, it->ToString());
+        for (std::vector<BookOrder>::iterator order = orders.begin(); order != orders.end(); ++order) {
+            const CMPMetaDEx& obj = *order->it;
 
-                // move from reserve to balance
-                assert(update_tally_map(it->getAddr(), it->getProperty(), -it->getAmountRemaining(), METADEX_RESERVE));
-                assert(update_tally_map(it->getAddr(), it->getProperty(), it->getAmountRemaining(), BALANCE));
+            rc = 0;
+            PrintToLog("%s(): REMOVING %s\n", __FUNCTION__, obj.ToString());
 
-                // record the cancellation
-                bool bValid = true;
-                pDbTransactionList->recordMetaDExCancelTX(txid, it->getHash(), bValid, block, it->getProperty(), it->getAmountRemaining());
+            // move from reserve to balance
+            assert(update_tally_map(obj.getAddr(), obj.getProperty(), -obj.getAmountRemaining(), METADEX_RESERVE));
+            assert(update_tally_map(obj.getAddr(), obj.getProperty(), obj.getAmountRemaining(), BALANCE));
 
-                indexes.erase(it++);
-            }
+            // record the cancellation
+            bool bValid = true;
+            pDbTransactionList->recordMetaDExCancelTX(txid, obj.getHash(), bValid, block, obj.getProperty(), obj.getAmountRemaining());
+
+            EraseOrder(*order->indexes, order->it);
         }
     }
     PrintToLog(">>>>>>\n");
@@ -693,17 +722,17 @@ int mastercore::MetaDEx_SHUTDOWN_ALLPAIR()
     int rc = 0;
     PrintToLog("%s()\n", __FUNCTION__);
     for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
+        const md_PropertyPair& pair = my_it->first;
+        if (pair.first <= OMNI_PROPERTY_TMSC || pair.second <= OMNI_PROPERTY_TMSC) continue; // OMN/TOMN side to the trade
         md_PricesMap& prices = my_it->second;
         for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
             md_Set& indexes = it->second;
             for (md_Set::iterator it = indexes.begin(); it != indexes.end();) {
-                if (it->getDesProperty() > OMNI_PROPERTY_TMSC && it->getProperty() > OMNI_PROPERTY_TMSC) { // no OMN/TOMN side to the trade
-                    PrintToLog("%s(): REMOVING %s\n", __FUNCTION__, it->ToString());
-                    // move from reserve to balance
-                    assert(update_tally_map(it->getAddr(), it->getProperty(), -it->getAmountRemaining(), METADEX_RESERVE));
-                    assert(update_tally_map(it->getAddr(), it->getProperty(), it->getAmountRemaining(), BALANCE));
-                    indexes.erase(it++);
-                }
+                PrintToLog("%s(): REMOVING %s\n", __FUNCTION__, it->ToString());
+                // move from reserve to balance
+                assert(update_tally_map(it->getAddr(), it->getProperty(), -it->getAmountRemaining(), METADEX_RESERVE));
+                assert(update_tally_map(it->getAddr(), it->getProperty(), it->getAmountRemaining(), BALANCE));
+                it = EraseOrder(indexes, it);
             }
         }
     }
@@ -726,29 +755,21 @@ int mastercore::MetaDEx_SHUTDOWN()
                 // move from reserve to balance
                 assert(update_tally_map(it->getAddr(), it->getProperty(), -it->getAmountRemaining(), METADEX_RESERVE));
                 assert(update_tally_map(it->getAddr(), it->getProperty(), it->getAmountRemaining(), BALANCE));
-                indexes.erase(it++);
+                it = EraseOrder(indexes, it);
             }
         }
     }
     return rc;
 }
 
-// searches the metadex maps to see if a trade is still open
-// allows search to be optimized if propertyIdForSale is specified
+// checks the order index to see if a trade is still open
+// if propertyIdForSale is specified, the trade must also offer this property
 bool mastercore::MetaDEx_isOpen(const uint256& txid, uint32_t propertyIdForSale)
 {
-    for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        if (propertyIdForSale != 0 && propertyIdForSale != my_it->first) continue;
-        md_PricesMap & prices = my_it->second;
-        for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
-            md_Set & indexes = (it->second);
-            for (md_Set::iterator it = indexes.begin(); it != indexes.end(); ++it) {
-                CMPMetaDEx obj = *it;
-                if( obj.getHash().GetHex() == txid.GetHex() ) return true;
-            }
-        }
-    }
-    return false;
+    const CMPMetaDEx* pobj = MetaDEx_RetrieveTrade(txid);
+    if (!pobj) return false;
+
+    return (propertyIdForSale == 0 || propertyIdForSale == pobj->getProperty());
 }
 
 /**
@@ -807,13 +828,13 @@ void mastercore::MetaDEx_debug_print(bool bShowPriceLevel, bool bDisplay)
 {
     PrintToLog("<<<\n");
     for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        uint32_t prop = my_it->first;
+        const md_PropertyPair& pair = my_it->first;
 
-        PrintToLog(" ## property: %u\n", prop);
+        PrintToLog(" ## property: %u for %u\n", pair.first, pair.second);
         md_PricesMap& prices = my_it->second;
 
         for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
-            rational_t price = it->first;
+            const CMPMetaDExPrice& price = it->first;
             md_Set& indexes = it->second;
 
             if (bShowPriceLevel) PrintToLog("  # Price Level: %s\n", xToString(price));
@@ -835,14 +856,8 @@ void mastercore::MetaDEx_debug_print(bool bShowPriceLevel, bool bDisplay)
  */
 const CMPMetaDEx* mastercore::MetaDEx_RetrieveTrade(const uint256& txid)
 {
-    for (md_PropertiesMap::iterator propIter = metadex.begin(); propIter != metadex.end(); ++propIter) {
-        md_PricesMap & prices = propIter->second;
-        for (md_PricesMap::iterator pricesIter = prices.begin(); pricesIter != prices.end(); ++pricesIter) {
-            md_Set & indexes = pricesIter->second;
-            for (md_Set::iterator tradesIter = indexes.begin(); tradesIter != indexes.end(); ++tradesIter) {
-                if (txid == (*tradesIter).getHash()) return &(*tradesIter);
-            }
-        }
-    }
+    std::unordered_map<uint256, const CMPMetaDEx*, SaltedTxidHasher>::const_iterator it = metadexOrders.find(txid);
+    if (it != metadexOrders.end()) return it->second;
+
     return static_cast<CMPMetaDEx*>(nullptr);
 }
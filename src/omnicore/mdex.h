@@ -3,6 +3,7 @@
 
 #include <omnicore/tx.h>
 
+#include <serialize.h>
 #include <uint256.h>
 
 #include <boost/lexical_cast.hpp>
@@ -12,12 +13,10 @@
 
 #include <stdint.h>
 
-#include <fstream>
 #include <map>
 #include <set>
 #include <string>
-
-class CHash256;
+#include <utility>
 
 typedef boost::rational<boost::multiprecision::checked_int128_t> rational_t;
 
@@ -32,6 +31,61 @@ typedef boost::rational<boost::multiprecision::checked_int128_t> rational_t;
 /** Converts price to string. */
 std::string xToString(const rational_t& value);
 
+/** Price of a trade as ratio of two amounts, compared without normalization.
+ *
+ * Prices are compared by cross-multiplication with 128 bit integers, which orders
+ * them exactly like the corresponding rational_t values, but avoids the checked
+ * arithmetic and the gcd normalization of boost::rational.
+ */
+class CMPMetaDExPrice
+{
+private:
+    int64_t numerator;
+    int64_t denominator;
+
+#ifdef __SIZEOF_INT128__
+    typedef __int128 int128;
+#else
+    typedef boost::multiprecision::int128_t int128;
+#endif
+
+    /** Returns -1, 0 or 1, if this price is lower than, equal to or higher than the other one. */
+    int compare(const CMPMetaDExPrice& other) const
+    {
+        int128 lhs = int128(numerator) * int128(other.denominator);
+        int128 rhs = int128(other.numerator) * int128(denominator);
+        if (lhs == rhs) return 0;
+        // the comparison is reversed, if exactly one of the denominators is negative
+        bool fLess = (lhs < rhs) != ((denominator < 0) != (other.denominator < 0));
+        return fLess ? -1 : 1;
+    }
+
+public:
+    /** Creates a price of zero. */
+    CMPMetaDExPrice() : numerator(0), denominator(1) {}
+
+    /** Creates the price num/denom, which is zero, like the rational_t prices, if denom is zero. */
+    CMPMetaDExPrice(int64_t num, int64_t denom) : numerator(num), denominator(denom)
+    {
+        if (denominator == 0) {
+            numerator = 0;
+            denominator = 1;
+        }
+    }
+
+    rational_t toRational() const { return rational_t(numerator, denominator); }
+
+    bool operator<(const CMPMetaDExPrice& other) const { return compare(other) < 0; }
+    bool operator>(const CMPMetaDExPrice& other) const { return compare(other) > 0; }
+    bool operator<=(const CMPMetaDExPrice& other) const { return compare(other) <= 0; }
+    bool operator>=(const CMPMetaDExPrice& other) const { return compare(other) >= 0; }
+    bool operator==(const CMPMetaDExPrice& other) const { return compare(other) == 0; }
+    bool operator!=(const CMPMetaDExPrice& other) const { return compare(other) != 0; }
+};
+
+/** Converts price to string. */
+std::string xToString(const CMPMetaDExPrice& value);
+
 /** A trade on the distributed exchange.
  */
 class CMPMetaDEx
@@ -94,12 +148,31 @@ public:
     rational_t unitPrice() const;
     rational_t inversePrice() const;
 
+    /** Unit price as used for the order books and matching: amount desired per unit for sale. */
+    CMPMetaDExPrice getUnitPrice() const { return CMPMetaDExPrice(amount_desired, amount_forsale); }
+    /** Inverse price as used for matching: amount for sale per unit desired. */
+    CMPMetaDExPrice getInversePrice() const { return CMPMetaDExPrice(amount_forsale, amount_desired); }
+
     /** Used for display of unit prices to 8 decimal places at UI layer. */
     std::string displayUnitPrice() const;
     /** Used for display of unit prices with 50 decimal places at RPC layer. */
     std::string displayFullUnitPrice() const;
 
-    void saveOffer(std::ofstream& file, CHash256 &hasher) const;
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(addr);
+        READWRITE(block);
+        READWRITE(amount_forsale);
+        READWRITE(property);
+        READWRITE(amount_desired);
+        READWRITE(desired_property);
+        READWRITE(subaction);
+        READWRITE(idx);
+        READWRITE(txid);
+        READWRITE(amount_remaining);
+    }
 };
 
 namespace mastercore
@@ -113,16 +186,17 @@ struct MetaDEx_compare
 //! Set of objects sorted by block+idx
 typedef std::set<CMPMetaDEx, MetaDEx_compare> md_Set; 
 //! Map of prices; there is a set of sorted objects for each price
-typedef std::map<rational_t, md_Set> md_PricesMap;
-//! Map of properties; there is a map of prices for each property
-typedef std::map<uint32_t, md_PricesMap> md_PropertiesMap;
+typedef std::map<CMPMetaDExPrice, md_Set> md_PricesMap;
+//! Property pair of the orders in a book: property for sale and property desired
+typedef std::pair<uint32_t, uint32_t> md_PropertyPair;
+//! Map of property pairs; there is a map of prices for each pair, lowest unit price first
+typedef std::map<md_PropertyPair, md_PricesMap> md_PropertiesMap;
 
-//! Global map for price and order data
+//! Global map for price and order data, only to be modified via the MetaDEx functions, which maintain the order index
 extern md_PropertiesMap metadex;
 
-// TODO: explore a property-pair, instead of a single property as map's key........
-md_PricesMap* get_Prices(uint32_t prop);
-md_Set* get_Indexes(md_PricesMap* p, rational_t price);
+md_PricesMap* get_Prices(uint32_t propertyForSale, uint32_t propertyDesired);
+md_Set* get_Indexes(md_PricesMap* p, const CMPMetaDExPrice& price);
 // ---------------
 
 int MetaDEx_ADD(const std::string& sender_addr, uint32_t, int64_t, int block, uint32_t property_desired, int64_t amount_desired, const uint256& txid, unsigned int idx);
@@ -132,12 +206,14 @@ int MetaDEx_CANCEL_EVERYTHING(const uint256& txid, uint32_t block, const std::st
 int MetaDEx_SHUTDOWN();
 int MetaDEx_SHUTDOWN_ALLPAIR();
 bool MetaDEx_INSERT(const CMPMetaDEx& objMetaDEx);
+// Removes all orders from the MetaDEx maps without touching balances
+void MetaDEx_Clear();
 void MetaDEx_debug_print(bool bShowPriceLevel = false, bool bDisplay = false);
 bool MetaDEx_isOpen(const uint256& txid, uint32_t propertyIdForSale = 0);
 int MetaDEx_getStatus(const uint256& txid, uint32_t propertyIdForSale, int64_t amountForSale, int64_t totalSold = -1);
 std::string MetaDEx_getStatusText(int tradeStatus);
 
-// Locates a trade in the MetaDEx maps via txid and returns the trade object
+// Locates an open trade via txid and returns the trade object, or nullptr
 const CMPMetaDEx* MetaDEx_RetrieveTrade(const uint256& txid);
 
 }
@@ -10,50 +10,118 @@
 #include <omnicore/errors.h>
 #include <omnicore/log.h>
 
+#include <crypto/common.h>
 #include <validation.h>
 
+#include <leveldb/iterator.h>
+#include <leveldb/slice.h>
+
 #include <stdint.h>
 
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
+#include <limits>
+#include <string>
 
 typedef std::underlying_type<NonFungibleStorage>::type StorageType;
 
+//! Size of a DB key: property ID, storage type, range start and range end
+static const size_t NFT_KEY_SIZE = 4 + 1 + 8 + 8;
+//! Size of the prefix of a DB key, which covers the property ID and storage type
+static const size_t NFT_KEY_PREFIX_SIZE = 4 + 1;
+
+/* Encodes a token ID, so that the byte order of the encoding matches the numeric order
+ */
+static void WriteTokenId(unsigned char* ptr, int64_t tokenId)
+{
+    WriteBE64(ptr, static_cast<uint64_t>(tokenId) ^ 0x8000000000000000ULL);
+}
+
+/* Decodes a token ID
+ */
+static int64_t ReadTokenId(const unsigned char* ptr)
+{
+    return static_cast<int64_t>(ReadBE64(ptr) ^ 0x8000000000000000ULL);
+}
+
+/* Creates the key prefix for all ranges of a property and storage type
+ */
+static std::string RangePrefix(uint32_t propertyId, NonFungibleStorage type)
+{
+    unsigned char prefix[NFT_KEY_PREFIX_SIZE];
+    WriteBE32(prefix, propertyId);
+    prefix[4] = static_cast<StorageType>(type);
+    return std::string(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+}
+
+/* Creates the DB key of a range in the format property ID | storage type | range start | range end
+ *
+ * All parts are stored in big-endian byte order, so the ranges of a property and storage
+ * type are adjacent and ordered by range start.
+ */
+static std::string RangeKey(uint32_t propertyId, NonFungibleStorage type, int64_t start, int64_t end)
+{
+    unsigned char key[NFT_KEY_SIZE];
+    WriteBE32(key, propertyId);
+    key[4] = static_cast<StorageType>(type);
+    WriteTokenId(key + 5, start);
+    WriteTokenId(key + 13, end);
+    return std::string(reinterpret_cast<const char*>(key), sizeof(key));
+}
+
 /* Extracts the property ID from a DB key
  */
 uint32_t CMPNonFungibleTokensDB::GetPropertyIdFromKey(const std::string& key)
 {
-    std::vector<std::string> vPropertyId;
-    boost::split(vPropertyId, key, boost::is_any_of("_"), boost::token_compress_on);
-    assert(vPropertyId.size() == 3); // if size !=3 then we cannot trust the data in the DB and we must halt
-    return boost::lexical_cast<uint32_t>(vPropertyId[0]);
+    assert(key.size() == NFT_KEY_SIZE); // if the size differs, then we cannot trust the data in the DB and we must halt
+    return ReadBE32(reinterpret_cast<const unsigned char*>(key.data()));
 }
 
 /* Extracts the storage type from a DB key
  */
 NonFungibleStorage CMPNonFungibleTokensDB::GetTypeFromKey(const std::string& key)
 {
-    std::vector<std::string> vPropertyId;
-    boost::split(vPropertyId, key, boost::is_any_of("_"), boost::token_compress_on);
-    assert(vPropertyId.size() == 3); // if size !=3 then we cannot trust the data in the DB and we must halt
-    auto ch = boost::lexical_cast<uint32_t>(vPropertyId[1]);
-    return static_cast<NonFungibleStorage>(ch);
+    assert(key.size() == NFT_KEY_SIZE); // if the size differs, then we cannot trust the data in the DB and we must halt
+    return static_cast<NonFungibleStorage>(key[4]);
 }
 
 /* Extracts the range from a DB key
  */
 void CMPNonFungibleTokensDB::GetRangeFromKey(const std::string& key, int64_t *start, int64_t *end)
 {
-   std::vector<std::string> vPropertyId;
-   boost::split(vPropertyId, key, boost::is_any_of("_"), boost::token_compress_on);
-   assert(vPropertyId.size() == 3); // if size !=2 then we cannot trust the data in the DB and we must halt
+    assert(key.size() == NFT_KEY_SIZE); // if the size differs, then we cannot trust the data in the DB and we must halt
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(key.data());
+
+    *start = ReadTokenId(ptr + 5);
+    *end = ReadTokenId(ptr + 13);
+}
+
+/* Positions the iterator at the range of a property and storage type with the highest
+ * range start not above the token ID (returns false if there is no such range)
+ */
+bool CMPNonFungibleTokensDB::SeekLastRange(leveldb::Iterator* it, const uint32_t &propertyId, const int64_t &tokenId, const NonFungibleStorage type)
+{
+    const std::string target = RangeKey(propertyId, type, tokenId, std::numeric_limits<int64_t>::max());
 
-   std::vector<std::string> vRanges;
-   boost::split(vRanges, vPropertyId[2], boost::is_any_of("-"), boost::token_compress_on);
-   assert(vRanges.size() == 2); // if size !=2 then we cannot trust the data in the DB and we must halt
+    it->Seek(target);
+    if (!it->Valid()) {
+        it->SeekToLast();
+    } else if (it->key().ToString() != target) {
+        it->Prev();
+    }
+    ++nRead;
+
+    return it->Valid() && it->key().starts_with(RangePrefix(propertyId, type));
+}
+
+/* Positions the iterator at the range, which contains the token (returns false if not found)
+ */
+bool CMPNonFungibleTokensDB::SeekRange(leveldb::Iterator* it, const uint32_t &propertyId, const int64_t &tokenId, const NonFungibleStorage type)
+{
+    if (!SeekLastRange(it, propertyId, tokenId, type)) return false;
 
-   *start = boost::lexical_cast<int64_t>(vRanges[0]);
-   *end = boost::lexical_cast<int64_t>(vRanges[1]);
+    int64_t start, end;
+    GetRangeFromKey(it->key().ToString(), &start, &end);
+
+    return tokenId >= start && tokenId <= end;
 }
 
 /* Gets the range a non-fungible token is in
@@ -63,16 +131,11 @@ std::pair<int64_t,int64_t> CMPNonFungibleTokensDB::GetRange(const uint32_t &prop
     assert(pdb);
     leveldb::Iterator* it = NewIterator();
 
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (propertyId != GetPropertyIdFromKey(it->key().ToString()) ||
-                GetTypeFromKey(it->key().ToString()) != type) continue;
-
+    if (SeekRange(it, propertyId, tokenId, type)) {
         int64_t start, end;
         GetRangeFromKey(it->key().ToString(), &start, &end);
-        if (tokenId >= start && tokenId <= end) {
-            delete it;
-            return std::make_pair(start, end);
-        }
+        delete it;
+        return std::make_pair(start, end);
     }
 
     delete it;
@@ -83,29 +146,13 @@ std::pair<int64_t,int64_t> CMPNonFungibleTokensDB::GetRange(const uint32_t &prop
  */
 bool CMPNonFungibleTokensDB::IsRangeContiguous(const uint32_t &propertyId, const int64_t &rangeStart, const int64_t &rangeEnd)
 {
-
-    assert(pdb);
-    leveldb::Iterator* it = NewIterator();
-
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (propertyId != GetPropertyIdFromKey(it->key().ToString()) ||
-                GetTypeFromKey(it->key().ToString()) != NonFungibleStorage::RangeIndex) continue;
-
-        int64_t start, end;
-        GetRangeFromKey(it->key().ToString(), &start, &end);
-
-        if (rangeStart >= start && rangeStart <= end) {
-            delete it;
-            if (rangeEnd >= rangeStart && rangeEnd <= end) {
-                return true;
-            } else {
-                return false; // the start ID falls within this range but the end ID does not - not owned by a single address
-            }
-        }
+    std::pair<int64_t,int64_t> range = GetRange(propertyId, rangeStart, NonFungibleStorage::RangeIndex);
+    if (range.first == 0 && range.second == 0) {
+        return false; // range doesn't exist
     }
 
-    delete it;
-    return false; // range doesn't exist
+    // the start ID falls within this range, the end ID must as well to be owned by a single address
+    return rangeEnd >= rangeStart && rangeEnd <= range.second;
 }
 
 /* Moves a range of tokens (returns false if not able to move)
@@ -229,12 +276,15 @@ int64_t CMPNonFungibleTokensDB::GetHighestRangeEnd(const uint32_t &propertyId)
 {
     assert(pdb);
 
+    std::map<uint32_t, int64_t>::const_iterator itCached = highestRangeEnds.find(propertyId);
+    if (itCached != highestRangeEnds.end()) {
+        return itCached->second;
+    }
+
+    // ranges don't overlap, so the last range also has the highest end
     int64_t tokenCount = 0;
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (propertyId != GetPropertyIdFromKey(it->key().ToString()) ||
-                GetTypeFromKey(it->key().ToString()) != NonFungibleStorage::RangeIndex) continue;
-
+    if (SeekLastRange(it, propertyId, std::numeric_limits<int64_t>::max(), NonFungibleStorage::RangeIndex)) {
         int64_t start, end;
         GetRangeFromKey(it->key().ToString(), &start, &end);
 
@@ -243,6 +293,8 @@ int64_t CMPNonFungibleTokensDB::GetHighestRangeEnd(const uint32_t &propertyId)
         }
     }
     delete it;
+
+    highestRangeEnds[propertyId] = tokenCount;
     return tokenCount;
 }
 
@@ -251,10 +303,11 @@ int64_t CMPNonFungibleTokensDB::GetHighestRangeEnd(const uint32_t &propertyId)
 void CMPNonFungibleTokensDB::DeleteRange(const uint32_t &propertyId, const int64_t &tokenIdStart, const int64_t &tokenIdEnd, const NonFungibleStorage type)
 {
     assert(pdb);
-    const std::string key = strprintf("%010d_%u_%020d-%020d", propertyId, static_cast<StorageType>(type), tokenIdStart, tokenIdEnd);
-    pdb->Delete(leveldb::WriteOptions(), key);
+    const std::string key = RangeKey(propertyId, type, tokenIdStart, tokenIdEnd);
+    // not buffered, as ranges are read with iterators, but recorded in the block journal
+    Delete(key);
 
-    if (msc_debug_nftdb) PrintToLog("%s():%s, line %d, file: %s\n", __FUNCTION__, key, __LINE__, __FILE__);
+    if (msc_debug_nftdb) PrintToLog("%s():%d_%u_%d-%d, line %d, file: %s\n", __FUNCTION__, propertyId, static_cast<StorageType>(type), tokenIdStart, tokenIdEnd, __LINE__, __FILE__);
 }
 
 /* Adds a range of non-fungible tokens and/or sets data on that range
@@ -263,11 +316,11 @@ void CMPNonFungibleTokensDB::AddRange(const uint32_t &propertyId, const int64_t
 {
     assert(pdb);
 
-    const std::string key = strprintf("%010d_%u_%020d-%020d", propertyId, static_cast<StorageType>(type), tokenIdStart, tokenIdEnd);
-    leveldb::Status status = pdb->Put(writeoptions, key, info);
+    const std::string key = RangeKey(propertyId, type, tokenIdStart, tokenIdEnd);
+    leveldb::Status status = Put(key, info);
     ++nWritten;
 
-    if (msc_debug_nftdb) PrintToLog("%s():%s=%s:%s, line %d, file: %s\n", __FUNCTION__, key, info, status.ToString(), __LINE__, __FILE__);
+    if (msc_debug_nftdb) PrintToLog("%s():%d_%u_%d-%d=%s:%s, line %d, file: %s\n", __FUNCTION__, propertyId, static_cast<StorageType>(type), tokenIdStart, tokenIdEnd, info, status.ToString(), __LINE__, __FILE__);
 }
 
 /* Creates a range of non-fungible tokens
@@ -300,6 +353,10 @@ std::pair<int64_t,int64_t> CMPNonFungibleTokensDB::CreateNonFungibleTokens(const
 
     AddRange(propertyId, newTokenStartId, newTokenEndId, owner, NonFungibleStorage::RangeIndex);
 
+    // new ranges are always appended, so their end is the highest
+    highestRangeEnds[propertyId] = newTokenEndId;
+    touchedProperties.insert(propertyId);
+
     return newRange;
 }
 
@@ -307,25 +364,7 @@ std::pair<int64_t,int64_t> CMPNonFungibleTokensDB::CreateNonFungibleTokens(const
  */
 std::string CMPNonFungibleTokensDB::GetNonFungibleTokenOwner(const uint32_t &propertyId, const int64_t &tokenId)
 {
-    assert(pdb);
-    leveldb::Iterator* it = NewIterator();
-
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (propertyId != GetPropertyIdFromKey(it->key().ToString()) ||
-                GetTypeFromKey(it->key().ToString()) != NonFungibleStorage::RangeIndex) continue;
-
-        int64_t start, end;
-        GetRangeFromKey(it->key().ToString(), &start, &end);
-
-        if (tokenId >= start && tokenId <= end) {
-            std::string retval = it->value().ToString();
-            delete it;
-            return retval;
-        }
-    }
-
-    delete it;
-    return ""; // not found
+    return GetNonFungibleTokenData(propertyId, tokenId, NonFungibleStorage::RangeIndex);
 }
 
 /* Gets the info set in a non-fungible token
@@ -335,18 +374,10 @@ std::string CMPNonFungibleTokensDB::GetNonFungibleTokenData(const uint32_t &prop
     assert(pdb);
     leveldb::Iterator* it = NewIterator();
 
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (propertyId != GetPropertyIdFromKey(it->key().ToString()) ||
-                GetTypeFromKey(it->key().ToString()) != type) continue;
-
-        int64_t start, end;
-        GetRangeFromKey(it->key().ToString(), &start, &end);
-
-        if (tokenId >= start && tokenId <= end) {
-            std::string retval = it->value().ToString();
-            delete it;
-            return retval;
-        }
+    if (SeekRange(it, propertyId, tokenId, type)) {
+        std::string retval = it->value().ToString();
+        delete it;
+        return retval;
     }
 
     delete it;
@@ -360,18 +391,20 @@ std::map<uint32_t, std::vector<std::pair<int64_t, int64_t>>> CMPNonFungibleToken
     std::map<uint32_t, std::vector<std::pair<int64_t, int64_t>>> uniqueMap;
     assert(pdb);
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+
+    // for a single property only its ranges are visited
+    const std::string prefix = (propertyId != 0) ? RangePrefix(propertyId, NonFungibleStorage::RangeIndex) : "";
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
         std::string value = it->value().ToString();
         if (value != address) continue;
 
-        const auto id = GetPropertyIdFromKey(it->key().ToString());
-        if ((propertyId != 0 && propertyId != id) ||
-            GetTypeFromKey(it->key().ToString()) != NonFungibleStorage::RangeIndex) continue;
+        const std::string key = it->key().ToString();
+        if (GetTypeFromKey(key) != NonFungibleStorage::RangeIndex) continue;
 
         int64_t start, end;
-        GetRangeFromKey(it->key().ToString(), &start, &end);
+        GetRangeFromKey(key, &start, &end);
 
-        uniqueMap[id].emplace_back(start, end);
+        uniqueMap[GetPropertyIdFromKey(key)].emplace_back(start, end);
     }
     delete it;
     return uniqueMap;
@@ -385,11 +418,9 @@ std::vector<std::pair<std::string,std::pair<int64_t,int64_t> > > CMPNonFungibleT
 
     assert(pdb);
 
+    const std::string prefix = RangePrefix(propertyId, NonFungibleStorage::RangeIndex);
     leveldb::Iterator* it = NewIterator();
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (propertyId != GetPropertyIdFromKey(it->key().ToString()) ||
-                GetTypeFromKey(it->key().ToString()) != NonFungibleStorage::RangeIndex) continue;
-
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
         std::string address = it->value().ToString();
         int64_t start, end;
         GetRangeFromKey(it->key().ToString(), &start, &end);
@@ -401,12 +432,38 @@ std::vector<std::pair<std::string,std::pair<int64_t,int64_t> > > CMPNonFungibleT
     return rangeMap;
 }
 
+/* Sanity checks the token counts of the properties with new tokens since the last check
+ */
 void CMPNonFungibleTokensDB::SanityCheck()
 {
     assert(pdb);
 
     std::string result = "";
 
+    for (std::set<uint32_t>::const_iterator it = touchedProperties.begin(); it != touchedProperties.end(); ++it) {
+        int64_t highestRangeEnd = GetHighestRangeEnd(*it);
+        int64_t totalTokens = mastercore::getTotalTokens(*it);
+        if (totalTokens != highestRangeEnd) {
+            std::string abortMsg = strprintf("Failed sanity check on property %d (%d != %d)\n", *it, totalTokens, highestRangeEnd);
+            LogFilePrint(abortMsg, true);
+            AbortNode(abortMsg);
+        } else {
+            result = result + strprintf("%d:%d=%d,", *it, totalTokens, highestRangeEnd);
+        }
+    }
+    touchedProperties.clear();
+
+    if (msc_debug_nftdb) PrintToLog("UTDB sanity check OK (%s)\n", result);
+}
+
+/* Sanity checks the token counts of all properties
+ */
+void CMPNonFungibleTokensDB::SanityCheckAll()
+{
+    assert(pdb);
+
+    std::string result = "";
+
     std::map<uint32_t,int64_t> totals;
 
     leveldb::Iterator* it = NewIterator();
@@ -424,13 +481,23 @@ void CMPNonFungibleTokensDB::SanityCheck()
     for (std::map<uint32_t,int64_t>::iterator it = totals.begin(); it != totals.end(); ++it) {
         if (mastercore::getTotalTokens(it->first) != it->second) {
             std::string abortMsg = strprintf("Failed sanity check on property %d (%d != %d)\n", it->first, mastercore::getTotalTokens(it->first), it->second);
+            LogFilePrint(abortMsg, true);
             AbortNode(abortMsg);
         } else {
             result = result + strprintf("%d:%d=%d,", it->first, mastercore::getTotalTokens(it->first), it->second);
         }
     }
 
-    if (msc_debug_nftdb) PrintToLog("UTDB sanity check OK (%s)\n", result);
+    if (msc_debug_nftdb) PrintToLog("UTDB full sanity check OK (%s)\n", result);
+}
+
+/* Deletes all entries of the database
+ */
+void CMPNonFungibleTokensDB::Clear()
+{
+    CDBBase::Clear();
+    highestRangeEnds.clear();
+    touchedProperties.clear();
 }
 
 void CMPNonFungibleTokensDB::printStats()
@@ -448,7 +515,9 @@ void CMPNonFungibleTokensDB::printAll()
         skey = it->key();
         svalue = it->value();
         ++count;
-        PrintToConsole("entry #%8d= %s:%s\n", count, skey.ToString(), svalue.ToString());
+        int64_t start, end;
+        GetRangeFromKey(skey.ToString(), &start, &end);
+        PrintToConsole("entry #%8d= %010d_%c_%d-%d:%s\n", count, GetPropertyIdFromKey(skey.ToString()), static_cast<StorageType>(GetTypeFromKey(skey.ToString())), start, end, svalue.ToString());
 //      PrintToLog("entry #%8d= %s:%s\n", count, skey.ToString(), svalue.ToString());
     }
 
@@ -7,6 +7,8 @@
 #include <omnicore/persistence.h>
 
 #include <stdint.h>
+#include <map>
+#include <set>
 #include <boost/filesystem.hpp>
 
 enum class NonFungibleStorage : unsigned char
@@ -18,10 +20,22 @@ enum class NonFungibleStorage : unsigned char
     HolderData = 'H',
 };
 
-/** LevelDB based storage for non-fungible tokens, with uid range (propertyid_tokenidstart-tokenidend) as key and token owner (address) as value.
+/** LevelDB based storage for non-fungible tokens, with uid range (propertyid|type|tokenidstart|tokenidend) as key and token owner (address) as value.
+ *
+ * Keys are stored in big-endian byte order, so the range of a token can be found with a single seek.
  */
 class CMPNonFungibleTokensDB : public CDBBase
 {
+private:
+    //! Highest token range end of properties, which were looked up or granted tokens
+    std::map<uint32_t, int64_t> highestRangeEnds;
+    //! Properties with new tokens since the last sanity check
+    std::set<uint32_t> touchedProperties;
+
+    // Positions the iterator at the last range, which starts at or before the token ID
+    bool SeekLastRange(leveldb::Iterator* it, const uint32_t &propertyId, const int64_t &tokenId, const NonFungibleStorage type);
+    // Positions the iterator at the range, which contains the token ID
+    bool SeekRange(leveldb::Iterator* it, const uint32_t &propertyId, const int64_t &tokenId, const NonFungibleStorage type);
 
 public:
     CMPNonFungibleTokensDB(const boost::filesystem::path& path, bool fWipe)
@@ -38,6 +52,9 @@ public:
     void printStats();
     void printAll();
 
+    // Deletes all entries of the database
+    void Clear();
+
     // Helper to extract the property ID from a DB key
     uint32_t GetPropertyIdFromKey(const std::string& key);
     // Extracts the storage type from a DB key
@@ -69,8 +86,10 @@ public:
     std::map<uint32_t, std::vector<std::pair<int64_t, int64_t>>> GetAddressNonFungibleTokens(const uint32_t &propertyId, const std::string &address);
     // Gets the non-fungible token ranges for a property ID
     std::vector<std::pair<std::string,std::pair<int64_t,int64_t> > > GetNonFungibleTokenRanges(const uint32_t &propertyId);
-    // Sanity checks the token counts
+    // Sanity checks the token counts of the properties with new tokens since the last check
     void SanityCheck();
+    // Sanity checks the token counts of all properties
+    void SanityCheckAll();
 };
 
 namespace mastercore
@@ -11,6 +11,7 @@
 #include <omnicore/convert.h>
 #include <omnicore/dbbase.h>
 #include <omnicore/dbfees.h>
+#include <omnicore/dbmarkerindex.h>
 #include <omnicore/dbspinfo.h>
 #include <omnicore/dbstolist.h>
 #include <omnicore/dbtradelist.h>
@@ -23,6 +24,7 @@
 #include <omnicore/parsing.h>
 #include <omnicore/pending.h>
 #include <omnicore/persistence.h>
+#include <omnicore/rpctxobject.h>
 #include <omnicore/rules.h>
 #include <omnicore/script.h>
 #include <omnicore/seedblocks.h>
@@ -33,6 +35,7 @@
 #include <omnicore/utilsui.h>
 #include <omnicore/version.h>
 #include <omnicore/walletcache.h>
+#include <omnicore/walletfetchtxs.h>
 #include <omnicore/walletutils.h>
 
 #include <base58.h>
@@ -40,6 +43,7 @@
 #include <coins.h>
 #include <core_io.h>
 #include <fs.h>
+#include <index/txindex.h>
 #include <key_io.h>
 #include <init.h>
 #include <validation.h>
@@ -50,6 +54,7 @@
 #include <shutdown.h>
 #include <sync.h>
 #include <tinyformat.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <ui_interface.h>
 #include <util/system.h>
@@ -67,8 +72,13 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -110,6 +120,11 @@ static int reorgRecoveryMode = 0;
 //! Block height to recover from after a block reorganization
 static int reorgRecoveryMaxHeight = 0;
 
+//! Whether the transactions of the current block were examined for Omni markers
+static bool fBlockExamined = false;
+//! Whether the current block contains transactions with an Omni marker
+static bool fBlockHasMarker = false;
+
 //! LevelDB based storage for currencies, smart properties and tokens
 CMPSPInfo* mastercore::pDbSpInfo;
 //! LevelDB based storage for transactions, with txid as key and validity bit, and other data as value
@@ -126,6 +141,8 @@ COmniFeeCache* mastercore::pDbFeeCache;
 COmniFeeHistory* mastercore::pDbFeeHistory;
 //! LevelDB based storage for UITs
 CMPNonFungibleTokensDB *mastercore::pDbNFT;
+//! LevelDB based storage for whether blocks contain transactions with an Omni marker
+COmniMarkerIndex* mastercore::pDbMarkerIndex;
 
 //! In-memory collection of DEx offers
 OfferMap mastercore::my_offers;
@@ -140,7 +157,12 @@ std::set<std::pair<uint32_t,int> > setFreezingEnabledProperties;
 std::set<std::pair<std::string,uint32_t> > setFrozenAddresses;
 
 //! In-memory collection of all amounts for all addresses for all properties
-std::unordered_map<std::string, CMPTally> mastercore::mp_tally_map;
+CMPTallyMap mastercore::mp_tally_map;
+
+//! Addresses with a non-zero amount of any tally type, indexed by property
+static std::unordered_map<uint32_t, std::set<std::string> > mapPropertyHolders;
+//! Number of tokens held in balances and reserves, indexed by property
+static std::unordered_map<uint32_t, int64_t> mapCirculatingTokens;
 
 // Only needed for GUI:
 
@@ -245,9 +267,64 @@ std::string FormatByType(int64_t amount, uint16_t propertyType)
     }
 }
 
+/**
+ * Returns the addresses with a non-zero amount of any tally type for a property.
+ *
+ * The returned set is only valid while holding cs_tally.
+ */
+const std::set<std::string>& mastercore::getPropertyHolders(uint32_t propertyId)
+{
+    static const std::set<std::string> setEmpty;
+
+    std::unordered_map<uint32_t, std::set<std::string> >::const_iterator it = mapPropertyHolders.find(propertyId);
+    if (it != mapPropertyHolders.end()) return it->second;
+
+    return setEmpty;
+}
+
+/**
+ * Clears the tally map and the indexes of holders and tokens in circulation.
+ */
+void mastercore::ClearTallyMap()
+{
+    LOCK(cs_tally);
+
+    mp_tally_map.clear();
+    mapPropertyHolders.clear();
+    mapCirculatingTokens.clear();
+    ResetIncrementalConsensusHash();
+    WalletCacheInvalidate();
+}
+
+/**
+ * Adds the address to, or removes the address from the holders of a property,
+ * based on the updated tally of the address.
+ */
+static void UpdatePropertyHolders(const std::string& address, uint32_t propertyId, const CMPTally& tally)
+{
+    bool fHolder = false;
+    for (int ttype = 0; ttype < TALLY_TYPE_COUNT; ++ttype) {
+        if (0 != tally.getMoney(propertyId, static_cast<TallyType>(ttype))) {
+            fHolder = true;
+            break;
+        }
+    }
+
+    if (fHolder) {
+        mapPropertyHolders[propertyId].insert(address);
+        return;
+    }
+
+    std::unordered_map<uint32_t, std::set<std::string> >::iterator it = mapPropertyHolders.find(propertyId);
+    if (it != mapPropertyHolders.end()) {
+        it->second.erase(address);
+        if (it->second.empty()) mapPropertyHolders.erase(it);
+    }
+}
+
 CMPTally* mastercore::getTally(const std::string& address)
 {
-    std::unordered_map<std::string, CMPTally>::iterator it = mp_tally_map.find(address);
+    CMPTallyMap::iterator it = mp_tally_map.find(address);
 
     if (it != mp_tally_map.end()) return &(it->second);
 
@@ -263,7 +340,7 @@ int64_t GetTokenBalance(const std::string& address, uint32_t propertyId, TallyTy
     }
 
     LOCK(cs_tally);
-    const std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.find(address);
+    const CMPTallyMap::iterator my_it = mp_tally_map.find(address);
     if (my_it != mp_tally_map.end()) {
         balance = (my_it->second).getMoney(propertyId, ttype);
     }
@@ -424,7 +501,6 @@ std::string mastercore::getTokenLabel(uint32_t propertyId)
 // optionally counts the number of addresses who own that property: n_owners_total
 int64_t mastercore::getTotalTokens(uint32_t propertyId, int64_t* n_owners_total)
 {
-    int64_t prev = 0;
     int64_t owners = 0;
     int64_t totalTokens = 0;
 
@@ -435,20 +511,28 @@ int64_t mastercore::getTotalTokens(uint32_t propertyId, int64_t* n_owners_total)
         return 0; // property ID does not exist
     }
 
-    if (!property.fixed || n_owners_total) {
-        for (std::unordered_map<std::string, CMPTally>::const_iterator it = mp_tally_map.begin(); it != mp_tally_map.end(); ++it) {
-            const CMPTally& tally = it->second;
+    if (n_owners_total) {
+        for (const std::string& address : getPropertyHolders(propertyId)) {
+            const CMPTally* tally = getTally(address);
+            assert(tally != nullptr);
 
-            totalTokens += tally.getMoney(propertyId, BALANCE);
-            totalTokens += tally.getMoney(propertyId, SELLOFFER_RESERVE);
-            totalTokens += tally.getMoney(propertyId, ACCEPT_RESERVE);
-            totalTokens += tally.getMoney(propertyId, METADEX_RESERVE);
+            int64_t tokens = 0;
+            tokens += tally->getMoney(propertyId, BALANCE);
+            tokens += tally->getMoney(propertyId, SELLOFFER_RESERVE);
+            tokens += tally->getMoney(propertyId, ACCEPT_RESERVE);
+            tokens += tally->getMoney(propertyId, METADEX_RESERVE);
 
-            if (prev != totalTokens) {
-                prev = totalTokens;
+            if (0 != tokens) {
                 owners++;
             }
         }
+    }
+
+    if (!property.fixed) {
+        std::unordered_map<uint32_t, int64_t>::const_iterator it = mapCirculatingTokens.find(propertyId);
+        if (it != mapCirculatingTokens.end()) {
+            totalTokens = it->second;
+        }
         int64_t cachedFee = pDbFeeCache->GetCachedAmount(propertyId);
         totalTokens += cachedFee;
     }
@@ -486,14 +570,25 @@ bool mastercore::update_tally_map(const std::string& who, uint32_t propertyId, i
 
     before = GetTokenBalance(who, propertyId, ttype);
 
-    std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.find(who);
+    CMPTallyMap::iterator my_it = mp_tally_map.find(who);
     if (my_it == mp_tally_map.end()) {
         // insert an empty element
         my_it = (mp_tally_map.insert(std::make_pair(who, CMPTally()))).first;
     }
 
     CMPTally& tally = my_it->second;
+    // pending amounts are not part of the consensus hash
+    if (PENDING != ttype) ConsensusHashRemoveBalance(tally, who, propertyId);
     bRet = tally.updateMoney(propertyId, amount, ttype);
+    if (PENDING != ttype) ConsensusHashAddBalance(tally, who, propertyId);
+
+    if (bRet) {
+        // keep the holder index and the number of tokens in circulation up to date
+        if (PENDING != ttype) mapCirculatingTokens[propertyId] += amount;
+        UpdatePropertyHolders(who, propertyId, tally);
+        mp_tally_map.setChanged(my_it);
+        WalletCacheAddressChanged(who);
+    }
 
     after = GetTokenBalance(who, propertyId, ttype);
     if (!bRet) {
@@ -625,7 +720,7 @@ void CheckWalletUpdate(bool forceUpdate)
     global_balance_reserved.clear();
 
     // populate global balance totals and wallet property list - note global balances do not include additional balances from watch-only addresses
-    for (std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
+    for (CMPTallyMap::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
         // check if the address is a wallet address (including watched addresses)
         std::string address = my_it->first;
         int addressIsMine = IsMyAddressAllWallets(address, false, ISMINE_SPENDABLE);
@@ -692,15 +787,15 @@ static RecursiveMutex cs_marker_cache;
  *
  * MUST NOT BE USED FOR CONSENSUS CRITICAL STUFF!
  */
-static bool HasMarkerUnsafe(const CTransactionRef& tx)
+static bool HasMarkerUnsafe(const CTransaction& tx)
 {
     const std::string strClassC("6f6d6e69");
     const std::string strClassAB("76a914946cb2e08075bcbaf157e47bcb67eb2b2339d24288ac");
     const std::string strClassABTest("76a914643ce12b1590633077b8620316f43a9362ef18e588ac");
     const std::string strClassMoney("76a9145ab93563a289b74c355a9b9258b86f12bb84affb88ac");
 
-    for (unsigned int n = 0; n < tx->vout.size(); ++n) {
-        const CTxOut& out = tx->vout[n];
+    for (unsigned int n = 0; n < tx.vout.size(); ++n) {
+        const CTxOut& out = tx.vout[n];
         std::string str = HexStr(out.scriptPubKey.begin(), out.scriptPubKey.end());
 
         if (str.find(strClassC) != std::string::npos) {
@@ -727,7 +822,7 @@ static bool HasMarkerUnsafe(const CTransactionRef& tx)
 /** Scans for marker and if one is found, add transaction to marker cache. */
 void TryToAddToMarkerCache(const CTransactionRef &tx)
 {
-    if (HasMarkerUnsafe(tx)) {
+    if (HasMarkerUnsafe(*tx)) {
         LOCK(cs_marker_cache);
         setMarkerCache.insert(tx->GetHash());
     }
@@ -1492,6 +1587,196 @@ public:
     }
 };
 
+//! Default number of threads, which read blocks ahead of the initial scan
+static const int DEFAULT_SCAN_THREADS = 2;
+//! Maximum number of blocks read ahead of the initial scan
+static const int MAX_PREFETCHED_BLOCKS = 16;
+
+/**
+ * Returns true, if the block is known not to contain Omni transactions.
+ *
+ * Blocks are skipped based on the hard-coded seed blocks, or based on the marker
+ * index, which is built while blocks are processed.
+ */
+static bool SkipScanBlock(int nBlock, const CBlockIndex* pblockindex, bool fBlockFilter)
+{
+    if (!fBlockFilter) return false;
+    if (SkipBlock(nBlock)) return true;
+
+    return pblockindex && pDbMarkerIndex->IsBlockWithoutMarker(pblockindex->GetBlockHash());
+}
+
+/**
+ * Reads blocks ahead of the initial transaction scanning on worker threads.
+ *
+ * Blocks are read from disk and deserialized, transactions with an Omni marker
+ * are identified, and the coins spent by them are resolved via the transaction
+ * index. The scan consumes the blocks strictly in order on a single thread, so
+ * all state changes remain sequential.
+ *
+ * The marker check is the state independent one, which may include transactions
+ * that turn out not to be Omni transactions, but never misses one.
+ *
+ * The scan may run while cs_main is held, so the workers never acquire it. The
+ * positions of the blocks are collected up front, and the heights of resolved
+ * coins are not set, as they are not used by the parser.
+ *
+ * @see msc_initial_scan()
+ */
+class BlockPrefetcher
+{
+public:
+    /** A block prepared for the scan. */
+    struct Entry
+    {
+        //! Whether the block was read
+        bool fRead;
+        CBlock block;
+        //! Whether the transactions of the block have an Omni marker
+        std::vector<bool> vHasMarker;
+        //! Coins spent by the transactions with an Omni marker
+        std::shared_ptr<std::map<COutPoint, Coin> > coins;
+
+        Entry() : fRead(false) {}
+    };
+
+private:
+    const int m_firstBlock;
+    const int m_lastBlock;
+    //! The blocks to prepare and their positions on disk
+    std::vector<std::pair<const CBlockIndex*, FlatFilePos> > m_blocks;
+    //! Whether the blocks are skipped by the scan
+    std::vector<bool> m_skip;
+
+    Mutex m_mutex;
+    //! Signals prepared blocks to the scan and consumed ones to the workers
+    std::condition_variable m_cond;
+    //! The next block to prepare
+    int m_nextBlock GUARDED_BY(m_mutex);
+    bool m_stop GUARDED_BY(m_mutex);
+    std::map<int, Entry> m_ready GUARDED_BY(m_mutex);
+    std::vector<std::thread> m_threads;
+
+    /** Returns true, if the block is skipped by the scan. */
+    bool skipBlock(int nBlock) const
+    {
+        return m_skip[nBlock - m_firstBlock];
+    }
+
+    /** Reads the block and resolves the inputs of transactions with an Omni marker. */
+    void prepare(int nBlock, Entry& entry) const
+    {
+        const CBlockIndex* pblockindex = m_blocks[nBlock - m_firstBlock].first;
+        if (nullptr == pblockindex) return;
+        if (!ReadBlockFromDisk(entry.block, m_blocks[nBlock - m_firstBlock].second, Params().GetConsensus())) return;
+        if (entry.block.GetHash() != pblockindex->GetBlockHash()) return;
+
+        entry.fRead = true;
+        entry.coins = std::make_shared<std::map<COutPoint, Coin> >();
+        entry.vHasMarker.reserve(entry.block.vtx.size());
+
+        std::map<uint256, CTransactionRef> prevTxs;
+        for (const auto& tx : entry.block.vtx) {
+            bool fHasMarker = HasMarkerUnsafe(*tx);
+            entry.vHasMarker.push_back(fHasMarker);
+            if (!fHasMarker || tx->IsCoinBase() || !g_txindex) continue;
+
+            for (const CTxIn& txIn : tx->vin) {
+                std::map<uint256, CTransactionRef>::iterator it = prevTxs.find(txIn.prevout.hash);
+                if (it == prevTxs.end()) {
+                    CTransactionRef txPrev;
+                    uint256 hashBlock;
+                    if (!g_txindex->FindTx(txIn.prevout.hash, hashBlock, txPrev)) continue;
+                    it = prevTxs.insert(std::make_pair(txIn.prevout.hash, txPrev)).first;
+                }
+                const CTransactionRef& txPrev = it->second;
+                if (txIn.prevout.n >= txPrev->vout.size()) continue;
+
+                Coin coin;
+                coin.out = txPrev->vout[txIn.prevout.n];
+                entry.coins->insert(std::make_pair(txIn.prevout, std::move(coin)));
+            }
+        }
+    }
+
+    void threadPrepare()
+    {
+        while (true) {
+            int nBlock;
+            {
+                WAIT_LOCK(m_mutex, lock);
+                while (!m_stop && (int) m_ready.size() >= MAX_PREFETCHED_BLOCKS) {
+                    m_cond.wait(lock);
+                }
+                while (m_nextBlock <= m_lastBlock && skipBlock(m_nextBlock)) {
+                    ++m_nextBlock;
+                }
+                if (m_stop || m_nextBlock > m_lastBlock) return;
+                nBlock = m_nextBlock++;
+            }
+
+            Entry entry;
+            prepare(nBlock, entry);
+
+            LOCK(m_mutex);
+            m_ready[nBlock] = std::move(entry);
+            m_cond.notify_all();
+        }
+    }
+
+public:
+    BlockPrefetcher(int nFirstBlock, int nLastBlock, bool fBlockFilter, int nThreads)
+    : m_firstBlock(nFirstBlock), m_lastBlock(nLastBlock), m_nextBlock(nFirstBlock), m_stop(false)
+    {
+        {
+            LOCK(cs_main);
+            for (int nBlock = nFirstBlock; nBlock <= nLastBlock; ++nBlock) {
+                const CBlockIndex* pblockindex = ::ChainActive()[nBlock];
+                m_blocks.push_back(std::make_pair(pblockindex, pblockindex ? pblockindex->GetBlockPos() : FlatFilePos()));
+            }
+        }
+        for (int nBlock = nFirstBlock; nBlock <= nLastBlock; ++nBlock) {
+            m_skip.push_back(SkipScanBlock(nBlock, m_blocks[nBlock - nFirstBlock].first, fBlockFilter));
+        }
+        for (int i = 0; i < nThreads; ++i) {
+            m_threads.emplace_back(&TraceThread<std::function<void()> >, "omniscan",
+                    std::function<void()>(std::bind(&BlockPrefetcher::threadPrepare, this)));
+        }
+    }
+
+    ~BlockPrefetcher()
+    {
+        {
+            LOCK(m_mutex);
+            m_stop = true;
+            m_cond.notify_all();
+        }
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    /** Waits until the given block is prepared and hands it over to the scan. */
+    void get(int nBlock, Entry& entry)
+    {
+        if (nBlock > m_lastBlock || skipBlock(nBlock)) return;
+
+        WAIT_LOCK(m_mutex, lock);
+        // blocks are prepared in order, so earlier ones are no longer needed
+        m_ready.erase(m_ready.begin(), m_ready.lower_bound(nBlock));
+        m_cond.notify_all();
+
+        std::map<int, Entry>::iterator it;
+        while ((it = m_ready.find(nBlock)) == m_ready.end()) {
+            m_cond.wait(lock);
+        }
+
+        entry = std::move(it->second);
+        m_ready.erase(it);
+        m_cond.notify_all();
+    }
+};
+
 /**
  * Scans the blockchain for meta transactions.
  *
@@ -1500,6 +1785,9 @@ public:
  *
  * Every 30 seconds the progress of the scan is reported.
  *
+ * Blocks are read and prepared ahead of the scan by worker threads, while the
+ * transactions are processed in order.
+ *
  * In case the current block being processed is not part of the active chain, or
  * if a block could not be retrieved from the disk, then the scan stops early.
  * Likewise, global shutdown requests are honored, and stop the scan progress.
@@ -1535,8 +1823,15 @@ static int msc_initial_scan(int nFirstBlock)
 
     ProgressReporter progressReporter(pFirstBlock, pLastBlock);
 
-    // check if using seed block filter should be disabled
-    bool seedBlockFilterEnabled = gArgs.GetBoolArg("-omniseedblockfilter", true);
+    // check if skipping blocks without Omni transactions should be disabled
+    bool blockFilterEnabled = gArgs.GetBoolArg("-omniseedblockfilter", true);
+
+    // read blocks ahead of the scan, unless disabled
+    std::unique_ptr<BlockPrefetcher> prefetcher;
+    int nScanThreads = gArgs.GetArg("-omniscanthreads", DEFAULT_SCAN_THREADS);
+    if (nScanThreads > 0) {
+        prefetcher.reset(new BlockPrefetcher(nFirstBlock, nLastBlock, blockFilterEnabled, nScanThreads));
+    }
 
     for (nBlock = nFirstBlock; nBlock <= nLastBlock; ++nBlock)
     {
@@ -1566,12 +1861,25 @@ static int msc_initial_scan(int nFirstBlock)
         unsigned int nTxsFoundInBlock = 0;
         mastercore_handler_block_begin(nBlock, pblockindex);
 
-        if (!seedBlockFilterEnabled || !SkipBlock(nBlock)) {
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus())) break;
+        if (!SkipScanBlock(nBlock, pblockindex, blockFilterEnabled)) {
+            BlockPrefetcher::Entry entry;
+            if (prefetcher) prefetcher->get(nBlock, entry);
+
+            // read the block here, if it wasn't prepared, or the chain changed in the meantime
+            if (!entry.fRead || entry.block.GetHash() != pblockindex->GetBlockHash()) {
+                entry = BlockPrefetcher::Entry();
+                if (!ReadBlockFromDisk(entry.block, pblockindex, Params().GetConsensus())) break;
+            }
 
-            for(const auto tx : block.vtx) {
-                if (mastercore_handler_tx(*tx, nBlock, nTxNum, pblockindex, nullptr)) ++nTxsFoundInBlock;
+            for (const auto& tx : entry.block.vtx) {
+                if (!entry.vHasMarker.empty() && !entry.vHasMarker[nTxNum]) {
+                    // not an Omni transaction, only clear pending amounts, if any
+                    LOCK(cs_tally);
+                    PendingDelete(tx->GetHash());
+                    fBlockExamined = true;
+                } else if (mastercore_handler_tx(*tx, nBlock, nTxNum, pblockindex, entry.coins)) {
+                    ++nTxsFoundInBlock;
+                }
                 ++nTxNum;
             }
         }
@@ -1599,11 +1907,15 @@ void clear_all_state()
     LOCK2(cs_tally, cs_pending);
 
     // Memory based storage
-    mp_tally_map.clear();
+    ClearTallyMap();
+    ResetStateSnapshots();
     my_offers.clear();
     my_accepts.clear();
     my_crowds.clear();
-    metadex.clear();
+    RebuildAcceptExpiryIndex();
+    RebuildCrowdsaleDeadlineIndex();
+    MetaDEx_Clear();
+    ResetIncrementalConsensusHash();
     my_pending.clear();
     ResetConsensusParams();
     ClearActivations();
@@ -1672,6 +1984,31 @@ void RewindDBsAndState(int nHeight, int nBlockPrev = 0, bool fInitialParse = fal
     }
 }
 
+//! Default share of -dbcache, which is used as block cache of the databases, as divisor
+static const int64_t DEFAULT_DB_CACHE_DIVISOR = 16;
+
+//! Default number of bits per key of the bloom filters of the databases
+static const int DEFAULT_DB_BLOOM_BITS = 10;
+
+//! Size of the block cache of the databases in bytes, reserved from the node's cache
+static int64_t nReservedDBCache = -1;
+
+/**
+ * Reserves the block cache of the databases from the node's database cache.
+ *
+ * The size is set with -omnidbcache, and is at most half of the total cache.
+ *
+ * @param nTotalCache  The total database cache of the node in bytes
+ * @return The size of the reserved block cache in bytes
+ */
+int64_t mastercore_reserve_dbcache(int64_t nTotalCache)
+{
+    int64_t nCacheSize = std::max(gArgs.GetArg("-omnidbcache", (nTotalCache >> 20) / DEFAULT_DB_CACHE_DIVISOR), (int64_t) 0);
+    nReservedDBCache = std::min(nCacheSize << 20, nTotalCache / 2);
+
+    return nReservedDBCache;
+}
+
 /**
  * Global handler to initialize Omni Core.
  *
@@ -1696,6 +2033,7 @@ int mastercore_init()
 
         InitDebugLogLevels();
         ShrinkDebugLog();
+        StartLogWriter();
 
         if (isNonMainNet()) {
             exodus_address = exodus_testnet;
@@ -1738,6 +2076,13 @@ int mastercore_init()
             }
         }
 
+        // share one block cache between the databases, which is reserved from the node's cache budget
+        if (nReservedDBCache < 0) {
+            mastercore_reserve_dbcache(std::min(std::max(gArgs.GetArg("-dbcache", nDefaultDbCache), nMinDbCache), nMaxDbCache) << 20);
+        }
+        int nBloomBits = std::max(gArgs.GetArg("-omnidbbloom", DEFAULT_DB_BLOOM_BITS), (int64_t) 0);
+        CDBBase::SetSharedOptions(nReservedDBCache, nBloomBits);
+
         pDbTradeList = new CMPTradeList(GetDataDir() / "MP_tradelist", fReindex);
         pDbStoList = new CMPSTOList(GetDataDir() / "MP_stolist", fReindex);
         pDbTransactionList = new CMPTxList(GetDataDir() / "MP_txlist", fReindex);
@@ -1746,9 +2091,11 @@ int mastercore_init()
         pDbFeeCache = new COmniFeeCache(GetDataDir() / "OMNI_feecache", fReindex);
         pDbFeeHistory = new COmniFeeHistory(GetDataDir() / "OMNI_feehistory", fReindex);
         pDbNFT = new CMPNonFungibleTokensDB(GetDataDir() / "OMNI_nftdb", fReindex);
+        pDbMarkerIndex = new COmniMarkerIndex(GetDataDir() / "OMNI_markerindex", fReindex);
 
         pathStateFiles = GetDataDir() / "MP_persist";
         TryCreateDirectories(pathStateFiles);
+        StartStatePersistence();
 
         wrongDBVersion = (pDbTransactionList->getDBVersion() != DB_VERSION);
 
@@ -1757,9 +2104,24 @@ int mastercore_init()
 
     int nWaterline = LoadMostRelevantInMemoryState();
 
-    if (!startClean && nWaterline > 0 && nWaterline < GetHeight()) {
+    // the databases are out of sync, if the writes of a block were interrupted
+    int nInterruptedBlock = -1;
+    bool fUnbufferedWrites = false;
+    bool interruptedWrites = !startClean && CDBBase::GetInterruptedBlock(nInterruptedBlock, fUnbufferedWrites);
+    if (interruptedWrites) {
+        PrintToLog("The database writes of block %d were interrupted%s\n", nInterruptedBlock,
+                fUnbufferedWrites ? ", including writes, which can't be rolled back" : "");
+        if (fUnbufferedWrites || nWaterline >= nInterruptedBlock) {
+            nWaterline = -1; // force a clear_all_state and parse from start
+        }
+    }
+
+    if (!startClean && nWaterline > 0 && (nWaterline < GetHeight() || interruptedWrites)) {
         RewindDBsAndState(nWaterline + 1, 0, true);
     }
+    if (interruptedWrites && nWaterline > 0) {
+        CDBBase::ClearInterruptedBlock();
+    }
 
     {
         LOCK(cs_tally);
@@ -1785,6 +2147,7 @@ int mastercore_init()
             std::string strReason = "unknown";
             if (wrongDBVersion) strReason = "client version changed";
             if (noPreviousState) strReason = "no usable previous state found";
+            if (interruptedWrites && nWaterline < 0) strReason = "database writes of a block were interrupted";
             if (startClean) strReason = "-startclean parameter used";
             if (inconsistentDb) strReason = "INCONSISTENT DB DETECTED!\n"
                     "\n!!! WARNING !!!\n\n"
@@ -1842,6 +2205,7 @@ int mastercore_init()
             std::string strShutdownReason = "Failed to load freeze state from levelDB.  It is unsafe to continue.\n";
             PrintToLog(strShutdownReason);
             if (!gArgs.GetBoolArg("-overrideforcedshutdown", false)) {
+                FlushLog();
                 AbortNode(strShutdownReason, strShutdownReason);
             }
         }
@@ -1875,8 +2239,14 @@ int mastercore_init()
  */
 int mastercore_shutdown()
 {
+    // write pending state files, before the databases are closed
+    StopStatePersistence();
+
     LOCK(cs_tally);
 
+    // commit writes of an unfinished block, before the databases are closed
+    CDBBase::CommitBlockWrites();
+
     if (pDbTransactionList) {
         delete pDbTransactionList;
         pDbTransactionList = nullptr;
@@ -1909,12 +2279,21 @@ int mastercore_shutdown()
         delete pDbNFT;
         pDbNFT = nullptr;
     }
+    if (pDbMarkerIndex) {
+        delete pDbMarkerIndex;
+        pDbMarkerIndex = nullptr;
+    }
+
+    CDBBase::ReleaseSharedOptions();
 
     mastercoreInitialized = 0;
 
     PrintToLog("\nOmni Core shutdown completed\n");
     PrintToLog("Shutdown time: %s\n", FormatISO8601DateTime(GetTime()));
 
+    // write buffered log messages
+    StopLogWriter();
+
     PrintToConsole("Omni Core shutdown completed\n");
 
     return 0;
@@ -1946,6 +2325,10 @@ bool mastercore_handler_tx(const CTransaction& tx, int nBlock, unsigned int idx,
         // NOTE2: Plus I wanna clear the amount before that TX is parsed by our protocol, in case we ever consider pending amounts in internal calculations.
         PendingDelete(tx.GetHash());
 
+        // track whether the block contains transactions with an Omni marker
+        fBlockExamined = true;
+        if (!fBlockHasMarker) fBlockHasMarker = HasMarkerUnsafe(tx);
+
         // we do not care about parsing blocks prior to our waterline (empty blockchain defense)
         if (nBlock < nWaterlineBlock) return false;
     }
@@ -2001,6 +2384,11 @@ bool mastercore_handler_tx(const CTransaction& tx, int nBlock, unsigned int idx,
     if (fFoundTx && msc_debug_consensus_hash_every_transaction) {
         uint256 consensusHash = GetConsensusHash();
         PrintToLog("Consensus hash for transaction %s: %s\n", tx.GetHash().GetHex(), consensusHash.GetHex());
+        if (msc_debug_consensus_hash_incremental) {
+            uint256 incrementalHash = GetIncrementalConsensusHash();
+            PrintToLog("Incremental consensus hash for transaction %s: %s\n", tx.GetHash().GetHex(), incrementalHash.GetHex());
+            VerifyIncrementalConsensusHash();
+        }
     }
 
     return fFoundTx;
@@ -2042,15 +2430,24 @@ int mastercore_handler_block_begin(int nBlockPrev, CBlockIndex const * pBlockInd
     {
         LOCK(cs_tally);
 
+        // buffer the database writes of this block, until the block was processed
+        CDBBase::BeginBlockWrites(pBlockIndex->nHeight);
+
         // handle any features that go live with this block
         CheckLiveActivations(pBlockIndex->nHeight);
 
         eraseExpiredCrowdsale(pBlockIndex);
+
+        fBlockExamined = false;
+        fBlockHasMarker = false;
     }
 
     return 0;
 }
 
+//! Default number of blocks between full audits of the non-fungible token DB, 0 to disable
+static const int DEFAULT_NFT_AUDIT_INTERVAL = 0;
+
 // called once per block, after the block has been processed
 // TODO: consolidate into *handler_block_begin() << need to adjust Accept expiry check.............
 // it performs cleanup and other functions
@@ -2068,6 +2465,7 @@ int mastercore_handler_block_end(int nBlockNow, CBlockIndex const * pBlockIndex,
     }
 
     bool checkpointValid;
+    bool writesCommitted;
     {
         LOCK(cs_tally);
 
@@ -2079,6 +2477,11 @@ int mastercore_handler_block_end(int nBlockNow, CBlockIndex const * pBlockIndex,
         int64_t devmsc = 0;
         unsigned int how_many_erased = eraseExpiredAccepts(nBlockNow);
 
+        // remember blocks without Omni transactions, so they can be skipped when reparsing
+        if (fBlockExamined) {
+            pDbMarkerIndex->RecordBlock(pBlockIndex->GetBlockHash(), fBlockHasMarker);
+        }
+
         if (how_many_erased) {
             PrintToLog("%s(%d); erased %u accepts this block, line %d, file: %s\n",
                 __FUNCTION__, how_many_erased, nBlockNow, __LINE__, __FILE__);
@@ -2105,10 +2508,34 @@ int mastercore_handler_block_end(int nBlockNow, CBlockIndex const * pBlockIndex,
         if (ShouldConsensusHashBlock(nBlockNow)) {
             uint256 consensusHash = GetConsensusHash();
             PrintToLog("Consensus hash for block %d: %s\n", nBlockNow, consensusHash.GetHex());
+            if (msc_debug_consensus_hash_incremental) {
+                uint256 incrementalHash = GetIncrementalConsensusHash();
+                PrintToLog("Incremental consensus hash for block %d: %s\n", nBlockNow, incrementalHash.GetHex());
+                VerifyIncrementalConsensusHash();
+            }
         }
 
-        // request nftdb sanity check
+        // write the fee cache changes of this block
+        pDbFeeCache->Flush();
+
+        // request nftdb sanity check of the properties with new tokens, and a full audit, if enabled
         pDbNFT->SanityCheck();
+        int nAuditInterval = gArgs.GetArg("-omninftauditinterval", DEFAULT_NFT_AUDIT_INTERVAL);
+        if (nAuditInterval > 0 && nBlockNow % nAuditInterval == 0) {
+            pDbNFT->SanityCheckAll();
+        }
+
+        // commit the database writes of this block together
+        writesCommitted = CDBBase::CommitBlockWrites();
+        if (!writesCommitted) {
+            // the databases are out of sync with the state, which is recovered with the journal on restart
+            const std::string& msg = strprintf(
+                    "Shutting down due to failed database writes of block %d. "
+                    "The databases are recovered on restart, or restart with -startclean flag.\n", nBlockNow);
+            PrintToLog(msg);
+            FlushLog();
+            AbortNode(msg, msg);
+        }
 
         // request checkpoint verification
         checkpointValid = VerifyCheckpoint(nBlockNow, pBlockIndex->GetBlockHash());
@@ -2121,25 +2548,36 @@ int mastercore_handler_block_end(int nBlockNow, CBlockIndex const * pBlockIndex,
             PrintToLog(msg);
             if (!gArgs.GetBoolArg("-overrideforcedshutdown", false)) {
                 fs::path persistPath = GetDataDir() / "MP_persist";
+                ResetStateSnapshots();
                 if (fs::exists(persistPath)) fs::remove_all(persistPath); // prevent the node being restarted without a reparse after forced shutdown
+                FlushLog();
                 AbortNode(msg, msg);
             }
         }
     }
 
     LOCK2(cs_main, cs_tally);
-    if (checkpointValid){
+    if (checkpointValid && writesCommitted) {
         // save out the state after this block
         if (IsPersistenceEnabled(nBlockNow) && nBlockNow >= ConsensusParams().GENESIS_BLOCK) {
             PersistInMemoryState(pBlockIndex);
         }
     }
 
+    UpdateDecodedTxCacheTip(nBlockNow);
+    UpdateWalletTxIndexTip(nBlockNow);
+
     return 0;
 }
 
 void mastercore_handler_disc_begin(const int nHeight)
 {
+    // decoded transactions of the disconnected block are no longer confirmed
+    ClearDecodedTxCache();
+    UpdateDecodedTxCacheTip(nHeight - 1);
+    InvalidateWalletTxIndexes();
+    UpdateWalletTxIndexTip(nHeight - 1);
+
     LOCK(cs_tally);
 
     reorgRecoveryMode = 1;
@@ -38,7 +38,7 @@ int const DONT_STORE_MAINNET_STATE_UNTIL = 622000;
 #define TEST_ECO_PROPERTY_1 (0x80000003UL)
 
 // increment this value to force a refresh of the state (similar to --startclean)
-#define DB_VERSION 8
+#define DB_VERSION 11
 
 // could probably also use: int64_t maxInt64 = std::numeric_limits<int64_t>::max();
 // maximum numeric values from the spec:
@@ -159,6 +159,9 @@ int64_t GetAvailableTokenBalance(const std::string& address, uint32_t propertyId
 int64_t GetReservedTokenBalance(const std::string& address, uint32_t propertyId);
 int64_t GetFrozenTokenBalance(const std::string& address, uint32_t propertyId);
 
+/** Reserves the block cache of the databases from the node's database cache. */
+int64_t mastercore_reserve_dbcache(int64_t nTotalCache);
+
 /** Global handler to initialize Omni Core. */
 int mastercore_init();
 
@@ -187,7 +190,7 @@ void NotifyTotalTokensChanged(uint32_t propertyId, int block);
 namespace mastercore
 {
 //! In-memory collection of all amounts for all addresses for all properties
-extern std::unordered_map<std::string, CMPTally> mp_tally_map;
+extern CMPTallyMap mp_tally_map;
 
 // TODO: move, rename
 extern CCoinsView viewDummy;
@@ -208,6 +211,10 @@ uint32_t GetNextPropertyId(bool maineco); // maybe move into sp
 CMPTally* getTally(const std::string& address);
 bool update_tally_map(const std::string& who, uint32_t propertyId, int64_t amount, TallyType ttype);
 int64_t getTotalTokens(uint32_t propertyId, int64_t* n_owners_total = nullptr);
+/** Returns the addresses with a non-zero amount of any tally type for a property. */
+const std::set<std::string>& getPropertyHolders(uint32_t propertyId);
+/** Clears the tally map and the indexes of holders and tokens in circulation. */
+void ClearTallyMap();
 
 std::string strMPProperty(uint32_t propertyId);
 std::string strTransactionType(uint16_t txType);
@@ -6,6 +6,7 @@
 
 #include <omnicore/persistence.h>
 
+#include <omnicore/consensushash.h>
 #include <omnicore/dex.h>
 #include <omnicore/log.h>
 #include <omnicore/mdex.h>
@@ -15,8 +16,12 @@
 #include <omnicore/utilsbitcoin.h>
 
 #include <chain.h>
+#include <clientversion.h>
 #include <fs.h>
 #include <hash.h>
+#include <serialize.h>
+#include <streams.h>
+#include <sync.h>
 #include <validation.h>
 #include <tinyformat.h>
 #include <uint256.h>
@@ -24,14 +29,20 @@
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include <stdint.h>
-
-#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
 #include <set>
 #include <string>
-#include <unordered_map>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -73,381 +84,399 @@ static bool is_state_prefix(std::string const &str)
     return false;
 }
 
-static int write_msc_balances(std::ofstream& file, CHash256& hasher)
-{
-    std::unordered_map<std::string, CMPTally>::iterator iter;
-    for (iter = mp_tally_map.begin(); iter != mp_tally_map.end(); ++iter) {
-        bool emptyWallet = true;
-
-        std::string lineOut = (*iter).first;
-        lineOut.append("=");
-        CMPTally& curAddr = (*iter).second;
-        curAddr.init();
-        uint32_t propertyId = 0;
-        while (0 != (propertyId = curAddr.next())) {
-            int64_t balance = (*iter).second.getMoney(propertyId, BALANCE);
-            int64_t sellReserved = (*iter).second.getMoney(propertyId, SELLOFFER_RESERVE);
-            int64_t acceptReserved = (*iter).second.getMoney(propertyId, ACCEPT_RESERVE);
-            int64_t metadexReserved = (*iter).second.getMoney(propertyId, METADEX_RESERVE);
-
-            // we don't allow 0 balances to read in, so if we don't write them
-            // it makes things match up better between persisted state and processed state
-            if (0 == balance && 0 == sellReserved && 0 == acceptReserved && 0 == metadexReserved) {
-                continue;
-            }
-
-            emptyWallet = false;
+//! Magic bytes at the beginning of each state file
+static const uint32_t STATE_FILE_MAGIC = 0x544d4f53;
+//! Version of the state file format
+static const int32_t STATE_FILE_VERSION = 1;
 
-            lineOut.append(strprintf("%d:%d,%d,%d,%d;",
-                    propertyId,
-                    balance,
-                    sellReserved,
-                    acceptReserved,
-                    metadexReserved));
-        }
-
-        if (false == emptyWallet) {
-            // add the line to the hash
-            hasher.Write((unsigned char*)lineOut.c_str(), lineOut.length());
+//! Full snapshots hold the whole state, deltas only the changes since a full snapshot
+enum SNAPSHOT_KINDS {
+  SNAPSHOT_FULL = 0,
+  SNAPSHOT_DELTA
+};
 
-            // write the line
-            file << lineOut << std::endl;
-        }
+/** Header of a state file.
+ *
+ * State files consist of the header, the serialized state and the double
+ * SHA256 hash of everything before it.
+ */
+struct CStateFileHeader
+{
+    uint32_t magic;
+    int32_t version;
+    uint8_t type;
+    uint8_t kind;
+    //! The block the state was stored at
+    uint256 block;
+    //! For deltas, the block of the full snapshot the delta is based on
+    uint256 base;
+
+    CStateFileHeader() : magic(0), version(0), type(0), kind(SNAPSHOT_FULL) {}
+
+    CStateFileHeader(int what, const uint256& blockHash)
+      : magic(STATE_FILE_MAGIC), version(STATE_FILE_VERSION), type(what), kind(SNAPSHOT_FULL),
+        block(blockHash) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(magic);
+        READWRITE(version);
+        READWRITE(type);
+        READWRITE(kind);
+        READWRITE(block);
+        READWRITE(base);
     }
+};
 
-    return 0;
-}
-
-static int write_mp_offers(std::ofstream& file, CHash256& hasher)
+/** Balances of an address for a single property. */
+struct CBalanceEntry
 {
-    OfferMap::const_iterator iter;
-    for (iter = my_offers.begin(); iter != my_offers.end(); ++iter) {
-        // decompose the key for address
-        std::vector<std::string> vstr;
-        boost::split(vstr, iter->first, boost::is_any_of("-"), boost::token_compress_on);
-        const CMPOffer& offer = iter->second;
-        offer.saveOffer(file, vstr[0], hasher);
+    uint32_t propertyId;
+    int64_t balance;
+    int64_t sellReserved;
+    int64_t acceptReserved;
+    int64_t metadexReserved;
+
+    CBalanceEntry() : propertyId(0), balance(0), sellReserved(0), acceptReserved(0), metadexReserved(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(propertyId);
+        READWRITE(balance);
+        READWRITE(sellReserved);
+        READWRITE(acceptReserved);
+        READWRITE(metadexReserved);
     }
+};
 
-    return 0;
+//! Address and its balances
+typedef std::pair<std::string, std::vector<CBalanceEntry> > AddressBalances;
+
+//! Block of the last full snapshot of the balances, deltas are based on it
+static uint256 hashBalancesBase;
+
+static fs::path GetStateFilePath(const fs::path& dir, int what, const uint256& blockHash)
+{
+    return dir / strprintf("%s-%s.dat", statePrefix[what], blockHash.ToString());
 }
 
-static int write_mp_accepts(std::ofstream& file, CHash256& hasher)
+/**
+ * Collects the balances of an address, skipping empty ones.
+ *
+ * Pending amounts are not persisted.
+ */
+static AddressBalances GetAddressBalances(const std::string& address, CMPTally& tally)
 {
-    AcceptMap::const_iterator iter;
-    for (iter = my_accepts.begin(); iter != my_accepts.end(); ++iter) {
-        // decompose the key for address
-        std::vector<std::string> vstr;
-        boost::split(vstr, iter->first, boost::is_any_of("-+"), boost::token_compress_on);
-        const CMPAccept& accept = iter->second;
-        accept.saveAccept(file, vstr[0], vstr[2], hasher);
+    AddressBalances entry;
+    entry.first = address;
+
+    tally.init();
+    uint32_t propertyId = 0;
+    while (0 != (propertyId = tally.next())) {
+        CBalanceEntry balance;
+        balance.propertyId = propertyId;
+        balance.balance = tally.getMoney(propertyId, BALANCE);
+        balance.sellReserved = tally.getMoney(propertyId, SELLOFFER_RESERVE);
+        balance.acceptReserved = tally.getMoney(propertyId, ACCEPT_RESERVE);
+        balance.metadexReserved = tally.getMoney(propertyId, METADEX_RESERVE);
+
+        // we don't allow 0 balances to read in, so if we don't write them
+        // it makes things match up better between persisted state and processed state
+        if (0 == balance.balance && 0 == balance.sellReserved && 0 == balance.acceptReserved && 0 == balance.metadexReserved) {
+            continue;
+        }
+
+        entry.second.push_back(balance);
     }
 
-    return 0;
+    return entry;
 }
 
-static int write_globals_state(std::ofstream& file, CHash256& hasher)
+/**
+ * Writes the balances of all addresses, or only of the addresses changed
+ * since the last full snapshot.
+ *
+ * A full snapshot is written every STORE_EVERY_N_BLOCK blocks, when there is
+ * no usable base, or when too many tallies changed since the base.
+ */
+static int write_msc_balances(CDataStream& ss, CStateFileHeader& header, int nHeight)
 {
-    uint32_t nextSPID = pDbSpInfo->peekNextSPID(OMNI_PROPERTY_MSC);
-    uint32_t nextTestSPID = pDbSpInfo->peekNextSPID(OMNI_PROPERTY_TMSC);
-    std::string lineOut = strprintf("%d,%d,%d",
-            exodus_prev,
-            nextSPID,
-            nextTestSPID);
+    const std::vector<uint32_t>& changed = mp_tally_map.getChanged();
 
-    // add the line to the hash
-    hasher.Write((unsigned char*)lineOut.c_str(), lineOut.length());
+    bool fDelta = !hashBalancesBase.IsNull()
+            && nHeight % STORE_EVERY_N_BLOCK != 0
+            && changed.size() * 4 < mp_tally_map.size();
 
-    // write the line
-    file << lineOut << std::endl;
+    std::vector<AddressBalances> vBalances;
 
-    return 0;
-}
+    if (fDelta) {
+        header.kind = SNAPSHOT_DELTA;
+        header.base = hashBalancesBase;
 
-static int write_mp_crowdsales(std::ofstream& file, CHash256& hasher)
-{
-    for (CrowdMap::const_iterator it = my_crowds.begin(); it != my_crowds.end(); ++it) {
-        // decompose the key for address
-        const CMPCrowd& crowd = it->second;
-        crowd.saveCrowdSale(file, it->first, hasher);
+        // changed addresses are included, even if they no longer hold any tokens
+        vBalances.reserve(changed.size());
+        for (uint32_t id : changed) {
+            CMPTallyMap::iterator it = mp_tally_map.begin() + id;
+            vBalances.push_back(GetAddressBalances(it->first, it->second));
+        }
+    } else {
+        vBalances.reserve(mp_tally_map.size());
+        for (CMPTallyMap::iterator it = mp_tally_map.begin(); it != mp_tally_map.end(); ++it) {
+            AddressBalances entry = GetAddressBalances(it->first, it->second);
+            if (!entry.second.empty()) {
+                vBalances.push_back(entry);
+            }
+        }
+
+        hashBalancesBase = header.block;
+        mp_tally_map.resetChanged();
     }
 
+    ss << vBalances;
+
     return 0;
 }
 
-static int write_mp_metadex(std::ofstream &file, CHash256& hasher)
+static int write_mp_offers(CDataStream& ss)
 {
-    for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        md_PricesMap& prices = my_it->second;
-        for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
-            md_Set& indexes = (it->second);
-            for (md_Set::iterator it = indexes.begin(); it != indexes.end(); ++it) {
-                const CMPMetaDEx& meta = *it;
-                meta.saveOffer(file, hasher);
-            }
-        }
-    }
+    ss << my_offers;
 
     return 0;
 }
 
-static int input_msc_balances_string(const std::string& s)
+static int write_mp_accepts(CDataStream& ss)
 {
-    // "address=propertybalancedata"
-    std::vector<std::string> addrData;
-    boost::split(addrData, s, boost::is_any_of("="), boost::token_compress_on);
-    if (addrData.size() != 2) return -1;
-
-    std::string strAddress = addrData[0];
-
-    // split the tuples of properties
-    std::vector<std::string> vProperties;
-    boost::split(vProperties, addrData[1], boost::is_any_of(";"), boost::token_compress_on);
-
-    std::vector<std::string>::const_iterator iter;
-    for (iter = vProperties.begin(); iter != vProperties.end(); ++iter) {
-        if ((*iter).empty()) {
-            continue;
-        }
-
-        // "propertyid:balancedata"
-        std::vector<std::string> curProperty;
-        boost::split(curProperty, *iter, boost::is_any_of(":"), boost::token_compress_on);
-        if (curProperty.size() != 2) return -1;
-
-        // "balance,sellreserved,acceptreserved,metadexreserved"
-        std::vector<std::string> curBalance;
-        boost::split(curBalance, curProperty[1], boost::is_any_of(","), boost::token_compress_on);
-        if (curBalance.size() != 4) return -1;
-
-        uint32_t propertyId = boost::lexical_cast<uint32_t>(curProperty[0]);
-
-        int64_t balance = boost::lexical_cast<int64_t>(curBalance[0]);
-        int64_t sellReserved = boost::lexical_cast<int64_t>(curBalance[1]);
-        int64_t acceptReserved = boost::lexical_cast<int64_t>(curBalance[2]);
-        int64_t metadexReserved = boost::lexical_cast<int64_t>(curBalance[3]);
-
-        if (balance) update_tally_map(strAddress, propertyId, balance, BALANCE);
-        if (sellReserved) update_tally_map(strAddress, propertyId, sellReserved, SELLOFFER_RESERVE);
-        if (acceptReserved) update_tally_map(strAddress, propertyId, acceptReserved, ACCEPT_RESERVE);
-        if (metadexReserved) update_tally_map(strAddress, propertyId, metadexReserved, METADEX_RESERVE);
-    }
+    ss << my_accepts;
 
     return 0;
 }
 
-// seller-address, offer_block, amount, property, desired BTC , property_desired, fee, blocktimelimit
-// 13z1JFtDMGTYQvtMq5gs4LmCztK3rmEZga,299076,76375000,1,6415500,0,10000,6
-static int input_mp_offers_string(const std::string& s)
+static int write_globals_state(CDataStream& ss)
 {
-    std::vector<std::string> vstr;
-    boost::split(vstr, s, boost::is_any_of(" ,="), boost::token_compress_on);
+    uint32_t nextSPID = pDbSpInfo->peekNextSPID(OMNI_PROPERTY_MSC);
+    uint32_t nextTestSPID = pDbSpInfo->peekNextSPID(OMNI_PROPERTY_TMSC);
 
-    if (9 != vstr.size()) return -1;
+    ss << exodus_prev << nextSPID << nextTestSPID;
 
-    int i = 0;
+    return 0;
+}
 
-    std::string sellerAddr = vstr[i++];
-    int offerBlock = boost::lexical_cast<int>(vstr[i++]);
-    int64_t amountOriginal = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint32_t prop = boost::lexical_cast<uint32_t>(vstr[i++]);
-    int64_t btcDesired = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint32_t prop_desired = boost::lexical_cast<uint32_t>(vstr[i++]);
-    int64_t minFee = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint8_t blocktimelimit = boost::lexical_cast<unsigned int>(vstr[i++]); // lexical_cast can't handle char!
-    uint256 txid = uint256S(vstr[i++]);
+static int write_mp_crowdsales(CDataStream& ss)
+{
+    ss << my_crowds;
 
-    // TODO: should this be here? There are usually no sanity checks..
-    if (OMNI_PROPERTY_BTC != prop_desired) return -1;
+    return 0;
+}
 
-    const std::string combo = STR_SELLOFFER_ADDR_PROP_COMBO(sellerAddr, prop);
-    CMPOffer newOffer(offerBlock, amountOriginal, prop, btcDesired, minFee, blocktimelimit, txid);
+static int write_mp_metadex(CDataStream& ss)
+{
+    std::vector<CMPMetaDEx> vOrders;
+    for (md_PropertiesMap::const_iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
+        const md_PricesMap& prices = my_it->second;
+        for (md_PricesMap::const_iterator it = prices.begin(); it != prices.end(); ++it) {
+            const md_Set& indexes = it->second;
+            vOrders.insert(vOrders.end(), indexes.begin(), indexes.end());
+        }
+    }
 
-    if (!my_offers.insert(std::make_pair(combo, newOffer)).second) return -1;
+    ss << vOrders;
 
     return 0;
 }
 
-// seller-address, property, buyer-address, amount, fee, block
-// 13z1JFtDMGTYQvtMq5gs4LmCztK3rmEZga,1, 148EFCFXbk2LrUhEHDfs9y3A5dJ4tttKVd,100000,11000,299126
-// 13z1JFtDMGTYQvtMq5gs4LmCztK3rmEZga,1,1Md8GwMtWpiobRnjRabMT98EW6Jh4rEUNy,50000000,11000,299132
-static int input_mp_accepts_string(const std::string& s)
-{
-    int nBlock;
-    unsigned char blocktimelimit;
-    std::vector<std::string> vstr;
-    boost::split(vstr, s, boost::is_any_of(" ,="), boost::token_compress_on);
-    int64_t amountRemaining, amountOriginal, offerOriginal, btcDesired;
-    unsigned int prop;
-    std::string sellerAddr, buyerAddr, txidStr;
-    int i = 0;
-
-    if (10 != vstr.size()) return -1;
-
-    sellerAddr = vstr[i++];
-    prop = boost::lexical_cast<unsigned int>(vstr[i++]);
-    buyerAddr = vstr[i++];
-    nBlock = atoi(vstr[i++]);
-    amountRemaining = boost::lexical_cast<int64_t>(vstr[i++]);
-    amountOriginal = boost::lexical_cast<uint64_t>(vstr[i++]);
-    blocktimelimit = atoi(vstr[i++]);
-    offerOriginal = boost::lexical_cast<int64_t>(vstr[i++]);
-    btcDesired = boost::lexical_cast<int64_t>(vstr[i++]);
-    txidStr = vstr[i++];
-
-    const std::string combo = STR_ACCEPT_ADDR_PROP_ADDR_COMBO(sellerAddr, buyerAddr, prop);
-    CMPAccept newAccept(amountOriginal, amountRemaining, nBlock, blocktimelimit, prop, offerOriginal, btcDesired, uint256S(txidStr));
-    if (my_accepts.insert(std::make_pair(combo, newAccept)).second) {
-        return 0;
-    } else {
-        return -1;
+static void input_address_balances(const AddressBalances& entry)
+{
+    const std::string& strAddress = entry.first;
+
+    for (const CBalanceEntry& balance : entry.second) {
+        if (balance.balance) update_tally_map(strAddress, balance.propertyId, balance.balance, BALANCE);
+        if (balance.sellReserved) update_tally_map(strAddress, balance.propertyId, balance.sellReserved, SELLOFFER_RESERVE);
+        if (balance.acceptReserved) update_tally_map(strAddress, balance.propertyId, balance.acceptReserved, ACCEPT_RESERVE);
+        if (balance.metadexReserved) update_tally_map(strAddress, balance.propertyId, balance.metadexReserved, METADEX_RESERVE);
     }
 }
 
-// exodus_prev
-static int input_globals_state_string(const std::string& s)
+/**
+ * Applies the persisted balances to the empty tally map.
+ *
+ * Entries of the delta replace the entries of the full snapshot.
+ */
+static int input_msc_balances(const std::vector<AddressBalances>& vBalances, const std::vector<AddressBalances>& vDelta)
 {
-    int64_t exodusPrev;
-    uint32_t nextSPID, nextTestSPID;
-    std::vector<std::string> vstr;
-    boost::split(vstr, s, boost::is_any_of(" ,="), boost::token_compress_on);
-    if (3 != vstr.size()) return -1;
+    std::unordered_set<std::string> setReplaced;
+    for (const AddressBalances& entry : vDelta) {
+        setReplaced.insert(entry.first);
+    }
 
-    int i = 0;
-    exodusPrev = boost::lexical_cast<int64_t>(vstr[i++]);
-    nextSPID = boost::lexical_cast<uint32_t>(vstr[i++]);
-    nextTestSPID = boost::lexical_cast<uint32_t>(vstr[i++]);
+    for (const AddressBalances& entry : vBalances) {
+        if (setReplaced.count(entry.first)) continue;
+        input_address_balances(entry);
+    }
+    for (const AddressBalances& entry : vDelta) {
+        input_address_balances(entry);
+    }
 
-    exodus_prev = exodusPrev;
-    pDbSpInfo->init(nextSPID, nextTestSPID);
     return 0;
 }
 
-// addr,propertyId,nValue,property_desired,deadline,early_bird,percentage,txid
-static int input_mp_crowdsale_string(const std::string& s)
+static int input_mp_mdexorders(const std::vector<CMPMetaDEx>& vOrders)
 {
-    std::vector<std::string> vstr;
-    boost::split(vstr, s, boost::is_any_of(" ,"), boost::token_compress_on);
-
-    if (9 > vstr.size()) return -1;
-
-    unsigned int i = 0;
-
-    std::string sellerAddr = vstr[i++];
-    uint32_t propertyId = boost::lexical_cast<uint32_t>(vstr[i++]);
-    int64_t nValue = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint32_t property_desired = boost::lexical_cast<uint32_t>(vstr[i++]);
-    int64_t deadline = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint8_t early_bird = boost::lexical_cast<unsigned int>(vstr[i++]); // lexical_cast can't handle char!
-    uint8_t percentage = boost::lexical_cast<unsigned int>(vstr[i++]); // lexical_cast can't handle char!
-    int64_t u_created = boost::lexical_cast<int64_t>(vstr[i++]);
-    int64_t i_created = boost::lexical_cast<int64_t>(vstr[i++]);
-
-    CMPCrowd newCrowdsale(propertyId, nValue, property_desired, deadline, early_bird, percentage, u_created, i_created);
-
-    // load the remaining as database pairs
-    while (i < vstr.size()) {
-        std::vector<std::string> entryData;
-        boost::split(entryData, vstr[i++], boost::is_any_of("="), boost::token_compress_on);
-        if (2 != entryData.size()) return -1;
-
-        std::vector<std::string> valueData;
-        boost::split(valueData, entryData[1], boost::is_any_of(";"), boost::token_compress_on);
-
-        std::vector<int64_t> vals;
-        for (std::vector<std::string>::const_iterator it = valueData.begin(); it != valueData.end(); ++it) {
-            vals.push_back(boost::lexical_cast<int64_t>(*it));
-        }
-
-        uint256 txHash = uint256S(entryData[0]);
-        newCrowdsale.insertDatabase(txHash, vals);
-    }
-
-    if (!my_crowds.insert(std::make_pair(sellerAddr, newCrowdsale)).second) {
-        return -1;
+    for (const CMPMetaDEx& mdexObj : vOrders) {
+        if (!MetaDEx_INSERT(mdexObj)) return -1;
     }
 
     return 0;
 }
 
-// address, block, amount for sale, property, amount desired, property desired, subaction, idx, txid, amount remaining
-static int input_mp_mdexorder_string(const std::string& s)
+/**
+ * Reads a state file and checks its header.
+ *
+ * @param path        The path of the file
+ * @param what        The expected type of the state file
+ * @param header      The header of the file
+ * @param ssState     The serialized state, without header and hash
+ * @param verifyHash  Whether to verify the hash of the file
+ * @return True, if the file was read successfully
+ */
+static bool ReadStateFile(const fs::path& path, int what, CStateFileHeader& header, CDataStream& ssState, bool verifyHash)
 {
-    std::vector<std::string> vstr;
-    boost::split(vstr, s, boost::is_any_of(" ,="), boost::token_compress_on);
+    FILE* file = fsbridge::fopen(path, "rb");
+    if (!file) {
+        if (msc_debug_persistence) LogPrintf("%s(%s): file not found\n", __func__, path.string());
+        return false;
+    }
 
-    if (10 != vstr.size()) return -1;
+    std::vector<char> vData;
+    try {
+        vData.resize(fs::file_size(path));
+    } catch (const fs::filesystem_error& e) {
+        fclose(file);
+        PrintToLog("%s(%s): failed to determine file size: %s\n", __func__, path.string(), e.what());
+        return false;
+    }
+    size_t nRead = vData.empty() ? 0 : fread(vData.data(), 1, vData.size(), file);
+    fclose(file);
 
-    int i = 0;
+    if (nRead != vData.size() || vData.size() < sizeof(uint256)) {
+        PrintToLog("%s(%s): failed to read file\n", __func__, path.string());
+        return false;
+    }
 
-    std::string addr = vstr[i++];
-    int block = boost::lexical_cast<int>(vstr[i++]);
-    int64_t amount_forsale = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint32_t property = boost::lexical_cast<uint32_t>(vstr[i++]);
-    int64_t amount_desired = boost::lexical_cast<int64_t>(vstr[i++]);
-    uint32_t desired_property = boost::lexical_cast<uint32_t>(vstr[i++]);
-    uint8_t subaction = boost::lexical_cast<unsigned int>(vstr[i++]); // lexical_cast can't handle char!
-    unsigned int idx = boost::lexical_cast<unsigned int>(vstr[i++]);
-    uint256 txid = uint256S(vstr[i++]);
-    int64_t amount_remaining = boost::lexical_cast<int64_t>(vstr[i++]);
+    const char* pend = vData.data() + vData.size() - sizeof(uint256);
+    if (verifyHash) {
+        uint256 hashFile;
+        memcpy(hashFile.begin(), pend, sizeof(uint256));
+        if (Hash(static_cast<const char*>(vData.data()), pend) != hashFile) {
+            PrintToLog("File %s loaded, but failed hash validation!\n", path.string());
+            return false;
+        }
+    }
 
-    CMPMetaDEx mdexObj(addr, block, property, amount_forsale, desired_property,
-            amount_desired, txid, idx, subaction, amount_remaining);
+    ssState = CDataStream(vData.data(), pend, SER_DISK, CLIENT_VERSION);
+    try {
+        ssState >> header;
+    } catch (const std::exception& e) {
+        PrintToLog("%s(%s): failed to read header: %s\n", __func__, path.string(), e.what());
+        return false;
+    }
 
-    if (!MetaDEx_INSERT(mdexObj)) return -1;
+    if (header.magic != STATE_FILE_MAGIC || header.version != STATE_FILE_VERSION || header.type != what) {
+        PrintToLog("%s(%s): unknown file format (version: %d, type: %d)\n", __func__, path.string(), header.version, header.type);
+        return false;
+    }
 
-    return 0;
+    return true;
 }
 
-static int write_state_file(const CBlockIndex* pBlockIndex, int what)
+/**
+ * Serializes the state of the given type, including the header of the state file.
+ */
+static int serialize_state(const CBlockIndex* pBlockIndex, int what, CStateFileHeader& header, CDataStream& ssFile)
 {
-    fs::path path = pathStateFiles / strprintf("%s-%s.dat", statePrefix[what], pBlockIndex->GetBlockHash().ToString());
-    const std::string strFile = path.string();
-
-    std::ofstream file;
-    file.open(strFile.c_str());
-
-    CHash256 hasher;
+    CDataStream ssState(SER_DISK, CLIENT_VERSION);
 
     int result = 0;
 
     switch (what) {
         case FILETYPE_BALANCES:
-            result = write_msc_balances(file, hasher);
+            result = write_msc_balances(ssState, header, pBlockIndex->nHeight);
             break;
 
         case FILETYPE_OFFERS:
-            result = write_mp_offers(file, hasher);
+            result = write_mp_offers(ssState);
             break;
 
         case FILETYPE_ACCEPTS:
-            result = write_mp_accepts(file, hasher);
+            result = write_mp_accepts(ssState);
             break;
 
         case FILETYPE_GLOBALS:
-            result = write_globals_state(file, hasher);
+            result = write_globals_state(ssState);
             break;
 
         case FILETYPE_CROWDSALES:
-            result = write_mp_crowdsales(file, hasher);
+            result = write_mp_crowdsales(ssState);
             break;
 
         case FILETYPE_MDEXORDERS:
-            result = write_mp_metadex(file, hasher);
+            result = write_mp_metadex(ssState);
             break;
     }
 
-    // generate and write the double hash of all the contents written
-    uint256 hash;
-    hasher.Finalize(hash.begin());
-    file << "!" << hash.ToString() << std::endl;
+    ssFile << header;
+    ssFile += ssState;
 
-    file.flush();
-    file.close();
     return result;
 }
 
-static void prune_state_files(const CBlockIndex* topIndex)
+/**
+ * Writes a serialized state file, followed by its hash.
+ */
+static int write_state_file(const fs::path& path, CDataStream& ssFile)
+{
+    // generate and write the double hash of all the contents written
+    uint256 hash = Hash(ssFile.begin(), ssFile.end());
+    ssFile << hash;
+
+    FILE* file = fsbridge::fopen(path, "wb");
+    if (!file) {
+        PrintToLog("%s(): failed to open %s for writing\n", __func__, path.string());
+        return -1;
+    }
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    fileout.write(ssFile.data(), ssFile.size());
+
+    return 0;
+}
+
+/**
+ * Returns the block of the full snapshot a balance delta is based on.
+ */
+static uint256 GetBalancesBase(const uint256& blockHash)
+{
+    CStateFileHeader header;
+    FILE* file = fsbridge::fopen(GetStateFilePath(pathStateFiles, FILETYPE_BALANCES, blockHash), "rb");
+    if (!file) {
+        return uint256();
+    }
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    try {
+        filein >> header;
+    } catch (const std::exception&) {
+        return uint256();
+    }
+
+    if (header.magic != STATE_FILE_MAGIC || header.kind != SNAPSHOT_DELTA) {
+        return uint256();
+    }
+    return header.base;
+}
+
+static void prune_state_files(int nTopHeight)
 {
     // build a set of blockHashes for which we have any state files
     std::set<uint256> statefulBlockHashes;
@@ -476,28 +505,39 @@ static void prune_state_files(const CBlockIndex* topIndex)
     }
 
     // for each blockHash in the set, determine the distance from the given block
+    std::set<uint256> obsoleteBlockHashes;
+    std::set<uint256> baseBlockHashes;
     std::set<uint256>::const_iterator iter;
     for (iter = statefulBlockHashes.begin(); iter != statefulBlockHashes.end(); ++iter) {
         // look up the CBlockIndex for height info
         CBlockIndex const *curIndex = GetBlockIndex(*iter);
 
         // if we have nothing int the index, or this block is too old..
-        if (nullptr == curIndex || (((topIndex->nHeight - curIndex->nHeight) > MAX_STATE_HISTORY)
+        if (nullptr == curIndex || (((nTopHeight - curIndex->nHeight) > MAX_STATE_HISTORY)
                 && (curIndex->nHeight % STORE_EVERY_N_BLOCK != 0))) {
             if (msc_debug_persistence) {
                 if (curIndex) {
-                    PrintToLog("State from Block:%s is no longer need, removing files (age-from-tip: %d)\n", (*iter).ToString(), topIndex->nHeight - curIndex->nHeight);
+                    PrintToLog("State from Block:%s is no longer need, removing files (age-from-tip: %d)\n", (*iter).ToString(), nTopHeight - curIndex->nHeight);
                 } else {
                     PrintToLog("State from Block:%s is no longer need, removing files (not in index)\n", (*iter).ToString());
                 }
             }
+            obsoleteBlockHashes.insert(*iter);
+        } else {
+            // the full snapshots of retained deltas are still needed
+            uint256 baseBlockHash = GetBalancesBase(*iter);
+            if (!baseBlockHash.IsNull()) baseBlockHashes.insert(baseBlockHash);
+        }
+    }
 
-            // destroy the associated files!
-            std::string strBlockHash = iter->ToString();
-            for (int i = 0; i < NUM_FILETYPES; ++i) {
-                fs::path path = pathStateFiles / strprintf("%s-%s.dat", statePrefix[i], strBlockHash);
-                fs::remove(path);
-            }
+    for (iter = obsoleteBlockHashes.begin(); iter != obsoleteBlockHashes.end(); ++iter) {
+        if (baseBlockHashes.count(*iter)) {
+            continue;
+        }
+
+        // destroy the associated files!
+        for (int i = 0; i < NUM_FILETYPES; ++i) {
+            fs::remove(GetStateFilePath(pathStateFiles, i, *iter));
         }
     }
 }
@@ -536,73 +576,206 @@ bool IsPersistenceEnabled(int blockHeight)
     return true;
 }
 
+/** Serialized state of a block, waiting to be written to disk. */
+struct CStateSnapshot
+{
+    uint256 blockHash;
+    int nHeight;
+    //! Whether the balances are a full snapshot, which later deltas may be based on
+    bool fFullBalances;
+    //! The serialized state files, indexed by file type
+    std::vector<CDataStream> vFiles;
+};
+
+//! Maximum number of snapshots waiting to be written, which bounds how far the watermark lags behind
+static const size_t MAX_QUEUED_SNAPSHOTS = 8;
+
+static Mutex cs_persist;
+//! Signals new snapshots to the worker and completed ones to waiting threads
+static std::condition_variable condPersist;
+//! Snapshots waiting to be written, oldest first
+static std::deque<std::shared_ptr<CStateSnapshot> > queueSnapshots GUARDED_BY(cs_persist);
+//! Whether the worker is writing a snapshot
+static bool fPersistBusy GUARDED_BY(cs_persist) = false;
+//! Whether the worker is running
+static bool fPersistRunning GUARDED_BY(cs_persist) = false;
+//! Whether the worker should stop, once all snapshots are written
+static bool fPersistStop GUARDED_BY(cs_persist) = false;
+static std::thread threadPersist;
+
 /**
- * Stores the in-memory state in files.
+ * Serializes the in-memory state as of the given block.
  */
-int PersistInMemoryState(const CBlockIndex* pBlockIndex)
+static std::shared_ptr<CStateSnapshot> CreateStateSnapshot(const CBlockIndex* pBlockIndex)
 {
-    // write the new state as of the given block
-    write_state_file(pBlockIndex, FILETYPE_BALANCES);
-    write_state_file(pBlockIndex, FILETYPE_OFFERS);
-    write_state_file(pBlockIndex, FILETYPE_ACCEPTS);
-    write_state_file(pBlockIndex, FILETYPE_GLOBALS);
-    write_state_file(pBlockIndex, FILETYPE_CROWDSALES);
-    write_state_file(pBlockIndex, FILETYPE_MDEXORDERS);
+    std::shared_ptr<CStateSnapshot> snapshot = std::make_shared<CStateSnapshot>();
+    snapshot->blockHash = pBlockIndex->GetBlockHash();
+    snapshot->nHeight = pBlockIndex->nHeight;
+    snapshot->fFullBalances = false;
 
-    // clean-up the directory
-    prune_state_files(pBlockIndex);
+    for (int i = 0; i < NUM_FILETYPES; ++i) {
+        CStateFileHeader header(i, snapshot->blockHash);
+        snapshot->vFiles.emplace_back(SER_DISK, CLIENT_VERSION);
+        serialize_state(pBlockIndex, i, header, snapshot->vFiles.back());
+        if (i == FILETYPE_BALANCES) {
+            snapshot->fFullBalances = (header.kind == SNAPSHOT_FULL);
+        }
+    }
 
-    pDbSpInfo->setWatermark(pBlockIndex->GetBlockHash());
+    return snapshot;
+}
 
-    return 0;
+/**
+ * Writes the state files of a snapshot, prunes old state files and updates
+ * the watermark of the SP database.
+ *
+ * The watermark is only moved to the snapshot, once all of its files were
+ * written, so it always refers to the last completed snapshot.
+ */
+static void WriteStateSnapshot(CStateSnapshot& snapshot)
+{
+    bool fComplete = true;
+    for (int i = 0; i < NUM_FILETYPES; ++i) {
+        if (write_state_file(GetStateFilePath(pathStateFiles, i, snapshot.blockHash), snapshot.vFiles[i]) != 0) {
+            fComplete = false;
+        }
+    }
+
+    // clean-up the directory, unless the block index is busy, in which case
+    // it is done with the next snapshot
+    {
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain) {
+            prune_state_files(snapshot.nHeight);
+        }
+    }
+
+    if (fComplete) {
+        pDbSpInfo->setWatermark(snapshot.blockHash);
+    }
+}
+
+static void ThreadPersistState()
+{
+    while (true) {
+        std::shared_ptr<CStateSnapshot> snapshot;
+        {
+            WAIT_LOCK(cs_persist, lock);
+            fPersistBusy = false;
+            condPersist.notify_all();
+
+            while (!fPersistStop && queueSnapshots.empty()) {
+                condPersist.wait(lock);
+            }
+            if (queueSnapshots.empty()) {
+                return;
+            }
+
+            snapshot = queueSnapshots.front();
+            queueSnapshots.pop_front();
+            fPersistBusy = true;
+            // wake up a producer, which waits for room in the queue
+            condPersist.notify_all();
+        }
+
+        WriteStateSnapshot(*snapshot);
+    }
 }
 
 /**
- * Loads and retrieves state from a file.
+ * Starts the worker, which writes state files in the background.
  */
-int RestoreInMemoryState(const std::string& filename, int what, bool verifyHash)
+void StartStatePersistence()
 {
-    int lines = 0;
-    int (*inputLineFunc)(const std::string&) = nullptr;
+    LOCK(cs_persist);
+    if (fPersistRunning) return;
 
-    CHash256 hasher;
+    fPersistRunning = true;
+    fPersistStop = false;
+    threadPersist = std::thread(&TraceThread<void (*)()>, "omnipersist", &ThreadPersistState);
+}
 
-    switch (what) {
-        case FILETYPE_BALANCES:
-            mp_tally_map.clear();
-            inputLineFunc = input_msc_balances_string;
-            break;
+/**
+ * Writes all pending snapshots and stops the worker.
+ */
+void StopStatePersistence()
+{
+    {
+        LOCK(cs_persist);
+        if (!fPersistRunning) return;
 
-        case FILETYPE_OFFERS:
-            my_offers.clear();
-            inputLineFunc = input_mp_offers_string;
-            break;
+        fPersistStop = true;
+        condPersist.notify_all();
+    }
 
-        case FILETYPE_ACCEPTS:
-            my_accepts.clear();
-            inputLineFunc = input_mp_accepts_string;
-            break;
+    threadPersist.join();
 
-        case FILETYPE_GLOBALS:
-            inputLineFunc = input_globals_state_string;
-            break;
+    LOCK(cs_persist);
+    fPersistRunning = false;
+}
 
-        case FILETYPE_CROWDSALES:
-            my_crowds.clear();
-            inputLineFunc = input_mp_crowdsale_string;
-            break;
+/**
+ * Waits until all pending snapshots are written.
+ */
+void FlushStateSnapshots()
+{
+    WAIT_LOCK(cs_persist, lock);
+    while (!queueSnapshots.empty() || fPersistBusy) {
+        condPersist.wait(lock);
+    }
+}
 
-        case FILETYPE_MDEXORDERS:
-            // FIXME
-            // memory leak ... gotta unallocate inner layers first....
-            // TODO
-            // ...
-            metadex.clear();
-            inputLineFunc = input_mp_mdexorder_string;
-            break;
+/**
+ * Stores the in-memory state in files.
+ *
+ * The state is serialized in memory, while the caller holds the lock. If the
+ * worker is running, the files are written in the background. When the worker
+ * falls behind, the oldest pending snapshot is dropped, unless it holds full
+ * balances, which later snapshots may be based on. If only full snapshots are
+ * pending, the caller waits until the worker has taken one, so the queue never
+ * holds more than MAX_QUEUED_SNAPSHOTS snapshots.
+ */
+int PersistInMemoryState(const CBlockIndex* pBlockIndex)
+{
+    std::shared_ptr<CStateSnapshot> snapshot = CreateStateSnapshot(pBlockIndex);
 
-        default:
-            return -1;
+    {
+        WAIT_LOCK(cs_persist, lock);
+        if (fPersistRunning) {
+            if (queueSnapshots.size() >= MAX_QUEUED_SNAPSHOTS) {
+                for (auto it = queueSnapshots.begin(); it != queueSnapshots.end(); ++it) {
+                    if (!(*it)->fFullBalances) {
+                        if (msc_debug_persistence) PrintToLog("%s(): skipping state of block %d\n", __func__, (*it)->nHeight);
+                        queueSnapshots.erase(it);
+                        break;
+                    }
+                }
+            }
+            while (fPersistRunning && queueSnapshots.size() >= MAX_QUEUED_SNAPSHOTS) {
+                if (msc_debug_persistence) PrintToLog("%s(): waiting for state files to be written\n", __func__);
+                condPersist.wait(lock);
+            }
+            queueSnapshots.push_back(snapshot);
+            condPersist.notify_all();
+            return 0;
+        }
+    }
+
+    WriteStateSnapshot(*snapshot);
+
+    return 0;
+}
+
+/**
+ * Loads and retrieves state from a file.
+ *
+ * Deltas of the balances are applied on top of the full snapshot they are
+ * based on, which is expected in the same directory.
+ */
+int RestoreInMemoryState(const std::string& filename, int what, bool verifyHash)
+{
+    if (what < 0 || what >= NUM_FILETYPES) {
+        return -1;
     }
 
     if (msc_debug_persistence) {
@@ -610,62 +783,125 @@ int RestoreInMemoryState(const std::string& filename, int what, bool verifyHash)
         PrintToLog("%s(%s), line %d, file: %s\n", __FUNCTION__, filename, __LINE__, __FILE__);
     }
 
-    std::ifstream file;
-    file.open(filename.c_str());
-    if (!file.is_open()) {
-        if (msc_debug_persistence) LogPrintf("%s(%s): file not found, line %d, file: %s\n", __FUNCTION__, filename, __LINE__, __FILE__);
+    CStateFileHeader header;
+    CDataStream ssState(SER_DISK, CLIENT_VERSION);
+    if (!ReadStateFile(filename, what, header, ssState, verifyHash)) {
         return -1;
     }
 
     int res = 0;
+    size_t entries = 0;
+
+    try {
+        switch (what) {
+            case FILETYPE_BALANCES:
+            {
+                std::vector<AddressBalances> vBalances;
+                std::vector<AddressBalances> vDelta;
+
+                if (header.kind == SNAPSHOT_DELTA) {
+                    fs::path pathBase = GetStateFilePath(fs::path(filename).parent_path(), FILETYPE_BALANCES, header.base);
+                    CStateFileHeader headerBase;
+                    CDataStream ssBase(SER_DISK, CLIENT_VERSION);
+                    if (!ReadStateFile(pathBase, what, headerBase, ssBase, verifyHash) ||
+                            headerBase.kind != SNAPSHOT_FULL || headerBase.block != header.base) {
+                        PrintToLog("%s(%s): full snapshot %s of delta not available\n", __func__, filename, header.base.ToString());
+                        return -1;
+                    }
+                    ssBase >> vBalances;
+                    ssState >> vDelta;
+                } else {
+                    ssState >> vBalances;
+                }
+
+                ClearTallyMap();
+                res = input_msc_balances(vBalances, vDelta);
+                entries = vBalances.size() + vDelta.size();
 
-    std::string fileHash;
-    while (file.good()) {
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#') continue;
+                // further deltas are based on the restored state, if it's a full snapshot
+                hashBalancesBase = (header.kind == SNAPSHOT_FULL) ? header.block : uint256();
+                mp_tally_map.resetChanged();
+                break;
+            }
 
-        // remove \r if the file came from Windows
-        line.erase(std::remove(line.begin(), line.end(), '\r'), line.end());
+            case FILETYPE_OFFERS:
+                my_offers.clear();
+                ssState >> my_offers;
+                entries = my_offers.size();
+                break;
 
-        // record and skip hashes in the file
-        if (line[0] == '!') {
-            fileHash = line.substr(1);
-            continue;
-        }
+            case FILETYPE_ACCEPTS:
+                my_accepts.clear();
+                ssState >> my_accepts;
+                RebuildAcceptExpiryIndex();
+                entries = my_accepts.size();
+                break;
 
-        // update hash?
-        if (verifyHash) {
-            hasher.Write((unsigned char*)line.c_str(), line.length());
-        }
+            case FILETYPE_GLOBALS:
+            {
+                int64_t exodusPrev;
+                uint32_t nextSPID, nextTestSPID;
+                ssState >> exodusPrev >> nextSPID >> nextTestSPID;
 
-        if (inputLineFunc) {
-            if (inputLineFunc(line) < 0) {
-                res = -1;
+                exodus_prev = exodusPrev;
+                pDbSpInfo->init(nextSPID, nextTestSPID);
+                entries = 1;
+                break;
+            }
+
+            case FILETYPE_CROWDSALES:
+                my_crowds.clear();
+                ssState >> my_crowds;
+                RebuildCrowdsaleDeadlineIndex();
+                entries = my_crowds.size();
+                break;
+
+            case FILETYPE_MDEXORDERS:
+            {
+                // FIXME
+                // memory leak ... gotta unallocate inner layers first....
+                // TODO
+                // ...
+                MetaDEx_Clear();
+                ResetIncrementalConsensusHash();
+                std::vector<CMPMetaDEx> vOrders;
+                ssState >> vOrders;
+                res = input_mp_mdexorders(vOrders);
+                entries = vOrders.size();
                 break;
             }
         }
+    } catch (const std::exception& e) {
+        PrintToLog("%s(%s): failed to deserialize state: %s\n", __func__, filename, e.what());
+        res = -1;
+    }
 
-        ++lines;
+    if (res == 0 && !ssState.empty()) {
+        PrintToLog("%s(%s): unexpected data after state\n", __func__, filename);
+        res = -1;
     }
 
-    file.close();
+    PrintToLog("%s(%s), loaded entries= %d, res= %d\n", __FUNCTION__, filename, entries, res);
+    LogPrintf("%s(): file: %s , loaded entries= %d, res= %d\n", __FUNCTION__, filename, entries, res);
 
-    if (verifyHash && res == 0) {
-        // generate and write the double hash of all the contents written
-        uint256 hash;
-        hasher.Finalize(hash.begin());
+    return res;
+}
 
-        if (false == boost::iequals(hash.ToString(), fileHash)) {
-            PrintToLog("File %s loaded, but failed hash validation!\n", filename);
-            res = -1;
-        }
+/**
+ * Forces the next snapshot of the balances to be a full one.
+ *
+ * Pending snapshots are discarded.
+ */
+void ResetStateSnapshots()
+{
+    WAIT_LOCK(cs_persist, lock);
+    queueSnapshots.clear();
+    condPersist.notify_all();
+    while (fPersistBusy) {
+        condPersist.wait(lock);
     }
 
-    PrintToLog("%s(%s), loaded lines= %d, res= %d\n", __FUNCTION__, filename, lines, res);
-    LogPrintf("%s(): file: %s , loaded lines= %d, res= %d\n", __FUNCTION__, filename, lines, res);
-
-    return res;
+    hashBalancesBase.SetNull();
 }
 
 /**
@@ -673,6 +909,9 @@ int RestoreInMemoryState(const std::string& filename, int what, bool verifyHash)
  */
 int LoadMostRelevantInMemoryState()
 {
+    // the watermark and state files are updated by the worker
+    FlushStateSnapshots();
+
     int res = -1;
     uint256 spWatermark;
     {
@@ -797,8 +1036,7 @@ int LoadMostRelevantInMemoryState()
             if (persistedBlocks.find(curTip->GetBlockHash()) != persistedBlocks.end()) {
                 int success = -1;
                 for (int i = 0; i < NUM_FILETYPES; ++i) {
-                    fs::path path = pathStateFiles / strprintf("%s-%s.dat", statePrefix[i], curTip->GetBlockHash().ToString());
-                    const std::string strFile = path.string();
+                    const std::string strFile = GetStateFilePath(pathStateFiles, i, curTip->GetBlockHash()).string();
                     success = RestoreInMemoryState(strFile, i, true);
                     if (success < 0) {
                         PrintToConsole("Found a state inconsistency at block height %d. "
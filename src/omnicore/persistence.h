@@ -11,11 +11,23 @@ bool IsPersistenceEnabled(int blockHeight);
 /** Stores the in-memory state in files. */
 int PersistInMemoryState(const CBlockIndex* pBlockIndex);
 
+/** Starts the worker, which writes state files in the background. */
+void StartStatePersistence();
+
+/** Writes all pending snapshots and stops the worker. */
+void StopStatePersistence();
+
+/** Waits until all pending snapshots are written. */
+void FlushStateSnapshots();
+
 /** Loads and retrieves state from a file. */
 int RestoreInMemoryState(const std::string& filename, int what, bool verifyHash = false);
 
 /** Loads and restores the latest state. Returns -1 if reparse is required. */
 int LoadMostRelevantInMemoryState();
 
+/** Forces the next snapshot of the balances to be a full one and discards pending snapshots. */
+void ResetStateSnapshots();
+
 
 #endif // BITCOIN_OMNICORE_PERSISTENCE_H
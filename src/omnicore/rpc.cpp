@@ -9,6 +9,7 @@
 #include <omnicore/activation.h>
 #include <omnicore/consensushash.h>
 #include <omnicore/convert.h>
+#include <omnicore/dbbase.h>
 #include <omnicore/dbfees.h>
 #include <omnicore/dbspinfo.h>
 #include <omnicore/dbstolist.h>
@@ -876,7 +877,7 @@ static UniValue mscrpc(const JSONRPCRequest& request)
             LOCK(cs_tally);
             int64_t total = 0;
             // display all balances
-            for (std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
+            for (CMPTallyMap::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
                 PrintToConsole("%34s => ", my_it->first);
                 total += (my_it->second).print(extra2, bDivisible);
             }
@@ -896,6 +897,7 @@ static UniValue mscrpc(const JSONRPCRequest& request)
             LOCK(cs_tally);
             // display smart properties
             pDbSpInfo->printAll();
+            pDbSpInfo->printStats();
             break;
         }
         case 3:
@@ -903,7 +905,7 @@ static UniValue mscrpc(const JSONRPCRequest& request)
             LOCK(cs_tally);
             uint32_t id = 0;
             // for each address display all currencies it holds
-            for (std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
+            for (CMPTallyMap::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
                 PrintToConsole("%34s => ", my_it->first);
                 (my_it->second).print(extra2);
                 (my_it->second).init();
@@ -1086,20 +1088,8 @@ static UniValue omni_getallbalancesforid(const JSONRPCRequest& request)
 
     LOCK(cs_tally);
 
-    for (std::unordered_map<std::string, CMPTally>::iterator it = mp_tally_map.begin(); it != mp_tally_map.end(); ++it) {
-        uint32_t id = 0;
-        bool includeAddress = false;
-        std::string address = it->first;
-        (it->second).init();
-        while (0 != (id = (it->second).next())) {
-            if (id == propertyId) {
-                includeAddress = true;
-                break;
-            }
-        }
-        if (!includeAddress) {
-            continue; // ignore this address, has never transacted in this propertyId
-        }
+    // only addresses with non-zero amounts of the property can have a non-empty balance
+    for (const std::string& address : getPropertyHolders(propertyId)) {
         UniValue balanceObj(UniValue::VOBJ);
         balanceObj.pushKV("address", address);
         bool nonEmptyBalance = BalanceToJSON(address, propertyId, balanceObj, isDivisible);
@@ -1900,15 +1890,14 @@ static UniValue omni_getorderbook(const JSONRPCRequest& request)
     std::vector<CMPMetaDEx> vecMetaDexObjects;
     {
         LOCK(cs_tally);
-        for (md_PropertiesMap::const_iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
+        // the books of the pairs, which offer the property for sale, are adjacent
+        md_PropertiesMap::const_iterator my_it = metadex.lower_bound(std::make_pair(propertyIdForSale, filterDesired ? propertyIdDesired : 0));
+        for (; my_it != metadex.end() && my_it->first.first == propertyIdForSale; ++my_it) {
+            if (filterDesired && my_it->first.second != propertyIdDesired) break;
             const md_PricesMap& prices = my_it->second;
             for (md_PricesMap::const_iterator it = prices.begin(); it != prices.end(); ++it) {
                 const md_Set& indexes = it->second;
-                for (md_Set::const_iterator it = indexes.begin(); it != indexes.end(); ++it) {
-                    const CMPMetaDEx& obj = *it;
-                    if (obj.getProperty() != propertyIdForSale) continue;
-                    if (!filterDesired || obj.getDesProperty() == propertyIdDesired) vecMetaDexObjects.push_back(obj);
-                }
+                vecMetaDexObjects.insert(vecMetaDexObjects.end(), indexes.begin(), indexes.end());
             }
         }
     }
@@ -1981,7 +1970,8 @@ static UniValue omni_gettradehistoryforaddress(const JSONRPCRequest& request)
     }.Check(request);
 
     std::string address = ParseAddress(request.params[0]);
-    uint64_t count = (request.params.size() > 1) ? request.params[1].get_int64() : 10;
+    int64_t count = (request.params.size() > 1) ? request.params[1].get_int64() : 10;
+    if (count < 0) throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
     uint32_t propertyId = 0;
 
     if (request.params.size() > 2) {
@@ -2020,6 +2010,7 @@ static UniValue omni_gettradehistoryforpair(const JSONRPCRequest& request)
            {"propertyid", RPCArg::Type::NUM, RPCArg::Optional::NO, "the first side of the traded pair"},
            {"propertyidsecond", RPCArg::Type::NUM, RPCArg::Optional::NO, "the second side of the traded pair"},
            {"count", RPCArg::Type::NUM, /* default */ "10", "number of trades to retrieve"},
+           {"skip", RPCArg::Type::NUM, /* default */ "0", "number of most recent trades to skip"},
        },
        RPCResult{
            RPCResult::Type::ARR, "", "",
@@ -2040,6 +2031,7 @@ static UniValue omni_gettradehistoryforpair(const JSONRPCRequest& request)
        },
        RPCExamples{
            HelpExampleCli("omni_gettradehistoryforpair", "1 12 500")
+           + HelpExampleCli("omni_gettradehistoryforpair", "1 12 500 500")
            + HelpExampleRpc("omni_gettradehistoryforpair", "1, 12, 500")
        }
     }.Check(request);
@@ -2047,7 +2039,10 @@ static UniValue omni_gettradehistoryforpair(const JSONRPCRequest& request)
     // obtain property identifiers for pair & check valid parameters
     uint32_t propertyIdSideA = ParsePropertyId(request.params[0]);
     uint32_t propertyIdSideB = ParsePropertyId(request.params[1]);
-    uint64_t count = (request.params.size() > 2) ? request.params[2].get_int64() : 10;
+    int64_t count = (request.params.size() > 2) ? request.params[2].get_int64() : 10;
+    if (count < 0) throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    int64_t skip = (request.params.size() > 3) ? request.params[3].get_int64() : 0;
+    if (skip < 0) throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
 
     RequireExistingProperty(propertyIdSideA);
     RequireExistingProperty(propertyIdSideB);
@@ -2057,7 +2052,7 @@ static UniValue omni_gettradehistoryforpair(const JSONRPCRequest& request)
     // request pair trade history from trade db
     UniValue response(UniValue::VARR);
     LOCK(cs_tally);
-    pDbTradeList->getTradesForPair(propertyIdSideA, propertyIdSideB, response, count);
+    pDbTradeList->getTradesForPair(propertyIdSideA, propertyIdSideB, response, count, skip);
     return response;
 }
 
@@ -2488,6 +2483,14 @@ static UniValue omni_getinfo(const JSONRPCRequest& request)
                {RPCResult::Type::NUM, "blocktime", "timestamp of the last processed block"},
                {RPCResult::Type::NUM, "blocktransactions", "Omni transactions found in the last processed block"},
                {RPCResult::Type::NUM, "totaltransactions", "Omni transactions processed in total"},
+               {RPCResult::Type::OBJ, "dbcache", "block cache and bloom filters of the databases",
+               {
+                   {RPCResult::Type::NUM, "cachesize", "size of the shared block cache in bytes"},
+                   {RPCResult::Type::NUM, "cacheusage", "bytes used in the shared block cache"},
+                   {RPCResult::Type::NUM, "bloombits", "bits per key of the bloom filters"},
+                   {RPCResult::Type::NUM, "spcachehits", "property lookups served from the property cache"},
+                   {RPCResult::Type::NUM, "spcachemisses", "property lookups, which were read from the database"},
+               }},
                {RPCResult::Type::ARR, "alerts", "active protocol alert (if any)",
                {
                    {RPCResult::Type::OBJ, "", "",
@@ -2532,6 +2535,15 @@ static UniValue omni_getinfo(const JSONRPCRequest& request)
     // provide the number of transactions parsed
     infoResponse.pushKV("totaltransactions", totalMPTransactions);
 
+    // provide the database cache details
+    UniValue dbCache(UniValue::VOBJ);
+    dbCache.pushKV("cachesize", (uint64_t) CDBBase::GetSharedCacheSize());
+    dbCache.pushKV("cacheusage", (uint64_t) CDBBase::GetSharedCacheUsage());
+    dbCache.pushKV("bloombits", CDBBase::GetBloomFilterBits());
+    dbCache.pushKV("spcachehits", pDbSpInfo->getCacheHits());
+    dbCache.pushKV("spcachemisses", pDbSpInfo->getCacheMisses());
+    infoResponse.pushKV("dbcache", dbCache);
+
     // handle alerts
     UniValue alerts(UniValue::VARR);
     std::vector<AlertData> omniAlerts = GetOmniCoreAlerts();
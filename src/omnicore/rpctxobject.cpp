@@ -28,6 +28,7 @@
 #include <validation.h>
 #include <primitives/transaction.h>
 #include <sync.h>
+#include <txmempool.h>
 #include <uint256.h>
 
 #include <univalue.h>
@@ -36,12 +37,152 @@
 #include <boost/lexical_cast.hpp>
 
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // Namespaces
 using namespace mastercore;
 
+//! Maximum number of decoded transactions cached for RPC calls
+static const size_t MAX_DECODED_TXS = 1000;
+
+/** A confirmed Omni transaction, decoded as of the block it was included in. */
+struct CDecodedTx
+{
+    CMPTransaction mp_obj;
+    uint256 blockHash;
+    int blockHeight;
+    int64_t blockTime;
+    bool valid;
+    int positionInBlock;
+    std::string invalidReason;
+
+    CDecodedTx() : blockHeight(0), blockTime(0), valid(false), positionInBlock(0) {}
+};
+
+//! Guards the cache of decoded transactions
+static Mutex cs_decoded;
+//! Recently used decoded transactions, most recent first
+static std::list<uint256> decodedOrder GUARDED_BY(cs_decoded);
+//! Cached decoded transactions by txid
+static std::unordered_map<uint256, std::pair<std::shared_ptr<const CDecodedTx>, std::list<uint256>::iterator>, SaltedTxidHasher> decodedTxs GUARDED_BY(cs_decoded);
+//! Incremented, when the cache is cleared, so transactions decoded before are not added
+static uint64_t nDecodedEpoch GUARDED_BY(cs_decoded) = 0;
+//! Height of the last processed block, or -1, if not known yet
+static std::atomic<int> nDecodedTipHeight{-1};
+
+/** Returns the cached decoded transaction, or nullptr, if it isn't cached. */
+static std::shared_ptr<const CDecodedTx> GetDecodedTx(const uint256& txid)
+{
+    LOCK(cs_decoded);
+    auto it = decodedTxs.find(txid);
+    if (it == decodedTxs.end()) {
+        return nullptr;
+    }
+    decodedOrder.splice(decodedOrder.begin(), decodedOrder, it->second.second);
+
+    return it->second.first;
+}
+
+/** Returns the current epoch of the cache. */
+static uint64_t GetDecodedEpoch()
+{
+    LOCK(cs_decoded);
+    return nDecodedEpoch;
+}
+
+/** Caches a decoded transaction, unless the cache was cleared after the given epoch. */
+static void PutDecodedTx(const uint256& txid, const std::shared_ptr<const CDecodedTx>& decoded, uint64_t nEpoch)
+{
+    LOCK(cs_decoded);
+    if (nEpoch != nDecodedEpoch || decodedTxs.count(txid)) {
+        return;
+    }
+    decodedOrder.push_front(txid);
+    decodedTxs.emplace(txid, std::make_pair(decoded, decodedOrder.begin()));
+
+    if (decodedTxs.size() > MAX_DECODED_TXS) {
+        decodedTxs.erase(decodedOrder.back());
+        decodedOrder.pop_back();
+    }
+}
+
+/**
+ * Updates the height of the last processed block, which is used to determine
+ * the confirmations of cached transactions.
+ */
+void UpdateDecodedTxCacheTip(int nHeight)
+{
+    nDecodedTipHeight = nHeight;
+}
+
+/**
+ * Clears the cache of decoded transactions, e.g. when blocks are disconnected.
+ */
+void ClearDecodedTxCache()
+{
+    LOCK(cs_decoded);
+    decodedTxs.clear();
+    decodedOrder.clear();
+    ++nDecodedEpoch;
+}
+
+/**
+ * Populates the RPC object of a decoded transaction.
+ */
+static int populateRPCDecodedTransaction(const CDecodedTx& decoded, int confirmations, UniValue& txobj, const std::string& filterAddress, bool extendedDetails, const std::string& extendedDetailsFilter, interfaces::Wallet* iWallet)
+{
+    // the populators may modify the transaction, so the cached one is copied
+    CMPTransaction mp_obj = decoded.mp_obj;
+    const uint256& txid = mp_obj.getHash();
+
+    // check if we're filtering from listtransactions_MP, and if so whether we have a non-match we want to skip
+    if (!filterAddress.empty() && mp_obj.getSender() != filterAddress && mp_obj.getReceiver() != filterAddress) return -1;
+
+    // populate some initial info for the transaction
+    bool fMine = false;
+    if (IsMyAddress(mp_obj.getSender(), iWallet) || IsMyAddress(mp_obj.getReceiver(), iWallet)) fMine = true;
+    txobj.pushKV("txid", txid.GetHex());
+    txobj.pushKV("fee", FormatDivisibleMP(mp_obj.getFeePaid()));
+    txobj.pushKV("sendingaddress", mp_obj.getSender());
+    if (showRefForTx(mp_obj.getType())) txobj.pushKV("referenceaddress", mp_obj.getReceiver());
+    txobj.pushKV("ismine", fMine);
+    txobj.pushKV("version", (uint64_t)mp_obj.getVersion());
+    txobj.pushKV("type_int", (uint64_t)mp_obj.getType());
+    if (mp_obj.getType() != MSC_TYPE_SIMPLE_SEND) { // Type 0 will add "Type" attribute during populateRPCTypeSimpleSend
+        txobj.pushKV("type", mp_obj.getTypeString());
+    }
+
+    // populate type specific info and extended details if requested
+    // extended details are not available for unconfirmed transactions
+    if (confirmations <= 0) extendedDetails = false;
+    populateRPCTypeInfo(mp_obj, txobj, mp_obj.getType(), extendedDetails, extendedDetailsFilter, confirmations, iWallet);
+
+    // state and chain related information
+    if (confirmations != 0 && !decoded.blockHash.IsNull()) {
+        txobj.pushKV("valid", decoded.valid);
+        if (!decoded.valid) {
+            txobj.pushKV("invalidreason", decoded.invalidReason);
+        }
+        txobj.pushKV("blockhash", decoded.blockHash.GetHex());
+        txobj.pushKV("blocktime", decoded.blockTime);
+        txobj.pushKV("positioninblock", decoded.positionInBlock);
+    }
+    if (confirmations != 0) {
+        txobj.pushKV("block", decoded.blockHeight);
+    }
+    txobj.pushKV("confirmations", confirmations);
+
+    // finished
+    return 0;
+}
+
 /**
  * Function to standardize RPC output for transactions into a JSON object in either basic or extended mode.
  *
@@ -49,9 +190,20 @@ using namespace mastercore;
  * Use extended mode for transaction specific calls (e.g. omni_getsto, omni_gettrade etc.)
  *
  * DEx payments and the extended mode are only available for confirmed transactions.
+ *
+ * Confirmed transactions are decoded once and cached, until blocks are disconnected.
  */
 int populateRPCTransactionObject(const uint256& txid, UniValue& txobj, std::string filterAddress, bool extendedDetails, std::string extendedDetailsFilter, interfaces::Wallet* iWallet)
 {
+    // serve cached transactions without retrieving and parsing them again
+    std::shared_ptr<const CDecodedTx> decoded = GetDecodedTx(txid);
+    if (decoded) {
+        int tipHeight = nDecodedTipHeight;
+        if (tipHeight < 0) tipHeight = GetHeight();
+        int confirmations = std::max(1 + tipHeight - decoded->blockHeight, 1);
+        return populateRPCDecodedTransaction(*decoded, confirmations, txobj, filterAddress, extendedDetails, extendedDetailsFilter, iWallet);
+    }
+
     bool f_txindex_ready = false;
     if (g_txindex) {
         f_txindex_ready = g_txindex->BlockUntilSyncedToCurrentChain();
@@ -75,7 +227,8 @@ int populateRPCTransactionObject(const CTransaction& tx, const uint256& blockHas
 {
     int confirmations = 0;
     int64_t blockTime = 0;
-    int positionInBlock = 0;
+    bool fActiveChain = false;
+    uint64_t nEpoch = GetDecodedEpoch();
 
     if (blockHeight == 0) {
         blockHeight = GetHeight();
@@ -87,11 +240,14 @@ int populateRPCTransactionObject(const CTransaction& tx, const uint256& blockHas
             confirmations = 1 + blockHeight - pBlockIndex->nHeight;
             blockTime = pBlockIndex->nTime;
             blockHeight = pBlockIndex->nHeight;
+            LOCK(cs_main);
+            fActiveChain = ::ChainActive().Contains(pBlockIndex);
         }
     }
 
     // attempt to parse the transaction
-    CMPTransaction mp_obj;
+    std::shared_ptr<CDecodedTx> decoded = std::make_shared<CDecodedTx>();
+    CMPTransaction& mp_obj = decoded->mp_obj;
     int parseRC = ParseTransaction(tx, blockHeight, 0, mp_obj, blockTime);
     if (parseRC == -101) {
         return MP_RPC_DECODE_INPUTS_MISSING;
@@ -134,49 +290,26 @@ int populateRPCTransactionObject(const CTransaction& tx, const uint256& blockHas
     if (!mp_obj.interpret_Transaction()) return MP_TX_IS_NOT_OMNI_PROTOCOL;
 
     // obtain validity - only confirmed transactions can be valid
-    bool valid = false;
+    bool fProcessed = false;
+    decoded->blockHash = blockHash;
+    decoded->blockHeight = blockHeight;
+    decoded->blockTime = blockTime;
     if (confirmations > 0) {
         LOCK(cs_tally);
-        valid = pDbTransactionList->getValidMPTX(txid);
-        positionInBlock = pDbTransaction->FetchTransactionPosition(txid);
-    }
-
-    // populate some initial info for the transaction
-    bool fMine = false;
-    if (IsMyAddress(mp_obj.getSender(), iWallet) || IsMyAddress(mp_obj.getReceiver(), iWallet)) fMine = true;
-    txobj.pushKV("txid", txid.GetHex());
-    txobj.pushKV("fee", FormatDivisibleMP(mp_obj.getFeePaid()));
-    txobj.pushKV("sendingaddress", mp_obj.getSender());
-    if (showRefForTx(mp_obj.getType())) txobj.pushKV("referenceaddress", mp_obj.getReceiver());
-    txobj.pushKV("ismine", fMine);
-    txobj.pushKV("version", (uint64_t)mp_obj.getVersion());
-    txobj.pushKV("type_int", (uint64_t)mp_obj.getType());
-    if (mp_obj.getType() != MSC_TYPE_SIMPLE_SEND) { // Type 0 will add "Type" attribute during populateRPCTypeSimpleSend
-        txobj.pushKV("type", mp_obj.getTypeString());
-    }
-
-    // populate type specific info and extended details if requested
-    // extended details are not available for unconfirmed transactions
-    if (confirmations <= 0) extendedDetails = false;
-    populateRPCTypeInfo(mp_obj, txobj, mp_obj.getType(), extendedDetails, extendedDetailsFilter, confirmations, iWallet);
-
-    // state and chain related information
-    if (confirmations != 0 && !blockHash.IsNull()) {
-        txobj.pushKV("valid", valid);
-        if (!valid) {
-            txobj.pushKV("invalidreason", pDbTransaction->FetchInvalidReason(txid));
+        fProcessed = pDbTransactionList->exists(txid);
+        decoded->valid = pDbTransactionList->getValidMPTX(txid);
+        decoded->positionInBlock = pDbTransaction->FetchTransactionPosition(txid);
+        if (!decoded->valid && !blockHash.IsNull()) {
+            decoded->invalidReason = pDbTransaction->FetchInvalidReason(txid);
         }
-        txobj.pushKV("blockhash", blockHash.GetHex());
-        txobj.pushKV("blocktime", blockTime);
-        txobj.pushKV("positioninblock", positionInBlock);
     }
-    if (confirmations != 0) {
-        txobj.pushKV("block", blockHeight);
+
+    // cache transactions, once they were processed in a block of the active chain
+    if (fActiveChain && fProcessed) {
+        PutDecodedTx(txid, decoded, nEpoch);
     }
-    txobj.pushKV("confirmations", confirmations);
 
-    // finished
-    return 0;
+    return populateRPCDecodedTransaction(*decoded, confirmations, txobj, filterAddress, extendedDetails, extendedDetailsFilter, iWallet);
 }
 
 /* Function to call respective populators based on message type
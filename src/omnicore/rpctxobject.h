@@ -13,6 +13,11 @@ namespace interfaces {
 class Wallet;
 } // namespace interfaces
 
+/** Updates the height of the last processed block, which is used for cached transactions. */
+void UpdateDecodedTxCacheTip(int nHeight);
+/** Clears the cache of decoded transactions, e.g. when blocks are disconnected. */
+void ClearDecodedTxCache();
+
 int populateRPCTransactionObject(const uint256& txid, UniValue& txobj, std::string filterAddress = "", bool extendedDetails = false, std::string extendedDetailsFilter = "", interfaces::Wallet* iWallet = nullptr);
 int populateRPCTransactionObject(const CTransaction& tx, const uint256& blockHash, UniValue& txobj, std::string filterAddress = "", bool extendedDetails = false, std::string extendedDetailsFilter = "", int blockHeight = 0, interfaces::Wallet* iWallet = nullptr);
 
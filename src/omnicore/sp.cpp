@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <utility>
@@ -54,44 +55,6 @@ void CMPCrowd::print(const std::string& address, FILE* fp) const
     fprintf(fp, "%s\n", toString(address).c_str());
 }
 
-void CMPCrowd::saveCrowdSale(std::ofstream& file, const std::string& addr, CHash256& hasher) const
-{
-    // compose the outputline
-    // addr,propertyId,nValue,property_desired,deadline,early_bird,percentage,created,mined
-    std::string lineOut = strprintf("%s,%d,%d,%d,%d,%d,%d,%d,%d",
-            addr,
-            propertyId,
-            nValue,
-            property_desired,
-            deadline,
-            early_bird,
-            percentage,
-            u_created,
-            i_created);
-
-    // append N pairs of address=nValue;blockTime for the database
-    std::map<uint256, std::vector<int64_t> >::const_iterator iter;
-    for (iter = txFundraiserData.begin(); iter != txFundraiserData.end(); ++iter) {
-        lineOut.append(strprintf(",%s=", (*iter).first.GetHex()));
-        std::vector<int64_t> const &vals = (*iter).second;
-
-        std::vector<int64_t>::const_iterator valIter;
-        for (valIter = vals.begin(); valIter != vals.end(); ++valIter) {
-            if (valIter != vals.begin()) {
-                lineOut.append(";");
-            }
-
-            lineOut.append(strprintf("%d", *valIter));
-        }
-    }
-
-    // add the line to the hash
-    hasher.Write((unsigned char*)lineOut.c_str(), lineOut.length());
-
-    // write the line
-    file << lineOut << std::endl;
-}
-
 CMPCrowd* mastercore::getCrowd(const std::string& address)
 {
     CrowdMap::iterator my_it = my_crowds.find(address);
@@ -393,6 +356,37 @@ void mastercore::eraseMaxedCrowdsale(const std::string& address, int64_t blockTi
     }
 }
 
+//! Crowdsales ordered by their deadline
+static std::multimap<int64_t, std::string> crowdsalesByDeadline;
+
+/**
+ * Adds a new crowdsale of the issuer, and schedules its deadline.
+ */
+void mastercore::insertCrowdsale(const std::string& address, const CMPCrowd& crowdsale)
+{
+    if (my_crowds.insert(std::make_pair(address, crowdsale)).second) {
+        crowdsalesByDeadline.insert(std::make_pair(crowdsale.getDeadline(), address));
+    }
+}
+
+/**
+ * Rebuilds the deadline index of the crowdsales, e.g. after they were loaded or cleared.
+ */
+void mastercore::RebuildCrowdsaleDeadlineIndex()
+{
+    crowdsalesByDeadline.clear();
+
+    for (CrowdMap::const_iterator it = my_crowds.begin(); it != my_crowds.end(); ++it) {
+        crowdsalesByDeadline.insert(std::make_pair(it->second.getDeadline(), it->first));
+    }
+}
+
+/**
+ * Erases the crowdsales, whose deadline passed.
+ *
+ * Only the crowdsales, which are due according to the deadline index, are visited.
+ * Entries of crowdsales, which were closed in the meantime, are skipped.
+ */
 unsigned int mastercore::eraseExpiredCrowdsale(const CBlockIndex* pBlockIndex)
 {
     if (pBlockIndex == nullptr) return 0;
@@ -400,46 +394,57 @@ unsigned int mastercore::eraseExpiredCrowdsale(const CBlockIndex* pBlockIndex)
     const int64_t blockTime = pBlockIndex->GetBlockTime();
     const int blockHeight = pBlockIndex->nHeight;
     unsigned int how_many_erased = 0;
-    CrowdMap::iterator my_it = my_crowds.begin();
 
-    while (my_crowds.end() != my_it) {
-        const std::string& address = my_it->first;
-        const CMPCrowd& crowdsale = my_it->second;
+    // collect the expired crowdsales, which are processed in the order of their addresses
+    std::set<std::string> expiredCrowdsales;
+    std::multimap<int64_t, std::string>::iterator it = crowdsalesByDeadline.begin();
 
-        if (blockTime > crowdsale.getDeadline()) {
-            PrintToLog("%s(): ERASING EXPIRED CROWDSALE from address=%s, at block %d (timestamp: %d), SP: %d (%s)\n",
-                __func__, address, blockHeight, blockTime, crowdsale.getPropertyId(), strMPProperty(crowdsale.getPropertyId()));
+    while (crowdsalesByDeadline.end() != it && blockTime > it->first) {
+        CrowdMap::const_iterator my_it = my_crowds.find(it->second);
 
-            if (msc_debug_sp) {
-                PrintToLog("%s(): %s\n", __func__, FormatISO8601DateTime(blockTime));
-                PrintToLog("%s(): %s\n", __func__, crowdsale.toString(address));
-            }
+        if (my_crowds.end() != my_it && my_it->second.getDeadline() == it->first) {
+            expiredCrowdsales.insert(it->second);
+        }
+        crowdsalesByDeadline.erase(it++);
+    }
 
-            // get sp from data struct
-            CMPSPInfo::Entry sp;
-            assert(pDbSpInfo->getSP(crowdsale.getPropertyId(), sp));
+    for (const std::string& address : expiredCrowdsales) {
+        CrowdMap::iterator my_it = my_crowds.find(address);
+        if (my_crowds.end() == my_it) continue;
+
+        const CMPCrowd& crowdsale = my_it->second;
+
+        PrintToLog("%s(): ERASING EXPIRED CROWDSALE from address=%s, at block %d (timestamp: %d), SP: %d (%s)\n",
+            __func__, address, blockHeight, blockTime, crowdsale.getPropertyId(), strMPProperty(crowdsale.getPropertyId()));
+
+        if (msc_debug_sp) {
+            PrintToLog("%s(): %s\n", __func__, FormatISO8601DateTime(blockTime));
+            PrintToLog("%s(): %s\n", __func__, crowdsale.toString(address));
+        }
 
-            // find missing tokens
-            int64_t missedTokens = GetMissedIssuerBonus(sp, crowdsale);
+        // get sp from data struct
+        CMPSPInfo::Entry sp;
+        assert(pDbSpInfo->getSP(crowdsale.getPropertyId(), sp));
 
-            // get txdata
-            sp.historicalData = crowdsale.getDatabase();
-            sp.missedTokens = missedTokens;
+        // find missing tokens
+        int64_t missedTokens = GetMissedIssuerBonus(sp, crowdsale);
 
-            // update SP with this data
-            sp.update_block = pBlockIndex->GetBlockHash();
-            assert(pDbSpInfo->updateSP(crowdsale.getPropertyId(), sp));
+        // get txdata
+        sp.historicalData = crowdsale.getDatabase();
+        sp.missedTokens = missedTokens;
 
-            // update values
-            if (missedTokens > 0) {
-                assert(update_tally_map(sp.issuer, crowdsale.getPropertyId(), missedTokens, BALANCE));
-            }
+        // update SP with this data
+        sp.update_block = pBlockIndex->GetBlockHash();
+        assert(pDbSpInfo->updateSP(crowdsale.getPropertyId(), sp));
 
-            my_crowds.erase(my_it++);
+        // update values
+        if (missedTokens > 0) {
+            assert(update_tally_map(sp.issuer, crowdsale.getPropertyId(), missedTokens, BALANCE));
+        }
 
-            ++how_many_erased;
+        my_crowds.erase(my_it);
 
-        } else my_it++;
+        ++how_many_erased;
     }
 
     return how_many_erased;
@@ -6,7 +6,6 @@
 #include <omnicore/log.h>
 
 class CBlockIndex;
-class CHash256;
 class uint256;
 
 #include <stdint.h>
@@ -61,7 +60,21 @@ public:
 
     std::string toString(const std::string& address) const;
     void print(const std::string& address, FILE* fp = stdout) const;
-    void saveCrowdSale(std::ofstream& file, const std::string& addr, CHash256 &hasher) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(propertyId);
+        READWRITE(nValue);
+        READWRITE(property_desired);
+        READWRITE(deadline);
+        READWRITE(early_bird);
+        READWRITE(percentage);
+        READWRITE(u_created);
+        READWRITE(i_created);
+        READWRITE(txFundraiserData);
+    }
 };
 
 namespace mastercore
@@ -96,6 +109,12 @@ void calculateFundraiser(bool inflateAmount, int64_t amtTransfer, uint8_t bonusP
         int64_t fundraiserSecs, int64_t currentSecs, int64_t numProps, uint8_t issuerPerc, int64_t totalTokens,
         std::pair<int64_t, int64_t>& tokens, bool& close_crowdsale);
 
+/** Adds a new crowdsale of the issuer, and schedules its deadline. */
+void insertCrowdsale(const std::string& address, const CMPCrowd& crowdsale);
+
+/** Rebuilds the deadline index of the crowdsales, e.g. after they were loaded or cleared. */
+void RebuildCrowdsaleDeadlineIndex();
+
 void eraseMaxedCrowdsale(const std::string& address, int64_t blockTime, int block, uint256& blockHash);
 
 unsigned int eraseExpiredCrowdsale(const CBlockIndex* pBlockIndex);
@@ -3,15 +3,46 @@
 #include <omnicore/log.h>
 #include <omnicore/omnicore.h>
 
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <limits>
 #include <stdint.h>
-#include <map>
+#include <string>
+#include <utility>
+
+/** Orders balance records by property identifier. */
+struct CompareBalanceRecord
+{
+    template <typename Record>
+    bool operator()(const Record& record, uint32_t propertyId) const
+    {
+        return record.propertyId < propertyId;
+    }
+};
 
 /**
  * Creates an empty tally.
  */
-CMPTally::CMPTally()
+CMPTally::CMPTally() : my_pos(0)
 {
-    my_it = mp_token.begin();
+}
+
+/**
+ * Returns the balance record of a token.
+ *
+ * @param propertyId  The identifier of the tally to lookup
+ * @return The balance record, or nullptr, if there is none
+ */
+const CMPTally::BalanceRecord* CMPTally::find(uint32_t propertyId) const
+{
+    TokenMap::const_iterator it = std::lower_bound(mp_token.begin(), mp_token.end(), propertyId, CompareBalanceRecord());
+
+    if (it != mp_token.end() && it->propertyId == propertyId) {
+        return &(*it);
+    }
+
+    return nullptr;
 }
 
 /**
@@ -22,9 +53,9 @@ CMPTally::CMPTally()
 uint32_t CMPTally::init()
 {
     uint32_t propertyId = 0;
-    my_it = mp_token.begin();
-    if (my_it != mp_token.end()) {
-        propertyId = my_it->first;
+    my_pos = 0;
+    if (my_pos < mp_token.size()) {
+        propertyId = mp_token[my_pos].propertyId;
     }
     return propertyId;
 }
@@ -37,9 +68,9 @@ uint32_t CMPTally::init()
 uint32_t CMPTally::next()
 {
     uint32_t ret = 0;
-    if (my_it != mp_token.end()) {
-        ret = my_it->first;
-        ++my_it;
+    if (my_pos < mp_token.size()) {
+        ret = mp_token[my_pos].propertyId;
+        ++my_pos;
     }
     return ret;
 }
@@ -62,6 +93,8 @@ static bool isOverflow(int64_t a, int64_t b)
  *
  * Negative balances are only permitted for pending balances.
  *
+ * A balance record is created for the token, even if the update fails.
+ *
  * @param propertyId  The identifier of the tally to update
  * @param amount      The amount to add
  * @param ttype       The tally type
@@ -73,7 +106,15 @@ bool CMPTally::updateMoney(uint32_t propertyId, int64_t amount, TallyType ttype)
         return false;
     }
     bool fUpdated = false;
-    int64_t now64 = mp_token[propertyId].balance[ttype];
+    TokenMap::iterator it = std::lower_bound(mp_token.begin(), mp_token.end(), propertyId, CompareBalanceRecord());
+
+    if (it == mp_token.end() || it->propertyId != propertyId) {
+        BalanceRecord record = {propertyId, {0}};
+        it = mp_token.insert(it, record);
+    }
+
+    BalanceRecord& record = *it;
+    int64_t now64 = record.balance[ttype];
 
     if (isOverflow(now64, amount)) {
         PrintToLog("%s(): ERROR: arithmetic overflow [%d + %d]\n", __func__, now64, amount);
@@ -86,7 +127,7 @@ bool CMPTally::updateMoney(uint32_t propertyId, int64_t amount, TallyType ttype)
     } else {
 
         now64 += amount;
-        mp_token[propertyId].balance[ttype] = now64;
+        record.balance[ttype] = now64;
 
         fUpdated = true;
     }
@@ -107,11 +148,10 @@ int64_t CMPTally::getMoney(uint32_t propertyId, TallyType ttype) const
         return 0;
     }
     int64_t money = 0;
-    TokenMap::const_iterator it = mp_token.find(propertyId);
+    const BalanceRecord* record = find(propertyId);
 
-    if (it != mp_token.end()) {
-        const BalanceRecord& record = it->second;
-        money = record.balance[ttype];
+    if (record != nullptr) {
+        money = record->balance[ttype];
     }
 
     return money;
@@ -128,14 +168,13 @@ int64_t CMPTally::getMoney(uint32_t propertyId, TallyType ttype) const
  */
 int64_t CMPTally::getMoneyAvailable(uint32_t propertyId) const
 {
-    TokenMap::const_iterator it = mp_token.find(propertyId);
+    const BalanceRecord* record = find(propertyId);
 
-    if (it != mp_token.end()) {
-        const BalanceRecord& record = it->second;
-        if (record.balance[PENDING] < 0) {
-            return record.balance[BALANCE] + record.balance[PENDING];
+    if (record != nullptr) {
+        if (record->balance[PENDING] < 0) {
+            return record->balance[BALANCE] + record->balance[PENDING];
         } else {
-            return record.balance[BALANCE];
+            return record->balance[BALANCE];
         }
     }
 
@@ -154,13 +193,12 @@ int64_t CMPTally::getMoneyAvailable(uint32_t propertyId) const
 int64_t CMPTally::getMoneyReserved(uint32_t propertyId) const
 {
     int64_t money = 0;
-    TokenMap::const_iterator it = mp_token.find(propertyId);
+    const BalanceRecord* record = find(propertyId);
 
-    if (it != mp_token.end()) {
-        const BalanceRecord& record = it->second;
-        money += record.balance[SELLOFFER_RESERVE];
-        money += record.balance[ACCEPT_RESERVE];
-        money += record.balance[METADEX_RESERVE];
+    if (record != nullptr) {
+        money += record->balance[SELLOFFER_RESERVE];
+        money += record->balance[ACCEPT_RESERVE];
+        money += record->balance[METADEX_RESERVE];
     }
 
     return money;
@@ -181,11 +219,11 @@ bool CMPTally::operator==(const CMPTally& rhs) const
     TokenMap::const_iterator pc2 = rhs.mp_token.begin();
 
     for (unsigned int i = 0; i < mp_token.size(); ++i) {
-        if (pc1->first != pc2->first) {
+        if (pc1->propertyId != pc2->propertyId) {
             return false;
         }
-        const BalanceRecord& record1 = pc1->second;
-        const BalanceRecord& record2 = pc2->second;
+        const BalanceRecord& record1 = *pc1;
+        const BalanceRecord& record2 = *pc2;
 
         for (int ttype = 0; ttype < TALLY_TYPE_COUNT; ++ttype) {
             if (record1.balance[ttype] != record2.balance[ttype]) {
@@ -228,15 +266,14 @@ int64_t CMPTally::print(uint32_t propertyId, bool bDivisible) const
     int64_t pending = 0;
     int64_t metadex_reserve = 0;
 
-    TokenMap::const_iterator it = mp_token.find(propertyId);
+    const BalanceRecord* record = find(propertyId);
 
-    if (it != mp_token.end()) {
-        const BalanceRecord& record = it->second;
-        balance = record.balance[BALANCE];
-        selloffer_reserve = record.balance[SELLOFFER_RESERVE];
-        accept_reserve = record.balance[ACCEPT_RESERVE];
-        pending = record.balance[PENDING];
-        metadex_reserve = record.balance[METADEX_RESERVE];
+    if (record != nullptr) {
+        balance = record->balance[BALANCE];
+        selloffer_reserve = record->balance[SELLOFFER_RESERVE];
+        accept_reserve = record->balance[ACCEPT_RESERVE];
+        pending = record->balance[PENDING];
+        metadex_reserve = record->balance[METADEX_RESERVE];
     }
 
     if (bDivisible) {
@@ -251,3 +288,146 @@ int64_t CMPTally::print(uint32_t propertyId, bool bDivisible) const
 
     return (balance + selloffer_reserve + accept_reserve + metadex_reserve);
 }
+
+const uint32_t CMPTallyMap::NO_ADDRESS_ID;
+
+/**
+ * Creates an empty tally map.
+ */
+CMPTallyMap::CMPTallyMap()
+{
+}
+
+/**
+ * Removes all tallies and resets the address identifiers.
+ */
+void CMPTallyMap::clear()
+{
+    ids.clear();
+    entries.clear();
+    changedIds.clear();
+    vChanged.clear();
+}
+
+/**
+ * Returns the position of an address in the storage.
+ *
+ * The lookup table is probed with the hash of the address, and the addresses
+ * of the candidates are compared, so no copy of the address is needed.
+ *
+ * @param address  The address to lookup
+ * @return The identifier of the address, or NO_ADDRESS_ID, if it is unknown
+ */
+uint32_t CMPTallyMap::lookup(const std::string& address) const
+{
+    auto range = ids.equal_range(std::hash<std::string>()(address));
+
+    for (auto it = range.first; it != range.second; ++it) {
+        if (entries[it->second].first == address) {
+            return it->second;
+        }
+    }
+    return NO_ADDRESS_ID;
+}
+
+/**
+ * Returns the tally of the given address.
+ *
+ * @param address  The address to lookup
+ * @return An iterator to the tally, or end(), if there is none
+ */
+CMPTallyMap::iterator CMPTallyMap::find(const std::string& address)
+{
+    uint32_t id = lookup(address);
+
+    if (id == NO_ADDRESS_ID) {
+        return entries.end();
+    }
+    return entries.begin() + id;
+}
+
+CMPTallyMap::const_iterator CMPTallyMap::find(const std::string& address) const
+{
+    uint32_t id = lookup(address);
+
+    if (id == NO_ADDRESS_ID) {
+        return entries.end();
+    }
+    return entries.begin() + id;
+}
+
+/**
+ * Adds a tally, if there is none for the address yet.
+ *
+ * The address is assigned the next free identifier.
+ *
+ * @param value  The address and tally to add
+ * @return An iterator to the tally of the address, and whether it was added
+ */
+std::pair<CMPTallyMap::iterator, bool> CMPTallyMap::insert(const value_type& value)
+{
+    uint32_t id = lookup(value.first);
+
+    if (id != NO_ADDRESS_ID) {
+        return std::make_pair(entries.begin() + id, false);
+    }
+
+    assert(entries.size() < NO_ADDRESS_ID);
+    id = entries.size();
+    entries.push_back(value);
+    ids.emplace(std::hash<std::string>()(value.first), id);
+
+    return std::make_pair(entries.begin() + id, true);
+}
+
+/**
+ * Returns the identifier of an address.
+ *
+ * @param address  The address to lookup
+ * @return The identifier of the address, or NO_ADDRESS_ID, if it is unknown
+ */
+uint32_t CMPTallyMap::getAddressId(const std::string& address) const
+{
+    return lookup(address);
+}
+
+/**
+ * Returns the address with the given identifier.
+ *
+ * @param id  The identifier of a known address
+ * @return The address
+ */
+const std::string& CMPTallyMap::getAddress(uint32_t id) const
+{
+    assert(id < entries.size());
+    return entries[id].first;
+}
+
+/**
+ * Marks the tally of an address as changed.
+ *
+ * @param it  An iterator to the tally
+ */
+void CMPTallyMap::setChanged(const_iterator it)
+{
+    uint32_t id = it - entries.cbegin();
+
+    if (vChanged.size() <= id) {
+        vChanged.resize(entries.size(), false);
+    }
+    if (!vChanged[id]) {
+        vChanged[id] = true;
+        changedIds.push_back(id);
+    }
+}
+
+/**
+ * Forgets about all previous changes.
+ */
+void CMPTallyMap::resetChanged()
+{
+    for (uint32_t id : changedIds) {
+        vChanged[id] = false;
+    }
+    changedIds.clear();
+}
@@ -1,8 +1,14 @@
 #ifndef BITCOIN_OMNICORE_TALLY_H
 #define BITCOIN_OMNICORE_TALLY_H
 
+#include <prevector.h>
+
 #include <stdint.h>
-#include <map>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 //! Balance record types
 enum TallyType {
@@ -15,20 +21,27 @@ enum TallyType {
 };
 
 /** Balance records of a single entity.
+ *
+ * The balance records are stored in a flat vector, sorted by property identifier.
+ * Most entities only hold a few tokens, so the first record is stored inline.
  */
 class CMPTally
 {
 private:
     typedef struct {
+        uint32_t propertyId;
         int64_t balance[TALLY_TYPE_COUNT];
     } BalanceRecord;
 
-    //! Map of balance records
-    typedef std::map<uint32_t, BalanceRecord> TokenMap;
+    //! Vector of balance records, sorted by property identifier
+    typedef prevector<1, BalanceRecord> TokenMap;
     //! Balance records for different tokens
     TokenMap mp_token;
-    //! Internal iterator pointing to a balance record
-    TokenMap::iterator my_it;
+    //! Internal position of the next balance record
+    TokenMap::size_type my_pos;
+
+    /** Returns the balance record of a token, or nullptr, if there is none. */
+    const BalanceRecord* find(uint32_t propertyId) const;
 
 public:
     /** Creates an empty tally. */
@@ -62,5 +75,83 @@ public:
     int64_t print(uint32_t propertyId = 1, bool bDivisible = true) const;
 };
 
+/** Tallies of all entities.
+ *
+ * Addresses are interned: each address is assigned a dense identifier, which
+ * is the position of its tally in the storage. Tallies are never removed, except
+ * when the whole map is cleared, so identifiers and references to tallies remain
+ * valid, even when new addresses are added.
+ *
+ * The lookup table only holds the hashes of the addresses and their identifiers,
+ * and candidates are compared by the addresses they refer to, so each address is
+ * stored only once. Lookups don't modify the map, so concurrent reads are safe.
+ *
+ * The interface mirrors the parts of std::unordered_map used by Omni Core.
+ * Iteration is in insertion order.
+ *
+ * Additionally the identifiers of changed tallies are tracked, so snapshots
+ * of the state can be limited to the tallies changed since the last one.
+ */
+class CMPTallyMap
+{
+public:
+    typedef std::pair<const std::string, CMPTally> value_type;
+    typedef std::deque<value_type>::iterator iterator;
+    typedef std::deque<value_type>::const_iterator const_iterator;
+
+    //! Identifier returned for unknown addresses
+    static const uint32_t NO_ADDRESS_ID = 0xFFFFFFFF;
+
+    CMPTallyMap();
+    CMPTallyMap(const CMPTallyMap&) = delete;
+    CMPTallyMap& operator=(const CMPTallyMap&) = delete;
+
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    /** Removes all tallies and resets the address identifiers. */
+    void clear();
+
+    /** Returns the tally of the given address, or end(), if there is none. */
+    iterator find(const std::string& address);
+    const_iterator find(const std::string& address) const;
+
+    /** Adds a tally, if there is none for the address yet. */
+    std::pair<iterator, bool> insert(const value_type& value);
+
+    /** Returns the identifier of an address, or NO_ADDRESS_ID, if it is unknown. */
+    uint32_t getAddressId(const std::string& address) const;
+
+    /** Returns the address with the given identifier. */
+    const std::string& getAddress(uint32_t id) const;
+
+    /** Marks the tally of an address as changed. */
+    void setChanged(const_iterator it);
+
+    /** Returns the identifiers of all tallies changed since the last reset. */
+    const std::vector<uint32_t>& getChanged() const { return changedIds; }
+
+    /** Forgets about all previous changes. */
+    void resetChanged();
+
+private:
+    //! Tallies, indexed by address identifier
+    std::deque<value_type> entries;
+    //! Identifiers of all addresses, by the hash of the address
+    std::unordered_multimap<size_t, uint32_t> ids;
+    //! Identifiers of changed tallies, in order of their first change
+    std::vector<uint32_t> changedIds;
+    //! Whether a tally was changed, indexed by address identifier
+    std::vector<bool> vChanged;
+
+    /** Returns the position of an address in the storage, or NO_ADDRESS_ID. */
+    uint32_t lookup(const std::string& address) const;
+};
+
 
 #endif // BITCOIN_OMNICORE_TALLY_H
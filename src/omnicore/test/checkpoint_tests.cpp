@@ -1,4 +1,5 @@
 #include <omnicore/consensushash.h>
+#include <omnicore/dbspinfo.h>
 #include <omnicore/dex.h>
 #include <omnicore/mdex.h>
 #include <omnicore/sp.h>
@@ -10,6 +11,7 @@
 #include <sync.h>
 #include <test/util/setup_common.h>
 #include <uint256.h>
+#include <util/system.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -106,5 +108,67 @@ BOOST_AUTO_TEST_CASE(get_checkpoints)
     BOOST_CHECK(ConsensusParams("regtest").GetCheckpoints().empty());
 }
 
+BOOST_AUTO_TEST_CASE(incremental_consensus_hash)
+{
+    LOCK(cs_tally);
+    CMPSPInfo* pDbSpInfoPrev = pDbSpInfo;
+    pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+    ClearTallyMap();
+    MetaDEx_Clear();
+
+    BOOST_CHECK(update_tally_map("alice", 3, 100, BALANCE));
+    uint256 hashBefore = GetIncrementalConsensusHash();
+
+    // balance updates are tracked, once the hash was requested
+    BOOST_CHECK(update_tally_map("bob", 3, 50, BALANCE));
+    BOOST_CHECK(update_tally_map("alice", 3, -40, BALANCE));
+    BOOST_CHECK(update_tally_map("alice", 3, 40, METADEX_RESERVE));
+    BOOST_CHECK(update_tally_map("bob", 3, 1000, PENDING));
+    BOOST_CHECK(!update_tally_map("carol", 3, -1, BALANCE));
+    uint256 hashTracked = GetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked != hashBefore);
+    ResetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked == GetIncrementalConsensusHash());
+
+    // so are insertions and removals of MetaDEx trades
+    CMPMetaDEx trade("alice", 100, 3, 40, 1, 20,
+            uint256S("2c9a055899147b03b2c5240a020c1f94d243a834ecc06ab8cfa504ee29d07b7d"), 1, 1, 40);
+    BOOST_CHECK(MetaDEx_INSERT(trade));
+    hashTracked = GetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked != hashBefore);
+    ResetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked == GetIncrementalConsensusHash());
+
+    MetaDEx_SHUTDOWN();
+    BOOST_CHECK(update_tally_map("bob", 3, -50, BALANCE));
+    BOOST_CHECK(update_tally_map("bob", 3, -1000, PENDING));
+    BOOST_CHECK(hashBefore == GetIncrementalConsensusHash());
+
+    // and new properties, as well as changed issuers
+    CMPSPInfo::Entry sp;
+    sp.issuer = "alice";
+    sp.txid = uint256S("01");
+    uint32_t propertyId = pDbSpInfo->putSP(OMNI_PROPERTY_MSC, sp);
+    hashTracked = GetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked != hashBefore);
+    BOOST_CHECK(VerifyIncrementalConsensusHash());
+    ResetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked == GetIncrementalConsensusHash());
+
+    sp.issuer = "bob";
+    sp.update_block = uint256S("02");
+    BOOST_CHECK(pDbSpInfo->updateSP(propertyId, sp));
+    BOOST_CHECK(hashTracked != GetIncrementalConsensusHash());
+    BOOST_CHECK(VerifyIncrementalConsensusHash());
+    hashTracked = GetIncrementalConsensusHash();
+    ResetIncrementalConsensusHash();
+    BOOST_CHECK(hashTracked == GetIncrementalConsensusHash());
+
+    ClearTallyMap();
+    MetaDEx_Clear();
+    delete pDbSpInfo;
+    pDbSpInfo = pDbSpInfoPrev;
+}
+
 
 BOOST_AUTO_TEST_SUITE_END()
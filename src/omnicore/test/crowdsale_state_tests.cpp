@@ -0,0 +1,81 @@
+#include <omnicore/dbspinfo.h>
+#include <omnicore/omnicore.h>
+#include <omnicore/sp.h>
+
+#include <chain.h>
+#include <sync.h>
+#include <test/util/setup_common.h>
+#include <uint256.h>
+#include <util/system.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <string>
+
+using namespace mastercore;
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_crowdsale_state_tests, BasicTestingSetup)
+
+static uint32_t CreateCrowdsaleProperty(const std::string& issuer, const uint256& txid, const uint256& block)
+{
+    CMPSPInfo::Entry sp;
+    sp.issuer = issuer;
+    sp.fixed = true; // no fee cache is needed to count the tokens
+    sp.txid = txid;
+    sp.creation_block = block;
+    sp.update_block = block;
+    return pDbSpInfo->putSP(OMNI_PROPERTY_MSC, sp);
+}
+
+BOOST_AUTO_TEST_CASE(crowdsale_deadline_index)
+{
+    LOCK(cs_tally);
+    CMPSPInfo* pDbSpInfoPrev = pDbSpInfo;
+    pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+    ClearTallyMap();
+    my_crowds.clear();
+    RebuildCrowdsaleDeadlineIndex();
+
+    const uint256 blockHash = uint256S("1000000000000000000000000000000000000000000000000000000000000001");
+    CBlockIndex blockIndex;
+    blockIndex.phashBlock = &blockHash;
+    blockIndex.nHeight = 100;
+
+    // the first crowdsale of the issuer ends at 1000
+    uint32_t firstId = CreateCrowdsaleProperty("issuer", uint256S("01"), blockHash);
+    insertCrowdsale("issuer", CMPCrowd(firstId, 100, OMNI_PROPERTY_MSC, 1000, 0, 0, 0, 0));
+
+    // a crowdsale of another issuer ends at 1200
+    uint32_t otherId = CreateCrowdsaleProperty("other", uint256S("02"), blockHash);
+    insertCrowdsale("other", CMPCrowd(otherId, 100, OMNI_PROPERTY_MSC, 1200, 0, 0, 0, 0));
+
+    // the first crowdsale is closed, and the issuer starts one, which ends at 2000
+    my_crowds.erase("issuer");
+    uint32_t secondId = CreateCrowdsaleProperty("issuer", uint256S("03"), blockHash);
+    insertCrowdsale("issuer", CMPCrowd(secondId, 100, OMNI_PROPERTY_MSC, 2000, 0, 0, 0, 0));
+
+    // the stale entry of the closed crowdsale is skipped
+    blockIndex.nTime = 1001;
+    BOOST_CHECK_EQUAL(0U, eraseExpiredCrowdsale(&blockIndex));
+    BOOST_CHECK_EQUAL(secondId, my_crowds.at("issuer").getPropertyId());
+
+    blockIndex.nTime = 1201;
+    BOOST_CHECK_EQUAL(1U, eraseExpiredCrowdsale(&blockIndex));
+    BOOST_CHECK(my_crowds.find("other") == my_crowds.end());
+    BOOST_CHECK(my_crowds.find("issuer") != my_crowds.end());
+
+    // the index is rebuilt, after the crowdsales were loaded
+    RebuildCrowdsaleDeadlineIndex();
+    blockIndex.nTime = 2000;
+    BOOST_CHECK_EQUAL(0U, eraseExpiredCrowdsale(&blockIndex));
+    blockIndex.nTime = 2001;
+    BOOST_CHECK_EQUAL(1U, eraseExpiredCrowdsale(&blockIndex));
+    BOOST_CHECK(my_crowds.empty());
+
+    ClearTallyMap();
+    delete pDbSpInfo;
+    pDbSpInfo = pDbSpInfoPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,72 @@
+#include <omnicore/dbfees.h>
+#include <omnicore/dbspinfo.h>
+#include <omnicore/sp.h>
+
+#include <util/system.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <set>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dbfees_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(fee_cache_flush_and_rollback)
+{
+    CMPSPInfo* pDbSpInfoPrev = mastercore::pDbSpInfo;
+    mastercore::pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+
+    // the distribution threshold is derived from the number of tokens
+    CMPSPInfo::Entry sp;
+    sp.fixed = true;
+    sp.num_tokens = 1000000000000LL;
+    uint32_t propertyId = mastercore::pDbSpInfo->putSP(1, sp);
+
+    COmniFeeCache* pFeeCache = new COmniFeeCache(GetDataDir() / "OMNI_feecache_test", true);
+    pFeeCache->UpdateDistributionThresholds(propertyId);
+    BOOST_CHECK_EQUAL(pFeeCache->GetDistributionThreshold(propertyId), 10000000);
+
+    pFeeCache->AddFee(propertyId, 100, 5);
+    pFeeCache->AddFee(propertyId, 100, 7);
+    pFeeCache->AddFee(propertyId, 101, 3);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId), 15);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCacheHistory(propertyId).size(), 2U);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId + 1), 0);
+
+    // the cache is written, when it is closed, and loaded, when it is opened
+    delete pFeeCache;
+    pFeeCache = new COmniFeeCache(GetDataDir() / "OMNI_feecache_test", false);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId), 15);
+
+    std::set<feeCacheItem> expected;
+    expected.insert(feeCacheItem(100, 12));
+    expected.insert(feeCacheItem(101, 15));
+    BOOST_CHECK(pFeeCache->GetCacheHistory(propertyId) == expected);
+
+    // rolling back is inclusive, and removes emptied properties entirely
+    pFeeCache->RollBackCache(101);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId), 12);
+    pFeeCache->RollBackCache(100);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId), 0);
+    BOOST_CHECK(pFeeCache->GetCacheHistory(propertyId).empty());
+
+    pFeeCache->UpdateDistributionThresholds(propertyId);
+    pFeeCache->AddFee(propertyId, 102, 9);
+    pFeeCache->Flush();
+    delete pFeeCache;
+    pFeeCache = new COmniFeeCache(GetDataDir() / "OMNI_feecache_test", false);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCacheHistory(propertyId).size(), 1U);
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId), 9);
+
+    // clearing wipes the database and the cached entries
+    pFeeCache->Clear();
+    BOOST_CHECK_EQUAL(pFeeCache->GetCachedAmount(propertyId), 0);
+
+    delete pFeeCache;
+    delete mastercore::pDbSpInfo;
+    mastercore::pDbSpInfo = pDbSpInfoPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,40 @@
+#include <omnicore/dbmarkerindex.h>
+
+#include <uint256.h>
+#include <util/system.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dbmarkerindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(marker_index_blocks)
+{
+    const uint256 blockA = uint256S("00000000000000000000000000000000000000000000000000000000000000aa");
+    const uint256 blockB = uint256S("00000000000000000000000000000000000000000000000000000000000000bb");
+    const uint256 blockC = uint256S("00000000000000000000000000000000000000000000000000000000000000cc");
+
+    {
+        COmniMarkerIndex markerIndex(GetDataDir() / "OMNI_markerindex_test", true);
+        markerIndex.RecordBlock(blockA, false);
+        markerIndex.RecordBlock(blockB, true);
+
+        BOOST_CHECK(markerIndex.IsBlockWithoutMarker(blockA));
+        BOOST_CHECK(!markerIndex.IsBlockWithoutMarker(blockB));
+        // unknown blocks are never skipped
+        BOOST_CHECK(!markerIndex.IsBlockWithoutMarker(blockC));
+
+        markerIndex.RecordBlock(blockA, true);
+        BOOST_CHECK(!markerIndex.IsBlockWithoutMarker(blockA));
+        markerIndex.RecordBlock(blockC, false);
+    }
+
+    // the index is kept, when it is opened again
+    COmniMarkerIndex markerIndex(GetDataDir() / "OMNI_markerindex_test", false);
+    BOOST_CHECK(!markerIndex.IsBlockWithoutMarker(blockA));
+    BOOST_CHECK(!markerIndex.IsBlockWithoutMarker(blockB));
+    BOOST_CHECK(markerIndex.IsBlockWithoutMarker(blockC));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+#include <omnicore/dbbase.h>
+#include <omnicore/dbspinfo.h>
+#include <omnicore/nftdb.h>
+
+#include <uint256.h>
+#include <util/system.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dbspinfo_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cached_entries_follow_updates)
+{
+    CMPSPInfo spInfo(GetDataDir() / "MP_spinfo_test", true);
+
+    const uint256 blockCreated = uint256S("1000000000000000000000000000000000000000000000000000000000000001");
+    const uint256 blockUpdated = uint256S("2000000000000000000000000000000000000000000000000000000000000002");
+
+    CMPSPInfo::Entry sp;
+    sp.name = "Token";
+    sp.num_tokens = 100;
+    sp.txid = uint256S("3000000000000000000000000000000000000000000000000000000000000003");
+    sp.creation_block = blockCreated;
+    sp.update_block = blockCreated;
+    uint32_t propertyId = spInfo.putSP(1, sp);
+
+    // the first lookup is loaded from the database, the second is cached
+    CMPSPInfo::Entry info;
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+    BOOST_CHECK_EQUAL(info.num_tokens, 100);
+    BOOST_CHECK_EQUAL(spInfo.getCacheMisses(), 1U);
+    BOOST_CHECK_EQUAL(spInfo.getCacheHits(), 1U);
+
+    // the implied properties and unknown properties are not cached
+    BOOST_CHECK(spInfo.getSP(1, info));
+    BOOST_CHECK(!spInfo.getSP(propertyId + 1, info));
+    BOOST_CHECK(!spInfo.getSP(propertyId + 1, info));
+    BOOST_CHECK_EQUAL(spInfo.getCacheMisses(), 3U);
+    BOOST_CHECK_EQUAL(spInfo.getCacheHits(), 1U);
+
+    // updates replace the cached entry
+    sp.num_tokens = 150;
+    sp.update_block = blockUpdated;
+    BOOST_CHECK(spInfo.updateSP(propertyId, sp));
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+    BOOST_CHECK_EQUAL(info.num_tokens, 150);
+
+    // so do roll backs
+    BOOST_CHECK_EQUAL(spInfo.popBlock(blockUpdated), 1);
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+    BOOST_CHECK_EQUAL(info.num_tokens, 100);
+
+    BOOST_CHECK_EQUAL(spInfo.popBlock(blockCreated), 0);
+    BOOST_CHECK(!spInfo.getSP(propertyId, info));
+
+    // and clearing the database
+    propertyId = spInfo.putSP(1, sp);
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+    spInfo.Clear();
+    BOOST_CHECK(!spInfo.getSP(propertyId, info));
+}
+
+BOOST_AUTO_TEST_CASE(block_writes_journal)
+{
+    CMPSPInfo spInfo(GetDataDir() / "MP_spinfo_test", true);
+    CMPNonFungibleTokensDB nftInfo(GetDataDir() / "OMNI_nftdb_test", true);
+
+    const uint256 block = uint256S("1000000000000000000000000000000000000000000000000000000000000001");
+    int nBlock = 0;
+    bool fUnbufferedWrites = false;
+
+    CMPSPInfo::Entry sp;
+    sp.name = "Token";
+    sp.txid = uint256S("3000000000000000000000000000000000000000000000000000000000000003");
+    sp.creation_block = block;
+    sp.update_block = block;
+
+    // writes of properties are buffered, while the block is journaled
+    CDBBase::BeginBlockWrites(500);
+    uint32_t propertyId = spInfo.putSP(1, sp);
+    CMPSPInfo::Entry info;
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+    BOOST_CHECK_EQUAL(spInfo.findSPByTX(sp.txid), propertyId);
+    BOOST_CHECK(CDBBase::GetInterruptedBlock(nBlock, fUnbufferedWrites));
+    BOOST_CHECK_EQUAL(nBlock, 500);
+    BOOST_CHECK(!fUnbufferedWrites);
+
+    // the journal entry is erased, once the writes were committed
+    BOOST_CHECK(CDBBase::CommitBlockWrites());
+    BOOST_CHECK(!CDBBase::GetInterruptedBlock(nBlock, fUnbufferedWrites));
+    BOOST_CHECK(spInfo.getSP(propertyId, info));
+
+    // writes of non-fungible tokens are not buffered, which is journaled
+    CDBBase::BeginBlockWrites(501);
+    nftInfo.CreateNonFungibleTokens(propertyId, 10, "owner", "");
+    BOOST_CHECK(CDBBase::GetInterruptedBlock(nBlock, fUnbufferedWrites));
+    BOOST_CHECK_EQUAL(nBlock, 501);
+    BOOST_CHECK(fUnbufferedWrites);
+    BOOST_CHECK(CDBBase::CommitBlockWrites());
+    BOOST_CHECK(!CDBBase::GetInterruptedBlock(nBlock, fUnbufferedWrites));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
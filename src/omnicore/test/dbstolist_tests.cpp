@@ -0,0 +1,81 @@
+#include <omnicore/dbspinfo.h>
+#include <omnicore/dbstolist.h>
+#include <omnicore/sp.h>
+
+#include <uint256.h>
+#include <util/system.h>
+
+#include <test/util/setup_common.h>
+
+#include <univalue.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dbstolist_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(recipients_of_sto)
+{
+    CMPSTOList stolist(GetDataDir() / "MP_stolist_test", true);
+    CMPSPInfo* pDbSpInfoPrev = mastercore::pDbSpInfo;
+    mastercore::pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+
+    const uint256 txid1 = uint256S("1000000000000000000000000000000000000000000000000000000000000001");
+    const uint256 txid2 = uint256S("2000000000000000000000000000000000000000000000000000000000000002");
+
+    std::vector<std::pair<std::string, uint64_t> > receipts1;
+    receipts1.push_back(std::make_pair("carol", 30));
+    receipts1.push_back(std::make_pair("alice", 50));
+    receipts1.push_back(std::make_pair("bob", 20));
+    stolist.recordSTOReceives(txid1, 100, 3, receipts1);
+
+    std::vector<std::pair<std::string, uint64_t> > receipts2;
+    receipts2.push_back(std::make_pair("alice", 7));
+    stolist.recordSTOReceives(txid2, 200, 3, receipts2);
+
+    BOOST_CHECK(stolist.exists("alice"));
+    BOOST_CHECK(stolist.exists("carol"));
+    BOOST_CHECK(!stolist.exists("ali"));
+    BOOST_CHECK(!stolist.exists("dave"));
+
+    // recipients are listed by address
+    UniValue recipients(UniValue::VARR);
+    uint64_t total = 0;
+    uint64_t numRecipients = 0;
+    stolist.getRecipients(txid1, "*", &recipients, &total, &numRecipients);
+    BOOST_CHECK_EQUAL(numRecipients, 3U);
+    BOOST_CHECK_EQUAL(total, 100U);
+    BOOST_REQUIRE_EQUAL(recipients.size(), 3U);
+    BOOST_CHECK_EQUAL(recipients[0]["address"].get_str(), "alice");
+    BOOST_CHECK_EQUAL(recipients[1]["address"].get_str(), "bob");
+    BOOST_CHECK_EQUAL(recipients[2]["address"].get_str(), "carol");
+    BOOST_CHECK_EQUAL(recipients[2]["amount"].get_str(), "0.00000030");
+
+    // all recipients are counted, but only the filtered one is listed
+    recipients = UniValue(UniValue::VARR);
+    total = 0;
+    stolist.getRecipients(txid1, "bob", &recipients, &total, &numRecipients);
+    BOOST_CHECK_EQUAL(numRecipients, 3U);
+    BOOST_CHECK_EQUAL(total, 20U);
+    BOOST_REQUIRE_EQUAL(recipients.size(), 1U);
+    BOOST_CHECK_EQUAL(recipients[0]["address"].get_str(), "bob");
+
+    // rolling back removes both entries of the receipts
+    BOOST_CHECK_EQUAL(stolist.deleteAboveBlock(100), 4);
+    BOOST_CHECK(!stolist.exists("alice"));
+
+    recipients = UniValue(UniValue::VARR);
+    total = 0;
+    stolist.getRecipients(txid2, "*", &recipients, &total, &numRecipients);
+    BOOST_CHECK_EQUAL(numRecipients, 0U);
+    BOOST_CHECK(recipients.empty());
+
+    delete mastercore::pDbSpInfo;
+    mastercore::pDbSpInfo = pDbSpInfoPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+#include <omnicore/dbspinfo.h>
+#include <omnicore/dbtradelist.h>
+#include <omnicore/sp.h>
+
+#include <uint256.h>
+#include <util/system.h>
+
+#include <test/util/setup_common.h>
+
+#include <univalue.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dbtradelist_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(trades_for_address)
+{
+    CMPTradeList tradelist(GetDataDir() / "MP_tradelist_test", true);
+
+    const uint256 txid1 = uint256S("1000000000000000000000000000000000000000000000000000000000000001");
+    const uint256 txid2 = uint256S("2000000000000000000000000000000000000000000000000000000000000002");
+    const uint256 txid3 = uint256S("3000000000000000000000000000000000000000000000000000000000000003");
+    const uint256 txid4 = uint256S("4000000000000000000000000000000000000000000000000000000000000004");
+
+    // recorded out of order, results are sorted by block and position
+    tradelist.recordNewTrade(txid1, "alice", 1, 3, 200, 5);
+    tradelist.recordNewTrade(txid2, "alice", 3, 1, 100, 7);
+    tradelist.recordNewTrade(txid3, "alice", 4, 1, 200, 2);
+    tradelist.recordNewTrade(txid4, "alicex", 1, 3, 150, 1);
+    tradelist.recordMatchedTrade(txid1, txid2, "alice", "alice", 1, 3, 10, 20, 200, 0);
+
+    std::vector<uint256> vecTrades;
+    tradelist.getTradesForAddress("alice", vecTrades);
+    BOOST_REQUIRE_EQUAL(vecTrades.size(), 3U);
+    BOOST_CHECK(vecTrades[0] == txid2);
+    BOOST_CHECK(vecTrades[1] == txid3);
+    BOOST_CHECK(vecTrades[2] == txid1);
+
+    vecTrades.clear();
+    tradelist.getTradesForAddress("alice", vecTrades, 3);
+    BOOST_REQUIRE_EQUAL(vecTrades.size(), 2U);
+    BOOST_CHECK(vecTrades[0] == txid2);
+    BOOST_CHECK(vecTrades[1] == txid1);
+
+    vecTrades.clear();
+    tradelist.getTradesForAddress("bob", vecTrades);
+    BOOST_CHECK(vecTrades.empty());
+
+    BOOST_CHECK_EQUAL(tradelist.getMPTradeCountTotal(), 5);
+
+    // rolling back removes the trades and their index entries
+    tradelist.deleteAboveBlock(200);
+
+    vecTrades.clear();
+    tradelist.getTradesForAddress("alice", vecTrades);
+    BOOST_REQUIRE_EQUAL(vecTrades.size(), 1U);
+    BOOST_CHECK(vecTrades[0] == txid2);
+
+    vecTrades.clear();
+    tradelist.getTradesForAddress("alicex", vecTrades);
+    BOOST_REQUIRE_EQUAL(vecTrades.size(), 1U);
+    BOOST_CHECK(vecTrades[0] == txid4);
+}
+
+BOOST_AUTO_TEST_CASE(trades_for_pair)
+{
+    CMPTradeList tradelist(GetDataDir() / "MP_tradelist_test", true);
+    CMPSPInfo* pDbSpInfoPrev = mastercore::pDbSpInfo;
+    mastercore::pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+
+    const uint256 txid1 = uint256S("1000000000000000000000000000000000000000000000000000000000000001");
+    const uint256 txid2 = uint256S("2000000000000000000000000000000000000000000000000000000000000002");
+    const uint256 txid3 = uint256S("3000000000000000000000000000000000000000000000000000000000000003");
+    const uint256 txid4 = uint256S("4000000000000000000000000000000000000000000000000000000000000004");
+
+    tradelist.recordMatchedTrade(txid2, txid1, "bob", "alice", 1, 2, 100, 200, 100, 0);
+    tradelist.recordMatchedTrade(txid3, txid1, "carol", "alice", 1, 2, 300, 600, 101, 0);
+    tradelist.recordMatchedTrade(txid4, txid3, "dave", "carol", 2, 1, 50, 25, 102, 0);
+
+    UniValue response(UniValue::VARR);
+    tradelist.getTradesForPair(1, 2, response, 10);
+    BOOST_REQUIRE_EQUAL(response.size(), 3U);
+    BOOST_CHECK_EQUAL(response[0]["block"].get_int(), 100);
+    BOOST_CHECK_EQUAL(response[1]["block"].get_int(), 101);
+    BOOST_CHECK_EQUAL(response[2]["block"].get_int(), 102);
+    BOOST_CHECK_EQUAL(response[0]["selleraddress"].get_str(), "alice");
+    BOOST_CHECK_EQUAL(response[0]["amountsold"].get_str(), "0.00000100");
+    BOOST_CHECK_EQUAL(response[2]["selleraddress"].get_str(), "dave");
+    BOOST_CHECK_EQUAL(response[2]["amountsold"].get_str(), "0.00000025");
+
+    // both orientations of the pair are served by the same index
+    response = UniValue(UniValue::VARR);
+    tradelist.getTradesForPair(2, 1, response, 10);
+    BOOST_REQUIRE_EQUAL(response.size(), 3U);
+    BOOST_CHECK_EQUAL(response[2]["selleraddress"].get_str(), "carol");
+
+    // only the most recent trades are returned, optionally skipping the newest ones
+    response = UniValue(UniValue::VARR);
+    tradelist.getTradesForPair(1, 2, response, 2);
+    BOOST_REQUIRE_EQUAL(response.size(), 2U);
+    BOOST_CHECK_EQUAL(response[0]["block"].get_int(), 101);
+    BOOST_CHECK_EQUAL(response[1]["block"].get_int(), 102);
+
+    response = UniValue(UniValue::VARR);
+    tradelist.getTradesForPair(1, 2, response, 2, 2);
+    BOOST_REQUIRE_EQUAL(response.size(), 1U);
+    BOOST_CHECK_EQUAL(response[0]["block"].get_int(), 100);
+
+    response = UniValue(UniValue::VARR);
+    tradelist.getTradesForPair(1, 3, response, 10);
+    BOOST_CHECK_EQUAL(response.size(), 0U);
+
+    // rolling back removes the trades and their index entries
+    tradelist.deleteAboveBlock(101);
+    BOOST_CHECK_EQUAL(tradelist.getMPTradeCountTotal(), 1);
+
+    response = UniValue(UniValue::VARR);
+    tradelist.getTradesForPair(1, 2, response, 10);
+    BOOST_REQUIRE_EQUAL(response.size(), 1U);
+    BOOST_CHECK_EQUAL(response[0]["block"].get_int(), 100);
+
+    delete mastercore::pDbSpInfo;
+    mastercore::pDbSpInfo = pDbSpInfoPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+#include <omnicore/dbbase.h>
+#include <omnicore/dbtxlist.h>
+
+#include <uint256.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <set>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dbtxlist_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(txlist_block_range_queries)
+{
+    CMPTxList txlist(GetDataDir() / "MP_txlist_test", true);
+
+    const uint256 txidA = uint256S("a000000000000000000000000000000000000000000000000000000000000001");
+    const uint256 txidB = uint256S("b000000000000000000000000000000000000000000000000000000000000002");
+    const uint256 txidC = uint256S("c000000000000000000000000000000000000000000000000000000000000003");
+    const uint256 txidD = uint256S("d000000000000000000000000000000000000000000000000000000000000004");
+
+    txlist.recordTX(txidA, true, 100, 0, 5);
+    txlist.recordTX(txidB, false, 100, 0, 7);
+    txlist.recordTX(txidC, true, 150, 4, 0);
+    txlist.recordSendAllSubRecord(txidC, 1, 3, 1000);
+    txlist.recordTX(txidD, true, 200, 256, 0);
+    txlist.recordMetaDExCancelTX(txidD, txidA, true, 200, 3, 50);
+
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountTotal(), 4);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(100), 2);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(150), 1);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(200), 1);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(101), 0);
+
+    std::set<uint256> txs;
+    BOOST_CHECK_EQUAL(txlist.GetOmniTxsInBlockRange(101, 200, txs), 2);
+    BOOST_CHECK(txs.count(txidC));
+    BOOST_CHECK(txs.count(txidD));
+
+    std::set<int> seedBlocks = txlist.GetSeedBlocks(0, 199);
+    BOOST_CHECK_EQUAL(seedBlocks.size(), 2U);
+    BOOST_CHECK(seedBlocks.count(100));
+    BOOST_CHECK(seedBlocks.count(150));
+
+    BOOST_CHECK(txlist.isMPinBlockRange(150, 150, false));
+    BOOST_CHECK(!txlist.isMPinBlockRange(151, 199, false));
+
+    // rolling back removes the records, their sub records and index entries
+    BOOST_CHECK(txlist.isMPinBlockRange(150, 1000, true));
+    BOOST_CHECK(!txlist.isMPinBlockRange(150, 1000, false));
+    BOOST_CHECK(!txlist.exists(txidC));
+    BOOST_CHECK(!txlist.exists(txidD));
+    BOOST_CHECK(txlist.exists(txidA));
+
+    uint32_t propertyId = 0;
+    int64_t amount = 0;
+    BOOST_CHECK(!txlist.getSendAllDetails(txidC, 1, propertyId, amount));
+    BOOST_CHECK_EQUAL(txlist.getNumberOfMetaDExCancels(txidD), 0);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountTotal(), 2);
+    BOOST_CHECK_EQUAL(txlist.GetSeedBlocks(0, 1000).size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(txlist_payment_records)
+{
+    CMPTxList txlist(GetDataDir() / "MP_txlist_test", true);
+
+    const uint256 txid = uint256S("e000000000000000000000000000000000000000000000000000000000000005");
+
+    txlist.recordPaymentTX(txid, true, 300, 1, 1, 100, "buyer", "seller");
+    txlist.recordPaymentTX(txid, true, 300, 2, 1, 200, "buyer", "seller");
+
+    BOOST_CHECK_EQUAL(txlist.getNumberOfSubRecords(txid), 2);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(300), 1);
+
+    BOOST_CHECK(txlist.isMPinBlockRange(300, 300, true));
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(300), 0);
+
+    std::string buyer, seller;
+    uint64_t vout, propertyId, nValue;
+    BOOST_CHECK(!txlist.getPurchaseDetails(txid, 1, &buyer, &seller, &vout, &propertyId, &nValue));
+}
+
+BOOST_AUTO_TEST_CASE(txlist_block_writes)
+{
+    CMPTxList txlist(GetDataDir() / "MP_txlist_test", true);
+
+    const uint256 txid = uint256S("f000000000000000000000000000000000000000000000000000000000000006");
+
+    // writes of the block are buffered, but visible to lookups
+    CDBBase::BeginBlockWrites(400);
+    txlist.recordPaymentTX(txid, true, 400, 1, 1, 100, "buyer", "seller");
+    txlist.recordPaymentTX(txid, true, 400, 2, 1, 200, "buyer", "seller");
+    BOOST_CHECK(txlist.exists(txid));
+    BOOST_CHECK_EQUAL(txlist.getNumberOfSubRecords(txid), 2);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountTotal(), 0);
+
+    // and committed together at the end of the block
+    BOOST_CHECK(CDBBase::CommitBlockWrites());
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountTotal(), 1);
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(400), 1);
+
+    // without session writes are applied immediately
+    BOOST_CHECK(txlist.isMPinBlockRange(400, 400, true));
+    BOOST_CHECK(!txlist.exists(txid));
+    BOOST_CHECK_EQUAL(txlist.getMPTransactionCountTotal(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(txlist_shared_cache_and_bloom_filter)
+{
+    CDBBase::SetSharedOptions(1 << 20, 10);
+    BOOST_CHECK_EQUAL(CDBBase::GetSharedCacheSize(), 1U << 20);
+    BOOST_CHECK_EQUAL(CDBBase::GetBloomFilterBits(), 10);
+
+    const uint256 txid = uint256S("a000000000000000000000000000000000000000000000000000000000000007");
+    const uint256 txidMissing = uint256S("b000000000000000000000000000000000000000000000000000000000000008");
+    {
+        CMPTxList txlist(GetDataDir() / "MP_txlist_test", true);
+        txlist.recordTX(txid, true, 500, 0, 5);
+    }
+    {
+        // the records are read from table files with bloom filters, after reopening the database
+        CMPTxList txlist(GetDataDir() / "MP_txlist_test", false);
+        BOOST_CHECK(txlist.exists(txid));
+        BOOST_CHECK(!txlist.exists(txidMissing));
+        BOOST_CHECK_EQUAL(txlist.getMPTransactionCountBlock(500), 1);
+    }
+
+    CDBBase::ReleaseSharedOptions();
+    BOOST_CHECK_EQUAL(CDBBase::GetSharedCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(CDBBase::GetSharedCacheUsage(), 0U);
+    BOOST_CHECK_EQUAL(CDBBase::GetBloomFilterBits(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
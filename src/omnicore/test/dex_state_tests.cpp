@@ -0,0 +1,61 @@
+#include <omnicore/dex.h>
+#include <omnicore/omnicore.h>
+#include <omnicore/tally.h>
+
+#include <sync.h>
+#include <test/util/setup_common.h>
+#include <uint256.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+
+using namespace mastercore;
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_dex_state_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(accept_expiry)
+{
+    LOCK(cs_tally);
+    ClearTallyMap();
+    my_offers.clear();
+    my_accepts.clear();
+    RebuildAcceptExpiryIndex();
+
+    BOOST_CHECK(update_tally_map("seller", 3, 1000, BALANCE));
+    BOOST_CHECK_EQUAL(0, DEx_offerCreate("seller", 3, 600, 100, 6000, 0, 10, uint256S("01")));
+
+    // payment windows end in block 110 and 115
+    BOOST_CHECK_EQUAL(0, DEx_acceptCreate("alice", "seller", 3, 100, 100, 0));
+    BOOST_CHECK_EQUAL(0, DEx_acceptCreate("bob", "seller", 3, 200, 105, 0));
+    BOOST_CHECK_EQUAL(300, GetTokenBalance("seller", 3, ACCEPT_RESERVE));
+
+    BOOST_CHECK_EQUAL(0U, eraseExpiredAccepts(109));
+    BOOST_CHECK_EQUAL(1U, eraseExpiredAccepts(110));
+    BOOST_CHECK(!DEx_acceptExists("seller", 3, "alice"));
+    BOOST_CHECK(DEx_acceptExists("seller", 3, "bob"));
+    BOOST_CHECK_EQUAL(200, GetTokenBalance("seller", 3, ACCEPT_RESERVE));
+    BOOST_CHECK_EQUAL(400, GetTokenBalance("seller", 3, SELLOFFER_RESERVE));
+
+    // a replaced accept expires with its new payment window
+    BOOST_CHECK_EQUAL(0, DEx_acceptDestroy("bob", "seller", 3, true));
+    BOOST_CHECK_EQUAL(0, DEx_acceptCreate("bob", "seller", 3, 50, 113, 0));
+    BOOST_CHECK_EQUAL(0U, eraseExpiredAccepts(115));
+    BOOST_CHECK(DEx_acceptExists("seller", 3, "bob"));
+    BOOST_CHECK_EQUAL(1U, eraseExpiredAccepts(123));
+    BOOST_CHECK(my_accepts.empty());
+    BOOST_CHECK_EQUAL(600, GetTokenBalance("seller", 3, SELLOFFER_RESERVE));
+
+    // the index is rebuilt, after the accepts were loaded
+    BOOST_CHECK_EQUAL(0, DEx_acceptCreate("alice", "seller", 3, 100, 130, 0));
+    RebuildAcceptExpiryIndex();
+    BOOST_CHECK_EQUAL(0U, eraseExpiredAccepts(139));
+    BOOST_CHECK_EQUAL(1U, eraseExpiredAccepts(140));
+    BOOST_CHECK(my_accepts.empty());
+
+    BOOST_CHECK_EQUAL(0, DEx_offerDestroy("seller", 3));
+    BOOST_CHECK_EQUAL(1000, GetTokenBalance("seller", 3, BALANCE));
+    ClearTallyMap();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
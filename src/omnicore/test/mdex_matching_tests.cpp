@@ -0,0 +1,374 @@
+#include <omnicore/dbspinfo.h>
+#include <omnicore/dbtradelist.h>
+#include <omnicore/dbtxlist.h>
+#include <omnicore/mdex.h>
+#include <omnicore/omnicore.h>
+#include <omnicore/sp.h>
+#include <omnicore/tally.h>
+#include <omnicore/uint256_extensions.h>
+
+#include <arith_uint256.h>
+#include <random.h>
+#include <sync.h>
+#include <test/util/setup_common.h>
+#include <tinyformat.h>
+#include <uint256.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace mastercore;
+
+namespace {
+/** Number of transactions replayed through the order books. */
+const int NUM_TRANSACTIONS = 3000;
+
+const std::string ADDRESSES[] = {"alice", "bob", "carol", "dave", "erin", "frank"};
+const uint32_t MAIN_PROPERTIES[] = {OMNI_PROPERTY_MSC, 3, 4, 5};
+const uint32_t TEST_PROPERTIES[] = {OMNI_PROPERTY_TMSC, TEST_ECO_PROPERTY_1};
+
+/**
+ * Reference implementation of the former single property keyed order book.
+ *
+ * Orders are matched by scanning all price levels of the desired property and
+ * skipping orders for other properties, exactly as before the books were keyed
+ * by property pair, and prices are normalized rationals.
+ */
+class LegacyMetaDEx
+{
+public:
+    typedef std::map<rational_t, md_Set> LegacyPricesMap;
+    typedef std::map<std::pair<std::string, uint32_t>, int64_t> Balances;
+
+    std::map<uint32_t, LegacyPricesMap> book;
+    Balances balance;
+    Balances reserve;
+
+    void Add(CMPMetaDEx obj)
+    {
+        Trade(obj);
+        if (0 < obj.getAmountRemaining()) {
+            book[obj.getProperty()][obj.unitPrice()].insert(obj);
+            balance[Key(obj.getAddr(), obj.getProperty())] -= obj.getAmountRemaining();
+            reserve[Key(obj.getAddr(), obj.getProperty())] += obj.getAmountRemaining();
+        }
+    }
+
+    std::vector<uint256> CancelAtPrice(const std::string& addr, uint32_t prop, int64_t amount, uint32_t desired, int64_t amountDesired)
+    {
+        const rational_t price = CMPMetaDEx(addr, 0, prop, amount, desired, amountDesired, uint256(), 0, 0).unitPrice();
+        std::vector<uint256> cancelled;
+        LegacyPricesMap& prices = book[prop];
+        for (LegacyPricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
+            if (it->first != price) continue;
+            Cancel(it->second, addr, desired, cancelled);
+        }
+        return cancelled;
+    }
+
+    std::vector<uint256> CancelAllForPair(const std::string& addr, uint32_t prop, uint32_t desired)
+    {
+        std::vector<uint256> cancelled;
+        LegacyPricesMap& prices = book[prop];
+        for (LegacyPricesMap::iterator it = prices.begin(); it != prices.end(); ++it) {
+            Cancel(it->second, addr, desired, cancelled);
+        }
+        return cancelled;
+    }
+
+    std::vector<uint256> CancelEverything(const std::string& addr, unsigned char ecosystem)
+    {
+        std::vector<uint256> cancelled;
+        for (std::map<uint32_t, LegacyPricesMap>::iterator my_it = book.begin(); my_it != book.end(); ++my_it) {
+            if (isMainEcosystemProperty(ecosystem) && !isMainEcosystemProperty(my_it->first)) continue;
+            if (isTestEcosystemProperty(ecosystem) && !isTestEcosystemProperty(my_it->first)) continue;
+            for (LegacyPricesMap::iterator it = my_it->second.begin(); it != my_it->second.end(); ++it) {
+                Cancel(it->second, addr, 0, cancelled);
+            }
+        }
+        return cancelled;
+    }
+
+private:
+    static std::pair<std::string, uint32_t> Key(const std::string& addr, uint32_t prop)
+    {
+        return std::make_pair(addr, prop);
+    }
+
+    /** Cancels the orders of the address, for the desired property, or all, if zero. */
+    void Cancel(md_Set& indexes, const std::string& addr, uint32_t desired, std::vector<uint256>& cancelled)
+    {
+        for (md_Set::iterator it = indexes.begin(); it != indexes.end();) {
+            if (it->getAddr() != addr || (desired != 0 && it->getDesProperty() != desired)) {
+                ++it;
+                continue;
+            }
+            reserve[Key(it->getAddr(), it->getProperty())] -= it->getAmountRemaining();
+            balance[Key(it->getAddr(), it->getProperty())] += it->getAmountRemaining();
+            cancelled.push_back(it->getHash());
+            indexes.erase(it++);
+        }
+    }
+
+    void Trade(CMPMetaDEx& pnew)
+    {
+        std::map<uint32_t, LegacyPricesMap>::iterator book_it = book.find(pnew.getDesProperty());
+        if (book_it == book.end()) return;
+
+        for (LegacyPricesMap::iterator priceIt = book_it->second.begin(); priceIt != book_it->second.end(); ++priceIt) {
+            if (pnew.inversePrice() < priceIt->first) continue;
+
+            md_Set& offers = priceIt->second;
+            md_Set::iterator offerIt = offers.begin();
+            while (offerIt != offers.end()) {
+                const CMPMetaDEx& pold = *offerIt;
+                if (pold.getDesProperty() != pnew.getProperty()) {
+                    ++offerIt;
+                    continue;
+                }
+
+                arith_uint256 iCouldBuy = (ConvertTo256(pnew.getAmountRemaining()) * ConvertTo256(pold.getAmountForSale())) / ConvertTo256(pold.getAmountDesired());
+                int64_t nCouldBuy = pold.getAmountRemaining();
+                if (iCouldBuy < ConvertTo256(pold.getAmountRemaining())) nCouldBuy = ConvertTo64(iCouldBuy);
+                if (nCouldBuy == 0) {
+                    ++offerIt;
+                    continue;
+                }
+
+                int64_t nWouldPay = ConvertTo64(DivideAndRoundUp(ConvertTo256(nCouldBuy) * ConvertTo256(pold.getAmountDesired()), ConvertTo256(pold.getAmountForSale())));
+                if (rational_t(nWouldPay, nCouldBuy) > pnew.inversePrice()) {
+                    ++offerIt;
+                    continue;
+                }
+
+                balance[Key(pnew.getAddr(), pnew.getProperty())] -= nWouldPay;
+                balance[Key(pold.getAddr(), pold.getDesProperty())] += nWouldPay;
+                reserve[Key(pold.getAddr(), pold.getProperty())] -= nCouldBuy;
+                balance[Key(pnew.getAddr(), pnew.getDesProperty())] += nCouldBuy;
+
+                CMPMetaDEx replacement = pold;
+                replacement.setAmountRemaining(pold.getAmountRemaining() - nCouldBuy, "legacy");
+                pnew.setAmountRemaining(pnew.getAmountRemaining() - nWouldPay, "legacy");
+
+                offers.erase(offerIt++);
+                if (0 < replacement.getAmountRemaining()) offers.insert(replacement);
+                if (0 == pnew.getAmountRemaining()) return;
+            }
+        }
+    }
+};
+
+/** Returns the remaining amounts of all orders in the books, keyed by transaction hash. */
+std::map<uint256, int64_t> GetOrders()
+{
+    std::map<uint256, int64_t> orders;
+    for (md_PropertiesMap::const_iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
+        for (md_PricesMap::const_iterator it = my_it->second.begin(); it != my_it->second.end(); ++it) {
+            for (md_Set::const_iterator iitt = it->second.begin(); iitt != it->second.end(); ++iitt) {
+                BOOST_CHECK(my_it->first == std::make_pair(iitt->getProperty(), iitt->getDesProperty()));
+                BOOST_CHECK(it->first == iitt->getUnitPrice());
+                BOOST_CHECK(MetaDEx_RetrieveTrade(iitt->getHash()) == &(*iitt));
+                orders[iitt->getHash()] = iitt->getAmountRemaining();
+            }
+        }
+    }
+    return orders;
+}
+
+std::map<uint256, int64_t> GetOrders(const LegacyMetaDEx& legacy)
+{
+    std::map<uint256, int64_t> orders;
+    for (std::map<uint32_t, LegacyMetaDEx::LegacyPricesMap>::const_iterator my_it = legacy.book.begin(); my_it != legacy.book.end(); ++my_it) {
+        for (LegacyMetaDEx::LegacyPricesMap::const_iterator it = my_it->second.begin(); it != my_it->second.end(); ++it) {
+            for (md_Set::const_iterator iitt = it->second.begin(); iitt != it->second.end(); ++iitt) {
+                orders[iitt->getHash()] = iitt->getAmountRemaining();
+            }
+        }
+    }
+    return orders;
+}
+
+std::vector<CMPMetaDEx> GetOrderObjects(const LegacyMetaDEx& legacy)
+{
+    std::vector<CMPMetaDEx> orders;
+    for (std::map<uint32_t, LegacyMetaDEx::LegacyPricesMap>::const_iterator my_it = legacy.book.begin(); my_it != legacy.book.end(); ++my_it) {
+        for (LegacyMetaDEx::LegacyPricesMap::const_iterator it = my_it->second.begin(); it != my_it->second.end(); ++it) {
+            orders.insert(orders.end(), it->second.begin(), it->second.end());
+        }
+    }
+    return orders;
+}
+
+/** Returns the orders, which were cancelled by a transaction, in the recorded order. */
+std::vector<uint256> GetCancelled(const uint256& txid)
+{
+    std::vector<uint256> cancelled;
+    int numberOfCancels = pDbTransactionList->getNumberOfMetaDExCancels(txid);
+    for (int refNumber = 1; refNumber <= numberOfCancels; ++refNumber) {
+        std::string strValue = pDbTransactionList->getKeyValue(txid.ToString() + "-C" + strprintf("%d", refNumber));
+        cancelled.push_back(uint256S(strValue.substr(0, strValue.find(':'))));
+    }
+    return cancelled;
+}
+
+struct MetaDExTestingSetup : public BasicTestingSetup
+{
+    CMPSPInfo* pDbSpInfoPrev;
+    CMPTradeList* pDbTradeListPrev;
+    CMPTxList* pDbTransactionListPrev;
+
+    MetaDExTestingSetup()
+      : pDbSpInfoPrev(pDbSpInfo), pDbTradeListPrev(pDbTradeList), pDbTransactionListPrev(pDbTransactionList)
+    {
+        pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+        pDbTradeList = new CMPTradeList(GetDataDir() / "MP_tradelist_test", true);
+        pDbTransactionList = new CMPTxList(GetDataDir() / "MP_txlist_test", true);
+        LOCK(cs_tally);
+        ClearTallyMap();
+        MetaDEx_Clear();
+    }
+
+    ~MetaDExTestingSetup()
+    {
+        {
+            LOCK(cs_tally);
+            ClearTallyMap();
+            MetaDEx_Clear();
+        }
+        delete pDbSpInfo;
+        delete pDbTradeList;
+        delete pDbTransactionList;
+        pDbSpInfo = pDbSpInfoPrev;
+        pDbTradeList = pDbTradeListPrev;
+        pDbTransactionList = pDbTransactionListPrev;
+    }
+};
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_mdex_matching_tests, MetaDExTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pair_book_matches_legacy_book)
+{
+    LOCK(cs_tally);
+
+    // the corpus is generated deterministically, so failures are reproducible
+    FastRandomContext rng(true);
+    LegacyMetaDEx legacy;
+    int nCancelled = 0;
+
+    for (int n = 0; n < NUM_TRANSACTIONS; ++n) {
+        const uint256 txid = ArithToUint256(arith_uint256(n + 1));
+        const int block = 400000 + n / 8;
+        const unsigned int idx = n % 8;
+        const std::string& addr = ADDRESSES[rng.randrange(6)];
+
+        bool fTestEcosystem = rng.randrange(4) == 0;
+        const uint32_t* properties = fTestEcosystem ? TEST_PROPERTIES : MAIN_PROPERTIES;
+        const int numProperties = fTestEcosystem ? 2 : 4;
+        uint32_t prop = properties[rng.randrange(numProperties)];
+        uint32_t desired = prop;
+        while (desired == prop) desired = properties[rng.randrange(numProperties)];
+
+        const int action = rng.randrange(20);
+        std::vector<uint256> expected;
+
+        std::vector<CMPMetaDEx> legacyOrders;
+        if (action < 2) legacyOrders = GetOrderObjects(legacy);
+
+        if (action < 2 && !legacyOrders.empty()) {
+            // cancel at the price of an existing order, which is often one of the sender
+            const CMPMetaDEx order = legacyOrders[rng.randrange(legacyOrders.size())];
+            const std::string& sender = rng.randbool() ? order.getAddr() : addr;
+            expected = legacy.CancelAtPrice(sender, order.getProperty(), order.getAmountForSale(), order.getDesProperty(), order.getAmountDesired());
+            MetaDEx_CANCEL_AT_PRICE(txid, block, sender, order.getProperty(), order.getAmountForSale(), order.getDesProperty(), order.getAmountDesired());
+        } else if (action < 3) {
+            expected = legacy.CancelAllForPair(addr, prop, desired);
+            MetaDEx_CANCEL_ALL_FOR_PAIR(txid, block, addr, prop, desired);
+        } else if (action < 4) {
+            unsigned char ecosystem = fTestEcosystem ? OMNI_PROPERTY_TMSC : OMNI_PROPERTY_MSC;
+            expected = legacy.CancelEverything(addr, ecosystem);
+            MetaDEx_CANCEL_EVERYTHING(txid, block, addr, ecosystem);
+        } else {
+            // mostly prices around one, with equal price levels, and a few tiny and large amounts
+            int64_t amount = 1 + rng.randrange(rng.randrange(10) == 0 ? 5 : 1000);
+            int64_t amountDesired = 1 + rng.randrange(rng.randrange(10) == 0 ? 5 : 1000);
+            if (rng.randrange(10) == 0) amount *= 100000000;
+            if (rng.randrange(10) == 0) amountDesired *= 100000000;
+
+            BOOST_CHECK(update_tally_map(addr, prop, amount, BALANCE));
+            legacy.balance[std::make_pair(addr, prop)] += amount;
+
+            legacy.Add(CMPMetaDEx(addr, block, prop, amount, desired, amountDesired, txid, idx, CMPTransaction::ADD));
+            BOOST_CHECK_EQUAL(MetaDEx_ADD(addr, prop, amount, block, desired, amountDesired, txid, idx), 0);
+        }
+
+        // cancellations are recorded in the same order
+        if (action < 4) {
+            BOOST_CHECK(GetCancelled(txid) == expected);
+            for (std::vector<uint256>::const_iterator it = expected.begin(); it != expected.end(); ++it) {
+                BOOST_CHECK(!MetaDEx_isOpen(*it));
+            }
+            nCancelled += expected.size();
+        }
+
+        // the remaining orders and all balances are identical after every transaction
+        BOOST_REQUIRE(GetOrders() == GetOrders(legacy));
+        for (const std::string& address : ADDRESSES) {
+            for (int i = 0; i < 6; ++i) {
+                uint32_t propertyId = i < 4 ? MAIN_PROPERTIES[i] : TEST_PROPERTIES[i - 4];
+                std::pair<std::string, uint32_t> key = std::make_pair(address, propertyId);
+                BOOST_REQUIRE_EQUAL(GetTokenBalance(address, propertyId, BALANCE), legacy.balance[key]);
+                BOOST_REQUIRE_EQUAL(GetTokenBalance(address, propertyId, METADEX_RESERVE), legacy.reserve[key]);
+            }
+        }
+    }
+
+    // the corpus exercises matching as well as cancellations
+    BOOST_CHECK(pDbTradeList->getMPTradeCountTotal() > NUM_TRANSACTIONS / 4);
+    BOOST_CHECK(nCancelled > 0);
+}
+
+BOOST_AUTO_TEST_CASE(order_index_follows_books)
+{
+    LOCK(cs_tally);
+
+    const uint256 txidA = uint256S("a000000000000000000000000000000000000000000000000000000000000001");
+    const uint256 txidB = uint256S("b000000000000000000000000000000000000000000000000000000000000002");
+    const uint256 txidC = uint256S("c000000000000000000000000000000000000000000000000000000000000003");
+
+    BOOST_CHECK(update_tally_map("alice", 3, 100, BALANCE));
+    BOOST_CHECK(update_tally_map("bob", 4, 100, BALANCE));
+    BOOST_CHECK(update_tally_map("carol", 4, 150, BALANCE));
+
+    BOOST_CHECK_EQUAL(MetaDEx_ADD("alice", 3, 100, 400000, 4, 200, txidA, 1), 0);
+    const CMPMetaDEx* pobj = MetaDEx_RetrieveTrade(txidA);
+    BOOST_REQUIRE(pobj);
+    BOOST_CHECK_EQUAL(pobj->getAmountRemaining(), 100);
+    BOOST_CHECK(MetaDEx_isOpen(txidA));
+    BOOST_CHECK(MetaDEx_isOpen(txidA, 3));
+    BOOST_CHECK(!MetaDEx_isOpen(txidA, 4));
+    BOOST_CHECK(!MetaDEx_isOpen(txidB));
+
+    // partially filled orders are replaced, and the index refers to the replacement
+    BOOST_CHECK_EQUAL(MetaDEx_ADD("bob", 4, 100, 400001, 3, 50, txidB, 1), 0);
+    BOOST_CHECK(!MetaDEx_isOpen(txidB));
+    pobj = MetaDEx_RetrieveTrade(txidA);
+    BOOST_REQUIRE(pobj);
+    BOOST_CHECK_EQUAL(pobj->getAmountRemaining(), 50);
+
+    // filled orders are removed, remainders are added
+    BOOST_CHECK_EQUAL(MetaDEx_ADD("carol", 4, 150, 400002, 3, 75, txidC, 1), 0);
+    BOOST_CHECK(!MetaDEx_isOpen(txidA));
+    BOOST_CHECK(MetaDEx_isOpen(txidC));
+
+    MetaDEx_Clear();
+    BOOST_CHECK(!MetaDEx_isOpen(txidC));
+    BOOST_CHECK(MetaDEx_RetrieveTrade(txidC) == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+#include <omnicore/mdex.h>
+
+#include <random.h>
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <limits>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_mdex_price_tests, BasicTestingSetup)
+
+/** Returns the price as rational_t, which is zero, if the denominator is zero. */
+static rational_t ToRational(int64_t num, int64_t denom)
+{
+    rational_t price;
+    if (denom) price = rational_t(num, denom);
+    return price;
+}
+
+static void CheckOrdering(int64_t numA, int64_t denomA, int64_t numB, int64_t denomB)
+{
+    CMPMetaDExPrice a(numA, denomA);
+    CMPMetaDExPrice b(numB, denomB);
+    rational_t x = ToRational(numA, denomA);
+    rational_t y = ToRational(numB, denomB);
+
+    BOOST_CHECK_EQUAL(a < b, x < y);
+    BOOST_CHECK_EQUAL(a > b, x > y);
+    BOOST_CHECK_EQUAL(a <= b, x <= y);
+    BOOST_CHECK_EQUAL(a >= b, x >= y);
+    BOOST_CHECK_EQUAL(a == b, x == y);
+    BOOST_CHECK_EQUAL(a != b, x != y);
+    BOOST_CHECK(a.toRational() == x);
+}
+
+BOOST_AUTO_TEST_CASE(price_ordering_edge_cases)
+{
+    const int64_t max = std::numeric_limits<int64_t>::max();
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    const std::vector<int64_t> values = {min, min + 1, -max / 2, -3, -2, -1, 0, 1, 2, 3, 6, max / 2, max - 1, max};
+
+    for (int64_t numA : values) {
+        for (int64_t denomA : values) {
+            for (int64_t numB : values) {
+                for (int64_t denomB : values) {
+                    CheckOrdering(numA, denomA, numB, denomB);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(price_ordering_random)
+{
+    FastRandomContext rng(true);
+
+    for (int i = 0; i < 100000; ++i) {
+        // small amounts create many equal prices, large ones exercise the full range
+        int bits = rng.randbool() ? 4 : 63;
+        int64_t numA = 1 + rng.randbits(bits);
+        int64_t denomA = 1 + rng.randbits(bits);
+        int64_t numB = 1 + rng.randbits(bits);
+        int64_t denomB = 1 + rng.randbits(bits);
+        CheckOrdering(numA, denomA, numB, denomB);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(price_of_trade)
+{
+    CMPMetaDEx trade("alice", 100, 3, 300, 4, 200, uint256(), 1, 1);
+    BOOST_CHECK(trade.getUnitPrice() == CMPMetaDExPrice(2, 3));
+    BOOST_CHECK(trade.getInversePrice() == CMPMetaDExPrice(3, 2));
+    BOOST_CHECK(trade.getUnitPrice().toRational() == trade.unitPrice());
+    BOOST_CHECK(trade.getInversePrice().toRational() == trade.inversePrice());
+
+    // trades without amounts have a price of zero
+    CMPMetaDEx empty;
+    BOOST_CHECK(empty.getUnitPrice() == CMPMetaDExPrice());
+    BOOST_CHECK(empty.getInversePrice() == CMPMetaDExPrice());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 #include <omnicore/nftdb.h>
 
 #include <stdint.h>
+#include <limits>
 #include <string>
 #include <utility>
 
@@ -126,4 +127,57 @@ BOOST_AUTO_TEST_CASE(nftdb_test_sequence)
     delete UITDb;
 }
 
+BOOST_AUTO_TEST_CASE(nftdb_range_lookups)
+{
+    LOCK(cs_tally);
+    auto UITDb = new CMPNonFungibleTokensDB(GetDataDir() / "OMNI_nftdb", true);
+
+    // ranges of neighbouring properties and the data ranges must not be found for another property
+    UITDb->CreateNonFungibleTokens(7, 100, "Alice", "grant7");
+    UITDb->CreateNonFungibleTokens(8, 10, "Bob", "grant8");
+    UITDb->CreateNonFungibleTokens(8, 10, "Charles", "grant8b");
+    UITDb->CreateNonFungibleTokens(9, 1, "Dave", "");
+    UITDb->CreateNonFungibleTokens(0x80000003, 5, "Eve", "");
+
+    BOOST_CHECK_EQUAL(100, UITDb->GetHighestRangeEnd(7));
+    BOOST_CHECK_EQUAL(20, UITDb->GetHighestRangeEnd(8));
+    BOOST_CHECK_EQUAL(1, UITDb->GetHighestRangeEnd(9));
+    BOOST_CHECK_EQUAL(0, UITDb->GetHighestRangeEnd(10));
+    BOOST_CHECK_EQUAL(5, UITDb->GetHighestRangeEnd(0x80000003));
+
+    BOOST_CHECK_EQUAL("", UITDb->GetNonFungibleTokenOwner(8, 0));
+    BOOST_CHECK_EQUAL("", UITDb->GetNonFungibleTokenOwner(8, -1));
+    BOOST_CHECK_EQUAL("Bob", UITDb->GetNonFungibleTokenOwner(8, 1));
+    BOOST_CHECK_EQUAL("Bob", UITDb->GetNonFungibleTokenOwner(8, 10));
+    BOOST_CHECK_EQUAL("Charles", UITDb->GetNonFungibleTokenOwner(8, 11));
+    BOOST_CHECK_EQUAL("Charles", UITDb->GetNonFungibleTokenOwner(8, 20));
+    BOOST_CHECK_EQUAL("", UITDb->GetNonFungibleTokenOwner(8, 21));
+    BOOST_CHECK_EQUAL("", UITDb->GetNonFungibleTokenOwner(8, std::numeric_limits<int64_t>::max()));
+    BOOST_CHECK_EQUAL("grant8b", UITDb->GetNonFungibleTokenData(8, 15, NonFungibleStorage::GrantData));
+
+    BOOST_CHECK(UITDb->GetRange(8, 15, NonFungibleStorage::RangeIndex) == std::make_pair(int64_t{11}, int64_t{20}));
+    BOOST_CHECK(UITDb->GetRange(8, 21, NonFungibleStorage::RangeIndex) == std::make_pair(int64_t{0}, int64_t{0}));
+    BOOST_CHECK(UITDb->IsRangeContiguous(8, 11, 20));
+    BOOST_CHECK(!UITDb->IsRangeContiguous(8, 10, 11));
+    BOOST_CHECK(!UITDb->IsRangeContiguous(8, 21, 22));
+
+    auto ranges = UITDb->GetNonFungibleTokenRanges(8);
+    BOOST_REQUIRE_EQUAL(2U, ranges.size());
+    BOOST_CHECK_EQUAL("Bob", ranges[0].first);
+    BOOST_CHECK_EQUAL("Charles", ranges[1].first);
+
+    BOOST_CHECK_EQUAL(1U, UITDb->GetAddressNonFungibleTokens(8, "Charles").size());
+    BOOST_CHECK(UITDb->GetAddressNonFungibleTokens(7, "Charles").empty());
+    BOOST_CHECK_EQUAL(1U, UITDb->GetAddressNonFungibleTokens(0, "Eve").count(0x80000003));
+
+    // the highest range ends are tracked, as tokens are created, and reset with the database
+    UITDb->CreateNonFungibleTokens(8, 5, "Bob", "");
+    BOOST_CHECK_EQUAL(25, UITDb->GetHighestRangeEnd(8));
+    UITDb->Clear();
+    BOOST_CHECK_EQUAL(0, UITDb->GetHighestRangeEnd(8));
+    BOOST_CHECK_EQUAL("", UITDb->GetNonFungibleTokenOwner(8, 1));
+
+    delete UITDb;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,84 @@
+#include <omnicore/dbspinfo.h>
+#include <omnicore/omnicore.h>
+#include <omnicore/sp.h>
+#include <omnicore/sto.h>
+#include <omnicore/tally.h>
+
+#include <sync.h>
+#include <util/system.h>
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <stdint.h>
+#include <set>
+#include <string>
+
+using namespace mastercore;
+
+BOOST_FIXTURE_TEST_SUITE(omnicore_property_holders_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(holders_follow_tally_updates)
+{
+    LOCK(cs_tally);
+    ClearTallyMap();
+
+    BOOST_CHECK(getPropertyHolders(3).empty());
+
+    BOOST_CHECK(update_tally_map("alice", 3, 100, BALANCE));
+    BOOST_CHECK(update_tally_map("bob", 3, 50, BALANCE));
+    BOOST_CHECK(update_tally_map("bob", 4, 10, BALANCE));
+    BOOST_CHECK_EQUAL(getPropertyHolders(3).size(), 2U);
+    BOOST_CHECK_EQUAL(getPropertyHolders(4).size(), 1U);
+
+    // reserved tokens are still held
+    BOOST_CHECK(update_tally_map("alice", 3, -100, BALANCE));
+    BOOST_CHECK(update_tally_map("alice", 3, 100, METADEX_RESERVE));
+    BOOST_CHECK(getPropertyHolders(3).count("alice"));
+
+    // failed updates don't change the index
+    BOOST_CHECK(!update_tally_map("carol", 3, -1, BALANCE));
+    BOOST_CHECK(!getPropertyHolders(3).count("carol"));
+
+    // holders without any tokens are removed
+    BOOST_CHECK(update_tally_map("bob", 4, -10, BALANCE));
+    BOOST_CHECK(getPropertyHolders(4).empty());
+    BOOST_CHECK(update_tally_map("alice", 3, -100, METADEX_RESERVE));
+    BOOST_CHECK_EQUAL(getPropertyHolders(3).size(), 1U);
+    BOOST_CHECK(getPropertyHolders(3).count("bob"));
+
+    ClearTallyMap();
+    BOOST_CHECK(getPropertyHolders(3).empty());
+}
+
+BOOST_AUTO_TEST_CASE(sto_receivers_from_holders)
+{
+    LOCK(cs_tally);
+    CMPSPInfo* pDbSpInfoPrev = pDbSpInfo;
+    pDbSpInfo = new CMPSPInfo(GetDataDir() / "MP_spinfo_test", true);
+    ClearTallyMap();
+
+    BOOST_CHECK(update_tally_map("sender", 3, 1000, BALANCE));
+    BOOST_CHECK(update_tally_map("alice", 3, 300, BALANCE));
+    BOOST_CHECK(update_tally_map("bob", 3, 100, SELLOFFER_RESERVE));
+    BOOST_CHECK(update_tally_map("carol", 4, 500, BALANCE));
+
+    OwnerAddrType receivers = STO_GetReceivers("sender", 3, 40);
+    BOOST_REQUIRE_EQUAL(receivers.size(), 2U);
+
+    std::set<std::string> addresses;
+    int64_t total = 0;
+    for (OwnerAddrType::const_iterator it = receivers.begin(); it != receivers.end(); ++it) {
+        addresses.insert(it->second);
+        total += it->first;
+    }
+    BOOST_CHECK(addresses.count("alice"));
+    BOOST_CHECK(addresses.count("bob"));
+    BOOST_CHECK_EQUAL(total, 40);
+
+    ClearTallyMap();
+    delete pDbSpInfo;
+    pDbSpInfo = pDbSpInfoPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
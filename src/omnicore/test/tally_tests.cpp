@@ -1,8 +1,13 @@
 #include <omnicore/tally.h>
 
 #include <test/util/setup_common.h>
+#include <tinyformat.h>
 
 #include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -319,4 +324,73 @@ BOOST_AUTO_TEST_CASE(tally_overflow)
 }
 
 
+BOOST_AUTO_TEST_CASE(tally_map_interning)
+{
+    CMPTallyMap tallyMap;
+    BOOST_CHECK(tallyMap.empty());
+    BOOST_CHECK(tallyMap.find("alice") == tallyMap.end());
+    BOOST_CHECK_EQUAL(tallyMap.getAddressId("alice"), CMPTallyMap::NO_ADDRESS_ID);
+
+    CMPTallyMap::iterator itAlice = tallyMap.insert(std::make_pair(std::string("alice"), CMPTally())).first;
+    BOOST_CHECK(itAlice->second.updateMoney(3, 100, BALANCE));
+
+    // addresses are assigned dense identifiers in insertion order
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK(tallyMap.insert(std::make_pair(strprintf("address%d", i), CMPTally())).second);
+    }
+    BOOST_CHECK_EQUAL(tallyMap.size(), 1001U);
+    BOOST_CHECK_EQUAL(tallyMap.getAddressId("alice"), 0U);
+    BOOST_CHECK_EQUAL(tallyMap.getAddressId("address999"), 1000U);
+    BOOST_CHECK_EQUAL(tallyMap.getAddress(500), "address499");
+
+    // references to tallies remain valid, when addresses are added
+    BOOST_CHECK_EQUAL(itAlice->second.getMoney(3, BALANCE), 100);
+    BOOST_CHECK(tallyMap.find("alice") == itAlice);
+
+    // existing tallies are not replaced
+    std::pair<CMPTallyMap::iterator, bool> ret = tallyMap.insert(std::make_pair(std::string("alice"), CMPTally()));
+    BOOST_CHECK(!ret.second);
+    BOOST_CHECK_EQUAL(ret.first->second.getMoney(3, BALANCE), 100);
+
+    uint32_t count = 0;
+    for (CMPTallyMap::const_iterator it = tallyMap.begin(); it != tallyMap.end(); ++it) {
+        BOOST_CHECK_EQUAL(tallyMap.getAddressId(it->first), count++);
+    }
+    BOOST_CHECK_EQUAL(count, 1001U);
+
+    tallyMap.clear();
+    BOOST_CHECK(tallyMap.empty());
+    BOOST_CHECK(tallyMap.find("alice") == tallyMap.end());
+    BOOST_CHECK(tallyMap.insert(std::make_pair(std::string("bob"), CMPTally())).second);
+    BOOST_CHECK_EQUAL(tallyMap.getAddressId("bob"), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(tally_map_concurrent_lookups)
+{
+    CMPTallyMap tallyMap;
+    for (int i = 0; i < 1000; ++i) {
+        tallyMap.insert(std::make_pair(strprintf("address%d", i), CMPTally()));
+    }
+
+    // lookups of a map, which isn't modified, may run in parallel
+    const CMPTallyMap& constMap = tallyMap;
+    std::atomic<int> nMismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&constMap, &nMismatches, t] {
+            for (int n = 0; n < 20; ++n) {
+                for (int i = 0; i < 1000; ++i) {
+                    const int id = (i + t * 250) % 1000;
+                    if (constMap.getAddressId(strprintf("address%d", id)) != uint32_t(id)) ++nMismatches;
+                    if (constMap.find(strprintf("other%d", id)) != constMap.end()) ++nMismatches;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(nMismatches, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
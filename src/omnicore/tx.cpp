@@ -1329,6 +1329,8 @@ int CMPTransaction::logicMath_SendToOwners()
 
     // split up what was taken and distribute between all holders
     int64_t sent_so_far = 0;
+    std::vector<std::pair<std::string, uint64_t> > receipts;
+    receipts.reserve(receiversSet.size());
     for (OwnerAddrType::reverse_iterator it = receiversSet.rbegin(); it != receiversSet.rend(); ++it) {
         const std::string& address = it->second;
 
@@ -1340,7 +1342,7 @@ int CMPTransaction::logicMath_SendToOwners()
         assert(update_tally_map(address, property, will_really_receive, BALANCE));
 
         // add to stodb
-        pDbStoList->recordSTOReceive(address, txid, block, property, will_really_receive);
+        receipts.push_back(std::make_pair(address, will_really_receive));
 
         if (sent_so_far != (int64_t)nValue) {
             PrintToLog("sent_so_far= %14d, nValue= %14d, n_owners= %d\n", sent_so_far, nValue, numberOfReceivers);
@@ -1352,6 +1354,8 @@ int CMPTransaction::logicMath_SendToOwners()
     // sent_so_far must equal nValue here
     assert(sent_so_far == (int64_t)nValue);
 
+    pDbStoList->recordSTOReceives(txid, block, property, receipts);
+
     // Number of tokens has changed, update fee distribution thresholds
     if (version == MP_TX_PKT_V0) NotifyTotalTokensChanged(OMNI_PROPERTY_MSC, block); // fee was burned
 
@@ -2008,7 +2012,7 @@ int CMPTransaction::logicMath_CreatePropertyVariable(CBlockIndex* pindex)
 
     const uint32_t propertyId = pDbSpInfo->putSP(ecosystem, newSP);
     assert(propertyId > 0);
-    my_crowds.insert(std::make_pair(sender, CMPCrowd(propertyId, nValue, property, deadline, early_bird, percentage, 0, 0)));
+    insertCrowdsale(sender, CMPCrowd(propertyId, nValue, property, deadline, early_bird, percentage, 0, 0));
 
     PrintToLog("CREATED CROWDSALE id: %d value: %d property: %d\n", propertyId, nValue, property);
 
@@ -2936,6 +2940,7 @@ int CMPTransaction::logicMath_Alert()
             if (!gArgs.GetBoolArg("-overrideforcedshutdown", false)) {
                 fs::path persistPath = GetDataDir() / "MP_persist";
                 if (fs::exists(persistPath)) fs::remove_all(persistPath); // prevent the node being restarted without a reparse after forced shutdown
+                FlushLog();
                 AbortNode(msgText, msgText);
             }
         }
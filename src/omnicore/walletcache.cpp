@@ -21,10 +21,13 @@
 
 #include <stdint.h>
 #include <algorithm>
+#include <atomic>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -32,10 +35,99 @@ namespace mastercore
 {
 //! Map of wallet balances
 static std::map<std::string, CMPTally> walletBalancesCache;
+//! Whether the cache is used, and changed addresses are recorded
+static bool fWalletCacheEnabled = false;
+//! Whether all addresses need to be checked with the next update
+static bool fWalletCacheFullUpdate = true;
+//! Addresses with changed tallies since the last update
+static std::set<std::string> walletChangedAddresses;
+//! Whether an address is in one of the wallets (including watch only)
+static std::unordered_map<std::string, bool> walletIsMineCache;
+//! Set, when addresses were added to one of the wallets
+static std::atomic<bool> fWalletAddressesChanged{false};
+
+#ifdef ENABLE_WALLET
+//! Wallets, which are observed for new addresses
+static std::vector<std::weak_ptr<CWallet> > observedWallets;
+//! Connections to the signals of the observed wallets
+static std::vector<boost::signals2::scoped_connection> walletConnections;
+
+/**
+ * Observes the loaded wallets for new addresses.
+ *
+ * @return True, if the loaded wallets changed since the last call
+ */
+static bool ObserveWallets()
+{
+    std::vector<std::shared_ptr<CWallet> > wallets = GetWallets();
+
+    bool fChanged = (wallets.size() != observedWallets.size());
+    for (size_t i = 0; !fChanged && i < wallets.size(); ++i) {
+        fChanged = (observedWallets[i].lock() != wallets[i]);
+    }
+    if (!fChanged) return false;
+
+    walletConnections.clear();
+    observedWallets.clear();
+    for (const std::shared_ptr<CWallet>& wallet : wallets) {
+        observedWallets.push_back(wallet);
+        walletConnections.emplace_back(wallet->NotifyAddressBookChanged.connect(
+                [](CWallet*, const CTxDestination&, const std::string&, bool, const std::string&, ChangeType) {
+            fWalletAddressesChanged = true;
+        }));
+        walletConnections.emplace_back(wallet->NotifyWatchonlyChanged.connect([](bool) {
+            fWalletAddressesChanged = true;
+        }));
+    }
+
+    return true;
+}
+#endif
+
+/**
+ * Returns true, if the address is in one of the wallets (including watch only).
+ */
+static bool IsMyAddressCached(const std::string& address)
+{
+    std::unordered_map<std::string, bool>::const_iterator it = walletIsMineCache.find(address);
+    if (it != walletIsMineCache.end()) {
+        return it->second;
+    }
+
+    bool fMine = (IsMyAddressAllWallets(address, true) != 0);
+    walletIsMineCache.insert(std::make_pair(address, fMine));
+
+    return fMine;
+}
+
+/**
+ * Records an address with a changed tally, to be checked with the next update.
+ */
+void WalletCacheAddressChanged(const std::string& address)
+{
+    LOCK(cs_tally);
+    if (fWalletCacheEnabled) {
+        walletChangedAddresses.insert(address);
+    }
+}
+
+/**
+ * Checks all addresses with the next update, e.g. after the tallies were cleared.
+ */
+void WalletCacheInvalidate()
+{
+    LOCK(cs_tally);
+    fWalletCacheFullUpdate = true;
+    walletChangedAddresses.clear();
+}
 
 /**
  * Updates the cache with the latest state, returning true if changes were made to wallet addresses (including watch only).
  *
+ * Only addresses with changed tallies since the last update are checked, unless
+ * all addresses need to be checked, because the tallies were cleared, or because
+ * addresses were added to the wallets.
+ *
  * Also prepares a list of addresses that were changed (for future usage).
  */
 int WalletCacheUpdate()
@@ -46,12 +138,35 @@ int WalletCacheUpdate()
 
     LOCK(cs_tally);
 
-    for (std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
-        const std::string& address = my_it->first;
+    fWalletCacheEnabled = true;
+    bool fWalletsChanged = fWalletAddressesChanged.exchange(false);
+#ifdef ENABLE_WALLET
+    if (ObserveWallets()) fWalletsChanged = true;
+#endif
+    if (fWalletsChanged) {
+        walletIsMineCache.clear();
+        fWalletCacheFullUpdate = true;
+    }
+
+    // determine the addresses to check
+    std::vector<std::string> addresses;
+    if (fWalletCacheFullUpdate) {
+        addresses.reserve(mp_tally_map.size());
+        for (CMPTallyMap::const_iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
+            addresses.push_back(my_it->first);
+        }
+        fWalletCacheFullUpdate = false;
+    } else {
+        addresses.assign(walletChangedAddresses.begin(), walletChangedAddresses.end());
+    }
+    walletChangedAddresses.clear();
+
+    for (const std::string& address : addresses) {
+        CMPTallyMap::iterator my_it = mp_tally_map.find(address);
+        if (my_it == mp_tally_map.end()) continue;
 
         // determine if this address is in the wallet
-        int addressIsMine = IsMyAddressAllWallets(address, true);
-        if (!addressIsMine) {
+        if (!IsMyAddressCached(address)) {
             if (msc_debug_walletcache) PrintToLog("WALLETCACHE: Ignoring non-wallet address %s\n", address);
             continue; // ignore this address, not in wallet
         }
@@ -88,7 +203,7 @@ int WalletCacheUpdate()
             }
         }
     }
-    if (msc_debug_walletcache) PrintToLog("WALLETCACHE: Update finished - there were %d changes\n", numChanges);
+    if (msc_debug_walletcache) PrintToLog("WALLETCACHE: Update finished - checked %d addresses, there were %d changes\n", addresses.size(), numChanges);
     return numChanges;
 }
 
@@ -3,10 +3,17 @@
 
 class uint256;
 
+#include <string>
 #include <vector>
 
 namespace mastercore
 {
+/** Records an address with a changed tally, to be checked with the next update */
+void WalletCacheAddressChanged(const std::string& address);
+
+/** Checks all addresses with the next update */
+void WalletCacheInvalidate();
+
 /** Updates the cache and returns whether any wallet addresses were changed */
 int WalletCacheUpdate();
 }
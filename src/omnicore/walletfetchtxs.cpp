@@ -15,6 +15,7 @@
 #include <omnicore/utilsbitcoin.h>
 
 #include <init.h>
+#include <interfaces/handler.h>
 #include <interfaces/wallet.h>
 #include <validation.h>
 #include <sync.h>
@@ -27,8 +28,10 @@
 #include <boost/algorithm/string.hpp>
 
 #include <stdint.h>
+#include <atomic>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
@@ -50,46 +53,140 @@ static unsigned int GetTransactionByteOffset(const uint256& txid)
     return 0;
 }
 
+//! Height of the last processed block, or -1, if not known yet
+static std::atomic<int> nWalletIndexHeight{-1};
+//! Incremented, when blocks are disconnected, to rebuild the wallet indexes
+static std::atomic<uint64_t> nWalletIndexEpoch{0};
+
+#ifdef ENABLE_WALLET
 /**
- * Returns an ordered list of Omni transactions including STO receipts that are relevant to the wallet.
+ * Index of the Omni transactions relevant to a wallet, including STO receipts,
+ * ordered by block and position in block.
  *
- * Ignores order in the wallet (which can be skewed by watch addresses) and utilizes block height and position within block.
+ * The index is built once and then updated with the wallet transactions, which
+ * changed since the last use, and with the blocks processed in the meantime.
  */
-std::map<std::string, uint256> FetchWalletOmniTransactions(interfaces::Wallet& iWallet, unsigned int count, int startBlock, int endBlock)
+struct CWalletOmniTxIndex
 {
-    std::map<std::string, uint256> mapResponse;
+    //! Omni wallet transactions by sort key
+    std::map<std::string, uint256> entries;
+    //! Sort keys of the indexed wallet transactions
+    std::map<uint256, std::string> keys;
+    //! STO receipts by sort key
+    std::map<std::string, uint256> stoReceipts;
+    //! Wallet transactions in blocks, which were not fully processed yet, with block height
+    std::map<uint256, int> unresolved;
+    //! Height of the last processed block, when the index was updated
+    int nHeight;
+    //! Epoch of the index
+    uint64_t nEpoch;
+    //! Whether the wallet was unloaded, and the index has to be rebuilt
+    std::atomic<bool> fStale;
+    //! Whether addresses were added to the wallet, and all STO receipts have to be reloaded
+    std::atomic<bool> fNewAddresses;
+
+    //! Guards the changed transactions, which are reported by the wallet
+    Mutex cs_changed;
+    //! Wallet transactions, which changed since the last update
+    std::set<uint256> changed GUARDED_BY(cs_changed);
+
+    std::unique_ptr<interfaces::Handler> handlerChanged;
+    std::unique_ptr<interfaces::Handler> handlerUnload;
+    std::unique_ptr<interfaces::Handler> handlerAddressBook;
+
+    CWalletOmniTxIndex() : nHeight(-1), nEpoch(0), fStale(true), fNewAddresses(false) {}
+};
+
+//! Guards the wallet indexes, acquired before locks of the wallet
+static Mutex cs_walletindex;
+//! Indexes of the wallets by wallet name
+static std::map<std::string, std::unique_ptr<CWalletOmniTxIndex> > walletIndexes GUARDED_BY(cs_walletindex);
+#endif
+
+/**
+ * Updates the height of the last processed block.
+ */
+void UpdateWalletTxIndexTip(int nHeight)
+{
+    nWalletIndexHeight = nHeight;
+}
+
+/**
+ * Rebuilds the wallet indexes, when they are used next, e.g. after blocks were disconnected.
+ */
+void InvalidateWalletTxIndexes()
+{
+    ++nWalletIndexEpoch;
+}
+
 #ifdef ENABLE_WALLET
-    if (!HasWallets()) {
-        return mapResponse;
+/** Returns the height of the last processed block. */
+static int GetWalletIndexHeight()
+{
+    int nHeight = nWalletIndexHeight;
+    return (nHeight < 0) ? GetHeight() : nHeight;
+}
+
+/**
+ * Indexes or removes a wallet transaction.
+ *
+ * Transactions in blocks, which were not processed yet, or which are not in the
+ * transaction index yet, are resolved later.
+ */
+static void IndexWalletTx(CWalletOmniTxIndex& index, const uint256& txHash, const uint256& blockHash) EXCLUSIVE_LOCKS_REQUIRED(cs_walletindex)
+{
+    std::map<uint256, std::string>::iterator itKey = index.keys.find(txHash);
+    if (itKey != index.keys.end()) {
+        index.entries.erase(itKey->second);
+        index.keys.erase(itKey);
     }
-    std::set<uint256> seenHashes;
-    std::multimap<int64_t, const interfaces::WalletTx*> txOrdered;
-    const std::vector<interfaces::WalletTx>& transactions = iWallet.getWalletTxs();
-    for (const auto& transaction : transactions)
-        txOrdered.insert(std::make_pair(transaction.order_pos, &transaction));
+    index.unresolved.erase(txHash);
 
-    // Iterate backwards through wallet transactions until we have count items to return:
-    for (std::multimap<int64_t, const interfaces::WalletTx*>::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
-        const interfaces::WalletTx* pwtx = it->second;
-        const uint256& txHash = pwtx->tx->GetHash();
-        {
-            LOCK(cs_tally);
-            if (!pDbTransactionList->exists(txHash)) continue;
-        }
-        const uint256& blockHash = pwtx->hash_block;
-        if (blockHash.IsNull()) continue;
-        const CBlockIndex* pBlockIndex = GetBlockIndex(blockHash);
-        if (pBlockIndex == nullptr) continue;
-        int blockHeight = pBlockIndex->nHeight;
-        if (blockHeight < startBlock || blockHeight > endBlock) continue;
-        int blockPosition = GetTransactionByteOffset(txHash);
-        std::string sortKey = strprintf("%06d%010d", blockHeight, blockPosition);
-        mapResponse.insert(std::make_pair(sortKey, txHash));
-        seenHashes.insert(txHash);
-        if (mapResponse.size() >= count) break;
+    if (blockHash.IsNull()) return;
+    const CBlockIndex* pBlockIndex = GetBlockIndex(blockHash);
+    if (pBlockIndex == nullptr) return;
+    int blockHeight = pBlockIndex->nHeight;
+
+    bool fOmniTx;
+    {
+        LOCK(cs_tally);
+        fOmniTx = pDbTransactionList->exists(txHash);
     }
+    if (!fOmniTx) {
+        if (blockHeight > index.nHeight) index.unresolved.insert(std::make_pair(txHash, blockHeight));
+        return;
+    }
+
+    int blockPosition = GetTransactionByteOffset(txHash);
+    if (blockPosition == 0 && g_txindex) {
+        index.unresolved.insert(std::make_pair(txHash, blockHeight));
+        return;
+    }
+
+    std::string sortKey = strprintf("%06d%010d", blockHeight, blockPosition);
+    index.entries.insert(std::make_pair(sortKey, txHash));
+    index.keys.insert(std::make_pair(txHash, sortKey));
+}
+
+/**
+ * Adds an STO receipt of the wallet to the index.
+ */
+static void AddSTOReceipt(CWalletOmniTxIndex& index, const uint256& txHash, int blockHeight) EXCLUSIVE_LOCKS_REQUIRED(cs_walletindex)
+{
+    int blockPosition = GetTransactionByteOffset(txHash);
+    std::string sortKey = strprintf("%06d%010d", blockHeight, blockPosition);
+    index.stoReceipts.insert(std::make_pair(sortKey, txHash));
+}
+
+/**
+ * Loads the STO receipts of the wallet.
+ *
+ * Receiving an STO has no inbound transaction to the wallet, so these are tracked separately.
+ */
+static void LoadSTOReceipts(CWalletOmniTxIndex& index, interfaces::Wallet& iWallet) EXCLUSIVE_LOCKS_REQUIRED(cs_walletindex)
+{
+    index.stoReceipts.clear();
 
-    // Insert STO receipts - receiving an STO has no inbound transaction to the wallet, so we will insert these manually into the response
     std::string mySTOReceipts;
     {
         LOCK(cs_tally);
@@ -106,13 +203,158 @@ std::map<std::string, uint256> FetchWalletOmniTransactions(interfaces::Wallet& i
             PrintToLog("STODB Error - number of tokens is not as expected (%s)\n", vecReceipts[i]);
             continue;
         }
-        int blockHeight = atoi(svstr[1]);
-        if (blockHeight < startBlock || blockHeight > endBlock) continue;
-        uint256 txHash = uint256S(svstr[0]);
-        if (seenHashes.find(txHash) != seenHashes.end()) continue; // an STO may already be in the wallet if we sent it
-        int blockPosition = GetTransactionByteOffset(txHash);
-        std::string sortKey = strprintf("%06d%010d", blockHeight, blockPosition);
-        mapResponse.insert(std::make_pair(sortKey, txHash));
+        AddSTOReceipt(index, uint256S(svstr[0]), atoi(svstr[1]));
+    }
+}
+
+/**
+ * Adds the STO receipts of the wallet within the block range.
+ *
+ * Only the send to owners transactions of the range and their recipients are
+ * visited, so processing new blocks doesn't scan the whole STO database.
+ */
+static void LoadSTOReceiptsInBlockRange(CWalletOmniTxIndex& index, interfaces::Wallet& iWallet, int blockFirst, int blockLast) EXCLUSIVE_LOCKS_REQUIRED(cs_walletindex)
+{
+    std::vector<std::pair<uint256, int> > myReceipts;
+    {
+        LOCK(cs_tally);
+        std::set<uint256> txsInRange;
+        pDbTransactionList->GetOmniTxsInBlockRange(blockFirst, blockLast, txsInRange);
+        for (const uint256& txHash : txsInRange) {
+            int blockHeight = 0;
+            unsigned int txType = 0;
+            if (!pDbTransactionList->getValidMPTX(txHash, &blockHeight, &txType)) continue;
+            if (txType != MSC_TYPE_SEND_TO_OWNERS) continue;
+            if (!pDbStoList->hasMySTOReceipt(txHash, iWallet)) continue;
+            myReceipts.push_back(std::make_pair(txHash, blockHeight));
+        }
+    }
+    for (const std::pair<uint256, int>& receipt : myReceipts) {
+        AddSTOReceipt(index, receipt.first, receipt.second);
+    }
+}
+
+/**
+ * Returns the index of the wallet, after it was built or updated.
+ */
+static CWalletOmniTxIndex& UpdateWalletTxIndex(interfaces::Wallet& iWallet) EXCLUSIVE_LOCKS_REQUIRED(cs_walletindex)
+{
+    std::unique_ptr<CWalletOmniTxIndex>& pIndex = walletIndexes[iWallet.getWalletName()];
+    if (!pIndex) pIndex.reset(new CWalletOmniTxIndex());
+    CWalletOmniTxIndex& index = *pIndex;
+
+    uint64_t nEpoch = nWalletIndexEpoch;
+    int nHeight = GetWalletIndexHeight();
+
+    if (index.fStale || index.nEpoch != nEpoch) {
+        // register the handlers first, so no change is missed while building the index
+        CWalletOmniTxIndex* pIndexRaw = &index;
+        index.handlerChanged = iWallet.handleTransactionChanged([pIndexRaw](const uint256& txid, ChangeType status) {
+            LOCK(pIndexRaw->cs_changed);
+            pIndexRaw->changed.insert(txid);
+        });
+        index.handlerUnload = iWallet.handleUnload([pIndexRaw]() {
+            pIndexRaw->fStale = true;
+        });
+        index.handlerAddressBook = iWallet.handleAddressBookChanged([pIndexRaw](const CTxDestination& address, const std::string& label, bool is_mine, const std::string& purpose, ChangeType status) {
+            if (status == CT_NEW) pIndexRaw->fNewAddresses = true;
+        });
+        {
+            LOCK(index.cs_changed);
+            index.changed.clear();
+        }
+        index.fStale = false;
+        index.fNewAddresses = false;
+        index.nEpoch = nEpoch;
+        index.nHeight = nHeight;
+        index.entries.clear();
+        index.keys.clear();
+        index.unresolved.clear();
+
+        for (const interfaces::WalletTx& transaction : iWallet.getWalletTxs()) {
+            IndexWalletTx(index, transaction.tx->GetHash(), transaction.hash_block);
+        }
+        LoadSTOReceipts(index, iWallet);
+
+        return index;
+    }
+
+    // update the wallet transactions, which changed since the last use
+    std::set<uint256> changed;
+    {
+        LOCK(index.cs_changed);
+        changed.swap(index.changed);
+    }
+    for (const uint256& txHash : changed) {
+        IndexWalletTx(index, txHash, iWallet.getWalletTx(txHash).hash_block);
+    }
+
+    // resolve the transactions of blocks, which were processed in the meantime
+    int nLastHeight = index.nHeight;
+    if (!index.unresolved.empty() || nLastHeight != nHeight) {
+        std::vector<uint256> resolvable;
+        for (std::map<uint256, int>::const_iterator it = index.unresolved.begin(); it != index.unresolved.end(); ++it) {
+            if (it->second <= nHeight) resolvable.push_back(it->first);
+        }
+        index.nHeight = nHeight;
+        for (const uint256& txHash : resolvable) {
+            IndexWalletTx(index, txHash, iWallet.getWalletTx(txHash).hash_block);
+        }
+    }
+
+    // STO receipts are only added, when blocks are processed, and disconnected blocks rebuild the index,
+    // but receipts of imported addresses may be in any block
+    if (index.fNewAddresses.exchange(false)) {
+        LoadSTOReceipts(index, iWallet);
+    } else if (nHeight > nLastHeight) {
+        LoadSTOReceiptsInBlockRange(index, iWallet, nLastHeight + 1, nHeight);
+    }
+
+    return index;
+}
+
+/**
+ * Adds the latest entries within the block range to the result.
+ */
+static void AddLatestEntries(const std::map<std::string, uint256>& entries, unsigned int count, int startBlock, int endBlock, std::map<std::string, uint256>& result)
+{
+    std::map<std::string, uint256>::const_iterator itEnd = entries.end();
+    if (endBlock < 999999) {
+        itEnd = entries.lower_bound(strprintf("%06d", endBlock + 1));
+    }
+
+    unsigned int nAdded = 0;
+    for (std::map<std::string, uint256>::const_reverse_iterator it(itEnd); it != entries.rend() && nAdded < count; ++it) {
+        int blockHeight = atoi(it->first.substr(0, 6));
+        if (blockHeight < startBlock) break;
+        if (result.insert(*it).second) ++nAdded;
+    }
+}
+#endif
+
+/**
+ * Returns an ordered list of Omni transactions including STO receipts that are relevant to the wallet.
+ *
+ * Ignores order in the wallet (which can be skewed by watch addresses) and utilizes block height and position within block.
+ *
+ * The transactions are served from an index of the wallet, which is maintained incrementally,
+ * and only the latest count transactions within the block range are returned.
+ */
+std::map<std::string, uint256> FetchWalletOmniTransactions(interfaces::Wallet& iWallet, unsigned int count, int startBlock, int endBlock)
+{
+    std::map<std::string, uint256> mapResponse;
+#ifdef ENABLE_WALLET
+    if (!HasWallets()) {
+        return mapResponse;
+    }
+
+    {
+        LOCK(cs_walletindex);
+        CWalletOmniTxIndex& index = UpdateWalletTxIndex(iWallet);
+
+        // an STO may already be in the wallet if we sent it, in which case the sort keys are equal
+        AddLatestEntries(index.entries, count, startBlock, endBlock, mapResponse);
+        AddLatestEntries(index.stoReceipts, count, startBlock, endBlock, mapResponse);
     }
 
     // Insert pending transactions (sets block as 999999 and position as wallet position)
@@ -122,15 +364,15 @@ std::map<std::string, uint256> FetchWalletOmniTransactions(interfaces::Wallet& i
         const uint256& txHash = it->first;
         int blockHeight = 999999;
         if (blockHeight < startBlock || blockHeight > endBlock) continue;
-        int blockPosition = 0;
-        {
-            for (const auto& transaction : transactions)
-                if (transaction.tx->GetHash() == txHash)
-                    blockPosition = transaction.order_pos;
-        }
+        int blockPosition = iWallet.getWalletTx(txHash).order_pos;
         std::string sortKey = strprintf("%06d%010d", blockHeight, blockPosition);
         mapResponse.insert(std::make_pair(sortKey, txHash));
     }
+
+    // only the latest transactions are returned
+    while (mapResponse.size() > count) {
+        mapResponse.erase(mapResponse.begin());
+    }
 #endif
     return mapResponse;
 }
@@ -13,6 +13,11 @@ class Wallet;
 
 namespace mastercore
 {
+/** Updates the height of the last processed block, which is used by the wallet indexes. */
+void UpdateWalletTxIndexTip(int nHeight);
+/** Rebuilds the wallet indexes, when they are used next, e.g. after blocks were disconnected. */
+void InvalidateWalletTxIndexes();
+
 /** Returns an ordered list of Omni transactions that are relevant to the wallet. */
 std::map<std::string, uint256> FetchWalletOmniTransactions(interfaces::Wallet& iWallet, unsigned int count, int startBlock = 0, int endBlock = 999999);
 }
@@ -137,7 +137,7 @@ void MetaDExDialog::PopulateAddresses()
         uint32_t propertyId = GetPropForSale();
         QString currentSetAddress = ui->comboAddress->currentText();
         ui->comboAddress->clear();
-        for (std::unordered_map<std::string, CMPTally>::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
+        for (CMPTallyMap::iterator my_it = mp_tally_map.begin(); my_it != mp_tally_map.end(); ++my_it) {
             std::string address = (my_it->first).c_str();
             int isMyAddress = IsMyAddress(address, &walletModel->wallet());
             uint32_t id;
@@ -164,8 +164,11 @@ void MetaDExDialog::UpdateProperties()
     ui->comboPairTokenA->clear();
     ui->comboPairTokenB->clear();
 
+    uint32_t lastPropertyId = 0;
     for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        uint32_t propertyId = my_it->first;
+        uint32_t propertyId = my_it->first.first;
+        if (propertyId == lastPropertyId) continue; // books of the same property for sale are adjacent
+        lastPropertyId = propertyId;
         if ((testEco && !isTestEcosystemProperty(propertyId)) || (!testEco && isTestEcosystemProperty(propertyId))) continue;
         std::string spName;
         spName = getPropertyName(propertyId).c_str();
@@ -349,7 +352,7 @@ void MetaDExDialog::UpdateOffers()
     bool divisDes = isPropertyDivisible(GetPropDesired());
 
     for (md_PropertiesMap::iterator my_it = metadex.begin(); my_it != metadex.end(); ++my_it) {
-        if ((my_it->first != GetPropForSale())) continue; // not the property we're looking for, don't waste any more work
+        if ((my_it->first.first != GetPropForSale())) continue; // not the property we're looking for, don't waste any more work
         md_PricesMap & prices = my_it->second;
         for (md_PricesMap::iterator it = prices.begin(); it != prices.end(); ++it) { // loop through the sell prices for the property
             std::string unitPriceStr;
@@ -189,6 +189,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "omni_gettradehistoryforpair", 0, "propertyid" },
     { "omni_gettradehistoryforpair", 1, "propertyidsecond" },
     { "omni_gettradehistoryforpair", 2, "count" },
+    { "omni_gettradehistoryforpair", 3, "skip" },
     { "omni_setautocommit", 0, "flag" },
     { "omni_getcrowdsale", 0, "propertyid" },
     { "omni_getcrowdsale", 1, "verbose" },